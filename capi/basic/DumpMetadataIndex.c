@@ -0,0 +1,84 @@
+/******************************************************************************
+ *
+ * DumpMetadataIndex.c
+ *
+ * This example maps a metadata index written by MantisExportStream with
+ * -meta stream or -meta export and prints its records. No connection to a
+ * camera is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MetadataIndex.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("DumpMetadataIndex Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> index file to read (default export.idx)\n");
+   printf("\t-mcam <mcam ID> only print records for this microcamera\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char indexFile[256] = "export.idx";
+    uint32_t mcamID = 0;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(indexFile, argv[i], sizeof(indexFile) - 1);
+        } else if( !strcmp(argv[i],"-mcam") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            mcamID = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    METADATA_INDEX_READER reader;
+    if( !metadataIndexMap(&reader, indexFile) ){
+        printf("Unable to read metadata index %s\n", indexFile);
+        return 0;
+    }
+
+    /* records are read straight from the mapping without copying */
+    uint64_t printed = 0;
+    for( size_t i = 0; i < reader.numRecords; i++ ){
+        const METADATA_INDEX_RECORD * record = metadataIndexRecord(&reader, i);
+        if( mcamID != 0 && record->mcamID != mcamID ){
+            continue;
+        }
+        printf("mcam %u frame %lu time %lu offset %lu size %lu mode %u\n",
+               record->mcamID,
+               record->frameId,
+               record->timestamp,
+               record->offset,
+               record->size,
+               record->mode);
+        printed++;
+    }
+    printf("Printed %lu of %lu records\n", printed, (uint64_t)reader.numRecords);
+
+    metadataIndexUnmap(&reader);
+
+    exit(1);
+}
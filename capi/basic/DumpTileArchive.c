@@ -0,0 +1,125 @@
+/******************************************************************************
+ *
+ * DumpTileArchive.c
+ *
+ * This example maps a tile pyramid written by GetClipMcamImages with
+ * -pyramid, prints its levels and tiles and optionally extracts one tile
+ * to a JPEG file the way a viewer would read it. No connection to a camera
+ * is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TileArchive.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("DumpTileArchive Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> tile archive to read\n");
+   printf("\t-level <level> only print tiles of this level\n");
+   printf("\t-extract <level> <column> <row> <filename> write one tile to a JPEG file\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char * archiveFile = NULL;
+    int level = -1;
+    int extract[3] = { -1, -1, -1 };
+    char * extractFile = NULL;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            archiveFile = argv[i];
+        } else if( !strcmp(argv[i],"-level") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            level = atoi(argv[i]);
+        } else if( !strcmp(argv[i],"-extract") ){
+            if( i + 4 >= argc ){
+                printHelp();
+                return 0;
+            }
+            for( int j = 0; j < 3; j++ ){
+                extract[j] = atoi(argv[++i]);
+            }
+            extractFile = argv[++i];
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+    if( archiveFile == NULL ){
+        printHelp();
+        return 0;
+    }
+
+    TILE_ARCHIVE_READER reader;
+    if( !tileArchiveMap(&reader, archiveFile) ){
+        printf("Unable to read tile archive %s\n", archiveFile);
+        return 0;
+    }
+    const TILE_ARCHIVE_HEADER * header = reader.header;
+    printf("mcam %u frame %lu time %lu: %ux%u in %u levels of %u tiles of %upx\n",
+           header->mcamID,
+           header->frameId,
+           header->timestamp,
+           header->width,
+           header->height,
+           header->numLevels,
+           header->numTiles,
+           header->tileSize);
+
+    /* entries are read straight from the mapping without copying */
+    for( size_t i = 0; i < header->numTiles; i++ ){
+        const TILE_ARCHIVE_ENTRY * entry = tileArchiveEntry(&reader, i);
+        if( level >= 0 && entry->level != level ){
+            continue;
+        }
+        printf("level %u column %u row %u %ux%u offset %lu size %lu\n",
+               entry->level,
+               entry->column,
+               entry->row,
+               entry->width,
+               entry->height,
+               entry->offset,
+               entry->size);
+    }
+
+    if( extractFile != NULL ){
+        uint64_t size;
+        const uint8_t * tile = tileArchiveFind(&reader, extract[0], extract[1], extract[2], &size);
+        FILE * file = (tile != NULL) ? fopen(extractFile, "w") : NULL;
+        if( tile == NULL ){
+            printf("No tile at level %d column %d row %d\n", extract[0], extract[1], extract[2]);
+        } else if( file == NULL || fwrite(tile, 1, size, file) != size ){
+            printf("Unable to write %s\n", extractFile);
+        } else{
+            printf("Wrote %lu byte tile to %s\n", size, extractFile);
+        }
+        if( file != NULL ){
+            fclose(file);
+        }
+    }
+
+    tileArchiveUnmap(&reader);
+
+    exit(1);
+}
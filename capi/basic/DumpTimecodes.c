@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * DumpTimecodes.c
+ *
+ * This example maps a binary timecode log written by McamGetTimeCodes and
+ * writes it as text, one "<sensor ID> <timestamp>" line per frame, the
+ * format McamGetTimeCodes used to write directly. No connection to a camera
+ * is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TimecodeLog.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("DumpTimecodes Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> timecode log to read (default frame_timecodes.tc)\n");
+   printf("\t-out <filename> text file to write (default stdout)\n");
+   printf("\t-mcam <mcam ID> only write records for this microcamera\n");
+   printf("\t-full also write the frame id, tile and host receive time in ns\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char logFile[256] = "frame_timecodes.tc";
+    const char * outFile = NULL;
+    uint32_t mcamID = 0;
+    bool full = false;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(logFile, argv[i], sizeof(logFile) - 1);
+        } else if( !strcmp(argv[i],"-out") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            outFile = argv[i];
+        } else if( !strcmp(argv[i],"-mcam") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            mcamID = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-full") ){
+            full = true;
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    TIMECODE_LOG_READER reader;
+    if( !timecodeLogMap(&reader, logFile) ){
+        printf("Unable to read timecode log %s\n", logFile);
+        return 0;
+    }
+
+    FILE * out = stdout;
+    if( outFile != NULL ){
+        out = fopen(outFile, "w");
+        if( out == NULL ){
+            printf("Unable to open %s\n", outFile);
+            timecodeLogUnmap(&reader);
+            return 0;
+        }
+    }
+
+    /* records are read straight from the mapping without copying */
+    uint64_t written = 0;
+    for( size_t i = 0; i < reader.numRecords; i++ ){
+        const TIMECODE_RECORD * record = timecodeLogRecordAt(&reader, i);
+        if( mcamID != 0 && record->mcamID != mcamID ){
+            continue;
+        }
+        if( full ){
+            fprintf(out, "%u %lu %lu %u %lu\n",
+                    record->mcamID,
+                    record->timestamp,
+                    record->frameId,
+                    record->tile,
+                    record->received);
+        } else{
+            fprintf(out, "%u %lu\n", record->mcamID, record->timestamp);
+        }
+        written++;
+    }
+
+    /* the summary goes to stderr so stdout stays a clean timecode list */
+    fprintf(stderr, "Wrote %lu of %lu timecodes\n", written, (uint64_t)reader.numRecords);
+    if( out != stdout ){
+        fclose(out);
+    }
+
+    timecodeLogUnmap(&reader);
+
+    exit(1);
+}
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * ExtractGop.c
+ *
+ * This example maps a container written by MantisExportStream -container
+ * and writes the GOP covering a requested time for one microcamera to a
+ * decodable .h264 file. No connection to a camera is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "StreamContainer.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("ExtractGop Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> container to read (default export.amc)\n");
+   printf("\t-mcam <mcam ID> microcamera to extract (required)\n");
+   printf("\t-time <microseconds> time the GOP must cover (required)\n");
+   printf("\t-out <filename> file to write the GOP to (default gop.h264)\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char containerFile[256] = "export.amc";
+    char outFile[256] = "gop.h264";
+    uint32_t mcamID = 0;
+    uint64_t time = 0;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(containerFile, argv[i], sizeof(containerFile) - 1);
+        } else if( !strcmp(argv[i],"-out") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(outFile, argv[i], sizeof(outFile) - 1);
+        } else if( !strcmp(argv[i],"-mcam") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            mcamID = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-time") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            time = strtoull(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    if( mcamID == 0 || time == 0 ){
+        printf("Microcamera and time are required arguments\n");
+        printHelp();
+        return 0;
+    }
+
+    STREAM_CONTAINER_READER reader;
+    if( !streamContainerMap(&reader, containerFile) ){
+        printf("Unable to read container %s\n", containerFile);
+        return 0;
+    }
+
+    /* the GOP references frame data inside the mapping */
+    STREAM_CONTAINER_GOP gop;
+    if( !streamContainerFindGop(&reader, mcamID, time, &gop) ){
+        printf("No frames for microcamera %u in %s\n", mcamID, containerFile);
+        streamContainerUnmap(&reader);
+        return 0;
+    }
+
+    FILE * out = fopen(outFile, "w");
+    if( out == NULL ){
+        printf("Unable to open output file %s\n", outFile);
+        streamContainerUnmap(&reader);
+        return 0;
+    }
+    for( size_t i = 0; i < gop.numEntries; i++ ){
+        const STREAM_CONTAINER_ENTRY * entry = &gop.entries[i];
+        printf("mcam %u time %lu offset %lu size %lu%s\n",
+               entry->mcamID,
+               entry->timestamp,
+               entry->offset,
+               entry->size,
+               (entry->flags & STREAM_CONTAINER_I_FRAME) ? " I-frame" : "");
+        fwrite(gop.data + entry->offset, 1, entry->size, out);
+    }
+    fclose(out);
+    printf("Wrote %lu frames to %s\n", (uint64_t)gop.numEntries, outFile);
+
+    streamContainerUnmap(&reader);
+
+    exit(1);
+}
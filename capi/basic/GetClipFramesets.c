@@ -0,0 +1,313 @@
+/******************************************************************************
+ *
+ * GetClipFramesets.c
+ *
+ * This example app uses the Mantis API to retrieve the frames of all
+ * microcameras between a given start and end time and groups them into
+ * framesets: one frame per microcamera captured at the same instant.
+ *
+ * Each microcamera is fetched by its own thread. Frames are merged by
+ * timestamp in a FramesetAssembler, which holds at most -depth frames per
+ * microcamera and makes a thread wait while its microcamera is that far
+ * ahead of the slowest one. Every frameset is printed with its skew (the
+ * spread of its timestamps) and, with -dir, complete framesets are saved
+ * to <dir>/<set>_<mcam>. A summary of the skew is printed at the end.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+#include "FrameCursor.h"
+#include "FramesetAssembler.h"
+
+/**
+ * \brief Arguments for the fetch thread of one microcamera
+ **/
+typedef struct {
+    ACOS_CAMERA          camera;     //!< Camera to request frames from
+    uint32_t             mcamID;     //!< Microcamera to request frames from
+    FRAME_CURSOR         cursor;     //!< Chooses the time of each request
+    FRAMESET_ASSEMBLER * assembler;  //!< Assembler the frames are added to
+} FETCH_ARGS;
+
+/**
+ * \brief Output options for emitted framesets
+ **/
+typedef struct {
+    const char * dir;       //!< Directory to save complete framesets to, or NULL
+    bool         quiet;     //!< Only print the summary
+} OUTPUT_ARGS;
+
+/**
+ * \brief Function that handles new ACOS_CAMERA objects
+ **/
+void newCameraCallback(ACOS_CAMERA cam, void* data)
+{
+    static int cameraCounter = 0;
+    ACOS_CAMERA* camList = (ACOS_CAMERA*) data;
+    camList[cameraCounter++] = cam;
+}
+
+/**
+ * \brief Returns frame buffers once the assembler is done with them
+ **/
+void releaseFrame(FRAME frame, void * data)
+{
+    if( frame.m_image != NULL && !returnPointer(frame.m_image) ){
+        printf("Failed to return the pointer for the frame buffer\n");
+    }
+}
+
+/**
+ * \brief Prints each frameset and saves the complete ones
+ **/
+void framesetCallback(const FRAMESET * frameset, void * data)
+{
+    OUTPUT_ARGS * output = (OUTPUT_ARGS *)data;
+
+    if( !output->quiet ){
+        printf("Frameset %lu: timestamp %lu, %d of %d mcams, skew %lu us\n",
+               frameset->index,
+               frameset->timestamp,
+               frameset->numPresent,
+               frameset->numMCams,
+               frameset->skew);
+    }
+
+    if( output->dir == NULL || frameset->numPresent != frameset->numMCams ){
+        return;
+    }
+    for( int i = 0; i < frameset->numMCams; i++ ){
+        char fileName[512];
+        snprintf(fileName, sizeof(fileName), "%s/%lu_%u",
+                 output->dir,
+                 frameset->index,
+                 frameset->frames[i].m_metadata.m_camId);
+        saveFrame(frameset->frames[i], fileName);
+    }
+}
+
+/**
+ * \brief Fetch thread. Walks one microcamera through the clip and adds each
+ *        new frame to the assembler
+ **/
+void * fetchThread(void * data)
+{
+    FETCH_ARGS * args = (FETCH_ARGS *)data;
+    uint64_t t;
+
+    while( frameCursorNext(&args->cursor, &t) ){
+        FRAME frame = getFrame(args->camera,
+                               args->mcamID,
+                               t,
+                               ATL_TILING_1_1_2,
+                               ATL_TILE_4K);
+        bool isNew = frameCursorUpdate(&args->cursor, &frame);
+        if( frame.m_image == NULL ){
+            printf("Frame request failed!\n");
+            continue;
+        }
+        if( !isNew ){
+            returnPointer(frame.m_image);
+            continue;
+        }
+
+        /* blocks while this mcam is depth frames ahead of the others */
+        framesetAssemblerAdd(args->assembler, frame);
+    }
+
+    /* framesets no longer wait for this mcam */
+    framesetAssemblerFinish(args->assembler, args->mcamID);
+
+    return NULL;
+}
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("GetClipFramesets Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-t <start> <end> The start and end times of the clip\n");
+   printf("\t-f <framerate> The framerate the clip was captured at\n");
+   printf("\t-h Prints this help message and exits\n");
+   printf("\t-ip <address> IP Address connect to (default localhost)\n");
+   printf("\t-port <port> Port connect to (default 9999)\n");
+   printf("\t-tolerance <us> Widest timestamp spread of a frameset (default half a frame period)\n");
+   printf("\t-depth <count> Frames buffered per microcamera (default %d)\n", FRAMESET_DEPTH);
+   printf("\t-dir <directory> Save the JPEGs of complete framesets to this directory\n");
+   printf("\t-quiet Only print the summary\n");
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char ip[24] = "localhost";
+    int port = 9999;
+    uint64_t startTime = 0;
+    uint64_t endTime = 0;
+    double framerate = 0;
+    double tolerance = -1;
+    int depth = FRAMESET_DEPTH;
+    OUTPUT_ARGS output = { NULL, false };
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-ip") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            int length = strlen(argv[i]);
+            if( length < 24 ){
+                strncpy(ip, argv[i], length);
+                ip[length] = 0;
+            }
+        } else if( !strcmp(argv[i],"-port") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            port = atoi(argv[i]);
+        } else if( !strcmp(argv[i],"-t") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            startTime = strtoul(argv[i], NULL, 10);
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            endTime = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-f") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            framerate = atof(argv[i]);
+        } else if( !strcmp(argv[i],"-tolerance") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            tolerance = atof(argv[i]);
+        } else if( !strcmp(argv[i],"-depth") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            depth = atoi(argv[i]);
+            if( depth < 1 ){
+                printf("-depth must be at least 1\n");
+                return 0;
+            }
+        } else if( !strcmp(argv[i],"-dir") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            output.dir = argv[i];
+        } else if( !strcmp(argv[i],"-quiet") ){
+            output.quiet = true;
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    if( framerate == 0 || startTime == 0 || endTime == 0 ){
+        printf("Start time, end time, and framerate are required arguments\n");
+        printHelp();
+        return 0;
+    }
+    double framePeriod = 1.0/framerate * 1e6;
+    if( tolerance < 0 ){
+        tolerance = framePeriod / 2;
+    }
+
+    /* connect to the V2 instance */
+    connectToCameraServer(ip, port);
+    sleep(1);
+
+    /* get cameras from API */
+    int numCameras = getNumberOfCameras();
+    ACOS_CAMERA cameraList[numCameras];
+    NEW_CAMERA_CALLBACK camCB;
+    camCB.f = newCameraCallback;
+    camCB.data = cameraList;
+    setNewCameraCallback(camCB);
+    printf("API connected to %d Mantis systems\n", numCameras);
+
+    /****************************************************************
+     * THE REST OF THIS EXAMPLE WILL USE THE FIRST CAMERA IN THE LIST
+     ****************************************************************/
+    ACOS_CAMERA myMantis = cameraList[0];
+    if( myMantis.mcamList.numMCams == 0 ){
+        if( setCameraConnection(myMantis, true, 15) != AQ_SUCCESS ){
+            printf("Failed to establish connection for camera %u!\n",
+                   myMantis.camID);
+            return 0;
+        }
+        sleep(1);
+        myMantis.mcamList.numMCams = getCameraNumberOfMCams(myMantis);
+    }
+
+    int numMCams = myMantis.mcamList.numMCams;
+    MICRO_CAMERA mcamList[numMCams];
+    getCameraMCamList(myMantis, mcamList, numMCams);
+    uint32_t mcamIDs[numMCams];
+    for( int i = 0; i < numMCams; i++ ){
+        mcamIDs[i] = mcamList[i].mcamID;
+    }
+
+    FRAMESET_ASSEMBLER assembler;
+    FRAMESET_CALLBACK setCB = { framesetCallback, &output };
+    FRAME_RELEASE_CALLBACK releaseCB = { releaseFrame, NULL };
+    if( !framesetAssemblerInit(&assembler, mcamIDs, numMCams, depth, (uint64_t)tolerance,
+                               UINT64_MAX, true, setCB, releaseCB) ){
+        printf("Unable to allocate a frameset assembler for %d microcameras\n", numMCams);
+        return 0;
+    }
+    printf("Assembling framesets of %d microcameras within %.0f us\n", numMCams, tolerance);
+
+    FETCH_ARGS fetchArgs[numMCams];
+    pthread_t fetchers[numMCams];
+    int started = 0;
+    for( int i = 0; i < numMCams; i++ ){
+        fetchArgs[i].camera    = myMantis;
+        fetchArgs[i].mcamID    = mcamIDs[i];
+        fetchArgs[i].assembler = &assembler;
+        frameCursorInit(&fetchArgs[i].cursor, startTime, endTime, framePeriod);
+        if( pthread_create(&fetchers[started], NULL, fetchThread, &fetchArgs[i]) != 0 ){
+            printf("Unable to start the fetch thread for mcam %u\n", mcamIDs[i]);
+            framesetAssemblerFinish(&assembler, mcamIDs[i]);
+            continue;
+        }
+        started++;
+    }
+    for( int i = 0; i < started; i++ ){
+        pthread_join(fetchers[i], NULL);
+    }
+
+    framesetAssemblerFlush(&assembler);
+    FRAMESET_STATS stats = framesetAssemblerGetStats(&assembler);
+    framesetAssemblerPrintStats(&stats, numMCams);
+    framesetAssemblerDestroy(&assembler);
+
+    /* Disconnect the cameras to prevent issues when another program
+     * tries to connect */
+    for( int i = 0; i < numCameras; i++ ){
+        disconnectCamera(cameraList[i]);
+    }
+
+    exit(1);
+}
@@ -6,6 +6,10 @@
  * This example app shows how to retrieve a full list of clips currently
  * avaliable on any Mantis systems connected to the API
  *
+ * Each clip is also added to a binary catalog indexed by camera and time
+ * as it arrives, so QueryClipCatalog can find the clips covering a time
+ * range without listing them all again.
+ *
  *****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,8 +17,10 @@
 #include <unistd.h>
 
 #include "mantis/MantisAPI.h"
+#include "ClipCatalog.h"
 
 FILE *fp;
+CLIP_CATALOG catalog;
 
 /**
  * \brief Function that handles new ACOS_CAMERA objects
@@ -52,6 +58,16 @@ void newClipCallback(ACOS_CLIP clip, void* data)
                 clip.startTime,
                 clip.endTime,
                 clip.framerate);
+    if( !clipCatalogAdd(&catalog, &clip) ){
+        printf("Unable to add clip %s to the catalog\n", clip.name);
+    }
+}
+
+/**
+ * \brief Clip callback installed before the catalog is closed
+ **/
+void ignoreClipCallback(ACOS_CLIP clip, void* data)
+{
 }
 
 /**
@@ -65,6 +81,7 @@ void printHelp()
    printf("\t-ip <address> IP Address connect to (default localhost)\n");
    printf("\t-port <port> port connect to (default 9999)\n\n");
    printf("\t-file <filename> file to write the clip list to (default clips.txt)\n");
+   printf("\t-catalog <filename> indexed clip catalog to add the clips to (default clips.cat)\n");
 }
 
 /**
@@ -77,6 +94,7 @@ int main(int argc, char * argv[])
     char ip[24] = "localhost";
     int port = 9999;
     char clipFile[256] = "clips.txt";
+    char catalogFile[256] = "clips.cat";
     for( int i = 1; i < argc; i++ ){
        if( !strcmp(argv[i],"-ip") ){
           if( ++i >= argc ){
@@ -101,6 +119,12 @@ int main(int argc, char * argv[])
              return 0;
           }
           strcpy(clipFile, argv[i]);
+       } else if( !strcmp(argv[i],"-catalog") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          strncpy(catalogFile, argv[i], sizeof(catalogFile) - 1);
         } else if( !strcmp(argv[i], "-h") ){
             printHelp();
             return 1;
@@ -113,6 +137,12 @@ int main(int argc, char * argv[])
     /* open the clip file to write to */
     fp = fopen(clipFile, "w+");
 
+    /* open the catalog, keeping the clips already in it */
+    if( !clipCatalogOpen(&catalog, catalogFile) ){
+        printf("Unable to open clip catalog %s\n", catalogFile);
+        return 0;
+    }
+
     /* Bind a new clip callback to receive the structs */
     ACOS_CLIP_CALLBACK clipCB;
     clipCB.f = newClipCallback;
@@ -123,5 +153,12 @@ int main(int argc, char * argv[])
     connectToCameraServer(ip, port);
     sleep(1);
 
+    /* stop adding clips before the catalog and its lock go away, then sort
+     * the clips added by this run into the index */
+    clipCB.f = ignoreClipCallback;
+    setNewClipCallback(clipCB);
+    disconnectFromCameraServer();
+    clipCatalogClose(&catalog);
+
     exit(1);
 }
@@ -8,13 +8,88 @@
  * save them to a specified storage directory with associated JSON
  * metadata files.
  *
+ * Frames are fetched by a pool of request threads that keep several
+ * requests in flight for each microcamera. Completed frames are handed to
+ * a pool of -savers save threads through a bounded queue, so requests only
+ * wait when every save thread is behind. Repeating -dir shards the images
+ * across several directories, for example one per disk.
+ *
+ * With -pyramid each JPEG frame is saved as a tile pyramid instead, see
+ * TilePyramid.h, so viewers can read only the visible tiles of the level
+ * matching their zoom. Pyramids are built on the save threads in parallel.
+ *
+ * Every -checkpoint seconds a checkpoint thread flushes the saved images to
+ * disk and records in clip.journal, in the first directory, the earliest
+ * time of each microcamera that may not have been saved yet. With -resume
+ * an interrupted download continues from there. Images are named by
+ * timestamp, so the few frames fetched again after a resume overwrite
+ * identical files. A journal left by a download of another clip or
+ * framerate is not resumed.
+ *
+ * With -metrics <prefix> the latency of each getFrame and saveFrame call and
+ * the time each frame is held before its buffer is returned are written to
+ * <prefix>.json and <prefix>.prom every -metrics-interval seconds.
+ *
  *****************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "mantis/MantisAPI.h"
+#include "FrameSaver.h"
+#ifdef HAVE_TILE_PYRAMID
+#include "TilePyramid.h"
+#endif
+#include "FrameCursor.h"
+#include "ExportJournal.h"
+#include "Metrics.h"
+
+#define MAX_INFLIGHT 64
+#define CHECKPOINT_INTERVAL 5.0
+#define IDLE_REQUEST UINT64_MAX
+
+/**
+ * \brief Request state for one microcamera
+ **/
+typedef struct {
+    uint32_t        mcamID;         //!< Microcamera to request frames from
+    FRAME_CURSOR    cursor;         //!< Chooses the time of each request
+    uint64_t        saved;          //!< Frames saved, including earlier runs
+    pthread_mutex_t lock;           //!< Guards cursor and the request times of its threads
+} MCAM_FETCH;
+
+/**
+ * \brief Arguments for a single fetch thread
+ **/
+typedef struct FETCH_ARGS {
+    struct FETCH_PIPELINE * pipeline; //!< Shared pipeline state
+    MCAM_FETCH *     mcam;          //!< Microcamera this thread requests
+    uint64_t         request;       //!< Time being fetched and not yet queued, or IDLE_REQUEST
+} FETCH_ARGS;
+
+/**
+ * \brief State shared by the fetch and save stages
+ **/
+typedef struct FETCH_PIPELINE {
+    ACOS_CAMERA     camera;         //!< Camera to request frames from
+    const char **   dirs;           //!< Directories to save frames to
+    int             numDirs;        //!< Number of entries in dirs
+    FRAME_SAVER     saver;          //!< Frames waiting to be saved
+    MCAM_FETCH *    mcams;          //!< Request state of each microcamera
+    int             numMCams;       //!< Number of entries in mcams
+    FETCH_ARGS *    fetchers;       //!< Arguments of every fetch thread
+    int             numFetchers;    //!< Number of entries in fetchers
+    EXPORT_JOURNAL * journal;       //!< Checkpoint journal, or NULL
+    double          checkpointInterval; //!< Seconds between checkpoints
+    bool            done;           //!< Set once every frame has been saved
+} FETCH_PIPELINE;
 
 /**
  * \brief Function that handles new ACOS_CAMERA objects
@@ -26,6 +101,225 @@ void newCameraCallback(ACOS_CAMERA cam, void* data)
     camList[cameraCounter++] = cam;
 }
 
+/**
+ * \brief Returns the current monotonic time in seconds
+ **/
+double getElapsedTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**
+ * \brief Fetch stage thread. Requests the next time chosen by the cursor
+ *        of its microcamera until the end of the clip and queues each
+ *        frame that has not been received before
+ **/
+void * fetchThread(void * data)
+{
+    FETCH_ARGS * args = (FETCH_ARGS *)data;
+    FETCH_PIPELINE * pipeline = args->pipeline;
+    MCAM_FETCH * mcam = args->mcam;
+
+    while( true ){
+        /* claim the next request time for this mcam */
+        uint64_t t;
+        pthread_mutex_lock(&mcam->lock);
+        bool more = frameCursorNext(&mcam->cursor, &t);
+        args->request = more ? t : IDLE_REQUEST;
+        pthread_mutex_unlock(&mcam->lock);
+        if( !more ){
+            break;
+        }
+
+        uint64_t requested = metricsNow();
+        FRAME frame = getFrame(pipeline->camera,
+                               mcam->mcamID,
+                               t,
+                               ATL_TILING_1_1_2,
+                               ATL_TILE_4K);
+        uint64_t received = metricsRecord(METRIC_GET_FRAME, requested);
+
+        pthread_mutex_lock(&mcam->lock);
+        bool isNew = frameCursorUpdate(&mcam->cursor, &frame);
+        if( frame.m_image == NULL || !isNew ){
+            args->request = IDLE_REQUEST;
+        }
+        pthread_mutex_unlock(&mcam->lock);
+
+        /* check that the request succeeded and returned a new frame */
+        if( frame.m_image == NULL ){
+            printf("Frame request failed!\n");
+            continue;
+        }
+        if( !isNew ){
+            printf("Skipping duplicate frame %lu for mcam %u\n",
+                   frame.m_metadata.m_id,
+                   mcam->mcamID);
+            returnPointer(frame.m_image);
+            metricsRecord(METRIC_FRAME_HOLD, received);
+            continue;
+        }
+
+        /* blocks while the savers are behind. The request stays marked
+         * until the frame is queued, so a checkpoint never skips it */
+        char name[FRAME_SAVER_NAME];
+        snprintf(name, sizeof(name), "%u_%lu",
+                 frame.m_metadata.m_camId,
+                 frame.m_metadata.m_timestamp);
+        bool queued = frameSaverPush(&pipeline->saver, frame, name, received);
+        pthread_mutex_lock(&mcam->lock);
+        args->request = IDLE_REQUEST;
+        pthread_mutex_unlock(&mcam->lock);
+        if( !queued ){
+            returnPointer(frame.m_image);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Records for each microcamera the earliest time that may not be
+ *        saved yet and flushes the saved images to disk before writing it
+ * \param [in] dirfds descriptors of the output directories
+ * \param [in] done   set once every frame has been saved
+ **/
+void checkpointPipeline(FETCH_PIPELINE * pipeline, const int * dirfds, bool done)
+{
+    /* resume times are taken before flushing, so every frame they count
+     * as saved was written before the flush started */
+    uint64_t resumeTimes[pipeline->numMCams];
+    uint64_t saved[pipeline->numMCams];
+    for( int i = 0; i < pipeline->numMCams; i++ ){
+        MCAM_FETCH * mcam = &pipeline->mcams[i];
+
+        /* requests in flight are read before the savers, so a frame moving
+         * from a fetch thread into the savers is seen in one of them */
+        pthread_mutex_lock(&mcam->lock);
+        uint64_t resumeTime = mcam->cursor.nextTime;
+        for( int j = 0; j < pipeline->numFetchers; j++ ){
+            if( pipeline->fetchers[j].mcam == mcam && pipeline->fetchers[j].request < resumeTime ){
+                resumeTime = pipeline->fetchers[j].request;
+            }
+        }
+        pthread_mutex_unlock(&mcam->lock);
+
+        uint64_t pending;
+        if( frameSaverOldest(&pipeline->saver, mcam->mcamID, &pending) && pending < resumeTime ){
+            resumeTime = pending;
+        }
+        resumeTimes[i] = resumeTime;
+        saved[i] = __atomic_load_n(&mcam->saved, __ATOMIC_RELAXED);
+    }
+
+    for( int i = 0; i < pipeline->numDirs; i++ ){
+        if( syncfs(dirfds[i]) != 0 ){
+            printf("Unable to flush %s for a checkpoint\n", pipeline->dirs[i]);
+            return;
+        }
+    }
+
+    for( int i = 0; i < pipeline->numMCams; i++ ){
+        uint32_t mcamID = pipeline->mcams[i].mcamID;
+        if( !exportJournalCheckpoint(pipeline->journal, mcamID, resumeTimes[i], 0, 0, saved[i], done) ){
+            printf("Unable to write the checkpoint for mcam %u\n", mcamID);
+        }
+    }
+}
+
+/**
+ * \brief Opens every output directory for syncfs
+ * \return false if a directory could not be opened
+ **/
+bool openOutputDirs(FETCH_PIPELINE * pipeline, int * dirfds)
+{
+    for( int i = 0; i < pipeline->numDirs; i++ ){
+        dirfds[i] = open(pipeline->dirs[i], O_RDONLY | O_DIRECTORY);
+        if( dirfds[i] < 0 ){
+            printf("Unable to open %s. Saving without checkpoints\n", pipeline->dirs[i]);
+            while( i-- > 0 ){
+                close(dirfds[i]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief Checkpoint thread. Writes a checkpoint every checkpointInterval
+ *        seconds until every frame has been saved
+ **/
+void * checkpointThread(void * data)
+{
+    FETCH_PIPELINE * pipeline = (FETCH_PIPELINE *)data;
+    int dirfds[FRAME_SAVER_MAX_DIRS];
+    if( !openOutputDirs(pipeline, dirfds) ){
+        return NULL;
+    }
+
+    double lastCheckpoint = getElapsedTime();
+    while( !__atomic_load_n(&pipeline->done, __ATOMIC_ACQUIRE) ){
+        usleep(100000);
+        if( getElapsedTime() - lastCheckpoint >= pipeline->checkpointInterval ){
+            checkpointPipeline(pipeline, dirfds, false);
+            lastCheckpoint = getElapsedTime();
+        }
+    }
+
+    /* the savers are finished, so this covers every frame */
+    checkpointPipeline(pipeline, dirfds, true);
+    for( int i = 0; i < pipeline->numDirs; i++ ){
+        close(dirfds[i]);
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Called by a save thread after each image
+ **/
+void frameSaved(const FRAME_METADATA * meta, const char * fileName, bool saved, void * data)
+{
+    FETCH_PIPELINE * pipeline = (FETCH_PIPELINE *)data;
+    if( !saved ){
+        printf("Failed to save image %s\n", fileName);
+        return;
+    }
+    printf("Saved image %s, mcam:%u, timestamp: %lu\n",
+           fileName,
+           meta->m_camId,
+           meta->m_timestamp);
+
+    for( int i = 0; i < pipeline->numMCams; i++ ){
+        if( pipeline->mcams[i].mcamID == meta->m_camId ){
+            __atomic_add_fetch(&pipeline->mcams[i].saved, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+#ifdef HAVE_TILE_PYRAMID
+/**
+ * \brief Frame writer that saves JPEG frames as tile pyramids. Frames
+ *        without a JPEG are saved as they are
+ **/
+bool savePyramid(FRAME frame, const char * fileName, void * data)
+{
+    int tileSize = *(int *)data;
+    if( frame.m_metadata.m_mode != ATL_MODE_JPEG ){
+        return saveFrame(frame, fileName);
+    }
+
+    return tilePyramidSave(frame, fileName, tileSize, TILE_PYRAMID_QUALITY);
+}
+#endif
+
 /**
  * \brief prints the command line options
  **/
@@ -39,7 +333,18 @@ void printHelp()
    printf("\t-ip <address> IP Address connect to (default localhost)\n");
    printf("\t-port <port> Port connect to (default 9999)\n");
    printf("\t-mcam <mcam ID> The ID of the microcamera to get images for (default behavior gets all microcameras for the clip\n");
-   printf("\t-dir <directory> The directory to save the JPEGs to (default .)\n");
+   printf("\t-dir <directory> The directory to save the JPEGs to, repeat to shard across directories (default .)\n");
+   printf("\t-inflight <count> Requests kept in flight per microcamera (default 2)\n");
+   printf("\t-queue <count> Frames buffered between fetching and saving (default 32)\n");
+   printf("\t-savers <count> Threads saving frames (default %d)\n", FRAME_SAVER_WORKERS);
+#ifdef HAVE_TILE_PYRAMID
+   printf("\t-pyramid Save each JPEG as a tile pyramid in a .%s archive\n", TILE_ARCHIVE_EXTENSION);
+   printf("\t-tile-size <pixels> Width and height of pyramid tiles (default %d)\n", TILE_PYRAMID_TILE_SIZE);
+#endif
+   printf("\t-checkpoint <seconds> Time between checkpoints in clip.journal, 0 to disable (default 5)\n");
+   printf("\t-resume Continue an interrupted download of the same clip from its checkpoints\n");
+   printf("\t-metrics <prefix> Write latency histograms to <prefix>.json and <prefix>.prom\n");
+   printf("\t-metrics-interval <seconds> Time between metrics dumps (default 10)\n");
 }
 
 /**
@@ -51,11 +356,23 @@ int main(int argc, char * argv[])
      * or port if provided from the command line */
     char ip[24] = "localhost";
     int port = 9999;
-    char dir[256] = ".";
+    const char * dirs[FRAME_SAVER_MAX_DIRS] = { "." };
+    int numDirs = 0;
     uint64_t startTime = 0;
     uint64_t endTime = 0;
     double framerate = 0;
     uint32_t mcamID = 0;
+    int inflight = 2;
+    int queueSize = 32;
+    int numSavers = FRAME_SAVER_WORKERS;
+#ifdef HAVE_TILE_PYRAMID
+    bool pyramid = false;
+    int tileSize = TILE_PYRAMID_TILE_SIZE;
+#endif
+    double checkpointInterval = CHECKPOINT_INTERVAL;
+    bool resume = false;
+    char * metricsPrefix = NULL;
+    double metricsInterval = METRICS_INTERVAL;
     for( int i = 1; i < argc; i++ ){
         if( !strcmp(argv[i],"-ip") ){
             if( ++i >= argc ){
@@ -97,12 +414,80 @@ int main(int argc, char * argv[])
                 return 0;
             }
             framerate = atof(argv[i]);
+        } else if( !strcmp(argv[i],"-inflight") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            inflight = atoi(argv[i]);
+            if( inflight < 1 || inflight > MAX_INFLIGHT ){
+                printf("-inflight must be between 1 and %d\n", MAX_INFLIGHT);
+                return 0;
+            }
+        } else if( !strcmp(argv[i],"-queue") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            queueSize = atoi(argv[i]);
+            if( queueSize < 1 ){
+                printf("-queue must be at least 1\n");
+                return 0;
+            }
+        } else if( !strcmp(argv[i],"-savers") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            numSavers = atoi(argv[i]);
+            if( numSavers < 1 ){
+                printf("-savers must be at least 1\n");
+                return 0;
+            }
+#ifdef HAVE_TILE_PYRAMID
+        } else if( !strcmp(argv[i],"-pyramid") ){
+            pyramid = true;
+        } else if( !strcmp(argv[i],"-tile-size") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            tileSize = atoi(argv[i]);
+            if( tileSize < 16 || tileSize > 65535 ){
+                printf("-tile-size must be between 16 and 65535\n");
+                return 0;
+            }
+#endif
+        } else if( !strcmp(argv[i],"-checkpoint") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            checkpointInterval = atof(argv[i]);
+        } else if( !strcmp(argv[i],"-resume") ){
+            resume = true;
+        } else if( !strcmp(argv[i],"-metrics") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            metricsPrefix = argv[i];
+        } else if( !strcmp(argv[i],"-metrics-interval") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            metricsInterval = atof(argv[i]);
         } else if( !strcmp(argv[i],"-dir") ){
             if( ++i >= argc ){
                 printHelp();
                 return 0;
             }
-            strcpy(dir, argv[i]);
+            if( numDirs == FRAME_SAVER_MAX_DIRS ){
+                printf("At most %d directories can be given with -dir\n", FRAME_SAVER_MAX_DIRS);
+                return 0;
+            }
+            dirs[numDirs++] = argv[i];
         } else if( !strcmp(argv[i], "-h") ){
             printHelp();
             return 1;
@@ -117,6 +502,18 @@ int main(int argc, char * argv[])
         printHelp();
         return 0;
     }
+    if( numDirs == 0 ){
+        numDirs = 1;
+    }
+    if( resume && checkpointInterval <= 0 ){
+        printf("-resume requires checkpoints\n");
+        printHelp();
+        return 0;
+    }
+
+    if( metricsPrefix != NULL && !metricsStart(metricsPrefix, "GetClipMcamImages", metricsInterval) ){
+        printf("Unable to start metrics for %s\n", metricsPrefix);
+    }
 
     /* connect to the V2 instance */
     connectToCameraServer(ip, port);
@@ -175,55 +572,145 @@ int main(int argc, char * argv[])
         mcamList[0] = mcam;
     }
 
-    /* Next we calculate the length of a frame in microseconds */
-    uint64_t frameLength = (uint64_t)(1.0/framerate * 1e6);
+    /* Next we calculate the nominal length of a frame in microseconds */
+    double framePeriod = 1.0/framerate * 1e6;
 
     /* Now for each microcamera, we request frames starting at the 
-     * startTime and increment the time of our requests by the length 
-     * of a frame until we reach the endTime, Unlike when requesting
+     * startTime and step from the timestamp of each returned frame
+     * until we reach the endTime, Unlike when requesting
      * the most recent frame, requesting a specific time may fail
      * if a frame was dropped, so it is good to check that the image
-     * buffer pointer is not NULL before interacting with the frame */
-    uint64_t requestCounter = 0;
-    uint64_t frameCounter = 0;
-    for( uint64_t t = startTime; t < endTime; t += frameLength ){
-        for( int i = 0; i < numMCams; i++ ){
-            /* get the next frame for this mcam */
-            requestCounter++;
-            FRAME frame = getFrame(myMantis, 
-                                   mcamList[i].mcamID,
-                                   t,
-                                   ATL_TILING_1_1_2,
-                                   ATL_TILE_4K);
-
-            /* check that the request succeeded before using the frame */
-            if( frame.m_image != NULL ){
-                frameCounter++;
-                char fileName[512];
-                sprintf(fileName, "%s/%u_%lu",
-                        dir,
-                        frame.m_metadata.m_camId,
-                        frame.m_metadata.m_timestamp);
-                printf("Saving image %s, mcam:%u, timestamp: %lu\n", 
-                       fileName, 
-                       frame.m_metadata.m_camId, 
-                       frame.m_metadata.m_timestamp);
-                saveFrame(frame, fileName);
-
-                /* return the frame buffer pointer to prevent memory leaks */
-                if( !returnPointer(frame.m_image) ){
-                    printf("Failed to return the pointer for the frame buffer\n");
-                }
+     * buffer pointer is not NULL before interacting with the frame.
+     * Each microcamera gets inflight request threads so the next
+     * requests are already outstanding while a frame is being saved */
+    int numFetchers = numMCams * inflight;
+    MCAM_FETCH mcamFetch[numMCams];
+    FETCH_ARGS fetchArgs[numFetchers];
+    pthread_t fetchers[numFetchers];
+    int started = 0;
+
+    FETCH_PIPELINE pipeline;
+    pipeline.camera         = myMantis;
+    pipeline.dirs           = dirs;
+    pipeline.numDirs        = numDirs;
+    pipeline.mcams          = mcamFetch;
+    pipeline.numMCams       = numMCams;
+    pipeline.fetchers       = fetchArgs;
+    pipeline.numFetchers    = 0;
+    pipeline.journal        = NULL;
+    pipeline.checkpointInterval = checkpointInterval;
+    pipeline.done           = false;
+
+    /* when resuming, each microcamera starts at its last checkpoint. A
+     * checkpoint marked done means the microcamera is complete */
+    uint32_t mcamIDs[numMCams];
+    EXPORT_JOURNAL_RECORD resumeList[numMCams];
+    memset(resumeList, 0, sizeof(resumeList));
+    for( int i = 0; i < numMCams; i++ ){
+        mcamIDs[i] = mcamList[i].mcamID;
+    }
+    EXPORT_JOURNAL journal;
+    if( checkpointInterval > 0 ){
+        char journalName[512];
+        snprintf(journalName, sizeof(journalName), "%s/clip.journal", dirs[0]);
+        if( resume ){
+            int found = exportJournalRead(journalName, startTime, endTime, framerate, mcamIDs, numMCams, resumeList);
+            if( found == EXPORT_JOURNAL_MISMATCH ){
+                printf("%s is from a download of another clip or framerate. Not resuming\n", journalName);
+                return 0;
+            } else if( found < 0 ){
+                printf("Unable to read %s. Starting over\n", journalName);
+                memset(resumeList, 0, sizeof(resumeList));
             } else{
-                printf("Frame request failed!\n");
+                printf("Resuming %d of %d microcameras from checkpoints\n", found, numMCams);
             }
+        }
+        if( exportJournalOpen(&journal, journalName, resume, startTime, endTime, framerate) ){
+            pipeline.journal = &journal;
+        } else{
+            printf("Unable to open %s. Saving without checkpoints\n", journalName);
+        }
+    }
+
+    for( int i = 0; i < numMCams; i++ ){
+        uint64_t mcamStart = startTime;
+        mcamFetch[i].saved = 0;
+        if( resumeList[i].checksum != 0 ){
+            mcamStart = (resumeList[i].flags & EXPORT_JOURNAL_DONE) ? endTime : resumeList[i].timestamp;
+            mcamFetch[i].saved = resumeList[i].frames;
+        }
+        mcamFetch[i].mcamID   = mcamList[i].mcamID;
+        frameCursorInit(&mcamFetch[i].cursor, mcamStart, endTime, framePeriod);
+        pthread_mutex_init(&mcamFetch[i].lock, NULL);
+    }
+    for( int i = 0; i < numFetchers; i++ ){
+        fetchArgs[i].pipeline = &pipeline;
+        fetchArgs[i].mcam     = &mcamFetch[i % numMCams];
+        fetchArgs[i].request  = IDLE_REQUEST;
+    }
+    pipeline.numFetchers = numFetchers;
+
+    FRAME_SAVED_CALLBACK savedCB;
+    savedCB.f    = frameSaved;
+    savedCB.data = &pipeline;
+    if( !frameSaverInit(&pipeline.saver, numSavers, queueSize, dirs, numDirs, savedCB) ){
+        printf("Unable to start %d save threads with a queue of %d frames\n", numSavers, queueSize);
+        frameSaverDestroy(&pipeline.saver);
+        return 0;
+    }
+#ifdef HAVE_TILE_PYRAMID
+    if( pyramid ){
+        FRAME_WRITER pyramidWriter;
+        pyramidWriter.f    = savePyramid;
+        pyramidWriter.data = &tileSize;
+        frameSaverSetWriter(&pipeline.saver, pyramidWriter);
+    }
+#endif
 
+    pthread_t checkpointer;
+    bool checkpointing = false;
+    if( pipeline.journal != NULL ){
+        checkpointing = pthread_create(&checkpointer, NULL, checkpointThread, &pipeline) == 0;
+        if( !checkpointing ){
+            printf("Unable to start the checkpoint thread. Saving without checkpoints\n");
         }
     }
+
+    for( int i = 0; i < numFetchers; i++ ){
+        if( pthread_create(&fetchers[started], NULL, fetchThread, &fetchArgs[i]) != 0 ){
+            printf("Unable to start fetch thread %d\n", i);
+            continue;
+        }
+        started++;
+    }
+
+    /* once every request has completed, let the savers drain the queue */
+    for( int i = 0; i < started; i++ ){
+        pthread_join(fetchers[i], NULL);
+    }
+    frameSaverFinish(&pipeline.saver);
+    if( checkpointing ){
+        __atomic_store_n(&pipeline.done, true, __ATOMIC_RELEASE);
+        pthread_join(checkpointer, NULL);
+    }
+    metricsStop();
+
+    printf("Saved %lu images, %lu failed\n", pipeline.saver.saved, pipeline.saver.failed);
+    frameSaverDestroy(&pipeline.saver);
+    if( pipeline.journal != NULL ){
+        exportJournalClose(pipeline.journal);
+    }
+    FRAME_CURSOR_STATS stats = {0};
+    for( int i = 0; i < numMCams; i++ ){
+        frameCursorAddStats(&stats, frameCursorGetStats(&mcamFetch[i].cursor));
+        pthread_mutex_destroy(&mcamFetch[i].lock);
+    }
+
     printf("Received %lu of %lu requested frames across %d microcameras\n",
-           frameCounter,
-           requestCounter,
+           stats.frames,
+           stats.requests,
            numMCams);
+    frameCursorPrintStats(stats);
 
     /* Disconnect the cameras to prevent issues when another program 
      * tries to connect */
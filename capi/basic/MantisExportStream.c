@@ -3,9 +3,13 @@
  * Author: Steve Feller
  *
  * This example downloads an h.264 stream from each microcamera in a system. 
- * The first frame of a microcamera stream is the first I-frame after the 
- * specified start time. If the start time is not provided, the timestamp
- * of the first microcamera is used as the start time. In the latter case, the
+ * The first frame of a microcamera stream is the I-frame at or before the 
+ * specified start time, found by walking back from the start time. The
+ * frames on the way are written rather than fetched again. If no I-frame
+ * turns up within a GOP, or with -noseek, the stream starts at the first
+ * I-frame after the start time.
+ * If the start time is not provided, the timestamp of the first
+ * microcamera is used as the start time. In the latter case, the
  * application waits the duration before starting the download process.
  *
  * If the cuda option is speciifed the avconv will use the cuda codec. This is
@@ -13,6 +17,37 @@
  * 
  * LIBAV: avconv -vsync 0 -c:v h264_cuvid -i <input.mp4> -f rawvideo <output.yuv> 
  *
+ * When built with HAVE_STREAM_DECODER, JPG output without -cuda is decoded
+ * in-process while frames are fetched, using libavcodec and libjpeg-turbo
+ * on a pool of -decoders threads, instead of running avconv afterwards.
+ *
+ * The -jobs option exports several microcameras at once. Each worker thread
+ * takes the next microcamera from the list and writes its stream file, so the
+ * output layout is identical to a sequential export.
+ *
+ * Requests from all workers pass through one adaptive rate controller. It
+ * raises the request rate and the number of requests in flight (at most
+ * -jobs) while getFrame latency and failures stay low, and backs off when
+ * they rise, so the export runs near the capacity of the server. -maxrate
+ * caps the request rate.
+ *
+ * Every -checkpoint seconds each stream file is flushed to disk and its
+ * length, last frame id and timestamp and frame count are appended to
+ * export.journal along with the export window. Running again with -resume
+ * and the same -start and -duration cuts each stream back to its last
+ * checkpoint, dropping any partial frame written before the interruption,
+ * and continues with the frame after it. Finished streams are skipped. A
+ * journal written for another window or framerate is not resumed.
+ *
+ * With -meta columns the metadata of every frame goes to one columnar,
+ * delta-compressed export.cols store held in memory and written when the
+ * export ends. MetadataColumns.h describes the format.
+ *
+ * With -metrics <prefix> the latency of each getFrame call, of writing each
+ * frame to its stream and the time each frame is held before its buffer is
+ * returned are written to <prefix>.json and <prefix>.prom every
+ * -metrics-interval seconds.
+ *
  *****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,12 +57,76 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "mantis/MantisAPI.h"
+#include "FrameCursor.h"
+#include "MetadataIndex.h"
+#include "MetadataColumns.h"
+#include "StreamContainer.h"
+#include "StreamWriter.h"
+#include "ExportJournal.h"
+#include "RateController.h"
+#include "Metrics.h"
+#ifdef HAVE_STREAM_DECODER
+#include "StreamDecoder.h"
+#endif
 
 #define FNAME_SIZE 1024
 #define MSEC_SCALE 1e6
 #define MAX_MODE_LEN 256
+#define MAX_JOBS 256
+#define MAX_GOP_SEARCH 300
+#define PREALLOC_FRAMES 16
+#define CHECKPOINT_INTERVAL 5.0
+
+/**
+ * \brief Where frame metadata is written
+ **/
+typedef enum {
+   META_FILES,    //!< One .meta file per frame
+   META_STREAM,   //!< One streamN.idx index per stream
+   META_EXPORT,   //!< One export.idx index shared by all streams
+   META_COLUMNS   //!< One export.cols columnar store for all streams
+} META_MODE;
+
+/**
+ * \brief State shared by all export workers
+ **/
+typedef struct {
+   ACOS_CAMERA     camera;          //!< Camera to request frames from
+   MICRO_CAMERA *  mcamList;        //!< Microcameras to export
+   int             numMCams;        //!< Number of entries in mcamList
+   bool *          firstFrameList;  //!< Per mcam flag set at the first I-frame
+   const char *    path;            //!< Output directory
+   META_MODE       metaMode;        //!< Where frame metadata is written
+   METADATA_INDEX  exportIndex;     //!< Shared index for META_EXPORT
+   METADATA_COLUMNS columns;        //!< Shared store for META_COLUMNS
+   STREAM_CONTAINER * container;    //!< Container for all streams, or NULL
+   size_t          blockSize;       //!< Bytes coalesced per stream write
+   bool            direct;          //!< Write stream files with O_DIRECT
+   EXPORT_JOURNAL * journal;        //!< Checkpoint journal, or NULL
+   EXPORT_JOURNAL_RECORD * resumeList; //!< Per mcam checkpoint to resume from, or NULL
+   double          checkpointInterval; //!< Seconds between checkpoints
+   RATE_CONTROLLER rate;            //!< Paces the frame requests of all workers
+#ifdef HAVE_STREAM_DECODER
+   STREAM_DECODER * decoder;        //!< In-process JPEG conversion, or NULL
+#endif
+   uint64_t        startTime;       //!< First request time in microseconds
+   uint64_t        endTime;         //!< End of the export window in microseconds
+   double          framePeriod;     //!< Nominal frame period in microseconds
+   int             nextMCam;        //!< Index of the next mcam to export
+   uint64_t        requestCounter;  //!< Total frame requests sent
+   uint64_t        frameCounter;    //!< Total distinct frames received
+   FRAME_CURSOR_STATS cursorStats;  //!< Request accounting across all mcams
+   bool            seek;            //!< Start at the I-frame before startTime
+   uint64_t        gopFrames;       //!< Frames per GOP once observed, else 0
+   uint64_t        seekProbes;      //!< Requests spent finding GOP starts
+   uint64_t        seekWasted;      //!< Seek requests that produced no written frame
+   uint64_t        seekAvoided;     //!< Leading frames that would have been discarded
+   uint64_t        seekLead;        //!< Frames fetched between GOP starts and startTime
+   pthread_mutex_t lock;            //!< Guards nextMCam and the counters
+} EXPORT_JOB;
 
 /**
  * \brief Returns the current time as a double
@@ -52,14 +151,11 @@ double convertDateToTimestamp( char * input )
 {
    struct tm t;
    unsigned int fraction = 0;
+   memset( &t, 0, sizeof(t));
 
-   if(strlen(input) != 21 ) {
-      printf("Invalid input. Length of %s is %ld, not 21\n\n", input, strlen(input));
-   }
-
-   //Read in each compeonent
+   //Read in each component. The fraction of a second is optional
    int rc = sscanf( input
-                  , "%4d-%2d-%2d_%2d:%2d:%2d.%2d"
+                  , "%4d-%2d-%2d_%2d:%2d:%2d.%2u"
                   , &t.tm_year
                   , &t.tm_mon
                   , &t.tm_mday
@@ -70,19 +166,33 @@ double convertDateToTimestamp( char * input )
                   );
  
    //Make sure all fields were entered
-   if( rc != 6 ) {
+   if( rc < 6 ) {
       printf("ERROR: Invalid date string: %s\n", input );
       return 0;
    }
    
-   //Convert time to epoch time
+   //Convert time to epoch time, letting mktime work out daylight saving
+   t.tm_year -= 1900;
+   t.tm_mon  -= 1;
+   t.tm_isdst = -1;
    double epochTime;
    epochTime = (double)mktime( &t);
-   epochTime = epochTime + fraction / 100;
+   epochTime = epochTime + fraction / 100.0;
 
    return epochTime;
 }
 
+/**
+ * \brief Returns the current monotonic time in seconds
+ **/
+double getElapsedTime()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
 /**
  * \brief Function that handles new ACOS_CAMERA objects
  **/
@@ -103,6 +213,464 @@ void newClipCallback(ACOS_CLIP clip, void* data)
     *myClip = clip;
 }
 
+/**
+ * \brief Walks back from job->startTime to the I-frame at or before it.
+ *
+ * Each request steps back one frame. Every frame received on the way is
+ * part of the GOP the export starts with, so the frames are kept for the
+ * caller to write instead of being returned and fetched again, and a
+ * successful walk costs no request beyond the frames it keeps. Once the GOP
+ * length is known from an earlier microcamera the walk gives up after that
+ * many frames, since an I-frame must have been among them.
+ *
+ * \param [out] frames    frames received, newest first. Holds MAX_GOP_SEARCH
+ * \param [out] numFrames number of frames in frames
+ * \param [out] probes    number of requests sent
+ * \return true if an I-frame was found. Otherwise the frames were returned
+ *         to the API and numFrames is 0
+ **/
+bool seekGopStart( EXPORT_JOB * job
+                 , uint32_t mcamID
+                 , FRAME * frames
+                 , int * numFrames
+                 , uint64_t * probes
+                 )
+{
+   uint64_t period = (uint64_t)(job->framePeriod + 0.5);
+   uint64_t t = job->startTime;
+
+   *numFrames = 0;
+   *probes = 0;
+
+   for( int i = 0; i < MAX_GOP_SEARCH; i++ ) {
+      pthread_mutex_lock(&job->lock);
+      bool wholeGop = job->gopFrames > 0 && (uint64_t)*numFrames >= job->gopFrames;
+      if( !wholeGop ) {
+         job->requestCounter++;
+      }
+      pthread_mutex_unlock(&job->lock);
+      if( wholeGop ) {
+         break;
+      }
+      (*probes)++;
+
+      double admitted = rateControllerAcquire( &job->rate );
+      uint64_t requested = metricsNow();
+      FRAME frame = getFrame( job->camera
+                            , mcamID
+                            , t
+                            , ATL_TILING_1_1_2
+                            , ATL_TILE_4K
+                            );
+      metricsRecord( METRIC_GET_FRAME, requested );
+      rateControllerRelease( &job->rate, admitted, frame.m_image != NULL );
+
+      /* Asking for the previous frame may return the same one again if the
+       * frame period is longer than expected. Step back further from the
+       * request time then */
+      uint64_t from = t;
+      if( frame.m_image != NULL ) {
+         if( *numFrames > 0 && frame.m_metadata.m_id >= frames[*numFrames - 1].m_metadata.m_id ) {
+            if( !returnPointer(frame.m_image) ){
+               printf("Failed to return the pointer for the frame buffer\n");
+            }
+         }
+         else {
+            frames[(*numFrames)++] = frame;
+            if( frame.m_metadata.m_mode == ATL_MODE_H264_I_FRAME ) {
+               return true;
+            }
+            from = frame.m_metadata.m_timestamp;
+         }
+      }
+      if( from <= period ) {
+         break;
+      }
+      t = from - period;
+   }
+
+   //Without their I-frame the frames cannot be decoded
+   for( int i = 0; i < *numFrames; i++ ) {
+      if( !returnPointer(frames[i].m_image) ){
+         printf("Failed to return the pointer for the frame buffer\n");
+      }
+   }
+   *numFrames = 0;
+
+   return false;
+}
+
+/**
+ * \brief Flushes a stream and its index to disk and records how far it got
+ * \param [in] timestamp timestamp of the last frame written
+ * \param [in] lastId    m_id of the last frame written
+ * \param [in] frames    number of frames written to the stream
+ * \param [in] done      set once the stream is complete
+ **/
+void checkpointStream( EXPORT_JOB * job
+                     , uint32_t mcamID
+                     , STREAM_WRITER * writer
+                     , METADATA_INDEX * streamIndex
+                     , uint64_t timestamp
+                     , uint64_t lastId
+                     , uint64_t frames
+                     , bool done
+                     )
+{
+   if( !streamWriterSync( writer )) {
+      printf("Unable to flush stream %u for a checkpoint\n", mcamID );
+      return;
+   }
+   if( streamIndex != NULL && !metadataIndexSync( streamIndex )) {
+      printf("Unable to flush the index of stream %u for a checkpoint\n", mcamID );
+      return;
+   }
+   if( !exportJournalCheckpoint( job->journal
+                               , mcamID
+                               , timestamp
+                               , lastId
+                               , streamWriterTell( writer )
+                               , frames
+                               , done
+                               )) {
+      printf("Unable to write the checkpoint for stream %u\n", mcamID );
+   }
+}
+
+/**
+ * \brief Exports the stream for a single microcamera
+ * \param [in] job   shared export state
+ * \param [in] index index of the microcamera in job->mcamList
+ **/
+void exportMCam( EXPORT_JOB * job, int index )
+{
+   MICRO_CAMERA mcam = job->mcamList[index];
+   char streamname[FNAME_SIZE];
+   char metaname[FNAME_SIZE];
+   snprintf( streamname, FNAME_SIZE, "%s/stream%d.h264", job->path, mcam.mcamID); 
+
+   //Continue after the last checkpoint of an interrupted export
+   const EXPORT_JOURNAL_RECORD * resume = NULL;
+   if( job->resumeList != NULL && job->resumeList[index].checksum != 0 ) {
+      resume = &job->resumeList[index];
+      if( resume->flags & EXPORT_JOURNAL_DONE ) {
+         printf("Stream %u was already exported\n", mcam.mcamID );
+         return;
+      }
+      printf("Resuming stream %u after frame %lu at time %lu\n", mcam.mcamID, resume->frames, resume->timestamp );
+   }
+
+   //Frames go to the shared container instead of a stream file if one is open
+   STREAM_WRITER writer;
+   STREAM_WRITER * streamPtr = NULL;
+   if( job->container == NULL ) {
+      bool opened = ( resume != NULL )
+                  ? streamWriterResume( &writer, streamname, resume->offset, job->blockSize, job->direct )
+                  : streamWriterOpen( &writer, streamname, job->blockSize, job->direct );
+      if( !opened )  {
+         printf("Unable to open output file at %s\n", streamname);
+         return;
+      }
+      streamPtr = &writer;
+   }
+
+   //Index records point at the frame offset in the stream or container file
+   METADATA_INDEX streamIndex;
+   METADATA_INDEX * metaIndex = NULL;
+   if( job->metaMode == META_EXPORT ) {
+      metaIndex = &job->exportIndex;
+   }
+   else if( job->metaMode == META_STREAM ) {
+      snprintf( metaname, FNAME_SIZE, "%s/stream%d.idx", job->path, mcam.mcamID );
+      bool opened = ( resume != NULL )
+                  ? metadataIndexResume( &streamIndex, metaname, resume->frames )
+                  : metadataIndexOpen( &streamIndex, metaname );
+      if( opened ) {
+         metaIndex = &streamIndex;
+      }
+      else {
+         printf("Unable to open metadata index %s\n", metaname );
+      }
+   }
+   uint64_t streamOffset = 0;
+   uint64_t streamFrames = ( resume != NULL ) ? resume->frames : 0;
+   uint64_t streamBase = ( streamPtr != NULL ) ? streamWriterTell( streamPtr ) : 0;
+   uint64_t preallocFrames = streamFrames + PREALLOC_FRAMES;
+   uint64_t lastTimestamp = ( resume != NULL ) ? resume->timestamp : 0;
+   uint64_t lastId = ( resume != NULL ) ? resume->lastId : 0;
+   double lastCheckpoint = getElapsedTime();
+
+   /* The cursor picks each request time from the timestamp of the last
+    * frame received, so float framerates do not drift into duplicates */
+   uint64_t startFrameId = 0;
+   uint64_t seekProbes = 0;
+   FRAME seekFrames[MAX_GOP_SEARCH];
+   int numSeekFrames = 0;
+   if( resume != NULL ) {
+      //The stream already starts with an I-frame
+      job->firstFrameList[index] = true;
+   }
+   else if( job->seek ) {
+      if( seekGopStart( job, mcam.mcamID, seekFrames, &numSeekFrames, &seekProbes )) {
+         printf("GOP for %u starts at time %lu (%lu probes)\n",
+                mcam.mcamID,
+                seekFrames[numSeekFrames - 1].m_metadata.m_timestamp,
+                seekProbes );
+         startFrameId = seekFrames[0].m_metadata.m_id;
+      }
+      else {
+         printf("No I-frame found before the start time for %u. Starting at the next one\n", mcam.mcamID );
+      }
+   }
+   uint64_t seekWasted = seekProbes - numSeekFrames;
+
+   FRAME_CURSOR cursor;
+   frameCursorInit( &cursor, job->startTime, job->endTime, job->framePeriod );
+   if( resume != NULL ) {
+      //Frames up to the checkpoint are already in the stream
+      frameCursorResume( &cursor, resume->lastId, resume->timestamp );
+   }
+   else if( numSeekFrames > 0 ) {
+      //The frames the seek kept are written first and not requested again
+      frameCursorResume( &cursor, seekFrames[0].m_metadata.m_id, seekFrames[0].m_metadata.m_timestamp );
+   }
+
+   //Frames a forward search for the first I-frame would have thrown away
+   uint64_t wouldDiscard = 0;
+   //Frames a seek fetched between the GOP start and the requested start
+   uint64_t leadFrames = 0;
+   bool startGopSeen = startFrameId == 0;
+   uint64_t lastIFrameId = 0;
+
+   uint64_t frameCount = streamFrames;
+   uint64_t t;
+   while( numSeekFrames > 0 || frameCursorNext( &cursor, &t )){
+      FRAME frame;
+      uint64_t received;
+      bool fresh;
+      if( numSeekFrames > 0 ) {
+         //Frames kept by the seek, oldest first
+         frame = seekFrames[--numSeekFrames];
+         t = frame.m_metadata.m_timestamp;
+         received = metricsNow();
+         fresh = true;
+      }
+      else {
+         pthread_mutex_lock(&job->lock);
+         uint64_t requestId = job->requestCounter++;
+         pthread_mutex_unlock(&job->lock);
+
+         printf("Sending frame request %lu to mcam %u at time %ld \n", requestId, mcam.mcamID, t);
+         /* get the next frame for this mcam once the rate controller admits
+          * the request */
+         double admitted = rateControllerAcquire( &job->rate );
+         uint64_t requested = metricsNow();
+         frame = getFrame( job->camera
+                         ,  mcam.mcamID
+                         ,  t
+                         ,  ATL_TILING_1_1_2
+                         ,  ATL_TILE_4K
+                         );
+         received = metricsRecord( METRIC_GET_FRAME, requested );
+         rateControllerRelease( &job->rate, admitted, frame.m_image != NULL );
+         fresh = frameCursorUpdate( &cursor, &frame );
+      }
+
+      /* check that the request succeeded and returned a new frame */
+      if( fresh ){
+          pthread_mutex_lock(&job->lock);
+          uint64_t frameId = job->frameCounter++;
+          pthread_mutex_unlock(&job->lock);
+
+          printf("Received frame %lu for microcamera %lu at time %lu:\n"
+                 "\tdimensions: %ux%u"
+                 "\tbuffer size: %lu"
+                 "\tgain: %f"
+                 "\tshutter: %f"
+                 "\texposure: %f\n",
+                 frameId,
+                 frame.m_metadata.m_id,
+                 frame.m_metadata.m_timestamp,
+                 frame.m_metadata.m_width,
+                 frame.m_metadata.m_height,
+                 frame.m_metadata.m_size,
+                 frame.m_metadata.m_gain,
+                 frame.m_metadata.m_shutter,
+                 frame.m_metadata.m_exposure);
+
+          if( frame.m_metadata.m_timestamp < job->startTime ) {
+             leadFrames++;
+          }
+          if( !startGopSeen && frame.m_metadata.m_id >= startFrameId ) {
+             if( frame.m_metadata.m_mode == ATL_MODE_H264_I_FRAME ) {
+                startGopSeen = true;
+             } else {
+                wouldDiscard++;
+             }
+          }
+
+          if( frame.m_metadata.m_mode == ATL_MODE_H264_I_FRAME ) {
+             printf("First frame for %u is at time %ld\n", mcam.mcamID, t );
+             job->firstFrameList[index] = true;
+
+             //Share the GOP length so later seeks know how far back to look
+             pthread_mutex_lock(&job->lock);
+             if( lastIFrameId > 0 && job->gopFrames == 0 ) {
+                job->gopFrames = frame.m_metadata.m_id - lastIFrameId;
+             }
+             pthread_mutex_unlock(&job->lock);
+             lastIFrameId = frame.m_metadata.m_id;
+          } else {
+             printf("Frame for %u at time %ld is %u\n", mcam.mcamID, t, frame.m_metadata.m_mode );
+          }
+
+          if( job->firstFrameList[index] ) {
+             //Append image to stream file
+             uint64_t writeStart = metricsNow();
+             if( job->container != NULL ) {
+                if( !streamContainerAppend( job->container, mcam.mcamID, &frame, &streamOffset )) {
+                   printf("Unable to append frame %lu to the container\n", frame.m_metadata.m_id );
+                }
+             }
+             else {
+                streamOffset = streamWriterTell( streamPtr );
+                if( !streamWriterWrite( streamPtr, frame.m_image, frame.m_metadata.m_size )) {
+                   printf("Unable to write frame %lu to %s\n", frame.m_metadata.m_id, streamname );
+                }
+
+                /* Once the average frame size is known, preallocate the
+                 * rest of the stream so the file stays contiguous */
+                if( ++streamFrames == preallocFrames ) {
+                   double frames = (job->endTime - job->startTime) / job->framePeriod;
+                   uint64_t written = streamWriterTell( streamPtr ) - streamBase;
+                   uint64_t expected = streamBase + (uint64_t)( written / (double)PREALLOC_FRAMES * frames * 1.1 );
+                   if( !streamWriterReserve( streamPtr, expected )) {
+                      printf("Unable to preallocate %lu bytes for %s\n", expected, streamname );
+                   }
+                }
+             }
+             metricsRecord( METRIC_SAVE_FRAME, writeStart );
+#ifdef HAVE_STREAM_DECODER
+             if( job->decoder != NULL ) {
+                if( !streamDecoderSubmit( job->decoder, index, &frame )) {
+                   printf("Unable to decode frame %lu\n", frame.m_metadata.m_id );
+                }
+             }
+#endif
+
+             if( metaIndex != NULL ) {
+                if( !metadataIndexAppend( metaIndex, &frame.m_metadata, mcam.mcamID, streamOffset )) {
+                   printf("Unable to append metadata for frame %lu\n", frame.m_metadata.m_id );
+                }
+             }
+             else if( job->metaMode == META_COLUMNS ) {
+                if( !metadataColumnsAppend( &job->columns, &frame.m_metadata, mcam.mcamID )) {
+                   printf("Unable to append metadata for frame %lu\n", frame.m_metadata.m_id );
+                }
+             }
+             else if( job->metaMode == META_FILES ) {
+                //Create metadata file for this image
+                snprintf( metaname, FNAME_SIZE, "%s/stream%d_%05ld_%ld.meta", job->path, mcam.mcamID, frameCount++, frame.m_metadata.m_timestamp ); 
+                FILE * metaPtr = fopen( metaname, "w");
+                if( metaPtr != NULL ) {
+                   fwrite( &frame.m_metadata, 1, sizeof( frame.m_metadata), metaPtr );
+                   fclose(metaPtr);
+                }
+                else {
+                   printf("Unable to open metadata file %s\n", metaname );
+                }
+             }
+
+             lastTimestamp = frame.m_metadata.m_timestamp;
+             lastId = frame.m_metadata.m_id;
+             if( job->journal != NULL && streamPtr != NULL
+              && getElapsedTime() - lastCheckpoint >= job->checkpointInterval ) {
+                checkpointStream( job
+                                , mcam.mcamID
+                                , streamPtr
+                                , metaIndex == &streamIndex ? metaIndex : NULL
+                                , lastTimestamp
+                                , lastId
+                                , streamFrames
+                                , false
+                                );
+                lastCheckpoint = getElapsedTime();
+             }
+          }
+
+          /* return the frame buffer pointer to prevent memory leaks */
+          if( !returnPointer(frame.m_image) ){
+              printf("Failed to return the pointer for the frame buffer\n");
+          }
+          metricsRecord( METRIC_FRAME_HOLD, received );
+      } else if( frame.m_image != NULL ){
+          printf("Skipping duplicate frame %lu for %u at time %ld\n", frame.m_metadata.m_id, mcam.mcamID, t );
+          if( !returnPointer(frame.m_image) ){
+              printf("Failed to return the pointer for the frame buffer\n");
+          }
+          metricsRecord( METRIC_FRAME_HOLD, received );
+      } else{
+          printf("Frame request failed!\n");
+      }
+   }
+
+   //Close the file pointer
+   if( streamPtr != NULL ) {
+      if( job->journal != NULL ) {
+         checkpointStream( job
+                         , mcam.mcamID
+                         , streamPtr
+                         , metaIndex == &streamIndex ? metaIndex : NULL
+                         , lastTimestamp
+                         , lastId
+                         , streamFrames
+                         , true
+                         );
+      }
+      if( !streamWriterClose( streamPtr )) {
+         printf("Unable to finish writing %s\n", streamname );
+      }
+      printf("Stream %u wrote %.1f MB at %.1f MB/s (%.1f MB/s while writing)\n",
+             mcam.mcamID,
+             streamWriterTell( streamPtr ) / (1024.0*1024.0),
+             streamWriterRate( streamPtr ),
+             streamWriterDeviceRate( streamPtr ));
+   }
+   if( metaIndex == &streamIndex ) {
+      metadataIndexClose( &streamIndex );
+   }
+
+   pthread_mutex_lock(&job->lock);
+   frameCursorAddStats( &job->cursorStats, frameCursorGetStats( &cursor ));
+   job->seekProbes += seekProbes;
+   job->seekWasted += seekWasted;
+   job->seekAvoided += wouldDiscard;
+   job->seekLead += leadFrames;
+   pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * \brief Worker thread that exports microcameras until none are left
+ * \param [in] data pointer to the shared EXPORT_JOB
+ **/
+void * exportWorker( void * data )
+{
+   EXPORT_JOB * job = (EXPORT_JOB *)data;
+
+   while( true ) {
+      pthread_mutex_lock(&job->lock);
+      int index = job->nextMCam++;
+      pthread_mutex_unlock(&job->lock);
+
+      if( index >= job->numMCams ) {
+         break;
+      }
+      exportMCam( job, index );
+   }
+
+   return NULL;
+}
+
 /**
  * \brief prints the command line options
  **/
@@ -118,9 +686,30 @@ void printHelp()
    printf("\t-output <type> output mode of the system (default: H264 )\n");
    printf("\t       where ff is the fraction of a second. (default = current system time)\n");
    printf("\t-duration <seconds> number of seconds to record data\n");
+   printf("\t-meta <mode> how frame metadata is written (default: files)\n");
+   printf("\t       files: one .meta file per frame, stream: one streamN.idx per stream,\n");
+   printf("\t       export: one export.idx for all streams,\n");
+   printf("\t       columns: one compressed export.cols for all streams, written at the end\n");
+   printf("\t-direct write stream files with O_DIRECT, bypassing the page cache\n");
+   printf("\t-blocksize <KB> size of each stream file write (default 4096)\n");
+   printf("\t-noseek start at the first I-frame after the start time instead of the one before it\n");
+   printf("\t-container write all streams to a single seekable export.amc file\n");
+#ifdef HAVE_STREAM_DECODER
+   printf("\t-decoders <count> number of threads converting H264 to JPG (default 4)\n");
+#endif
+   printf("\t-checkpoint <seconds> time between stream checkpoints in export.journal, 0 to disable (default 5)\n");
+   printf("\t-resume continue an interrupted export from its checkpoints. Requires the same -start and -duration\n");
+   printf("\t-maxrate <requests/s> highest frame request rate the controller may reach (default unlimited)\n");
+   printf("\t-jobs <count> number of microcameras to export in parallel (default 1)\n");
+   printf("\t-metrics <prefix> write latency histograms to <prefix>.json and <prefix>.prom\n");
+   printf("\t-metrics-interval <seconds> time between metrics dumps (default 10)\n");
    printf("\n");
    printf("Supported output modes: H264, JPG\n");
+#ifdef HAVE_STREAM_DECODER
+   printf("avconv must be installed for JPG output with -cuda.\n");
+#else
    printf("avconv must be installed for non H264 output modes.\n");
+#endif
    printf("The application does not check for CUDA support and trusts the user\n");
    printf("\n");
 }
@@ -140,6 +729,18 @@ int main(int argc, char * argv[])
     bool cuda = false;
     char path[FNAME_SIZE] = ".";
     int  outputMode = ATL_OUTPUT_MODE_H264;
+    int  jobs = 1;
+    META_MODE metaMode = META_FILES;
+    bool useContainer = false;
+    bool seek = true;
+    bool direct = false;
+    size_t blockSize = STREAM_WRITER_BLOCK_SIZE;
+    int  decoders = 4;
+    bool resume = false;
+    double checkpointInterval = CHECKPOINT_INTERVAL;
+    double maxRate = 0;
+    char * metricsPrefix = NULL;
+    double metricsInterval = METRICS_INTERVAL;
 
     for( int i = 1; i < argc; i++ ){
        if( !strcmp(argv[i],"-cuda")) {
@@ -192,6 +793,107 @@ int main(int argc, char * argv[])
              return 0;
           }
           duration = (double)atof( argv[i] );
+       } else if( !strcmp(argv[i],"-direct") ){
+          direct = true;
+       } else if( !strcmp(argv[i],"-blocksize") ){
+          if( ++i >= argc ){
+             printf("-blocksize must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          int kb = atoi( argv[i] );
+          if( kb < 4 ) {
+             printf("-blocksize must be at least 4 KB\n\n");
+             printHelp();
+             return 0;
+          }
+          blockSize = (size_t)kb * 1024;
+       } else if( !strcmp(argv[i],"-resume") ){
+          resume = true;
+       } else if( !strcmp(argv[i],"-checkpoint") ){
+          if( ++i >= argc ){
+             printf("-checkpoint must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          checkpointInterval = atof( argv[i] );
+       } else if( !strcmp(argv[i],"-maxrate") ){
+          if( ++i >= argc ){
+             printf("-maxrate must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          maxRate = atof( argv[i] );
+          if( maxRate <= 0 ) {
+             printf("-maxrate must be positive\n\n");
+             printHelp();
+             return 0;
+          }
+       } else if( !strcmp(argv[i],"-metrics") ){
+          if( ++i >= argc ){
+             printf("-metrics must have a file prefix\n");
+             printHelp();
+             return 0;
+          }
+          metricsPrefix = argv[i];
+       } else if( !strcmp(argv[i],"-metrics-interval") ){
+          if( ++i >= argc ){
+             printf("-metrics-interval must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          metricsInterval = atof( argv[i] );
+       } else if( !strcmp(argv[i],"-noseek") ){
+          seek = false;
+       } else if( !strcmp(argv[i],"-container") ){
+          useContainer = true;
+       } else if( !strcmp(argv[i],"-decoders") ){
+          if( ++i >= argc ){
+             printf("-decoders must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          decoders = atoi( argv[i] );
+          if( decoders < 1 ) {
+             printf("-decoders must be at least 1\n\n");
+             printHelp();
+             return 0;
+          }
+       } else if( !strcmp(argv[i],"-jobs") ){
+          if( ++i >= argc ){
+             printf("-jobs must have a numeric value\n");
+             printHelp();
+             return 0;
+          }
+          jobs = atoi( argv[i] );
+          if( jobs < 1 || jobs > MAX_JOBS ) {
+             printf("-jobs must be between 1 and %d\n\n", MAX_JOBS);
+             printHelp();
+             return 0;
+          }
+       } else if( !strcmp(argv[i],"-meta") ){
+          if( ++i >= argc ){
+             printf("-meta must specify a mode\n");
+             printHelp();
+             return 0;
+          }
+          if( !strcmp("files", argv[i])) {
+             metaMode = META_FILES;
+          }
+          else if( !strcmp("stream", argv[i])) {
+             metaMode = META_STREAM;
+          }
+          else if( !strcmp("export", argv[i])) {
+             metaMode = META_EXPORT;
+          }
+          else if( !strcmp("columns", argv[i])) {
+             metaMode = META_COLUMNS;
+          }
+          else {
+             printf("Invalid metadata mode of \"%s\"\n\n", argv[i]);
+             printHelp();
+             return 0;
+          }
        } else if( !strcmp(argv[i],"-output") ){
           if( ++i >= argc ){
              printf("-output must specify a mode\n");
@@ -215,8 +917,32 @@ int main(int argc, char * argv[])
        }
     }
 
+    if( useContainer && outputMode != ATL_OUTPUT_MODE_H264 ) {
+       printf("-container is only supported for H264 output\n\n");
+       printHelp();
+       return 0;
+    }
+
+    /* A checkpoint describes one stream file. The container and the shared
+     * index interleave all streams, so they cannot be cut back per stream.
+     * The columnar store only reaches the disk when the export ends */
+    if( resume && ( useContainer || metaMode == META_EXPORT || metaMode == META_COLUMNS )) {
+       printf("-resume is not supported with -container, -meta export or -meta columns\n\n");
+       printHelp();
+       return 0;
+    }
+    if( resume && ( start == 0 || checkpointInterval <= 0 )) {
+       printf("-resume requires -start and checkpoints\n\n");
+       printHelp();
+       return 0;
+    }
+
     printf("Getting frames from UTC time  %lf  for %lf seconds\n", start, duration);
 
+    if( metricsPrefix != NULL && !metricsStart( metricsPrefix, "MantisExportStream", metricsInterval )) {
+       printf("Unable to start metrics for %s\n", metricsPrefix );
+    }
+
     printf("Connecting to V2 instance at %s:%d\n", ip, port );
 
     /* connect to the V2 instance */
@@ -300,12 +1026,9 @@ int main(int argc, char * argv[])
         }
     }
 
-    /* Next we calculate the length of a frame in microseconds */
-    uint64_t frameLength = (uint64_t)(1.0/fps * 1e6);
-
     if( mkdir(path, 0777) < 0 ) {
        if( errno == EEXIST ) {
-          printf("Directory exists. Overwriting\n");
+          printf( resume ? "Directory exists. Resuming\n" : "Directory exists. Overwriting\n");
        }
        else {
           printf("Unable to make directory %s\n", path);
@@ -315,108 +1038,229 @@ int main(int argc, char * argv[])
 
     printf("Writing data to %s\n", path );
 
+    /* Checkpoints only describe the export that wrote them, so a journal
+     * from another window or framerate is not resumed */
+    EXPORT_JOURNAL_RECORD resumeList[myMantis.mcamList.numMCams];
+    bool haveResume = false;
+    if( resume && start > 0.0 ) {
+       char journalname[FNAME_SIZE];
+       snprintf( journalname, FNAME_SIZE, "%s/export.journal", path );
+       uint32_t mcamIDs[myMantis.mcamList.numMCams];
+       for( int i = 0; i < myMantis.mcamList.numMCams; i++ ) {
+          mcamIDs[i] = mcamList[i].mcamID;
+       }
+       int found = exportJournalRead( journalname
+                                    , start*MSEC_SCALE
+                                    , (start+duration)*MSEC_SCALE
+                                    , fps
+                                    , mcamIDs
+                                    , myMantis.mcamList.numMCams
+                                    , resumeList
+                                    );
+       if( found == EXPORT_JOURNAL_MISMATCH ) {
+          printf("%s is from an export with another -start, -duration or framerate. Not resuming\n", journalname );
+          start = 0.0;
+       }
+       else if( found < 0 ) {
+          printf("Unable to read %s. Starting over\n", journalname );
+       }
+       else {
+          printf("Resuming %d of %d streams from checkpoints\n", found, myMantis.mcamList.numMCams );
+          haveResume = true;
+       }
+    }
+
     if( start >0.0 ) {
-       uint64_t requestCounter = 0;
-       uint64_t frameCounter = 0;
-      
        bool * firstFrameList = (bool *) malloc( myMantis.mcamList.numMCams * sizeof(bool));
        for( int i = 0; i < myMantis.mcamList.numMCams; i++ ) {
           firstFrameList[i] = false;
        }
 
-       //Loop through all times
-       for( int i = 0; i < myMantis.mcamList.numMCams; i++ ){
-          char streamname[FNAME_SIZE];
-          char metaname[FNAME_SIZE];
-          snprintf( streamname, FNAME_SIZE, "%s/stream%d.h264",path, mcamList[i].mcamID); 
-
-
-          FILE * streamPtr = fopen( streamname, "w");
-          uint64_t frameCount = 0;
-          if( streamPtr != NULL )  {
-             for( uint64_t t = start*MSEC_SCALE; t < (start+duration)*MSEC_SCALE; t += frameLength ){
-                  printf("Sending frame request %lu to mcam %u at time %ld \n", requestCounter++, mcamList[i].mcamID, t);
-                  /* get the next frame for this mcam */
-                  FRAME frame = getFrame( myMantis 
-                                        ,  mcamList[i].mcamID
-                                        ,  t
-                                        ,  ATL_TILING_1_1_2
-                                        ,  ATL_TILE_4K
-                                        );
-
-                  /* check that the request succeeded before using the frame */
-                  if( frame.m_image != NULL ){
-                      printf("Received frame %lu for microcamera %lu at time %lu:\n"
-                             "\tdimensions: %ux%u"
-                             "\tbuffer size: %lu"
-                             "\tgain: %f"
-                             "\tshutter: %f"
-                             "\texposure: %f\n",
-                             frameCounter++,
-                             frame.m_metadata.m_id,
-                             frame.m_metadata.m_timestamp,
-                             frame.m_metadata.m_width,
-                             frame.m_metadata.m_height,
-                             frame.m_metadata.m_size,
-                             frame.m_metadata.m_gain,
-                             frame.m_metadata.m_shutter,
-                             frame.m_metadata.m_exposure);
-
-                      if( frame.m_metadata.m_mode == ATL_MODE_H264_I_FRAME ) {
-                         printf("First frame for %u is at time %ld\n", mcamList[i].mcamID, t );
-                         firstFrameList[i] = true;
-                      } else {
-                         printf("Frame for %u at time %ld is %u\n", mcamList[i].mcamID, t, frame.m_metadata.m_mode );
-                      }
-
-                      if( firstFrameList[i] ) {
-                         //Append image to stream file
-                         fwrite( frame.m_image, 1, frame.m_metadata.m_size, streamPtr );          
-
-                         //Create metadata file for this image
-                         snprintf( metaname, FNAME_SIZE, "%s/stream%d_%05ld_%ld.meta", path, mcamList[i].mcamID, frameCount++, frame.m_metadata.m_timestamp ); 
-                         FILE * metaPtr = fopen( metaname, "w");
-                         if( metaPtr != NULL ) {
-                            fwrite( &frame.m_metadata, 1, sizeof( frame.m_metadata), metaPtr );
-                            fclose(metaPtr);
-                         }
-                         else {
-                            printf("Unable to open metadata file %s\n", metaname );
-                         }
-                      }
-
-                      /* return the frame buffer pointer to prevent memory leaks */
-                      if( !returnPointer(frame.m_image) ){
-                          printf("Failed to return the pointer for the frame buffer\n");
-                      }
-                  } else{
-                      printf("Frame request failed!\n");
-                  }
-
-                  //Take a break to not overload the system
-                  usleep(0.01);
-              }
-
-           }
-           else { 
-              printf("Unable to open output file at %s\n", streamname);
-           }
-
-          //Close the file pointer
-          if(streamPtr != NULL ) {
-              fclose(streamPtr);
+       EXPORT_JOB job;
+       job.camera         = myMantis;
+       job.mcamList       = mcamList;
+       job.numMCams       = myMantis.mcamList.numMCams;
+       job.firstFrameList = firstFrameList;
+       job.path           = path;
+       job.metaMode       = metaMode;
+       job.container      = NULL;
+       job.blockSize      = blockSize;
+       job.direct         = direct;
+       job.journal        = NULL;
+       job.resumeList     = NULL;
+       job.checkpointInterval = checkpointInterval;
+       job.startTime      = start*MSEC_SCALE;
+       job.endTime        = (start+duration)*MSEC_SCALE;
+       job.framePeriod    = 1.0/fps * 1e6;
+       job.nextMCam       = 0;
+       job.requestCounter = 0;
+       job.frameCounter   = 0;
+       memset( &job.cursorStats, 0, sizeof(job.cursorStats));
+       job.seek           = seek;
+       job.gopFrames      = 0;
+       job.seekProbes     = 0;
+       job.seekWasted     = 0;
+       job.seekAvoided    = 0;
+       job.seekLead       = 0;
+       pthread_mutex_init(&job.lock, NULL);
+
+       if( metaMode == META_EXPORT ) {
+          char indexname[FNAME_SIZE];
+          snprintf( indexname, FNAME_SIZE, "%s/export.idx", path );
+          if( !metadataIndexOpen( &job.exportIndex, indexname )) {
+             printf("Unable to open metadata index %s. Writing .meta files\n", indexname );
+             job.metaMode = META_FILES;
+          }
+       }
+       else if( metaMode == META_COLUMNS ) {
+          metadataColumnsInit( &job.columns );
+       }
+
+       STREAM_CONTAINER container;
+       if( useContainer ) {
+          char containername[FNAME_SIZE];
+          snprintf( containername, FNAME_SIZE, "%s/export.amc", path );
+          if( streamContainerOpen( &container, containername )) {
+             job.container = &container;
+          }
+          else {
+             printf("Unable to open container %s. Writing stream files\n", containername );
+          }
+       }
+
+       /* Checkpoints are only taken for separate stream files. Resuming
+        * reads the latest checkpoint of each stream before appending more */
+       EXPORT_JOURNAL journal;
+       if( checkpointInterval > 0 && job.container == NULL
+        && job.metaMode != META_EXPORT && job.metaMode != META_COLUMNS ) {
+          char journalname[FNAME_SIZE];
+          snprintf( journalname, FNAME_SIZE, "%s/export.journal", path );
+          if( haveResume ) {
+             job.resumeList = resumeList;
+          }
+          if( exportJournalOpen( &journal
+                               , journalname
+                               , job.resumeList != NULL
+                               , job.startTime
+                               , job.endTime
+                               , fps
+                               )) {
+             job.journal = &journal;
+          }
+          else {
+             printf("Unable to open %s. Exporting without checkpoints\n", journalname );
           }
        }
+
+       /* Convert to JPEG while frames arrive when the decoder is available.
+        * A resumed export converts whole streams with avconv afterwards */
+       bool decoding = false;
+#ifdef HAVE_STREAM_DECODER
+       job.decoder = NULL;
+       if( outputMode == ATL_OUTPUT_MODE_JPEG && !cuda && !resume ) {
+          uint32_t mcamIDs[job.numMCams];
+          for( int i = 0; i < job.numMCams; i++ ) {
+             mcamIDs[i] = mcamList[i].mcamID;
+          }
+          job.decoder = streamDecoderCreate( path, mcamIDs, job.numMCams, decoders, 95 );
+          if( job.decoder == NULL ) {
+             printf("Unable to start the in-process decoder. Using avconv\n");
+          }
+          decoding = job.decoder != NULL;
+       }
+#endif
+
+       //Never start more workers than there are microcameras
+       if( jobs > job.numMCams ) {
+          jobs = job.numMCams;
+       }
+
+       /* Start at the capture rate of each worker and let the controller
+        * find how much faster the server can deliver */
+       rateControllerInit( &job.rate, fps * jobs, fps, maxRate, jobs );
+
+       double exportStart = getElapsedTime();
+
+       //Export the microcameras. A single job runs on this thread
+       if( jobs <= 1 ) {
+          exportWorker( &job );
+       }
+       else {
+          pthread_t workers[MAX_JOBS];
+          int started = 0;
+          for( ; started < jobs; started++ ) {
+             if( pthread_create( &workers[started], NULL, exportWorker, &job ) != 0 ) {
+                printf("Unable to start export worker %d\n", started);
+                break;
+             }
+          }
+
+          //Fall back to this thread if no worker could be started
+          if( started == 0 ) {
+             exportWorker( &job );
+          }
+          for( int i = 0; i < started; i++ ) {
+             pthread_join( workers[i], NULL );
+          }
+       }
+
+       double exportTime = getElapsedTime() - exportStart;
+       metricsStop();
+#ifdef HAVE_STREAM_DECODER
+       if( job.decoder != NULL ) {
+          uint64_t jpegCount = streamDecoderFinish( job.decoder );
+          printf("Wrote %lu JPEGs, finished %lf seconds after the last frame\n",
+                 jpegCount,
+                 getElapsedTime() - exportStart - exportTime);
+       }
+#endif
+       pthread_mutex_destroy(&job.lock);
+       if( job.journal != NULL ) {
+          exportJournalClose( job.journal );
+       }
+       if( job.metaMode == META_EXPORT ) {
+          metadataIndexClose( &job.exportIndex );
+       }
+       else if( job.metaMode == META_COLUMNS ) {
+          char columnsname[FNAME_SIZE];
+          snprintf( columnsname, FNAME_SIZE, "%s/export.%s", path, METADATA_COLUMNS_EXTENSION );
+          if( !metadataColumnsSave( &job.columns, columnsname )) {
+             printf("Unable to write metadata store %s\n", columnsname );
+          }
+          metadataColumnsDestroy( &job.columns );
+       }
+       if( job.container != NULL ) {
+          if( !streamContainerClose( job.container )) {
+             printf("Unable to write the container index\n");
+          }
+       }
+
+       uint64_t requestCounter = job.requestCounter;
+       uint64_t frameCounter = job.frameCounter;
        printf("Received %lu of %lu requested frames across %d microcameras\n",
               frameCounter,
               requestCounter,
               myMantis.mcamList.numMCams);
+       printf("Export took %lf seconds with %d jobs (%lf frames/s)\n",
+              exportTime,
+              jobs,
+              exportTime > 0 ? frameCounter/exportTime : 0.0);
+       frameCursorPrintStats( job.cursorStats );
+       rateControllerPrintSetpoint( rateControllerSetpoint( &job.rate ));
+       rateControllerDestroy( &job.rate );
+       if( seek ) {
+          printf("GOP seek sent %lu probe requests, %lu of them for no frame written, and wrote %lu frames before the start time instead of discarding %lu leading frames (%ld requests saved)\n",
+                 job.seekProbes,
+                 job.seekWasted,
+                 job.seekLead,
+                 job.seekAvoided,
+                 (int64_t)job.seekAvoided - (int64_t)job.seekWasted);
+       }
 
-       
        free(firstFrameList);
 
        //If we are generating jpegs
-       if( outputMode ==  ATL_OUTPUT_MODE_JPEG ) {
+       if( outputMode ==  ATL_OUTPUT_MODE_JPEG && !decoding ) {
           if( requestCounter > 0 ) {
              chdir(path);
 
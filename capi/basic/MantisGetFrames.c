@@ -4,7 +4,9 @@
  * Author: Andrew Ferg
  *
  * This example shows how to retrieve the most recent frame for each 
- * microcamera in a Mantis system and save them to disk
+ * microcamera in a Mantis system and save them to disk. The frames are
+ * requested in parallel at a common time, see McamSnapshot.h, and saved
+ * by a pool of save threads, see FrameSaver.h
  *
  *****************************************************************************/
 #include <stdio.h>
@@ -13,6 +15,9 @@
 #include <unistd.h>
 
 #include "mantis/MantisAPI.h"
+#include "Metrics.h"
+#include "McamSnapshot.h"
+#include "FrameSaver.h"
 
 /**
  * \brief Function that handles new ACOS_CAMERA objects
@@ -24,6 +29,18 @@ void newCameraCallback(ACOS_CAMERA cam, void* data)
     camList[cameraCounter++] = cam;
 }
 
+/**
+ * \brief Called by a save thread after each frame
+ **/
+void frameSaved(const FRAME_METADATA * meta, const char * fileName, bool saved, void * data)
+{
+    if( !saved ){
+        printf("Failed to save %s to disk\n", fileName);
+    } else{
+        printf("Saved frame %s to disk\n", fileName);
+    }
+}
+
 /**
  * \brief prints the command line options
  **/
@@ -32,7 +49,13 @@ void printHelp()
    printf("MantisGetFrames Demo Application\n");
    printf("Usage:\n");
    printf("\t-ip <address> IP Address connect to (default localhost)\n");
-   printf("\t-port <port> port connect to (default 9999)\n\n");
+   printf("\t-port <port> port connect to (default 9999)\n");
+   printf("\t-time <us> common time of the frames (default newest time all mcams have)\n");
+   printf("\t-threads <n> parallel frame requests (default one per mcam)\n");
+   printf("\t-savers <n> threads saving frames (default %d)\n", FRAME_SAVER_WORKERS);
+   printf("\t-dir <directory> directory to save frames to, repeat to shard across directories (default .)\n");
+   printf("\t-metrics <prefix> write latency histograms to <prefix>.json and <prefix>.prom\n");
+   printf("\t-metrics-interval <seconds> time between metrics dumps (default 10)\n\n");
 }
 
 /**
@@ -44,6 +67,13 @@ int main(int argc, char * argv[])
      * or port if provided from the command line */
     char ip[24] = "localhost";
     int port = 9999;
+    char * metricsPrefix = NULL;
+    double metricsInterval = METRICS_INTERVAL;
+    uint64_t snapshotTime = 0;
+    int numThreads = 0;
+    int numSavers = FRAME_SAVER_WORKERS;
+    const char * dirs[FRAME_SAVER_MAX_DIRS] = { "." };
+    int numDirs = 0;
     for( int i = 1; i < argc; i++ ){
        if( !strcmp(argv[i],"-ip") ){
           if( ++i >= argc ){
@@ -62,12 +92,60 @@ int main(int argc, char * argv[])
           }
           int length = strlen(argv[i]);
           port = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-time") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          snapshotTime = strtoull(argv[i], NULL, 10);
+       } else if( !strcmp(argv[i],"-threads") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          numThreads = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-savers") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          numSavers = atoi(argv[i]);
+          if( numSavers < 1 ){
+             printf("-savers must be at least 1\n");
+             return 0;
+          }
+       } else if( !strcmp(argv[i],"-dir") ){
+          if( ++i >= argc || numDirs == FRAME_SAVER_MAX_DIRS ){
+             printHelp();
+             return 0;
+          }
+          dirs[numDirs++] = argv[i];
+       } else if( !strcmp(argv[i],"-metrics") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsPrefix = argv[i];
+       } else if( !strcmp(argv[i],"-metrics-interval") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsInterval = atof(argv[i]);
        } else{
           printHelp();
           return 0;
        }
     }
 
+    if( numDirs == 0 ){
+        numDirs = 1;
+    }
+
+    if( metricsPrefix != NULL && !metricsStart(metricsPrefix, "MantisGetFrames", metricsInterval) ){
+        printf("Unable to start metrics for %s\n", metricsPrefix);
+    }
+
     /* connect to the V2 instance */
     connectToCameraServer(ip, port);;
 
@@ -146,38 +224,56 @@ int main(int argc, char * argv[])
     }
 
     /* Now we can retrieve frames for any microcamera from our Mantis 
-     * camera. Requesting time=0 will give us the most recent frame 
-     * for that microcamera. Be aware that since these requests are 
-     * happening sequentially in a loop, the most recent frame retrieved 
-     * from each mcam in the list may be at different times since the 
-     * requests happen at different times. */
-    for( int i = 0; i < myMantis.mcamList.numMCams; i++ ){
-
-        /* get the next frame for this mcam */
-        FRAME frame = getFrame(myMantis, 
-                               mcamList[i].mcamID,
-                               0,
-                               ATL_TILING_1_1_2,
-                               ATL_TILE_4K);
+     * camera. Requesting the latest frame of each microcamera in turn
+     * would mix frames captured at different times, so the snapshot
+     * requests all of them in parallel at the newest time every
+     * microcamera has a frame for, or at the time given with -time */
+    int numMCams = myMantis.mcamList.numMCams;
+    uint32_t mcamIDs[numMCams];
+    FRAME frames[numMCams];
+    MCAM_SNAPSHOT_REPORT report;
+    for( int i = 0; i < numMCams; i++ ){
+        mcamIDs[i] = mcamList[i].mcamID;
+    }
+    mcamSnapshotGet(myMantis, mcamIDs, numMCams, snapshotTime,
+                    ATL_TILING_1_1_2, ATL_TILE_4K, numThreads, frames, &report);
+    uint64_t received = metricsNow();
+    mcamSnapshotPrintReport(&report, frames, numMCams);
 
-        if( frame.m_image != NULL ){
-            /* save the frame to a JPEG */
+    /* save the frames in parallel. Each save thread returns the frame
+     * buffer pointer as soon as its frame is on disk */
+    FRAME_SAVER saver;
+    FRAME_SAVED_CALLBACK savedCB;
+    savedCB.f    = frameSaved;
+    savedCB.data = NULL;
+    bool useSaver = frameSaverInit(&saver, numSavers, numMCams, dirs, numDirs, savedCB);
+    if( !useSaver ){
+        printf("Unable to start %d save threads, saving on this thread\n", numSavers);
+    }
+    for( int i = 0; i < numMCams; i++ ){
+        if( frames[i].m_image != NULL ){
             char fileName[32];
             sprintf(fileName, "mcam_%u", mcamList[i].mcamID);
-            if( !saveFrame(frame, fileName) ){
-                printf("Failed to save %s to disk\n", fileName);
+            if( !useSaver ){
+                /* the frame buffer is returned with the others below */
+                char path[1024];
+                snprintf(path, sizeof(path), "%s/%s", dirs[0], fileName);
+                frameSaved(&frames[i].m_metadata, path, saveFrame(frames[i], path), NULL);
+            } else if( frameSaverPush(&saver, frames[i], fileName, received) ){
+                frames[i].m_image = NULL;
             } else{
-                printf("Saved frame %s to disk\n", fileName);
-            }
-
-            /* return the frame buffer pointer to prevent memory leaks */
-            if( !returnPointer(frame.m_image) ){
-                printf("Failed to return the pointer for the frame buffer\n");
+                printf("Failed to save %s to disk\n", fileName);
             }
         } else{
             printf("Failed to get frame for mcam %u\n", mcamList[i].mcamID);
         }
     }
+    frameSaverDestroy(&saver);
+
+    /* return the pointers of frames that were not saved */
+    mcamSnapshotRelease(frames, numMCams);
+
+    metricsStop();
 
     /* Disconnect the cameras to prevent issues when another 
      * program tries to connect */
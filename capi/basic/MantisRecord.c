@@ -14,6 +14,8 @@
 #include <unistd.h>
 
 #include "mantis/MantisAPI.h"
+#include "FrameCursor.h"
+#include "Metrics.h"
 
 /**
  * \brief Function that handles new ACOS_CAMERA objects
@@ -43,7 +45,9 @@ void printHelp()
    printf("MantisRecord Demo Application\n");
    printf("Usage:\n");
    printf("\t-ip <address> IP Address connect to (default localhost)\n");
-   printf("\t-port <port> port connect to (default 9999)\n\n");
+   printf("\t-port <port> port connect to (default 9999)\n");
+   printf("\t-metrics <prefix> write latency histograms to <prefix>.json and <prefix>.prom\n");
+   printf("\t-metrics-interval <seconds> time between metrics dumps (default 10)\n\n");
 }
 
 /**
@@ -55,6 +59,8 @@ int main(int argc, char * argv[])
      * or port if provided from the command line */
     char ip[24] = "localhost";
     int port = 9999;
+    char * metricsPrefix = NULL;
+    double metricsInterval = METRICS_INTERVAL;
     for( int i = 1; i < argc; i++ ){
        if( !strcmp(argv[i],"-ip") ){
           if( ++i >= argc ){
@@ -73,12 +79,28 @@ int main(int argc, char * argv[])
           }
           int length = strlen(argv[i]);
           port = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-metrics") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsPrefix = argv[i];
+       } else if( !strcmp(argv[i],"-metrics-interval") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsInterval = atof(argv[i]);
        } else{
           printHelp();
           return 0;
        }
     }
 
+    if( metricsPrefix != NULL && !metricsStart(metricsPrefix, "MantisRecord", metricsInterval) ){
+        printf("Unable to start metrics for %s\n", metricsPrefix);
+    }
+
     /* connect to the V2 instance */
     connectToCameraServer(ip, port);
 
@@ -216,33 +238,49 @@ int main(int argc, char * argv[])
     MICRO_CAMERA mcamList[myClip.cam.mcamList.numMCams];
     getCameraMCamList(myClip.cam, mcamList, myMantis.mcamList.numMCams);
 
-    /* Next we calculate the length of a frame in microseconds */
-    uint64_t frameLength = (uint64_t)(1.0/myClip.framerate * 1e6);
+    /* Next we calculate the nominal length of a frame in microseconds */
+    double framePeriod = 1.0/myClip.framerate * 1e6;
 
     /* Now for each microcamera, we request frames starting at the 
-     * startTime and increment the time of our requests by the length 
-     * of a frame until we reach the endTime, Unlike when requesting
-     * the most recent frame, requesting a specific time may fail
-     * if a frame was dropped, so it is good to check that the image
-     * buffer pointer is not NULL before interacting with the frame */
+     * startTime and step from the timestamp of each returned frame
+     * until we reach the endTime. Each microcamera has a cursor that
+     * picks its request times and recognizes frames that were already
+     * returned. Unlike when requesting the most recent frame,
+     * requesting a specific time may fail if a frame was dropped,
+     * so it is good to check that the image buffer pointer is not
+     * NULL before interacting with the frame */
     printf("Requesting frames for clip %s on camera %u from %d microcameras\n",
            myClip.name,
            myClip.cam.camID,
            myClip.cam.mcamList.numMCams);
     uint64_t requestCounter = 0;
     uint64_t frameCounter = 0;
-    for( uint64_t t = myClip.startTime; t < myClip.endTime; t += frameLength ){
+    FRAME_CURSOR cursors[myMantis.mcamList.numMCams];
+    for( int i = 0; i < myMantis.mcamList.numMCams; i++ ){
+        frameCursorInit(&cursors[i], myClip.startTime, myClip.endTime, framePeriod);
+    }
+    bool active = true;
+    while( active ){
+        active = false;
         for( int i = 0; i < myMantis.mcamList.numMCams; i++ ){
+            uint64_t t;
+            if( !frameCursorNext(&cursors[i], &t) ){
+                continue;
+            }
+            active = true;
+
             printf("Sending frame request %lu\n", requestCounter++);
             /* get the next frame for this mcam */
+            uint64_t requested = metricsNow();
             FRAME frame = getFrame(myMantis, 
                                    mcamList[i].mcamID,
                                    t,
                                    ATL_TILING_1_1_2,
                                    ATL_TILE_4K);
+            uint64_t received = metricsRecord(METRIC_GET_FRAME, requested);
 
-            /* check that the request succeeded before using the frame */
-            if( frame.m_image != NULL ){
+            /* check that the request succeeded and returned a new frame */
+            if( frameCursorUpdate(&cursors[i], &frame) ){
                 printf("Received frame %lu for microcamera %lu at time %lu:\n"
                        "\tdimensions: %ux%u"
                        "\tbuffer size: %lu"
@@ -263,17 +301,31 @@ int main(int argc, char * argv[])
                 if( !returnPointer(frame.m_image) ){
                     printf("Failed to return the pointer for the frame buffer\n");
                 }
+                metricsRecord(METRIC_FRAME_HOLD, received);
+            } else if( frame.m_image != NULL ){
+                printf("Skipping duplicate frame %lu\n", frame.m_metadata.m_id);
+                if( !returnPointer(frame.m_image) ){
+                    printf("Failed to return the pointer for the frame buffer\n");
+                }
+                metricsRecord(METRIC_FRAME_HOLD, received);
             } else{
                 printf("Frame request failed!\n");
             }
 
         }
     }
+    metricsStop();
     printf("Received %lu of %lu requested frames across %d microcameras\n",
            frameCounter,
            requestCounter,
            myMantis.mcamList.numMCams);
 
+    FRAME_CURSOR_STATS stats = {0};
+    for( int i = 0; i < myMantis.mcamList.numMCams; i++ ){
+        frameCursorAddStats(&stats, frameCursorGetStats(&cursors[i]));
+    }
+    frameCursorPrintStats(stats);
+
     /* Disconnect the cameras to prevent issues when another program 
      * tries to connect */
     for( int i = 0; i < numCameras; i++ ){
@@ -6,8 +6,30 @@
  * This script is a usefull diagnostic that collects timecodes from all the Mcams
  * in an array and saves them to a file.
  *
+ * The frame callback runs on the receiver thread of each microcamera, so it
+ * only copies the timecode into that microcamera's ring buffer. A writer
+ * thread drains the rings into a binary timecode log (frame_timecodes.tc by
+ * default). DumpTimecodes converts the log to the "<sensor ID> <timestamp>"
+ * text format.
+ *
+ * The writer also keeps the frame interval statistics of each microcamera
+ * (mean, standard deviation, min/max, p50/p99/p99.9 and frames missing from
+ * the -f frame period) in constant memory and prints them for every sensor
+ * each -r seconds, so sync problems show up without post-processing the log.
+ *
+ * All streams capture at the same time for one -t second window, so the
+ * collection time does not grow with the size of the array. With -w the
+ * microcameras are captured in waves of at most that many streams, each
+ * with its own window, for hosts that cannot receive every stream at once.
+ * Only the receivers of the current wave are open. Streams are started and
+ * stopped from several threads because each call waits for its Tegra.
+ *
+ * With -s the writer also merges the timecodes of all sensors into
+ * framesets of timestamps within the given tolerance and reports how many
+ * sets were complete and how far apart their sensors captured.
+ *
  *****************************************************************************/
- // gcc -std=c++11 -o  McamGetTimeCodes McamGetTimeCodes.cpp -lMantisAPI -lpthread -lm -lstdc++
+ // gcc -std=c++11 -I../common -o  McamGetTimeCodes McamGetTimeCodes.cpp ../common/TimecodeLog.c ../common/IntervalStats.c ../common/FramesetAssembler.c -lMantisAPI -lpthread -lm -lstdc++
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,10 +38,19 @@
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
 #include "mantis/MantisAPI.h"
+#include "TimecodeLog.h"
+#include "IntervalStats.h"
+#include "FramesetAssembler.h"
 
 const int portbase = 13000;
-bool ready = false;
+const int stream_control_threads = 8;
+const int frameset_depth = 64;
+volatile bool ready = false;
 using namespace std;
 
 
@@ -31,40 +62,126 @@ void newMCamCallback(MICRO_CAMERA mcam, void* data)
     mcamList[mcamCounter++] = mcam;
 }
 
-ofstream myfile;
-double avg=0;
-double frame_ctr=0;
-double last_timestamp=0;
-double current_timestamp=0;
-int frames_to_average=300;
+TIMECODE_LOG timecodes;
+
+/**
+ * \brief Interval statistics of every microcamera, only touched by the
+ *        writer thread until the log is closed
+ **/
+struct MCAM_INTERVALS {
+    uint32_t *       mcamIDs;
+    INTERVAL_STATS * stats;
+    int              numMCams;
+    int              current;      //!< Index of the last record's mcam
+    uint64_t         reportPeriod; //!< ns between reports
+    uint64_t         lastReport;   //!< Receive time of the last report in ns
+    FRAMESET_ASSEMBLER * framesets; //!< Frameset assembly with -s, or NULL
+};
+
+/**
+ * \brief Prints the interval statistics of every microcamera
+ **/
+void printIntervals(const MCAM_INTERVALS * intervals)
+{
+    intervalStatsPrintHeader();
+    for( int i = 0; i < intervals->numMCams; i++ ){
+        intervalStatsPrint(intervals->mcamIDs[i], &intervals->stats[i]);
+    }
+    if( intervals->framesets != NULL ){
+        FRAMESET_STATS stats = framesetAssemblerGetStats(intervals->framesets);
+        framesetAssemblerPrintStats(&stats, intervals->numMCams);
+    }
+}
 
+/**
+ * \brief Called by the timecode writer for every record it writes. Adds the
+ *        frame to the statistics of its sensor and prints all sensors every
+ *        report period
+ **/
+void timecodeWritten(const TIMECODE_RECORD * record, void* data)
+{
+    MCAM_INTERVALS * intervals = (MCAM_INTERVALS *) data;
+
+    /* the writer drains one ring at a time, so the previous mcam usually matches */
+    if( intervals->mcamIDs[intervals->current] != record->mcamID ){
+        for( int i = 0; i < intervals->numMCams; i++ ){
+            if( intervals->mcamIDs[i] == record->mcamID ){
+                intervals->current = i;
+                break;
+            }
+        }
+    }
+    intervalStatsAdd(&intervals->stats[intervals->current], record->timestamp);
+
+    /* the assembler only needs the metadata, there is no image to release */
+    if( intervals->framesets != NULL ){
+        FRAME frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.m_metadata.m_camId     = record->mcamID;
+        frame.m_metadata.m_id        = record->frameId;
+        frame.m_metadata.m_timestamp = record->timestamp;
+        frame.m_metadata.m_tile      = record->tile;
+        framesetAssemblerAdd(intervals->framesets, frame);
+    }
 
+    if( intervals->lastReport == 0 ){
+        intervals->lastReport = record->received;
+    } else if( record->received - intervals->lastReport >= intervals->reportPeriod ){
+        printIntervals(intervals);
+        intervals->lastReport = record->received;
+    }
+}
+
+/**
+ * \brief Runs on the receiver thread of each microcamera. Only copies the
+ *        timecode into the ring of that microcamera, so it never blocks on
+ *        the disk or allocates
+ **/
 void mcamFrameCallback(FRAME frame, void* data)
 {
-    if (ready){
-//    printf("Received a frame for microcamera %u with timestamp %lu\n",
-//           frame.m_metadata.m_camId,
-//          frame.m_metadata.m_timestamp);
-     
-    if (myfile.is_open() && frame.m_metadata.m_tile==1)
-     {
-            printf("sensorID %lu frame_time_stamp  %lu \n",(frame.m_metadata.m_camId), (frame.m_metadata.m_timestamp));
-            
-            myfile << to_string(frame.m_metadata.m_camId)+" "+to_string(frame.m_metadata.m_timestamp) +"\n";
-            current_timestamp=double(frame.m_metadata.m_timestamp);
-            avg=avg+(current_timestamp-last_timestamp)/frames_to_average;
-            last_timestamp=current_timestamp;
-            frame_ctr++;
-            if (frame_ctr==frames_to_average)   {
-                 printf("average frame to frame spacing for sensor id %i is %f \n",frame.m_metadata.m_camId, avg);
-                 avg=0;
-                 frame_ctr=0;
-            }
+    if( ready && frame.m_metadata.m_tile == 1 ){
+        timecodeLogRecord(&timecodes, &frame.m_metadata);
+    }
+}
 
-     }
- 
-        
+/**
+ * \brief Starts or stops the streams of mcamList[first, first+count) in
+ *        parallel. Only streams marked in streaming are stopped
+ * \return the number of calls that succeeded
+ **/
+int controlStreams(MICRO_CAMERA * mcamList, bool * streaming, int first, int count, bool start)
+{
+    std::atomic<int> next(first);
+    std::atomic<int> succeeded(0);
+    std::vector<std::thread> threads;
+    int numThreads = count < stream_control_threads ? count : stream_control_threads;
+    for( int t = 0; t < numThreads; t++ ){
+        threads.push_back(std::thread([&](){
+            for( int i = next++; i < first + count; i = next++ ){
+                if( start ){
+                    streaming[i] = startMCamStream(mcamList[i], portbase+i);
+                    if( !streaming[i] ){
+                        printf("Failed to start streaming mcam %u\n", mcamList[i].mcamID);
+                        continue;
+                    }
+                } else if( streaming[i] ){
+                    streaming[i] = false;
+                    if( !stopMCamStream(mcamList[i], portbase+i) ){
+                        printf("Failed to stop streaming mcam %u\n", mcamList[i].mcamID);
+                        continue;
+                    }
+                } else{
+                    continue;
+                }
+                succeeded++;
+            }
+        }));
     }
+    for( size_t t = 0; t < threads.size(); t++ ){
+        threads[t].join();
+    }
+
+    return succeeded;
 }
 
 void printHelp()
@@ -72,10 +189,16 @@ void printHelp()
    printf("Get frame timestamps:\n");
    printf("Usage:\n");
    printf("\t-c FILE   Host file for microcameras (default sync.cfg) \n");
+   printf("\t-o FILE   Binary timecode log to append to (default frame_timecodes.tc) \n");
+   printf("\t-f <framerate> expected frame rate for counting missing frames (default 30)\n");
+   printf("\t-r <seconds> time between interval statistics reports (default 5)\n");
+   printf("\t-t <seconds> capture window of each wave (default 32)\n");
+   printf("\t-w <count> most streams captured at once (default all)\n");
+   printf("\t-s <us> also assemble framesets of timestamps within this tolerance\n");
    printf("\t-port <port> port connect to (default 9999)\n\n");
 }
 
-int getIpsFromSyncFile(char fileName[])
+int getIpsFromSyncFile(const char fileName[])
 {
 
  //   sleep(5);
@@ -140,7 +263,13 @@ return numIps;  }
 int main(int argc, char* argv[]){
     //Parse arguments
     int argCount = 0;
-    char* hostfile = "sync.cfg";
+    const char* hostfile = "sync.cfg";
+    const char* outfile = "frame_timecodes.tc";
+    double framerate = 30;
+    double reportInterval = 5;
+    double window = 32;
+    int waveSize = 0;
+    double tolerance = -1;
     //std::string clipfile = DEFAULT_CLIPFILE;
     for( int i = 1; i < argc; i++ ){
         if( !strcmp( argv[i], "-c" ) ){
@@ -154,6 +283,52 @@ int main(int argc, char* argv[]){
             }
             hostfile=argv[i];
             std::cout << "using hostfile: " << hostfile << std::endl;
+        } else if( !strcmp( argv[i], "-o" ) ){
+            argCount++;
+            i++;
+            if( i >= argc ){
+                std::cout << "-o option must specify a file"
+                          << std::endl;
+                printHelp();
+                exit(1);
+            }
+            outfile=argv[i];
+        } else if( !strcmp( argv[i], "-w" ) ){
+            argCount++;
+            i++;
+            if( i >= argc || atoi(argv[i]) < 1 ){
+                std::cout << "-w option must specify a positive count"
+                          << std::endl;
+                printHelp();
+                exit(1);
+            }
+            waveSize = atoi(argv[i]);
+        } else if( !strcmp( argv[i], "-s" ) ){
+            argCount++;
+            i++;
+            if( i >= argc || atof(argv[i]) < 0 ){
+                std::cout << "-s option must specify a tolerance in microseconds"
+                          << std::endl;
+                printHelp();
+                exit(1);
+            }
+            tolerance = atof(argv[i]);
+        } else if( !strcmp( argv[i], "-f" ) || !strcmp( argv[i], "-r" ) || !strcmp( argv[i], "-t" ) ){
+            argCount++;
+            i++;
+            if( i >= argc || atof(argv[i]) <= 0 ){
+                std::cout << argv[i-1] << " option must specify a positive number"
+                          << std::endl;
+                printHelp();
+                exit(1);
+            }
+            if( !strcmp( argv[i-1], "-f" ) ){
+                framerate = atof(argv[i]);
+            } else if( !strcmp( argv[i-1], "-r" ) ){
+                reportInterval = atof(argv[i]);
+            } else{
+                window = atof(argv[i]);
+            }
         } else if( !strcmp( argv[i], "-p" ) ){
             argCount++;
             i++;
@@ -198,56 +373,90 @@ int main(int argc, char* argv[]){
     frameCB.f = mcamFrameCallback;
     frameCB.data = NULL;
     setMCamFrameCallback(frameCB);
-    for (int i = 0; i < numMCams; i++){
-    	initMCamFrameReceiver( portbase+i, 1 );
-    }
     /*************************************************************/
     /*************************************************************/
     
-    /* For each camera in MCamList start the stream for 10 seconds, then stop it,
-    which will allow the frame callback to recieve frames and save the timestamp
-    to a file */ 
-    //ofstream outputFile("frame_timecodes.txt");
-    //myfile= ofstream ("frame_timecodes.txt");
-    myfile.open("frame_timecodes.txt",std::ofstream::out | std::ofstream::app) ;
+    /* Each microcamera records into its own ring, drained by the writer
+     * thread of the timecode log */
+    uint32_t mcamIDs[numMCams];
+    MCAM_INTERVALS intervals;
+    intervals.mcamIDs      = mcamIDs;
+    intervals.stats        = (INTERVAL_STATS *) malloc(numMCams * sizeof(INTERVAL_STATS));
+    intervals.numMCams     = numMCams;
+    intervals.current      = 0;
+    intervals.reportPeriod = uint64_t(reportInterval * 1e9);
+    intervals.lastReport   = 0;
+    intervals.framesets    = NULL;
+    if( intervals.stats == NULL ){
+        printf("Unable to allocate interval statistics for %d microcameras\n", numMCams);
+        exit(0);
+    }
     for (int i = 0; i < numMCams; i++){
-        //Start the stream
-        ready = true;
-       
-        if( !startMCamStream(mcamList[i], portbase+i) ){
-            printf("Failed to start streaming mcam %u\n", mcamList[i].mcamID);
+        mcamIDs[i] = mcamList[i].mcamID;
+        intervalStatsInit(&intervals.stats[i], 1e6/framerate);
+    }
+
+    /* Sensors outside the current wave never send frames, so sets only
+     * wait a second for missing sensors and are forced out when a sensor
+     * gets frameset_depth frames ahead */
+    FRAMESET_ASSEMBLER assembler;
+    if( tolerance >= 0 ){
+        FRAMESET_CALLBACK setCB = { NULL, NULL };
+        FRAME_RELEASE_CALLBACK releaseCB = { NULL, NULL };
+        if( !framesetAssemblerInit(&assembler, mcamIDs, numMCams, frameset_depth, uint64_t(tolerance),
+                                   1000000, false, setCB, releaseCB) ){
+            printf("Unable to allocate a frameset assembler for %d microcameras\n", numMCams);
             exit(0);
         }
-       sleep(0.2);
-       // ofstream outputFile(to_string(mcamList[i].mcamID)+".txt");
-       // myfile= ofstream (to_string(mcamList[i].mcamID)+".txt");
-
-        //myfile.open(to_string(mcamList[i].mcamID)+".txt");
-        //Sleep
-        //Stop the stream
-        
+        intervals.framesets = &assembler;
     }
+    TIMECODE_RECORD_CALLBACK writtenCB;
+    writtenCB.f = timecodeWritten;
+    writtenCB.data = &intervals;
+    if( !timecodeLogOpen(&timecodes, outfile, mcamIDs, numMCams, TIMECODE_LOG_CAPACITY, writtenCB) ){
+        printf("Unable to open timecode log %s\n", outfile);
+        exit(0);
+    }
+    ready = true;
+
+    /* Start the streams of each wave together, which will allow the frame
+    callback to recieve frames and save the timestamps for the capture
+    window, then stop them and close their receivers before the next wave */
+    int wave = (waveSize > 0 && waveSize < numMCams) ? waveSize : numMCams;
+    int numWaves = (numMCams + wave - 1) / wave;
+    bool streaming[numMCams];
+    memset(streaming, 0, sizeof(streaming));
+    printf("Capturing %d microcameras in %d waves of %g seconds\n", numMCams, numWaves, window);
+    for (int first = 0; first < numMCams; first += wave){
+        int count = (numMCams - first < wave) ? numMCams - first : wave;
+        for (int i = first; i < first + count; i++){
+            initMCamFrameReceiver( portbase+i, 1 );
+        }
 
-        sleep(32);
-
-
-    for (int i = 0; i < numMCams; i++){
-        //Stop the stream
+        int started = controlStreams(mcamList, streaming, first, count, true);
+        printf("Capturing from %d of %d microcameras for %g seconds\n", started, count, window);
+        std::this_thread::sleep_for(std::chrono::duration<double>(window));
+        controlStreams(mcamList, streaming, first, count, false);
 
-        if( !stopMCamStream(mcamList[i], portbase+i) ){
-            printf("Failed to stop streaming mcam %u\n", mcamList[i].mcamID);
+        for (int i = first; i < first + count; i++){
+            closeMCamFrameReceiver( portbase+i );
         }
-        
     }
-        myfile.close();
-
-
-
-
-
-  for (int i = 0; i < numMCams; i++){
-    	closeMCamFrameReceiver( portbase+i );
+    ready = false;
+
+    /* the receivers are closed, so no callback can record any more */
+    uint64_t dropped = timecodeLogDropped(&timecodes);
+    timecodeLogClose(&timecodes);
+    printf("Wrote %lu timecodes to %s, dropped %lu\n",
+           timecodes.written, outfile, dropped);
+    if( intervals.framesets != NULL ){
+        framesetAssemblerFlush(intervals.framesets);
+    }
+    printIntervals(&intervals);
+    if( intervals.framesets != NULL ){
+        framesetAssemblerDestroy(intervals.framesets);
     }
+    free(intervals.stats);
 
 
 
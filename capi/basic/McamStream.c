@@ -6,6 +6,12 @@
  * This example shows how to get a stream of frames from a microcamera
  * using a callback function by directly connecting to a Tegra
  *
+ * Frames are handed to the callback through a FrameDispatcher, so the
+ * receiver thread only copies each frame and a worker thread runs the
+ * callback. -policy chooses what happens when the callback falls behind
+ * (-delay simulates a slow consumer) and the frames dropped are printed at
+ * the end. -direct runs the callback on the receiver thread instead.
+ *
  *****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +19,8 @@
 #include <unistd.h>
 
 #include "mantis/MantisAPI.h"
+#include "Metrics.h"
+#include "FrameDispatcher.h"
 
 /**
  * \brief Function that handles new ACOS_CAMERA objects
@@ -30,9 +38,15 @@ void newMCamCallback(MICRO_CAMERA mcam, void* data)
  **/
 void mcamFrameCallback(FRAME frame, void* data)
 {
+    int delay = *(int *)data;
+    uint64_t start = metricsNow();
     printf("Received a frame for microcamera %u with timestamp %lu\n",
            frame.m_metadata.m_camId,
            frame.m_metadata.m_timestamp);
+    if( delay > 0 ){
+        usleep(delay * 1000);
+    }
+    metricsRecord(METRIC_FRAME_CALLBACK, start);
 }
 
 /**
@@ -43,7 +57,14 @@ void printHelp()
    printf("McamStream Demo Application\n");
    printf("Usage:\n");
    printf("\t-ip <address> IP Address connect to (default 10.0.0.202)\n");
-   printf("\t-port <port> port connect to (default 9999)\n\n");
+   printf("\t-port <port> port connect to (default 9999)\n");
+   printf("\t-metrics <prefix> write callback latency histograms to <prefix>.json and <prefix>.prom\n");
+   printf("\t-metrics-interval <seconds> time between metrics dumps (default 10)\n");
+   printf("\t-policy <latest|drop-oldest|block> what to do when the callback falls behind (default drop-oldest)\n");
+   printf("\t-depth <count> frames queued for the callback (default %d)\n", FRAME_DISPATCH_DEPTH);
+   printf("\t-workers <count> threads running the callback (default 1)\n");
+   printf("\t-delay <ms> time the callback spends on each frame (default 0)\n");
+   printf("\t-direct run the callback on the receiver thread\n\n");
 }
 
 /**
@@ -55,6 +76,13 @@ int main(int argc, char * argv[])
      * or port if provided from the command line */
     char ip[24] = "10.0.0.202";
     int port = 9999;
+    char * metricsPrefix = NULL;
+    double metricsInterval = METRICS_INTERVAL;
+    FRAME_DISPATCH_POLICY policy = FRAME_DISPATCH_DROP_OLDEST;
+    int depth = FRAME_DISPATCH_DEPTH;
+    int workers = 1;
+    int delay = 0;
+    bool direct = false;
     for( int i = 1; i < argc; i++ ){
        if( !strcmp(argv[i],"-ip") ){
           if( ++i >= argc ){
@@ -73,6 +101,43 @@ int main(int argc, char * argv[])
           }
           int length = strlen(argv[i]);
           port = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-metrics") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsPrefix = argv[i];
+       } else if( !strcmp(argv[i],"-metrics-interval") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          metricsInterval = atof(argv[i]);
+       } else if( !strcmp(argv[i],"-policy") ){
+          if( ++i >= argc || !frameDispatchPolicyParse(argv[i], &policy) ){
+             printHelp();
+             return 0;
+          }
+       } else if( !strcmp(argv[i],"-depth") ){
+          if( ++i >= argc || atoi(argv[i]) < 1 ){
+             printHelp();
+             return 0;
+          }
+          depth = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-workers") ){
+          if( ++i >= argc || atoi(argv[i]) < 1 ){
+             printHelp();
+             return 0;
+          }
+          workers = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-delay") ){
+          if( ++i >= argc ){
+             printHelp();
+             return 0;
+          }
+          delay = atoi(argv[i]);
+       } else if( !strcmp(argv[i],"-direct") ){
+          direct = true;
        } else{
           printHelp();
           return 0;
@@ -131,9 +196,23 @@ int main(int argc, char * argv[])
 
     /* Next we set a callback function to receive the stream of frames
      * from the desired microcamera */
+    if( metricsPrefix != NULL && !metricsStart(metricsPrefix, "McamStream", metricsInterval) ){
+        printf("Unable to start metrics for %s\n", metricsPrefix);
+    }
     MICRO_CAMERA_FRAME_CALLBACK frameCB;
     frameCB.f = mcamFrameCallback;
-    frameCB.data = NULL;
+    frameCB.data = &delay;
+
+    /* The dispatcher is set as the frame callback instead, so the receiver
+     * thread returns as soon as the frame is copied */
+    FRAME_DISPATCHER dispatcher;
+    if( !direct ){
+        if( !frameDispatcherInit(&dispatcher, &myMCam.mcamID, 1, policy, depth, workers, frameCB) ){
+            printf("Unable to start the frame dispatcher\n");
+            exit(0);
+        }
+        frameCB = frameDispatcherCallback(&dispatcher);
+    }
     setMCamFrameCallback(frameCB);
 
     /* At this point we should see the print statement in the frame callback
@@ -149,5 +228,14 @@ int main(int argc, char * argv[])
     mCamDisconnect(ip, 11001);
     closeMCamFrameReceiver( 11001 );
 
+    /* no frames arrive after the receiver is closed, so the dispatcher
+     * only delivers the frames still queued */
+    if( !direct ){
+        frameDispatcherStop(&dispatcher);
+        frameDispatcherPrintStats(&dispatcher);
+        frameDispatcherDestroy(&dispatcher);
+    }
+    metricsStop();
+
     exit(1);
 }
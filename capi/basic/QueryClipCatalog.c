@@ -0,0 +1,110 @@
+/******************************************************************************
+ *
+ * QueryClipCatalog.c
+ *
+ * This example maps a clip catalog written by GetClipList and prints the
+ * clips that overlap a time range, optionally for a single camera. No
+ * connection to a camera is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ClipCatalog.h"
+#include "Metrics.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("QueryClipCatalog Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> catalog to read (default clips.cat)\n");
+   printf("\t-start <time> start of the range in microseconds (default 0)\n");
+   printf("\t-end <time> end of the range in microseconds (default no limit)\n");
+   printf("\t-camera <camera ID> only print clips of this camera\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Prints a clip found by the query
+ **/
+static void printClip( const CLIP_CATALOG_RECORD * record, void * data )
+{
+    printf("%.*s:\n"
+           "\tcamera:    %u\n"
+           "\tstartTime: %lu\n"
+           "\tendTime:   %lu\n"
+           "\tframerate: %f\n",
+           CLIP_CATALOG_NAME,
+           record->name,
+           record->camID,
+           record->startTime,
+           record->endTime,
+           record->framerate);
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char catalogFile[256] = "clips.cat";
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    uint32_t camID = 0;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(catalogFile, argv[i], sizeof(catalogFile) - 1);
+        } else if( !strcmp(argv[i],"-start") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            start = strtoull(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-end") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            end = strtoull(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-camera") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            camID = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    CLIP_CATALOG_READER reader;
+    if( !clipCatalogMap(&reader, catalogFile) ){
+        printf("Unable to read clip catalog %s\n", catalogFile);
+        return 0;
+    }
+
+    /* clips are read straight from the mapping without copying */
+    CLIP_CATALOG_CALLBACK callback = { printClip, NULL };
+    uint64_t queryStart = metricsNow();
+    uint64_t found = clipCatalogQuery(&reader, camID, start, end, callback);
+    printf("Found %lu of %lu clips in %.3f ms\n",
+           found,
+           (uint64_t)reader.numRecords,
+           (metricsNow() - queryStart) / 1e6);
+
+    clipCatalogUnmap(&reader);
+
+    exit(1);
+}
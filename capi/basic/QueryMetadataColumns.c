@@ -0,0 +1,150 @@
+/******************************************************************************
+ *
+ * QueryMetadataColumns.c
+ *
+ * This example maps a columnar metadata store written by MantisExportStream
+ * with -meta columns, counts the frames in a time range and prints the gain
+ * and exposure of each microcamera over that range, optionally listing the
+ * frames themselves. No connection to a camera is needed.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MetadataColumns.h"
+#include "Metrics.h"
+
+/**
+ * \brief prints the command line options
+ **/
+void printHelp()
+{
+   printf("QueryMetadataColumns Demo Application\n");
+   printf("Usage:\n");
+   printf("\t-file <filename> metadata store to read (default export.cols)\n");
+   printf("\t-start <time> first timestamp of the range in microseconds (default 0)\n");
+   printf("\t-end <time> last timestamp of the range in microseconds (default no limit)\n");
+   printf("\t-mcam <mcam ID> only count and list frames of this microcamera\n");
+   printf("\t-list print the metadata of every frame in the range\n");
+   printf("\t-h Prints this help message and exits\n\n");
+}
+
+/**
+ * \brief Prints the metadata of a frame
+ **/
+static void printFrame( const FRAME_METADATA * metadata, void * data )
+{
+    printf("mcam %u frame %lu time %lu size %lu mode %u %ux%u gain %.3f shutter %.6f exposure %.6f\n",
+           metadata->m_camId,
+           metadata->m_id,
+           metadata->m_timestamp,
+           metadata->m_size,
+           metadata->m_mode,
+           metadata->m_width,
+           metadata->m_height,
+           metadata->m_gain,
+           metadata->m_shutter,
+           metadata->m_exposure);
+}
+
+/**
+ * \brief Main function
+ **/
+int main(int argc, char * argv[])
+{
+    char storeFile[256] = "export.cols";
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    uint32_t mcamID = 0;
+    bool list = false;
+    for( int i = 1; i < argc; i++ ){
+        if( !strcmp(argv[i],"-file") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            strncpy(storeFile, argv[i], sizeof(storeFile) - 1);
+        } else if( !strcmp(argv[i],"-start") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            start = strtoull(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-end") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            end = strtoull(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-mcam") ){
+            if( ++i >= argc ){
+                printHelp();
+                return 0;
+            }
+            mcamID = strtoul(argv[i], NULL, 10);
+        } else if( !strcmp(argv[i],"-list") ){
+            list = true;
+        } else if( !strcmp(argv[i], "-h") ){
+            printHelp();
+            return 1;
+        } else{
+            printHelp();
+            return 0;
+        }
+    }
+
+    METADATA_COLUMNS store;
+    if( !metadataColumnsMap(&store, storeFile) ){
+        printf("Unable to read metadata store %s\n", storeFile);
+        return 0;
+    }
+    uint64_t total = metadataColumnsCount(&store, 0, 0, UINT64_MAX);
+    uint64_t bytes = metadataColumnsMemory(&store);
+    printf("%lu frames of %u microcameras in %lu bytes, %.1f bytes per frame\n",
+           total,
+           store.numMCams,
+           bytes,
+           total > 0 ? (double)bytes / total : 0.0);
+
+    /* the columns are scanned straight from the mapping without copying */
+    uint64_t queryStart = metricsNow();
+    uint64_t frames = metadataColumnsCount(&store, mcamID, start, end);
+    printf("%lu frames in range, counted in %.3f ms\n",
+           frames, (metricsNow() - queryStart) / 1e6);
+
+    METADATA_COLUMNS_STATS * stats = (METADATA_COLUMNS_STATS *)calloc(store.numMCams + 1, sizeof(METADATA_COLUMNS_STATS));
+    if( stats == NULL ){
+        printf("Unable to allocate statistics\n");
+        metadataColumnsDestroy(&store);
+        return 0;
+    }
+    queryStart = metricsNow();
+    uint32_t numStats = metadataColumnsAggregate(&store, start, end, stats, store.numMCams);
+    double aggregateTime = (metricsNow() - queryStart) / 1e6;
+    for( uint32_t i = 0; i < numStats; i++ ){
+        if( (mcamID != 0 && stats[i].mcamID != mcamID) || stats[i].frames == 0 ){
+            continue;
+        }
+        printf("mcam %u: %lu frames gain %.3f..%.3f mean %.3f exposure %.6f..%.6f mean %.6f\n",
+               stats[i].mcamID,
+               stats[i].frames,
+               stats[i].minGain,
+               stats[i].maxGain,
+               stats[i].meanGain,
+               stats[i].minExposure,
+               stats[i].maxExposure,
+               stats[i].meanExposure);
+    }
+    printf("Aggregated %u microcameras in %.3f ms\n", numStats, aggregateTime);
+    free(stats);
+
+    if( list ){
+        METADATA_COLUMNS_CALLBACK callback = { printFrame, NULL };
+        metadataColumnsScan(&store, mcamID, start, end, callback);
+    }
+
+    metadataColumnsDestroy(&store);
+
+    exit(1);
+}
@@ -0,0 +1,538 @@
+/******************************************************************************
+ *
+ * ClipCatalog.c
+ *
+ * Persistent indexed clip catalog. See ClipCatalog.h
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ClipCatalog.h"
+
+/**
+ * \brief Orders records by camera, start time and name
+ **/
+static int compareRecords( const void * a, const void * b )
+{
+   const CLIP_CATALOG_RECORD * x = (const CLIP_CATALOG_RECORD *)a;
+   const CLIP_CATALOG_RECORD * y = (const CLIP_CATALOG_RECORD *)b;
+   if( x->camID != y->camID ) {
+      return ( x->camID < y->camID ) ? -1 : 1;
+   }
+   if( x->startTime != y->startTime ) {
+      return ( x->startTime < y->startTime ) ? -1 : 1;
+   }
+
+   return strncmp( x->name, y->name, CLIP_CATALOG_NAME );
+}
+
+/**
+ * \brief Sets maxEnd of the implicit tree over records [lo, hi)
+ * \return the latest endTime in the range
+ **/
+static uint64_t buildTree( CLIP_CATALOG_RECORD * records, uint64_t lo, uint64_t hi )
+{
+   if( lo >= hi ) {
+      return 0;
+   }
+   uint64_t mid   = lo + ( hi - lo ) / 2;
+   uint64_t left  = buildTree( records, lo, mid );
+   uint64_t right = buildTree( records, mid + 1, hi );
+   uint64_t maxEnd = records[mid].endTime;
+   maxEnd = ( left > maxEnd ) ? left : maxEnd;
+   maxEnd = ( right > maxEnd ) ? right : maxEnd;
+   records[mid].maxEnd = maxEnd;
+
+   return maxEnd;
+}
+
+/**
+ * \brief Returns the maxEnd of the implicit tree over records [lo, hi)
+ **/
+static uint64_t treeMaxEnd( const CLIP_CATALOG_RECORD * records, uint64_t lo, uint64_t hi )
+{
+   return ( lo < hi ) ? records[lo + ( hi - lo ) / 2].maxEnd : 0;
+}
+
+/**
+ * \brief Sets maxEnd again on the path from the root of the implicit tree
+ *        over records [lo, hi) down to record i, after its endTime changed
+ * \param [out] path indices of the records on the path, deepest first
+ * \return the number of records on the path
+ **/
+static int updateTree( CLIP_CATALOG_RECORD * records, uint64_t lo, uint64_t hi, uint64_t i, uint64_t * path )
+{
+   uint64_t mid = lo + ( hi - lo ) / 2;
+   int depth = 0;
+   if( i < mid ) {
+      depth = updateTree( records, lo, mid, i, path );
+   }
+   else if( i > mid ) {
+      depth = updateTree( records, mid + 1, hi, i, path );
+   }
+   uint64_t maxEnd = records[mid].endTime;
+   uint64_t left   = treeMaxEnd( records, lo, mid );
+   uint64_t right  = treeMaxEnd( records, mid + 1, hi );
+   maxEnd = ( left > maxEnd ) ? left : maxEnd;
+   maxEnd = ( right > maxEnd ) ? right : maxEnd;
+   records[mid].maxEnd = maxEnd;
+   path[depth] = mid;
+
+   return depth + 1;
+}
+
+/**
+ * \brief Finds the sorted records of a camera as [first, last)
+ **/
+static void cameraRecords( const CLIP_CATALOG * catalog, uint32_t camID, uint64_t * first, uint64_t * last )
+{
+   //Two binary searches, for the first record of the camera and the first after it
+   for( int after = 0; after < 2; after++ ) {
+      uint64_t low  = after ? *first : 0;
+      uint64_t high = catalog->numIndexed;
+      while( low < high ) {
+         uint64_t mid = low + ( high - low ) / 2;
+         uint32_t cam = catalog->records[mid].camID;
+         if( cam < camID || ( after && cam == camID )) {
+            low = mid + 1;
+         }
+         else {
+            high = mid;
+         }
+      }
+      *( after ? last : first ) = low;
+   }
+}
+
+/**
+ * \brief Writes record i over its copy in the file, leaving the file
+ *        positioned for the next append
+ **/
+static bool rewriteRecord( CLIP_CATALOG * catalog, uint64_t i )
+{
+   off_t offset = sizeof(CLIP_CATALOG_HEADER) + i * sizeof(CLIP_CATALOG_RECORD);
+
+   return fseeko( catalog->file, offset, SEEK_SET ) == 0
+       && fwrite( &catalog->records[i], sizeof(CLIP_CATALOG_RECORD), 1, catalog->file ) == 1
+       && fseeko( catalog->file, 0, SEEK_END ) == 0;
+}
+
+/**
+ * \brief Writes the whole catalog to a new file and reopens it for appends
+ **/
+static bool writeCatalog( CLIP_CATALOG * catalog )
+{
+   CLIP_CATALOG_HEADER header;
+   memset( &header, 0, sizeof(header));
+   header.magic      = CLIP_CATALOG_MAGIC;
+   header.version    = CLIP_CATALOG_VERSION;
+   header.recordSize = sizeof(CLIP_CATALOG_RECORD);
+   header.numIndexed = catalog->numIndexed;
+
+   //A reader never sees a partial catalog, even after a crash
+   char tempName[sizeof(catalog->fileName) + 8];
+   snprintf( tempName, sizeof(tempName), "%s.tmp", catalog->fileName );
+   FILE * file = fopen( tempName, "w" );
+   if( file == NULL ) {
+      return false;
+   }
+   bool rc = fwrite( &header, sizeof(header), 1, file ) == 1
+          && ( catalog->numRecords == 0
+            || fwrite( catalog->records, sizeof(CLIP_CATALOG_RECORD), catalog->numRecords, file ) == catalog->numRecords );
+   rc = ( fclose( file ) == 0 ) && rc;
+   if( !rc || rename( tempName, catalog->fileName ) != 0 ) {
+      unlink( tempName );
+      return false;
+   }
+
+   //The old handle still points at the replaced file
+   if( catalog->file != NULL ) {
+      fclose( catalog->file );
+   }
+   catalog->file = fopen( catalog->fileName, "r+" );
+   if( catalog->file == NULL || fseeko( catalog->file, 0, SEEK_END ) != 0 ) {
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Opens a catalog file for adding clips, creating it if needed
+ **/
+bool clipCatalogOpen( CLIP_CATALOG * catalog, const char * fileName )
+{
+   memset( catalog, 0, sizeof(*catalog));
+   snprintf( catalog->fileName, sizeof(catalog->fileName), "%s", fileName );
+
+   //Only a missing catalog is created. Any other error, such as a read-only
+   //file, must not replace the clips already in it
+   catalog->file = fopen( fileName, "r+" );
+   if( catalog->file == NULL ) {
+      if( errno != ENOENT || !writeCatalog( catalog )) {
+         return false;
+      }
+      pthread_mutex_init( &catalog->lock, NULL );
+      return true;
+   }
+
+   /* Only add to files written with the current record layout, dropping a
+    * record cut short by a crash */
+   CLIP_CATALOG_HEADER header;
+   struct stat st;
+   if( fread( &header, sizeof(header), 1, catalog->file ) != 1
+    || header.magic != CLIP_CATALOG_MAGIC
+    || header.recordSize != sizeof(CLIP_CATALOG_RECORD)
+    || fstat( fileno( catalog->file ), &st ) != 0 ) {
+      fclose( catalog->file );
+      catalog->file = NULL;
+      return false;
+   }
+   uint64_t numRecords = ( st.st_size - sizeof(header)) / sizeof(CLIP_CATALOG_RECORD);
+   catalog->records = (CLIP_CATALOG_RECORD *)malloc(( numRecords + 1 ) * sizeof(CLIP_CATALOG_RECORD));
+   off_t length = sizeof(header) + numRecords * sizeof(CLIP_CATALOG_RECORD);
+   if( catalog->records == NULL
+    || fread( catalog->records, sizeof(CLIP_CATALOG_RECORD), numRecords, catalog->file ) != numRecords
+    || ftruncate( fileno( catalog->file ), length ) != 0
+    || fseeko( catalog->file, length, SEEK_SET ) != 0 ) {
+      fclose( catalog->file );
+      free( catalog->records );
+      memset( catalog, 0, sizeof(*catalog));
+      return false;
+   }
+   catalog->numRecords = numRecords;
+   catalog->capacity   = numRecords + 1;
+   catalog->numIndexed = ( header.numIndexed < numRecords ) ? header.numIndexed : numRecords;
+
+   pthread_mutex_init( &catalog->lock, NULL );
+   return true;
+}
+
+/**
+ * \brief Finds the record of a clip
+ * \return its index, or numRecords if it is not in the catalog
+ **/
+static uint64_t findRecord( const CLIP_CATALOG * catalog, const CLIP_CATALOG_RECORD * record )
+{
+   //Sorted records by binary search on camera and start time
+   uint64_t low  = 0;
+   uint64_t high = catalog->numIndexed;
+   while( low < high ) {
+      uint64_t mid = low + ( high - low ) / 2;
+      const CLIP_CATALOG_RECORD * r = &catalog->records[mid];
+      if( r->camID < record->camID || ( r->camID == record->camID && r->startTime < record->startTime )) {
+         low = mid + 1;
+      }
+      else {
+         high = mid;
+      }
+   }
+   for( uint64_t i = low; i < catalog->numIndexed; i++ ) {
+      const CLIP_CATALOG_RECORD * r = &catalog->records[i];
+      if( r->camID != record->camID || r->startTime != record->startTime ) {
+         break;
+      }
+      if( !strncmp( r->name, record->name, CLIP_CATALOG_NAME )) {
+         return i;
+      }
+   }
+
+   for( uint64_t i = catalog->numIndexed; i < catalog->numRecords; i++ ) {
+      const CLIP_CATALOG_RECORD * r = &catalog->records[i];
+      if( r->camID == record->camID && r->startTime == record->startTime
+       && !strncmp( r->name, record->name, CLIP_CATALOG_NAME )) {
+         return i;
+      }
+   }
+
+   return catalog->numRecords;
+}
+
+/**
+ * \brief Sorts the records and rewrites the file. Called with the lock held
+ **/
+static bool compactLocked( CLIP_CATALOG * catalog )
+{
+   qsort( catalog->records, catalog->numRecords, sizeof(CLIP_CATALOG_RECORD), compareRecords );
+
+   //One tree per camera
+   for( uint64_t first = 0; first < catalog->numRecords; ) {
+      uint64_t last = first + 1;
+      while( last < catalog->numRecords && catalog->records[last].camID == catalog->records[first].camID ) {
+         last++;
+      }
+      buildTree( catalog->records, first, last );
+      first = last;
+   }
+   catalog->numIndexed = catalog->numRecords;
+
+   return writeCatalog( catalog );
+}
+
+/**
+ * \brief Adds a clip, or replaces the one with the same camera, start time
+ *        and name
+ **/
+bool clipCatalogAdd( CLIP_CATALOG * catalog, const ACOS_CLIP * clip )
+{
+   CLIP_CATALOG_RECORD record;
+   memset( &record, 0, sizeof(record));
+   record.camID     = clip->cam.camID;
+   record.startTime = clip->startTime;
+   record.endTime   = clip->endTime;
+   record.framerate = clip->framerate;
+   snprintf( record.name, sizeof(record.name), "%.*s", (int)sizeof(clip->name), clip->name );
+
+   pthread_mutex_lock( &catalog->lock );
+   if( catalog->file == NULL ) {
+      pthread_mutex_unlock( &catalog->lock );
+      return false;
+   }
+
+   /* The sort order only depends on the camera, start time and name, so a
+    * changed clip keeps its place and is rewritten there. A sorted one also
+    * updates maxEnd on its path through the camera's tree */
+   bool rc = true;
+   uint64_t i = findRecord( catalog, &record );
+   if( i < catalog->numRecords ) {
+      CLIP_CATALOG_RECORD * existing = &catalog->records[i];
+      if( existing->endTime != record.endTime || existing->framerate != record.framerate ) {
+         existing->endTime   = record.endTime;
+         existing->framerate = record.framerate;
+         if( i < catalog->numIndexed ) {
+            uint64_t first;
+            uint64_t last;
+            uint64_t path[64];
+            cameraRecords( catalog, record.camID, &first, &last );
+            int depth = updateTree( catalog->records, first, last, i, path );
+            for( int d = 0; d < depth && rc; d++ ) {
+               rc = rewriteRecord( catalog, path[d] );
+            }
+         }
+         else {
+            rc = rewriteRecord( catalog, i );
+         }
+         rc = ( fflush( catalog->file ) == 0 ) && rc;
+      }
+      pthread_mutex_unlock( &catalog->lock );
+      return rc;
+   }
+
+   if( catalog->numRecords == catalog->capacity ) {
+      uint64_t capacity = ( catalog->capacity > 0 ) ? 2 * catalog->capacity : 64;
+      CLIP_CATALOG_RECORD * records = (CLIP_CATALOG_RECORD *)realloc( catalog->records, capacity * sizeof(CLIP_CATALOG_RECORD));
+      if( records == NULL ) {
+         pthread_mutex_unlock( &catalog->lock );
+         return false;
+      }
+      catalog->records  = records;
+      catalog->capacity = capacity;
+   }
+   catalog->records[catalog->numRecords++] = record;
+
+   rc = fwrite( &record, sizeof(record), 1, catalog->file ) == 1
+     && fflush( catalog->file ) == 0;
+   if( catalog->numRecords - catalog->numIndexed >= CLIP_CATALOG_TAIL ) {
+      rc = compactLocked( catalog ) && rc;
+   }
+   pthread_mutex_unlock( &catalog->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Sorts every record into the index and rewrites the file
+ **/
+bool clipCatalogCompact( CLIP_CATALOG * catalog )
+{
+   pthread_mutex_lock( &catalog->lock );
+   bool rc = ( catalog->file != NULL ) && compactLocked( catalog );
+   pthread_mutex_unlock( &catalog->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Compacts and closes a catalog file
+ **/
+void clipCatalogClose( CLIP_CATALOG * catalog )
+{
+   if( catalog->file == NULL ) {
+      return;
+   }
+
+   if( catalog->numIndexed < catalog->numRecords && !clipCatalogCompact( catalog )) {
+      printf("Unable to sort clip catalog %s\n", catalog->fileName );
+   }
+   pthread_mutex_lock( &catalog->lock );
+   if( catalog->file != NULL ) {
+      fclose( catalog->file );
+      catalog->file = NULL;
+   }
+   free( catalog->records );
+   catalog->records    = NULL;
+   catalog->numRecords = 0;
+   catalog->numIndexed = 0;
+   catalog->capacity   = 0;
+   pthread_mutex_unlock( &catalog->lock );
+   pthread_mutex_destroy( &catalog->lock );
+}
+
+/**
+ * \brief Maps a catalog file for reading
+ **/
+bool clipCatalogMap( CLIP_CATALOG_READER * reader, const char * fileName )
+{
+   memset( reader, 0, sizeof(*reader));
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(CLIP_CATALOG_HEADER)) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+
+   const CLIP_CATALOG_HEADER * header = (const CLIP_CATALOG_HEADER *)data;
+   if( header->magic != CLIP_CATALOG_MAGIC
+    || header->recordSize < sizeof(CLIP_CATALOG_RECORD)) {
+      munmap( data, st.st_size );
+      return false;
+   }
+
+   reader->data       = (const uint8_t *)data;
+   reader->length     = st.st_size;
+   reader->recordSize = header->recordSize;
+   reader->numRecords = ( st.st_size - sizeof(CLIP_CATALOG_HEADER)) / header->recordSize;
+   reader->numIndexed = ( header->numIndexed < reader->numRecords ) ? header->numIndexed : reader->numRecords;
+
+   return true;
+}
+
+/**
+ * \brief Returns record i of a mapped catalog
+ **/
+const CLIP_CATALOG_RECORD * clipCatalogRecord( const CLIP_CATALOG_READER * reader, size_t i )
+{
+   return (const CLIP_CATALOG_RECORD *)( reader->data
+                                       + sizeof(CLIP_CATALOG_HEADER)
+                                       + i * reader->recordSize );
+}
+
+/**
+ * \brief Returns the first sorted record of a camera after index from
+ **/
+static size_t cameraBound( const CLIP_CATALOG_READER * reader, size_t from, uint32_t camID )
+{
+   size_t low  = from;
+   size_t high = reader->numIndexed;
+   while( low < high ) {
+      size_t mid = low + ( high - low ) / 2;
+      if( clipCatalogRecord( reader, mid )->camID < camID ) {
+         low = mid + 1;
+      }
+      else {
+         high = mid;
+      }
+   }
+
+   return low;
+}
+
+/**
+ * \brief Reports the clips of the tree over records [lo, hi) overlapping
+ *        [start, end]
+ **/
+static uint64_t queryTree( const CLIP_CATALOG_READER * reader
+                         , size_t lo
+                         , size_t hi
+                         , uint64_t start
+                         , uint64_t end
+                         , CLIP_CATALOG_CALLBACK callback
+                         )
+{
+   if( lo >= hi ) {
+      return 0;
+   }
+   size_t mid = lo + ( hi - lo ) / 2;
+   const CLIP_CATALOG_RECORD * record = clipCatalogRecord( reader, mid );
+   if( record->maxEnd < start ) {
+      return 0;
+   }
+
+   //Records after mid start no earlier than it
+   uint64_t found = queryTree( reader, lo, mid, start, end, callback );
+   if( record->startTime > end ) {
+      return found;
+   }
+   if( record->endTime >= start ) {
+      if( callback.f != NULL ) {
+         callback.f( record, callback.data );
+      }
+      found++;
+   }
+
+   return found + queryTree( reader, mid + 1, hi, start, end, callback );
+}
+
+/**
+ * \brief Finds the clips overlapping [start, end]
+ **/
+uint64_t clipCatalogQuery( const CLIP_CATALOG_READER * reader
+                         , uint32_t camID
+                         , uint64_t start
+                         , uint64_t end
+                         , CLIP_CATALOG_CALLBACK callback
+                         )
+{
+   uint64_t found = 0;
+   size_t first = ( camID != 0 ) ? cameraBound( reader, 0, camID ) : 0;
+   while( first < reader->numIndexed ) {
+      uint32_t id = clipCatalogRecord( reader, first )->camID;
+      if( camID != 0 && id != camID ) {
+         break;
+      }
+      size_t last = ( id < UINT32_MAX ) ? cameraBound( reader, first, id + 1 ) : reader->numIndexed;
+      found += queryTree( reader, first, last, start, end, callback );
+      first = last;
+   }
+
+   for( size_t i = reader->numIndexed; i < reader->numRecords; i++ ) {
+      const CLIP_CATALOG_RECORD * record = clipCatalogRecord( reader, i );
+      if(( camID == 0 || record->camID == camID )
+       && record->startTime <= end && record->endTime >= start ) {
+         if( callback.f != NULL ) {
+            callback.f( record, callback.data );
+         }
+         found++;
+      }
+   }
+
+   return found;
+}
+
+/**
+ * \brief Unmaps a catalog file
+ **/
+void clipCatalogUnmap( CLIP_CATALOG_READER * reader )
+{
+   if( reader->data != NULL ) {
+      munmap( (void *)reader->data, reader->length );
+   }
+   memset( reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,157 @@
+/******************************************************************************
+ *
+ * ClipCatalog.h
+ *
+ * Persistent catalog of recorded clips, indexed by camera and time so the
+ * clips covering a time range are found without listing every clip again.
+ * The file starts with a CLIP_CATALOG_HEADER followed by fixed-size
+ * CLIP_CATALOG_RECORDs in native byte order:
+ *
+ *   - the first numIndexed records are sorted by camera, start time and
+ *     name. The records of each camera form an implicit interval tree: the
+ *     root of a range of records is its middle one and its maxEnd holds
+ *     the latest endTime in that range, so an overlap query descends only
+ *     into ranges that can hold a match, in O(log n + matches)
+ *   - later records were appended since the file was last sorted and are
+ *     scanned in order. The writer sorts the file again once there are
+ *     CLIP_CATALOG_TAIL of them, so the scan stays short
+ *
+ * A clip added again with the same camera, start time and name replaces
+ * the earlier one in place, along with the maxEnd of the sorted records
+ * above it. A record cut short by a crash is ignored. Sorting rewrites go
+ * to a temporary file that is then renamed, so a mapped catalog stays valid.
+ *
+ *****************************************************************************/
+#ifndef CLIP_CATALOG_H
+#define CLIP_CATALOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CLIP_CATALOG_MAGIC   0x50494C43 //!< "CLIP" in a little endian file
+#define CLIP_CATALOG_VERSION 1
+#define CLIP_CATALOG_TAIL    256        //!< Unsorted records before a rewrite
+#define CLIP_CATALOG_NAME    256        //!< Bytes of a clip name, as in ACOS_CLIP
+
+/**
+ * \brief Header at the start of every catalog file
+ **/
+typedef struct {
+   uint32_t magic;        //!< CLIP_CATALOG_MAGIC
+   uint16_t version;      //!< CLIP_CATALOG_VERSION of the writer
+   uint16_t recordSize;   //!< Size of each record in bytes
+   uint64_t numIndexed;   //!< Sorted records at the start of the file
+} CLIP_CATALOG_HEADER;
+
+/**
+ * \brief Catalog entry for one clip
+ **/
+typedef struct {
+   uint32_t camID;                   //!< Camera the clip was recorded on
+   uint32_t reserved;                //!< Zero
+   uint64_t startTime;               //!< First timestamp in microseconds
+   uint64_t endTime;                 //!< Last timestamp in microseconds
+   uint64_t maxEnd;                  //!< Latest endTime in this record's tree range, 0 if unsorted
+   double   framerate;               //!< Capture framerate
+   char     name[CLIP_CATALOG_NAME]; //!< Clip name
+} CLIP_CATALOG_RECORD;
+
+/**
+ * \brief Catalog being written. The writer keeps every record in memory;
+ *        adds are serialized so clips can come from any callback thread
+ **/
+typedef struct {
+   FILE *                file;         //!< Open catalog file
+   char                  fileName[1024];
+   CLIP_CATALOG_RECORD * records;      //!< Sorted records, then the appended ones
+   uint64_t              numRecords;
+   uint64_t              numIndexed;
+   uint64_t              capacity;
+   pthread_mutex_t       lock;         //!< Serializes adds
+} CLIP_CATALOG;
+
+/**
+ * \brief Read-only view of a catalog file mapped into memory
+ **/
+typedef struct {
+   const uint8_t * data;        //!< Start of the mapping
+   size_t          length;      //!< Length of the mapping in bytes
+   size_t          recordSize;  //!< Stride between records
+   size_t          numIndexed;  //!< Sorted records
+   size_t          numRecords;  //!< Number of complete records
+} CLIP_CATALOG_READER;
+
+/**
+ * \brief Callback for each clip found by clipCatalogQuery
+ **/
+typedef struct {
+   void (*f)( const CLIP_CATALOG_RECORD * record, void * data );
+   void * data;
+} CLIP_CATALOG_CALLBACK;
+
+/**
+ * \brief Opens a catalog file for adding clips, creating it if needed
+ * \return true on success
+ **/
+bool clipCatalogOpen( CLIP_CATALOG * catalog, const char * fileName );
+
+/**
+ * \brief Adds a clip, or replaces the one with the same camera, start time
+ *        and name
+ * \return true on success
+ **/
+bool clipCatalogAdd( CLIP_CATALOG * catalog, const ACOS_CLIP * clip );
+
+/**
+ * \brief Sorts every record into the index and rewrites the file
+ * \return true on success
+ **/
+bool clipCatalogCompact( CLIP_CATALOG * catalog );
+
+/**
+ * \brief Compacts and closes a catalog file
+ **/
+void clipCatalogClose( CLIP_CATALOG * catalog );
+
+/**
+ * \brief Maps a catalog file for reading
+ * \return true if the file exists and has a valid header
+ **/
+bool clipCatalogMap( CLIP_CATALOG_READER * reader, const char * fileName );
+
+/**
+ * \brief Returns record i of a mapped catalog. i must be below numRecords
+ **/
+const CLIP_CATALOG_RECORD * clipCatalogRecord( const CLIP_CATALOG_READER * reader, size_t i );
+
+/**
+ * \brief Finds the clips overlapping [start, end] and passes each one to
+ *        callback, sorted ones first
+ * \param [in] camID camera to search, 0 for all of them
+ * \return the number of clips found
+ **/
+uint64_t clipCatalogQuery( const CLIP_CATALOG_READER * reader
+                         , uint32_t camID
+                         , uint64_t start
+                         , uint64_t end
+                         , CLIP_CATALOG_CALLBACK callback
+                         );
+
+/**
+ * \brief Unmaps a catalog file
+ **/
+void clipCatalogUnmap( CLIP_CATALOG_READER * reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
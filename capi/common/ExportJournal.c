@@ -0,0 +1,154 @@
+/******************************************************************************
+ *
+ * ExportJournal.c
+ *
+ * Checkpoint journal for resumable exports. See ExportJournal.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ExportJournal.h"
+
+/**
+ * \brief FNV-1a hash of a record without its checksum field
+ **/
+static uint64_t recordChecksum( const EXPORT_JOURNAL_RECORD * record )
+{
+   const uint8_t * bytes = (const uint8_t *)record;
+   uint64_t hash = 14695981039346656037ULL;
+   for( size_t i = 0; i < offsetof(EXPORT_JOURNAL_RECORD, checksum); i++ ) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+
+   return hash;
+}
+
+/**
+ * \brief Opens a journal for appending
+ **/
+bool exportJournalOpen( EXPORT_JOURNAL * journal
+                      , const char * fileName
+                      , bool resume
+                      , uint64_t startTime
+                      , uint64_t endTime
+                      , double framerate
+                      )
+{
+   int flags = O_WRONLY | O_CREAT | O_APPEND;
+   if( !resume ) {
+      flags |= O_TRUNC;
+   }
+
+   journal->fd = open( fileName, flags, 0666 );
+   if( journal->fd < 0 ) {
+      return false;
+   }
+
+   journal->startTime = startTime;
+   journal->endTime   = endTime;
+   journal->framerate = framerate;
+   pthread_mutex_init( &journal->lock, NULL );
+   return true;
+}
+
+/**
+ * \brief Appends a checkpoint and waits until it is on disk
+ **/
+bool exportJournalCheckpoint( EXPORT_JOURNAL * journal
+                            , uint32_t mcamID
+                            , uint64_t timestamp
+                            , uint64_t lastId
+                            , uint64_t offset
+                            , uint64_t frames
+                            , bool done
+                            )
+{
+   EXPORT_JOURNAL_RECORD record;
+   memset( &record, 0, sizeof(record));
+   record.mcamID    = mcamID;
+   record.flags     = done ? EXPORT_JOURNAL_DONE : 0;
+   record.timestamp = timestamp;
+   record.lastId    = lastId;
+   record.offset    = offset;
+   record.frames    = frames;
+   record.startTime = journal->startTime;
+   record.endTime   = journal->endTime;
+   record.framerate = journal->framerate;
+   record.checksum  = recordChecksum( &record );
+
+   pthread_mutex_lock( &journal->lock );
+   bool rc = write( journal->fd, &record, sizeof(record)) == sizeof(record)
+          && fdatasync( journal->fd ) == 0;
+   pthread_mutex_unlock( &journal->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Closes a journal
+ **/
+void exportJournalClose( EXPORT_JOURNAL * journal )
+{
+   if( journal->fd < 0 ) {
+      return;
+   }
+
+   close( journal->fd );
+   journal->fd = -1;
+   pthread_mutex_destroy( &journal->lock );
+}
+
+/**
+ * \brief Reads the latest valid checkpoint of each microcamera
+ **/
+int exportJournalRead( const char * fileName
+                     , uint64_t startTime
+                     , uint64_t endTime
+                     , double framerate
+                     , const uint32_t * mcamIDs
+                     , int numMCams
+                     , EXPORT_JOURNAL_RECORD * latest
+                     )
+{
+   memset( latest, 0, numMCams * sizeof(EXPORT_JOURNAL_RECORD));
+
+   FILE * file = fopen( fileName, "r" );
+   if( file == NULL ) {
+      return errno == ENOENT ? 0 : -1;
+   }
+
+   /* Later records replace earlier ones. A short or corrupt record can only
+    * be the last one written before a crash, so reading stops there */
+   int found = 0;
+   EXPORT_JOURNAL_RECORD record;
+   while( fread( &record, sizeof(record), 1, file ) == 1 ) {
+      if( record.checksum != recordChecksum( &record )) {
+         break;
+      }
+      //Framerates are compared loosely since they may come from frame metadata
+      if( record.startTime != startTime || record.endTime != endTime
+       || fabs( record.framerate - framerate ) > 1e-6 * framerate ) {
+         found = EXPORT_JOURNAL_MISMATCH;
+         break;
+      }
+      for( int i = 0; i < numMCams; i++ ) {
+         if( mcamIDs[i] == record.mcamID ) {
+            if( latest[i].checksum == 0 ) {
+               found++;
+            }
+            latest[i] = record;
+            break;
+         }
+      }
+   }
+
+   fclose( file );
+   return found;
+}
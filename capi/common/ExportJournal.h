@@ -0,0 +1,117 @@
+/******************************************************************************
+ *
+ * ExportJournal.h
+ *
+ * Checkpoint journal for long running exports. Each checkpoint appends a
+ * fixed-size record holding, for one microcamera, the timestamp and id of
+ * the last frame that is durably on disk, the length of its stream file at
+ * that point and the number of frames written. Every record also carries
+ * the time window and framerate of the export, so a journal left by a
+ * different export is not resumed. Records carry a checksum so a record
+ * torn by a crash is ignored. On restart the latest valid record of each
+ * microcamera tells the export where to continue.
+ *
+ *****************************************************************************/
+#ifndef EXPORT_JOURNAL_H
+#define EXPORT_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPORT_JOURNAL_DONE     0x1 //!< Record flag set once a microcamera is complete
+#define EXPORT_JOURNAL_MISMATCH (-2) //!< exportJournalRead found another export window
+
+/**
+ * \brief One checkpoint
+ **/
+typedef struct {
+   uint32_t mcamID;      //!< Microcamera this checkpoint is for
+   uint32_t flags;       //!< EXPORT_JOURNAL_DONE when the mcam is finished
+   uint64_t timestamp;   //!< Timestamp of the last durable frame
+   uint64_t lastId;      //!< m_id of the last durable frame, 0 if not tracked
+   uint64_t offset;      //!< Durable length of the stream file in bytes
+   uint64_t frames;      //!< Frames durably written
+   uint64_t startTime;   //!< Start of the export window in microseconds
+   uint64_t endTime;     //!< End of the export window in microseconds
+   double   framerate;   //!< Framerate of the export
+   uint64_t checksum;    //!< Checksum of the fields above
+} EXPORT_JOURNAL_RECORD;
+
+/**
+ * \brief Journal file being appended to. Checkpoints from several threads
+ *        are serialized
+ **/
+typedef struct {
+   int             fd;         //!< Journal file descriptor
+   uint64_t        startTime;  //!< Export window stamped on every record
+   uint64_t        endTime;
+   double          framerate;
+   pthread_mutex_t lock;       //!< Serializes appends
+} EXPORT_JOURNAL;
+
+/**
+ * \brief Opens a journal for appending
+ * \param [in] resume    keep existing checkpoints instead of truncating
+ * \param [in] startTime start of the export window in microseconds
+ * \param [in] endTime   end of the export window in microseconds
+ * \param [in] framerate framerate of the export
+ * \return true on success
+ **/
+bool exportJournalOpen( EXPORT_JOURNAL * journal
+                      , const char * fileName
+                      , bool resume
+                      , uint64_t startTime
+                      , uint64_t endTime
+                      , double framerate
+                      );
+
+/**
+ * \brief Appends a checkpoint and waits until it is on disk. The data it
+ *        describes must already be durable
+ * \return true on success
+ **/
+bool exportJournalCheckpoint( EXPORT_JOURNAL * journal
+                            , uint32_t mcamID
+                            , uint64_t timestamp
+                            , uint64_t lastId
+                            , uint64_t offset
+                            , uint64_t frames
+                            , bool done
+                            );
+
+/**
+ * \brief Closes a journal
+ **/
+void exportJournalClose( EXPORT_JOURNAL * journal );
+
+/**
+ * \brief Reads the latest valid checkpoint of each microcamera. Entries of
+ *        latest for microcameras without a checkpoint are zeroed
+ * \param [in]  startTime export window and framerate the checkpoints must
+ * \param [in]  endTime   have been taken with
+ * \param [in]  framerate
+ * \param [in]  mcamIDs   microcameras to look up
+ * \param [out] latest    one record per entry of mcamIDs
+ * \return number of microcameras that have a checkpoint, -1 if the journal
+ *         could not be read or EXPORT_JOURNAL_MISMATCH if it was written by
+ *         an export of another window or framerate
+ **/
+int exportJournalRead( const char * fileName
+                     , uint64_t startTime
+                     , uint64_t endTime
+                     , double framerate
+                     , const uint32_t * mcamIDs
+                     , int numMCams
+                     , EXPORT_JOURNAL_RECORD * latest
+                     );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/******************************************************************************
+ *
+ * FrameCursor.c
+ *
+ * Timestamp driven request cursor. See FrameCursor.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "FrameCursor.h"
+
+/**
+ * \brief Returns true if id is marked in the duplicate window
+ **/
+static bool isSeen( const FRAME_CURSOR * cursor, uint64_t id )
+{
+   uint64_t bit = id % FRAME_CURSOR_WINDOW;
+   return (cursor->seen[bit/64] >> (bit%64)) & 1;
+}
+
+/**
+ * \brief Marks id in the duplicate window
+ **/
+static void markSeen( FRAME_CURSOR * cursor, uint64_t id )
+{
+   uint64_t bit = id % FRAME_CURSOR_WINDOW;
+   cursor->seen[bit/64] |= (uint64_t)1 << (bit%64);
+}
+
+/**
+ * \brief Moves the top of the duplicate window to id, clearing the ids that
+ *        enter the window
+ **/
+static void advanceWindow( FRAME_CURSOR * cursor, uint64_t id )
+{
+   if( id - cursor->maxId >= FRAME_CURSOR_WINDOW ) {
+      memset( cursor->seen, 0, sizeof(cursor->seen));
+      return;
+   }
+
+   for( uint64_t i = cursor->maxId + 1; i <= id; i++ ) {
+      uint64_t bit = i % FRAME_CURSOR_WINDOW;
+      cursor->seen[bit/64] &= ~((uint64_t)1 << (bit%64));
+   }
+}
+
+/**
+ * \brief Initializes a cursor for [startTime, endTime)
+ **/
+void frameCursorInit( FRAME_CURSOR * cursor
+                    , uint64_t startTime
+                    , uint64_t endTime
+                    , double period
+                    )
+{
+   memset( cursor, 0, sizeof(*cursor));
+   cursor->nextTime = startTime;
+   cursor->endTime  = endTime;
+   cursor->period   = period;
+}
+
+/**
+ * \brief Continues a walk that was interrupted after frame lastId
+ **/
+void frameCursorResume( FRAME_CURSOR * cursor, uint64_t lastId, uint64_t lastTimestamp )
+{
+   cursor->resumed  = true;
+   cursor->resumeId = lastId;
+   cursor->nextTime = lastTimestamp + (uint64_t)(cursor->period * 1.25 + 0.5);
+}
+
+/**
+ * \brief Returns the next time to request and counts the request
+ **/
+bool frameCursorNext( FRAME_CURSOR * cursor, uint64_t * requestTime )
+{
+   if( cursor->nextTime >= cursor->endTime ) {
+      return false;
+   }
+
+   *requestTime = cursor->nextTime;
+   cursor->nextTime += (uint64_t)(cursor->period + 0.5);
+   cursor->outstanding++;
+   cursor->stats.requests++;
+
+   return true;
+}
+
+/**
+ * \brief Records the result of a request issued by frameCursorNext
+ **/
+bool frameCursorUpdate( FRAME_CURSOR * cursor, const FRAME * frame )
+{
+   cursor->outstanding--;
+
+   if( frame->m_image == NULL ) {
+      cursor->stats.failures++;
+      return false;
+   }
+
+   uint64_t id = frame->m_metadata.m_id;
+   uint64_t timestamp = frame->m_metadata.m_timestamp;
+
+   /* A duplicate, or a frame written before a resume, leaves the cursor
+    * where it is. frameCursorNext already moved the next request a period
+    * past this one */
+   bool inWindow = cursor->haveFrame
+                && id <= cursor->maxId
+                && cursor->maxId - id < FRAME_CURSOR_WINDOW;
+   if(( inWindow && isSeen( cursor, id )) || ( cursor->resumed && id <= cursor->resumeId )) {
+      cursor->stats.duplicates++;
+      return false;
+   }
+
+   if( !cursor->haveFrame ) {
+      cursor->haveFrame    = true;
+      cursor->minId        = id;
+      cursor->minTimestamp = timestamp;
+      cursor->maxId        = id;
+      cursor->maxTimestamp = timestamp;
+   } else if( id > cursor->maxId ) {
+      advanceWindow( cursor, id );
+      cursor->maxId        = id;
+      cursor->maxTimestamp = timestamp;
+   } else if( id < cursor->minId ) {
+      cursor->minId        = id;
+      cursor->minTimestamp = timestamp;
+   }
+   if( cursor->maxId - id < FRAME_CURSOR_WINDOW ) {
+      markSeen( cursor, id );
+   }
+   cursor->stats.frames++;
+
+   /* Frame ids are consecutive, so the average period across the frames
+    * received is exact and does not accumulate rounding error */
+   if( cursor->maxId > cursor->minId && cursor->maxTimestamp > cursor->minTimestamp ) {
+      cursor->period = (double)(cursor->maxTimestamp - cursor->minTimestamp)
+                     / (double)(cursor->maxId - cursor->minId);
+   }
+
+   /* Re-anchor on the newest frame. A request returns the frame at or
+    * before its time, so aim a quarter period past where the next frame is
+    * expected; a frame that lands a little late is then not missed and
+    * returned as a duplicate of this one. With other requests still in
+    * flight the cursor only moves forward so those requests are not
+    * repeated */
+   uint64_t next = cursor->maxTimestamp + (uint64_t)(cursor->period * 1.25 + 0.5);
+   if( cursor->outstanding == 0 || next > cursor->nextTime ) {
+      cursor->nextTime = next;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Returns the accounting for a cursor, including missing frames
+ **/
+FRAME_CURSOR_STATS frameCursorGetStats( const FRAME_CURSOR * cursor )
+{
+   FRAME_CURSOR_STATS stats = cursor->stats;
+   if( cursor->haveFrame ) {
+      uint64_t span = cursor->maxId - cursor->minId + 1;
+      stats.missing = span > stats.frames ? span - stats.frames : 0;
+   }
+
+   return stats;
+}
+
+/**
+ * \brief Adds the counts in stats to total
+ **/
+void frameCursorAddStats( FRAME_CURSOR_STATS * total, FRAME_CURSOR_STATS stats )
+{
+   total->requests   += stats.requests;
+   total->frames     += stats.frames;
+   total->duplicates += stats.duplicates;
+   total->failures   += stats.failures;
+   total->missing    += stats.missing;
+}
+
+/**
+ * \brief Prints a one line summary of stats
+ **/
+void frameCursorPrintStats( FRAME_CURSOR_STATS stats )
+{
+   printf("Requests: %lu frames: %lu duplicates: %lu failed: %lu missing: %lu efficiency: %.1f%%\n",
+          stats.requests,
+          stats.frames,
+          stats.duplicates,
+          stats.failures,
+          stats.missing,
+          stats.requests > 0 ? 100.0*stats.frames/stats.requests : 0.0);
+}
@@ -0,0 +1,108 @@
+/******************************************************************************
+ *
+ * FrameCursor.h
+ *
+ * Chooses the request times used to walk one microcamera through a time
+ * range. Instead of stepping by a fixed frame length computed from the
+ * nominal framerate, the cursor re-anchors on the timestamp of each frame
+ * the API returns and refines its estimate of the frame period from the
+ * frame ids it has seen. Frames whose m_id was already returned are
+ * reported as duplicates so callers can drop them.
+ *
+ * A cursor is not thread safe. Callers that share one between threads
+ * must serialize calls to it.
+ *
+ *****************************************************************************/
+#ifndef FRAME_CURSOR_H
+#define FRAME_CURSOR_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CURSOR_WINDOW 1024 //!< Number of recent frame ids checked for duplicates
+
+/**
+ * \brief Request accounting for one or more cursors
+ **/
+typedef struct {
+   uint64_t requests;    //!< Frame requests issued
+   uint64_t frames;      //!< Distinct frames received
+   uint64_t duplicates;  //!< Frames received again with an id already seen
+   uint64_t failures;    //!< Requests that returned no frame
+   uint64_t missing;     //!< Frame ids inside the received range never received
+} FRAME_CURSOR_STATS;
+
+/**
+ * \brief Request time cursor for one microcamera
+ **/
+typedef struct {
+   uint64_t endTime;                        //!< Requests stop at this time
+   uint64_t nextTime;                       //!< Time of the next request
+   double   period;                         //!< Current frame period estimate in microseconds
+   int      outstanding;                    //!< Requests issued but not yet updated
+   bool     haveFrame;                      //!< Set once a frame has been received
+   bool     resumed;                        //!< Set if frames up to resumeId were received earlier
+   uint64_t resumeId;                       //!< Highest frame id received before a resume
+   uint64_t minId;                          //!< Lowest frame id received
+   uint64_t minTimestamp;                   //!< Timestamp of minId
+   uint64_t maxId;                          //!< Highest frame id received
+   uint64_t maxTimestamp;                   //!< Timestamp of maxId
+   uint64_t seen[FRAME_CURSOR_WINDOW/64];   //!< Bitmap of ids in (maxId-WINDOW, maxId]
+   FRAME_CURSOR_STATS stats;                //!< Accounting for this cursor
+} FRAME_CURSOR;
+
+/**
+ * \brief Initializes a cursor for [startTime, endTime)
+ * \param [in] period nominal frame period in microseconds
+ **/
+void frameCursorInit( FRAME_CURSOR * cursor
+                    , uint64_t startTime
+                    , uint64_t endTime
+                    , double period
+                    );
+
+/**
+ * \brief Continues a walk that was interrupted after frame lastId. The next
+ *        request aims past lastTimestamp, and frames with ids up to lastId
+ *        are reported as duplicates
+ **/
+void frameCursorResume( FRAME_CURSOR * cursor, uint64_t lastId, uint64_t lastTimestamp );
+
+/**
+ * \brief Returns the next time to request and counts the request
+ * \return false once the cursor has passed endTime
+ **/
+bool frameCursorNext( FRAME_CURSOR * cursor, uint64_t * requestTime );
+
+/**
+ * \brief Records the result of a request issued by frameCursorNext
+ * \return true if frame holds an image that has not been seen before, false
+ *         if the request failed or the frame is a duplicate
+ **/
+bool frameCursorUpdate( FRAME_CURSOR * cursor, const FRAME * frame );
+
+/**
+ * \brief Returns the accounting for a cursor, including missing frames
+ **/
+FRAME_CURSOR_STATS frameCursorGetStats( const FRAME_CURSOR * cursor );
+
+/**
+ * \brief Adds the counts in stats to total
+ **/
+void frameCursorAddStats( FRAME_CURSOR_STATS * total, FRAME_CURSOR_STATS stats );
+
+/**
+ * \brief Prints a one line summary of stats
+ **/
+void frameCursorPrintStats( FRAME_CURSOR_STATS stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,472 @@
+/******************************************************************************
+ *
+ * FrameDispatcher.c
+ *
+ * Frame callback dispatch onto a worker pool. See FrameDispatcher.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FrameDispatcher.h"
+#include "Metrics.h"
+
+static const char * g_policyNames[] = { "latest", "drop-oldest", "block" };
+
+/* Dispatchers between init and stop. The API may call a receiver callback
+ * it read just before setMCamFrameCallback replaced it, so dispatchFrame
+ * only follows its data pointer to a dispatcher in this list */
+static pthread_mutex_t g_liveLock = PTHREAD_MUTEX_INITIALIZER;
+static FRAME_DISPATCHER * g_live = NULL;
+
+/**
+ * \brief Returns the index of a microcamera, or -1 if it is not dispatched
+ **/
+static int findMCam( FRAME_DISPATCHER * d, uint32_t mcamID )
+{
+   for( int i = 0; i < d->numMCams; i++ ) {
+      if( d->mcams[i].mcamID == mcamID ) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+/**
+ * \brief Returns queued slot i of microcamera m
+ **/
+static FRAME_DISPATCH_SLOT * slot( FRAME_DISPATCHER * d, int m, int i )
+{
+   return &d->slots[m * d->depth + ( d->mcams[m].head + i ) % d->depth];
+}
+
+/**
+ * \brief Finds a microcamera with a queued frame that no worker is
+ *        delivering, starting after the last one served
+ * \return its index, or -1 if there is none
+ **/
+static int nextMCam( FRAME_DISPATCHER * d )
+{
+   for( int i = 0; i < d->numMCams; i++ ) {
+      int m = ( d->next + i ) % d->numMCams;
+      if( d->mcams[m].count > 0 && !d->mcams[m].busy ) {
+         d->next = m + 1;
+         return m;
+      }
+   }
+
+   return -1;
+}
+
+/**
+ * \brief Worker thread. Delivers queued frames until the dispatcher is
+ *        stopped and drained
+ **/
+static void * workerThread( void * data )
+{
+   FRAME_DISPATCHER * d = (FRAME_DISPATCHER *)data;
+
+   pthread_mutex_lock( &d->lock );
+   while( true ) {
+      int m = nextMCam( d );
+      if( m < 0 ) {
+         if( d->stopping && d->pending == 0 ) {
+            break;
+         }
+         pthread_cond_wait( &d->work, &d->lock );
+         continue;
+      }
+
+      FRAME_DISPATCH_MCAM * mcam = &d->mcams[m];
+      FRAME_DISPATCH_SLOT taken = *slot( d, m, 0 );
+      mcam->head = ( mcam->head + 1 ) % d->depth;
+      mcam->count--;
+      mcam->busy = true;
+      mcam->delivering = taken.buffer;
+      d->pending--;
+      pthread_mutex_unlock( &d->lock );
+
+      metricsRecord( METRIC_DISPATCH_QUEUE, taken.queued );
+      d->callback.f( taken.frame, d->callback.data );
+
+      //A held buffer comes back through frameDispatcherRelease
+      pthread_mutex_lock( &d->lock );
+      if( !mcam->held ) {
+         d->freeBuffers[d->numFree++] = taken.buffer;
+      }
+      mcam->held = false;
+      mcam->busy = false;
+      mcam->stats.delivered++;
+      pthread_cond_broadcast( &d->space );
+
+      //Another worker may be waiting for this mcam or for the queues to drain
+      if( mcam->count > 0 || d->stopping ) {
+         pthread_cond_broadcast( &d->work );
+      }
+   }
+   pthread_mutex_unlock( &d->lock );
+
+   return NULL;
+}
+
+/**
+ * \brief Ends a push counted in pushing and releases the lock. The last push
+ *        to end while stopping wakes frameDispatcherStop
+ * \return rc
+ **/
+static bool endPush( FRAME_DISPATCHER * d, bool rc )
+{
+   d->pushing--;
+   if( d->stopping && d->pushing == 0 ) {
+      pthread_cond_broadcast( &d->idle );
+   }
+   pthread_mutex_unlock( &d->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Allocates a dispatcher and starts its workers
+ **/
+bool frameDispatcherInit( FRAME_DISPATCHER * dispatcher
+                        , const uint32_t * mcamIDs
+                        , int numMCams
+                        , FRAME_DISPATCH_POLICY policy
+                        , int depth
+                        , int numWorkers
+                        , MICRO_CAMERA_FRAME_CALLBACK callback
+                        )
+{
+   FRAME_DISPATCHER * d = dispatcher;
+   memset( d, 0, sizeof(*d));
+   if( policy == FRAME_DISPATCH_LATEST ) {
+      depth = 1;
+   }
+   if( numMCams < 1 || depth < 1 || numWorkers < 1 || callback.f == NULL ) {
+      return false;
+   }
+
+   //Every slot can be full while each receiver copies and each worker delivers
+   d->numBuffers  = numMCams * ( depth + 1 ) + numWorkers;
+   d->mcams       = (FRAME_DISPATCH_MCAM *)calloc( numMCams, sizeof(FRAME_DISPATCH_MCAM));
+   d->slots       = (FRAME_DISPATCH_SLOT *)calloc( (size_t)numMCams * depth, sizeof(FRAME_DISPATCH_SLOT));
+   d->buffers     = (void **)calloc( d->numBuffers, sizeof(void *));
+   d->bufferSizes = (uint64_t *)calloc( d->numBuffers, sizeof(uint64_t));
+   d->freeBuffers = (int *)malloc( d->numBuffers * sizeof(int));
+   d->workers     = (pthread_t *)malloc( numWorkers * sizeof(pthread_t));
+   if( d->mcams == NULL || d->slots == NULL || d->buffers == NULL || d->bufferSizes == NULL
+    || d->freeBuffers == NULL || d->workers == NULL ) {
+      frameDispatcherDestroy( d );
+      return false;
+   }
+
+   for( int i = 0; i < numMCams; i++ ) {
+      d->mcams[i].mcamID = mcamIDs[i];
+   }
+   for( int i = 0; i < d->numBuffers; i++ ) {
+      d->freeBuffers[i] = i;
+   }
+   d->numFree  = d->numBuffers;
+   d->numMCams = numMCams;
+   d->depth    = depth;
+   d->policy   = policy;
+   d->callback = callback;
+   pthread_mutex_init( &d->lock, NULL );
+   pthread_cond_init( &d->work, NULL );
+   pthread_cond_init( &d->space, NULL );
+   pthread_cond_init( &d->idle, NULL );
+
+   for( int i = 0; i < numWorkers; i++ ) {
+      if( pthread_create( &d->workers[i], NULL, workerThread, d ) != 0 ) {
+         printf("Unable to start dispatch worker %d\n", i);
+         break;
+      }
+      d->numWorkers++;
+   }
+   if( d->numWorkers == 0 ) {
+      frameDispatcherDestroy( d );
+      return false;
+   }
+
+   pthread_mutex_lock( &g_liveLock );
+   d->nextLive = g_live;
+   g_live = d;
+   pthread_mutex_unlock( &g_liveLock );
+
+   return true;
+}
+
+/**
+ * \brief Copies a frame and queues it for the workers. Called with the lock
+ *        held and the push counted in pushing, so stopping waits for the
+ *        copy, which is made without the lock
+ **/
+static bool pushCounted( FRAME_DISPATCHER * d, FRAME frame )
+{
+   int m = ( frame.m_image != NULL ) ? findMCam( d, frame.m_metadata.m_camId ) : -1;
+   if( m < 0 ) {
+      return endPush( d, false );
+   }
+   FRAME_DISPATCH_MCAM * mcam = &d->mcams[m];
+   mcam->stats.received++;
+
+   //Only block waits for a slot. The other policies replace a queued frame
+   bool waited = false;
+   if( d->policy == FRAME_DISPATCH_BLOCK ) {
+      while( !d->stopping && ( d->numFree == 0 || mcam->count == d->depth )) {
+         waited = true;
+         pthread_cond_wait( &d->space, &d->lock );
+      }
+   }
+   if( waited ) {
+      mcam->stats.blocked++;
+   }
+   if( d->stopping || d->numFree == 0 ) {
+      mcam->stats.dropped++;
+      return endPush( d, false );
+   }
+   int buffer = d->freeBuffers[--d->numFree];
+   pthread_mutex_unlock( &d->lock );
+
+   //Only this thread holds the buffer, so copy without the lock
+   uint64_t size = frame.m_metadata.m_size;
+   if( d->bufferSizes[buffer] < size ) {
+      void * grown = realloc( d->buffers[buffer], size );
+      if( grown == NULL ) {
+         pthread_mutex_lock( &d->lock );
+         d->freeBuffers[d->numFree++] = buffer;
+         mcam->stats.dropped++;
+         return endPush( d, false );
+      }
+      d->buffers[buffer] = grown;
+      d->bufferSizes[buffer] = size;
+   }
+   memcpy( d->buffers[buffer], frame.m_image, size );
+   frame.m_image = d->buffers[buffer];
+
+   pthread_mutex_lock( &d->lock );
+   if( d->stopping ) {
+      d->freeBuffers[d->numFree++] = buffer;
+      mcam->stats.dropped++;
+      return endPush( d, false );
+   }
+   if( mcam->count == d->depth ) {
+      FRAME_DISPATCH_SLOT * oldest = slot( d, m, 0 );
+      d->freeBuffers[d->numFree++] = oldest->buffer;
+      mcam->head = ( mcam->head + 1 ) % d->depth;
+      mcam->count--;
+      mcam->stats.dropped++;
+      d->pending--;
+   }
+   FRAME_DISPATCH_SLOT * queued = slot( d, m, mcam->count );
+   queued->frame  = frame;
+   queued->buffer = buffer;
+   queued->queued = metricsNow();
+   mcam->count++;
+   d->pending++;
+   pthread_cond_signal( &d->work );
+
+   return endPush( d, true );
+}
+
+/**
+ * \brief Copies a frame and queues it for the workers
+ **/
+bool frameDispatcherPush( FRAME_DISPATCHER * dispatcher, FRAME frame )
+{
+   pthread_mutex_lock( &dispatcher->lock );
+   dispatcher->pushing++;
+
+   return pushCounted( dispatcher, frame );
+}
+
+/**
+ * \brief Receiver callback that pushes the frame to the dispatcher in data,
+ *        unless it was stopped already
+ **/
+static void dispatchFrame( FRAME frame, void * data )
+{
+   pthread_mutex_lock( &g_liveLock );
+   FRAME_DISPATCHER * d = g_live;
+   while( d != NULL && d != data ) {
+      d = d->nextLive;
+   }
+   if( d == NULL ) {
+      pthread_mutex_unlock( &g_liveLock );
+      return;
+   }
+   pthread_mutex_lock( &d->lock );
+   d->pushing++;
+   pthread_mutex_unlock( &g_liveLock );
+
+   pushCounted( d, frame );
+}
+
+/**
+ * \brief Returns a callback for setMCamFrameCallback
+ **/
+MICRO_CAMERA_FRAME_CALLBACK frameDispatcherCallback( FRAME_DISPATCHER * dispatcher )
+{
+   MICRO_CAMERA_FRAME_CALLBACK callback;
+   callback.f    = dispatchFrame;
+   callback.data = dispatcher;
+
+   return callback;
+}
+
+/**
+ * \brief Stops accepting frames, waits for pushes in progress, delivers the
+ *        queued ones and joins the workers
+ **/
+void frameDispatcherStop( FRAME_DISPATCHER * dispatcher )
+{
+   FRAME_DISPATCHER * d = dispatcher;
+   if( d->numWorkers == 0 ) {
+      return;
+   }
+
+   pthread_mutex_lock( &g_liveLock );
+   FRAME_DISPATCHER ** link = &g_live;
+   while( *link != NULL && *link != d ) {
+      link = &(*link)->nextLive;
+   }
+   if( *link != NULL ) {
+      *link = d->nextLive;
+   }
+   pthread_mutex_unlock( &g_liveLock );
+
+   pthread_mutex_lock( &d->lock );
+   d->stopping = true;
+   pthread_cond_broadcast( &d->work );
+   pthread_cond_broadcast( &d->space );
+
+   //A receiver may still be copying into a pool buffer without the lock
+   while( d->pushing > 0 ) {
+      pthread_cond_wait( &d->idle, &d->lock );
+   }
+   pthread_mutex_unlock( &d->lock );
+
+   for( int i = 0; i < d->numWorkers; i++ ) {
+      pthread_join( d->workers[i], NULL );
+   }
+   d->numWorkers = 0;
+}
+
+/**
+ * \brief Keeps the buffer of the frame being delivered past the callback
+ **/
+int frameDispatcherHold( FRAME_DISPATCHER * dispatcher, FRAME frame )
+{
+   FRAME_DISPATCHER * d = dispatcher;
+   int buffer = -1;
+
+   pthread_mutex_lock( &d->lock );
+   int m = findMCam( d, frame.m_metadata.m_camId );
+   if( m >= 0 && d->mcams[m].busy && !d->mcams[m].held
+    && d->buffers[d->mcams[m].delivering] == frame.m_image ) {
+      d->mcams[m].held = true;
+      buffer = d->mcams[m].delivering;
+   }
+   pthread_mutex_unlock( &d->lock );
+
+   return buffer;
+}
+
+/**
+ * \brief Returns a held buffer to the pool
+ **/
+void frameDispatcherRelease( FRAME_DISPATCHER * dispatcher, int buffer )
+{
+   pthread_mutex_lock( &dispatcher->lock );
+   dispatcher->freeBuffers[dispatcher->numFree++] = buffer;
+   pthread_cond_broadcast( &dispatcher->space );
+   pthread_mutex_unlock( &dispatcher->lock );
+}
+
+/**
+ * \brief Returns the accounting of a microcamera
+ **/
+bool frameDispatcherGetStats( FRAME_DISPATCHER * dispatcher
+                            , uint32_t mcamID
+                            , FRAME_DISPATCH_STATS * stats
+                            )
+{
+   pthread_mutex_lock( &dispatcher->lock );
+   int m = findMCam( dispatcher, mcamID );
+   if( m >= 0 ) {
+      *stats = dispatcher->mcams[m].stats;
+   }
+   pthread_mutex_unlock( &dispatcher->lock );
+
+   return m >= 0;
+}
+
+/**
+ * \brief Prints the accounting of every microcamera
+ **/
+void frameDispatcherPrintStats( FRAME_DISPATCHER * dispatcher )
+{
+   printf("Dispatch policy %s, %d frames per mcam\n",
+          g_policyNames[dispatcher->policy],
+          dispatcher->depth);
+   printf("%8s %10s %10s %10s %10s\n", "mcam", "received", "delivered", "dropped", "blocked");
+
+   pthread_mutex_lock( &dispatcher->lock );
+   for( int i = 0; i < dispatcher->numMCams; i++ ) {
+      const FRAME_DISPATCH_MCAM * mcam = &dispatcher->mcams[i];
+      printf("%8u %10lu %10lu %10lu %10lu\n",
+             mcam->mcamID,
+             mcam->stats.received,
+             mcam->stats.delivered,
+             mcam->stats.dropped,
+             mcam->stats.blocked);
+   }
+   pthread_mutex_unlock( &dispatcher->lock );
+}
+
+/**
+ * \brief Parses a policy name
+ **/
+bool frameDispatchPolicyParse( const char * name, FRAME_DISPATCH_POLICY * policy )
+{
+   for( int i = 0; i < (int)( sizeof(g_policyNames) / sizeof(g_policyNames[0])); i++ ) {
+      if( !strcmp( name, g_policyNames[i] )) {
+         *policy = (FRAME_DISPATCH_POLICY)i;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * \brief Stops the dispatcher if needed and frees it
+ **/
+void frameDispatcherDestroy( FRAME_DISPATCHER * dispatcher )
+{
+   FRAME_DISPATCHER * d = dispatcher;
+
+   frameDispatcherStop( d );
+   //The callback is only set once the lock was initialized
+   if( d->callback.f != NULL ) {
+      pthread_cond_destroy( &d->idle );
+      pthread_cond_destroy( &d->space );
+      pthread_cond_destroy( &d->work );
+      pthread_mutex_destroy( &d->lock );
+   }
+   if( d->buffers != NULL ) {
+      for( int i = 0; i < d->numBuffers; i++ ) {
+         free( d->buffers[i] );
+      }
+   }
+
+   free( d->mcams );
+   free( d->slots );
+   free( d->buffers );
+   free( d->bufferSizes );
+   free( d->freeBuffers );
+   free( d->workers );
+   memset( d, 0, sizeof(*d));
+}
@@ -0,0 +1,191 @@
+/******************************************************************************
+ *
+ * FrameDispatcher.h
+ *
+ * Moves frame callbacks off the API's receiver threads. The dispatcher is
+ * set as the frame callback: it copies each frame into a pooled buffer,
+ * queues it for its microcamera and returns, so a slow consumer (disk,
+ * Python, a GUI) never stalls reception. A pool of worker threads calls the
+ * user callback with the copy. Frames of one microcamera are delivered in
+ * order by one worker at a time, and microcameras are served round robin.
+ *
+ * When a microcamera's queue is full the policy decides what happens:
+ *  - latest:      the queue holds one frame and a new frame replaces it
+ *  - drop-oldest: the oldest queued frame is dropped for the new one
+ *  - block:       the receiver thread waits for the workers
+ * Drops are counted per microcamera.
+ *
+ * Buffers are allocated once per queue slot and grow to the largest frame,
+ * so steady state dispatch does not allocate. A buffer is only valid until
+ * the user callback returns, unless the callback holds it with
+ * frameDispatcherHold. A held buffer stays out of the pool until
+ * frameDispatcherRelease, so frames are dropped, or receivers block, while
+ * too many are held.
+ *
+ *****************************************************************************/
+#ifndef FRAME_DISPATCHER_H
+#define FRAME_DISPATCHER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_DISPATCH_DEPTH 8   //!< Default frames queued per microcamera
+
+/**
+ * \brief What to do with a frame whose microcamera queue is full
+ **/
+typedef enum {
+   FRAME_DISPATCH_LATEST,       //!< Keep only the newest frame
+   FRAME_DISPATCH_DROP_OLDEST,  //!< Drop the oldest queued frame
+   FRAME_DISPATCH_BLOCK         //!< Wait for the workers
+} FRAME_DISPATCH_POLICY;
+
+/**
+ * \brief Dispatch accounting of one microcamera
+ **/
+typedef struct {
+   uint64_t received;   //!< Frames passed to the dispatcher
+   uint64_t delivered;  //!< Frames passed to the user callback
+   uint64_t dropped;    //!< Frames dropped by the policy or while stopping
+   uint64_t blocked;    //!< Frames the receiver thread waited to queue
+} FRAME_DISPATCH_STATS;
+
+/**
+ * \brief A queued copy of a frame
+ **/
+typedef struct {
+   FRAME    frame;      //!< Frame with m_image pointing at the buffer
+   int      buffer;     //!< Pool buffer holding the image
+   uint64_t queued;     //!< metricsNow() when the frame was queued
+} FRAME_DISPATCH_SLOT;
+
+/**
+ * \brief Queue state of one microcamera
+ **/
+typedef struct {
+   uint32_t             mcamID;
+   int                  head;       //!< First queued slot
+   int                  count;      //!< Frames queued
+   bool                 busy;       //!< A worker is delivering a frame of this mcam
+   int                  delivering; //!< Buffer of the frame being delivered
+   bool                 held;       //!< The user callback held the buffer being delivered
+   FRAME_DISPATCH_STATS stats;
+} FRAME_DISPATCH_MCAM;
+
+/**
+ * \brief Frame dispatcher for a fixed list of microcameras
+ **/
+typedef struct FRAME_DISPATCHER {
+   FRAME_DISPATCH_POLICY policy;
+   int                   depth;        //!< Frames queued per microcamera
+   int                   numMCams;
+   FRAME_DISPATCH_MCAM * mcams;
+   FRAME_DISPATCH_SLOT * slots;        //!< depth slots per microcamera
+   void **               buffers;      //!< Image buffer pool
+   uint64_t *            bufferSizes;  //!< Allocated bytes of each buffer
+   int *                 freeBuffers;  //!< Stack of unused buffers
+   int                   numFree;
+   int                   numBuffers;
+   int                   pending;      //!< Frames queued over all microcameras
+   int                   next;         //!< Microcamera the next worker looks at first
+   bool                  stopping;     //!< Set once no more frames are accepted
+   int                   pushing;      //!< Pushes between taking the lock and returning
+   MICRO_CAMERA_FRAME_CALLBACK callback;
+   pthread_t *           workers;
+   int                   numWorkers;
+   pthread_mutex_t       lock;         //!< Guards all fields above
+   pthread_cond_t        work;         //!< Signaled when a frame can be delivered
+   pthread_cond_t        space;        //!< Signaled when a slot or buffer is freed
+   pthread_cond_t        idle;         //!< Signaled when the last push returns while stopping
+   struct FRAME_DISPATCHER * nextLive; //!< Next dispatcher receivers may still call
+} FRAME_DISPATCHER;
+
+/**
+ * \brief Allocates a dispatcher and starts its workers
+ * \param [in] mcamIDs    microcameras whose frames are dispatched
+ * \param [in] policy     what to do when a queue is full
+ * \param [in] depth      frames queued per microcamera, 1 for FRAME_DISPATCH_LATEST
+ * \param [in] numWorkers threads calling callback
+ * \param [in] callback   user callback, called on a worker thread
+ * \return true on success
+ **/
+bool frameDispatcherInit( FRAME_DISPATCHER * dispatcher
+                        , const uint32_t * mcamIDs
+                        , int numMCams
+                        , FRAME_DISPATCH_POLICY policy
+                        , int depth
+                        , int numWorkers
+                        , MICRO_CAMERA_FRAME_CALLBACK callback
+                        );
+
+/**
+ * \brief Copies a frame and queues it for the workers. Runs on the caller's
+ *        thread and only waits with FRAME_DISPATCH_BLOCK
+ * \return false if the frame was not queued
+ **/
+bool frameDispatcherPush( FRAME_DISPATCHER * dispatcher, FRAME frame );
+
+/**
+ * \brief Returns a callback for setMCamFrameCallback that pushes every
+ *        received frame to the dispatcher
+ **/
+MICRO_CAMERA_FRAME_CALLBACK frameDispatcherCallback( FRAME_DISPATCHER * dispatcher );
+
+/**
+ * \brief Stops accepting frames, waits for pushes already copying a frame,
+ *        delivers the queued ones and joins the workers. Once it returns the
+ *        receiver callback ignores the dispatcher, even if the API calls a
+ *        callback it read before it was replaced, so it may be freed
+ **/
+void frameDispatcherStop( FRAME_DISPATCHER * dispatcher );
+
+/**
+ * \brief Keeps the buffer of a frame after the user callback returns. Call it
+ *        at most once, from the callback delivering frame
+ * \return the buffer to pass to frameDispatcherRelease, or -1 if frame is
+ *         not being delivered
+ **/
+int frameDispatcherHold( FRAME_DISPATCHER * dispatcher, FRAME frame );
+
+/**
+ * \brief Returns a buffer held by frameDispatcherHold to the pool. Every held
+ *        buffer must be released before frameDispatcherDestroy
+ **/
+void frameDispatcherRelease( FRAME_DISPATCHER * dispatcher, int buffer );
+
+/**
+ * \brief Returns the accounting of a microcamera
+ * \return false if the microcamera is not dispatched
+ **/
+bool frameDispatcherGetStats( FRAME_DISPATCHER * dispatcher
+                            , uint32_t mcamID
+                            , FRAME_DISPATCH_STATS * stats
+                            );
+
+/**
+ * \brief Prints the accounting of every microcamera
+ **/
+void frameDispatcherPrintStats( FRAME_DISPATCHER * dispatcher );
+
+/**
+ * \brief Parses "latest", "drop-oldest" or "block"
+ * \return false if name is not a policy
+ **/
+bool frameDispatchPolicyParse( const char * name, FRAME_DISPATCH_POLICY * policy );
+
+/**
+ * \brief Stops the dispatcher if needed and frees it
+ **/
+void frameDispatcherDestroy( FRAME_DISPATCHER * dispatcher );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,461 @@
+/******************************************************************************
+ *
+ * FrameHandle.c
+ *
+ * Frames for language bindings. See FrameHandle.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#include "FrameHandle.h"
+
+struct FRAME_HANDLE_STREAM {
+   FRAME_DISPATCHER      dispatcher;
+   FRAME_HANDLE_CALLBACK callback;
+   int                   decode;
+   int                   scale;
+   pthread_mutex_t       lock;      //!< Guards kept and stopped
+   int                   kept;      //!< Kept frames not released yet
+   bool                  stopped;   //!< frameHandleStreamStop was called
+};
+
+static pthread_mutex_t g_camerasLock = PTHREAD_MUTEX_INITIALIZER;
+static ACOS_CAMERA     g_cameras[FRAME_HANDLE_MAX_CAMERAS];
+static int             g_numCameras = 0;
+
+/**
+ * \brief libjpeg error handler that returns to the decoder instead of exiting
+ **/
+typedef struct {
+   struct jpeg_error_mgr pub;
+   jmp_buf               jump;
+} DECODE_ERROR;
+
+static void decodeErrorExit( j_common_ptr cinfo )
+{
+   longjmp( ((DECODE_ERROR *)cinfo->err)->jump, 1 );
+}
+
+static void decodeSilent( j_common_ptr cinfo )
+{
+}
+
+/**
+ * \brief Camera callback that adds a camera or updates the one with its ID
+ **/
+static void trackCamera( ACOS_CAMERA cam, void * data )
+{
+   pthread_mutex_lock( &g_camerasLock );
+   int i = 0;
+   while( i < g_numCameras && g_cameras[i].camID != cam.camID ) {
+      i++;
+   }
+   if( i < FRAME_HANDLE_MAX_CAMERAS ) {
+      g_cameras[i] = cam;
+      if( i == g_numCameras ) {
+         g_numCameras++;
+      }
+   }
+   pthread_mutex_unlock( &g_camerasLock );
+}
+
+/**
+ * \brief Copies the tracked camera with the given ID
+ **/
+static bool findCamera( uint32_t camID, ACOS_CAMERA * cam )
+{
+   bool found = false;
+   pthread_mutex_lock( &g_camerasLock );
+   for( int i = 0; i < g_numCameras && !found; i++ ) {
+      if( g_cameras[i].camID == camID ) {
+         *cam  = g_cameras[i];
+         found = true;
+      }
+   }
+   pthread_mutex_unlock( &g_camerasLock );
+
+   return found;
+}
+
+/**
+ * \brief Fills the fixed fields of a handle from its frame
+ **/
+static void describeFrame( FRAME_HANDLE * h )
+{
+   const FRAME_METADATA * meta = &h->frame.m_metadata;
+   h->frameId   = meta->m_id;
+   h->timestamp = meta->m_timestamp;
+   h->mcamID    = meta->m_camId;
+   h->mode      = meta->m_mode;
+   h->tile      = meta->m_tile;
+   h->width     = meta->m_width;
+   h->height    = meta->m_height;
+   h->size      = meta->m_size;
+   h->data      = h->frame.m_image;
+}
+
+/**
+ * \brief Decodes the JPEG of a handle into a new pixel buffer
+ * \return false if the frame is not a JPEG or could not be decoded
+ **/
+static bool decodeFrame( FRAME_HANDLE * h, int decode, int scale )
+{
+   if( h->data == NULL || h->mode != ATL_MODE_JPEG ) {
+      return false;
+   }
+
+   struct jpeg_decompress_struct cinfo;
+   DECODE_ERROR error;
+   uint8_t * volatile pixels = NULL;
+   cinfo.err = jpeg_std_error( &error.pub );
+   error.pub.error_exit     = decodeErrorExit;
+   error.pub.output_message = decodeSilent;
+   if( setjmp( error.jump )) {
+      jpeg_destroy_decompress( &cinfo );
+      free( pixels );
+      return false;
+   }
+
+   jpeg_create_decompress( &cinfo );
+   jpeg_mem_src( &cinfo, (unsigned char *)h->data, h->size );
+   jpeg_read_header( &cinfo, TRUE );
+
+   cinfo.scale_num       = 1;
+   cinfo.scale_denom     = ( scale == 2 || scale == 4 || scale == 8 ) ? scale : 1;
+   cinfo.out_color_space = ( decode == FRAME_DECODE_LUMA ) ? JCS_GRAYSCALE : JCS_RGB;
+   jpeg_start_decompress( &cinfo );
+
+   size_t rowBytes = (size_t)cinfo.output_width * cinfo.output_components;
+   pixels = (uint8_t *)malloc( rowBytes * cinfo.output_height );
+   if( pixels == NULL ) {
+      jpeg_destroy_decompress( &cinfo );
+      return false;
+   }
+   while( cinfo.output_scanline < cinfo.output_height ) {
+      JSAMPROW row = pixels + cinfo.output_scanline * rowBytes;
+      jpeg_read_scanlines( &cinfo, &row, 1 );
+   }
+
+   h->pixels      = pixels;
+   h->pixelWidth  = cinfo.output_width;
+   h->pixelHeight = cinfo.output_height;
+   h->channels    = cinfo.output_components;
+   h->pixelSize   = rowBytes * cinfo.output_height;
+
+   jpeg_finish_decompress( &cinfo );
+   jpeg_destroy_decompress( &cinfo );
+
+   return true;
+}
+
+/**
+ * \brief Dispatcher callback that passes a pooled frame on as a handle
+ **/
+static void streamFrame( FRAME frame, void * data )
+{
+   FRAME_HANDLE_STREAM * stream = (FRAME_HANDLE_STREAM *)data;
+   FRAME_HANDLE h;
+   memset( &h, 0, sizeof(h));
+   h.frame  = frame;
+   h.stream = stream;
+   describeFrame( &h );
+   if( stream->decode != FRAME_DECODE_NONE ) {
+      decodeFrame( &h, stream->decode, stream->scale );
+   }
+
+   //A kept handle owns the pixels now
+   stream->callback.f( &h, stream->callback.data );
+   if( !h.kept ) {
+      free( (void *)h.pixels );
+   }
+}
+
+/**
+ * \brief Frees a stream once it is stopped and no kept frame is left
+ **/
+static void freeStream( FRAME_HANDLE_STREAM * stream )
+{
+   frameDispatcherDestroy( &stream->dispatcher );
+   pthread_mutex_destroy( &stream->lock );
+   free( stream );
+}
+
+/**
+ * \brief Returns the buffer of a kept frame to the pool of its stream, and
+ *        frees the stream if it was the last one kept after a stop
+ **/
+static void releaseStreamFrame( FRAME_HANDLE_STREAM * stream, int buffer )
+{
+   frameDispatcherRelease( &stream->dispatcher, buffer );
+
+   pthread_mutex_lock( &stream->lock );
+   stream->kept--;
+   bool last = stream->stopped && stream->kept == 0;
+   pthread_mutex_unlock( &stream->lock );
+   if( last ) {
+      freeStream( stream );
+   }
+}
+
+/**
+ * \brief Frame callback left behind by frameHandleStreamStop
+ **/
+static void ignoreFrame( FRAME frame, void * data )
+{
+}
+
+/**
+ * \brief Connects to the camera server and starts tracking its cameras
+ **/
+void frameHandleConnect( const char * ip, int port )
+{
+   connectToCameraServer( ip, port );
+
+   NEW_CAMERA_CALLBACK camCB;
+   camCB.f    = trackCamera;
+   camCB.data = NULL;
+   setNewCameraCallback( camCB );
+}
+
+/**
+ * \brief Lists the IDs of the tracked cameras
+ **/
+int frameHandleCameras( uint32_t * camIDs, int max )
+{
+   pthread_mutex_lock( &g_camerasLock );
+   int n = g_numCameras;
+   for( int i = 0; i < n && i < max; i++ ) {
+      camIDs[i] = g_cameras[i].camID;
+   }
+   pthread_mutex_unlock( &g_camerasLock );
+
+   return n;
+}
+
+/**
+ * \brief Lists the microcameras of a camera
+ **/
+int frameHandleMCams( uint32_t camID, uint32_t * mcamIDs, int max )
+{
+   ACOS_CAMERA cam;
+   if( !findCamera( camID, &cam )) {
+      return -1;
+   }
+
+   //A camera that never was connected reports no microcameras
+   if( cam.mcamList.numMCams == 0 ) {
+      if( setCameraConnection( cam, true, 15 ) != AQ_SUCCESS ) {
+         return -1;
+      }
+      cam.mcamList.numMCams = getCameraNumberOfMCams( cam );
+      trackCamera( cam, NULL );
+   }
+
+   int numMCams = cam.mcamList.numMCams;
+   MICRO_CAMERA * list = (MICRO_CAMERA *)malloc( numMCams * sizeof(MICRO_CAMERA));
+   if( list == NULL ) {
+      return -1;
+   }
+   numMCams = getCameraMCamList( cam, list, numMCams );
+   for( int i = 0; i < numMCams && i < max; i++ ) {
+      mcamIDs[i] = list[i].mcamID;
+   }
+   free( list );
+
+   return numMCams;
+}
+
+/**
+ * \brief Starts or stops a camera receiving data from its microcameras
+ **/
+bool frameHandleSetReceiving( uint32_t camID, bool receive )
+{
+   ACOS_CAMERA cam;
+   if( !findCamera( camID, &cam )) {
+      return false;
+   }
+
+   return setCameraReceivingData( cam, receive, 15 ) == AQ_SUCCESS;
+}
+
+/**
+ * \brief Disconnects every tracked camera
+ **/
+void frameHandleDisconnect( void )
+{
+   pthread_mutex_lock( &g_camerasLock );
+   for( int i = 0; i < g_numCameras; i++ ) {
+      disconnectCamera( g_cameras[i] );
+   }
+   g_numCameras = 0;
+   pthread_mutex_unlock( &g_camerasLock );
+}
+
+/**
+ * \brief Requests a frame like getFrame and optionally decodes it
+ **/
+FRAME_HANDLE * frameHandleGet( uint32_t camID
+                             , uint32_t mcamID
+                             , uint64_t timestamp
+                             , int tiling
+                             , int tile
+                             , int decode
+                             , int scale
+                             )
+{
+   ACOS_CAMERA cam;
+   if( !findCamera( camID, &cam )) {
+      return NULL;
+   }
+   FRAME_HANDLE * h = (FRAME_HANDLE *)calloc( 1, sizeof(FRAME_HANDLE));
+   if( h == NULL ) {
+      return NULL;
+   }
+
+   h->frame = getFrame( cam, mcamID, timestamp, tiling, tile );
+   if( h->frame.m_image == NULL ) {
+      free( h );
+      return NULL;
+   }
+   h->owned = true;
+   describeFrame( h );
+
+   if( decode != FRAME_DECODE_NONE && !decodeFrame( h, decode, scale )) {
+      frameHandleRelease( h );
+      return NULL;
+   }
+
+   return h;
+}
+
+/**
+ * \brief Returns the frame buffer to the API and frees the handle
+ **/
+void frameHandleRelease( FRAME_HANDLE * handle )
+{
+   if( handle == NULL ) {
+      return;
+   }
+   if( handle->stream != NULL ) {
+      releaseStreamFrame( handle->stream, handle->buffer );
+   }
+   else if( handle->owned && !returnPointer( handle->frame.m_image )) {
+      printf("Failed to return frame buffer of microcamera %u\n", handle->mcamID);
+   }
+   free( (void *)handle->pixels );
+   free( handle );
+}
+
+/**
+ * \brief Sets the frame callback to pass every stream frame to callback
+ **/
+FRAME_HANDLE_STREAM * frameHandleStreamStart( const uint32_t * mcamIDs
+                                            , int numMCams
+                                            , FRAME_DISPATCH_POLICY policy
+                                            , int depth
+                                            , int numWorkers
+                                            , int decode
+                                            , int scale
+                                            , FRAME_HANDLE_CALLBACK callback
+                                            )
+{
+   if( callback.f == NULL ) {
+      return NULL;
+   }
+   FRAME_HANDLE_STREAM * stream = (FRAME_HANDLE_STREAM *)calloc( 1, sizeof(FRAME_HANDLE_STREAM));
+   if( stream == NULL ) {
+      return NULL;
+   }
+   stream->callback = callback;
+   stream->decode   = decode;
+   stream->scale    = scale;
+   pthread_mutex_init( &stream->lock, NULL );
+
+   MICRO_CAMERA_FRAME_CALLBACK frameCB;
+   frameCB.f    = streamFrame;
+   frameCB.data = stream;
+   if( !frameDispatcherInit( &stream->dispatcher, mcamIDs, numMCams,
+                             policy, depth, numWorkers, frameCB )) {
+      pthread_mutex_destroy( &stream->lock );
+      free( stream );
+      return NULL;
+   }
+   setMCamFrameCallback( frameDispatcherCallback( &stream->dispatcher ));
+
+   return stream;
+}
+
+/**
+ * \brief Returns the dispatch accounting of one microcamera of a stream
+ **/
+bool frameHandleStreamStats( FRAME_HANDLE_STREAM * stream
+                           , uint32_t mcamID
+                           , FRAME_DISPATCH_STATS * stats
+                           )
+{
+   return frameDispatcherGetStats( &stream->dispatcher, mcamID, stats );
+}
+
+/**
+ * \brief Keeps a stream frame past its callback, taking over its pool buffer
+ *        and pixels
+ **/
+FRAME_HANDLE * frameHandleKeep( const FRAME_HANDLE * handle )
+{
+   FRAME_HANDLE_STREAM * stream = handle->stream;
+   if( stream == NULL || handle->kept ) {
+      return NULL;
+   }
+   FRAME_HANDLE * kept = (FRAME_HANDLE *)malloc( sizeof(FRAME_HANDLE));
+   if( kept == NULL ) {
+      return NULL;
+   }
+   *kept = *handle;
+   kept->buffer = frameDispatcherHold( &stream->dispatcher, handle->frame );
+   if( kept->buffer < 0 ) {
+      free( kept );
+      return NULL;
+   }
+
+   pthread_mutex_lock( &stream->lock );
+   stream->kept++;
+   pthread_mutex_unlock( &stream->lock );
+
+   //The callback's handle still describes the frame but no longer frees it
+   ((FRAME_HANDLE *)handle)->kept = true;
+
+   return kept;
+}
+
+/**
+ * \brief Ignores further frames, delivers the queued ones and frees the
+ *        stream, or leaves that to the release of its last kept frame
+ **/
+void frameHandleStreamStop( FRAME_HANDLE_STREAM * stream )
+{
+   if( stream == NULL ) {
+      return;
+   }
+
+   //Receivers that stay open must not call into the freed dispatcher.
+   //Stopping it waits for those already pushing a frame
+   MICRO_CAMERA_FRAME_CALLBACK ignoreCB;
+   ignoreCB.f    = ignoreFrame;
+   ignoreCB.data = NULL;
+   setMCamFrameCallback( ignoreCB );
+
+   frameDispatcherStop( &stream->dispatcher );
+
+   pthread_mutex_lock( &stream->lock );
+   stream->stopped = true;
+   bool last = stream->kept == 0;
+   pthread_mutex_unlock( &stream->lock );
+   if( last ) {
+      freeStream( stream );
+   }
+}
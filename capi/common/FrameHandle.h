@@ -0,0 +1,174 @@
+/******************************************************************************
+ *
+ * FrameHandle.h
+ *
+ * Frames for language bindings that want to read the native buffers in
+ * place. A FRAME_HANDLE keeps the buffer returned by getFrame until it is
+ * released, which returns it with returnPointer, and describes it with
+ * fixed width fields so ctypes or cffi can map the handle without knowing
+ * the layout of FRAME. Decoding is optional: a handle holds the encoded
+ * JPEG or H.264 bytes and, when asked for, the JPEG decoded to RGB or luma
+ * pixels, optionally scaled down by the IDCT.
+ *
+ * Bindings cannot hold ACOS_CAMERA structs, so cameras are tracked here by
+ * ID. frameHandleConnect sets the new camera callback, replacing any camera
+ * callback set before.
+ *
+ * Stream frames belong to the receiver, so frameHandleStreamStart copies
+ * each one into a pooled buffer through a FrameDispatcher and passes a
+ * handle that is valid until the callback returns. frameHandleKeep keeps
+ * the pooled buffer, without copying it again, until the handle it returns
+ * is released.
+ *
+ *****************************************************************************/
+#ifndef FRAME_HANDLE_H
+#define FRAME_HANDLE_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+#include "FrameDispatcher.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_HANDLE_MAX_CAMERAS 64   //!< Cameras tracked by frameHandleConnect
+
+typedef struct FRAME_HANDLE_STREAM FRAME_HANDLE_STREAM;
+
+/**
+ * \brief Pixels to decode a JPEG frame to
+ **/
+typedef enum {
+   FRAME_DECODE_NONE = 0,   //!< Encoded bytes only
+   FRAME_DECODE_RGB  = 1,   //!< Interleaved 8 bit RGB, rows of 3 * width bytes
+   FRAME_DECODE_LUMA = 2    //!< 8 bit luma plane, rows of width bytes
+} FRAME_DECODE;
+
+/**
+ * \brief A frame and its buffers. Fields up to frame have a fixed layout
+ **/
+typedef struct {
+   uint64_t    frameId;      //!< m_id
+   uint64_t    timestamp;    //!< m_timestamp in microseconds
+   uint32_t    mcamID;       //!< m_camId
+   uint32_t    mode;         //!< ATL_MODE_* of data
+   uint32_t    tile;         //!< ATL_TILE_*
+   uint32_t    width;        //!< Encoded width
+   uint32_t    height;       //!< Encoded height
+   uint32_t    channels;     //!< Bytes per decoded pixel, 0 if not decoded
+   uint32_t    pixelWidth;   //!< Decoded width
+   uint32_t    pixelHeight;  //!< Decoded height
+   uint64_t    size;         //!< Bytes in data
+   uint64_t    pixelSize;    //!< Bytes in pixels
+   const void * data;        //!< Encoded frame
+   const void * pixels;      //!< Decoded frame, or NULL
+   FRAME       frame;        //!< Frame from the API
+   bool        owned;        //!< data must be returned with returnPointer
+   FRAME_HANDLE_STREAM * stream; //!< Stream whose dispatcher pool holds data, if any
+   int         buffer;       //!< Pool buffer of a kept stream frame
+   bool        kept;         //!< frameHandleKeep took over the buffers of this handle
+} FRAME_HANDLE;
+
+/**
+ * \brief Called on a dispatcher worker for every stream frame. The handle
+ *        is only valid until the callback returns, unless it is kept
+ **/
+typedef struct {
+   void (*f)( const FRAME_HANDLE * handle, void * data );
+   void * data;
+} FRAME_HANDLE_CALLBACK;
+
+/**
+ * \brief Connects to the camera server and starts tracking its cameras
+ **/
+void frameHandleConnect( const char * ip, int port );
+
+/**
+ * \brief Lists the IDs of the tracked cameras
+ * \return the number of cameras, which may exceed max
+ **/
+int frameHandleCameras( uint32_t * camIDs, int max );
+
+/**
+ * \brief Lists the microcameras of a camera, connecting it if it never was
+ * \return the number of microcameras, which may exceed max, or -1
+ **/
+int frameHandleMCams( uint32_t camID, uint32_t * mcamIDs, int max );
+
+/**
+ * \brief Starts or stops a camera receiving data from its microcameras
+ **/
+bool frameHandleSetReceiving( uint32_t camID, bool receive );
+
+/**
+ * \brief Disconnects every tracked camera
+ **/
+void frameHandleDisconnect( void );
+
+/**
+ * \brief Requests a frame like getFrame and optionally decodes it
+ * \param [in] decode FRAME_DECODE_* to decode a JPEG frame to
+ * \param [in] scale  1, 2, 4 or 8 to decode at that fraction of the size
+ * \return the handle, or NULL if the request or the decode failed
+ **/
+FRAME_HANDLE * frameHandleGet( uint32_t camID
+                             , uint32_t mcamID
+                             , uint64_t timestamp
+                             , int tiling
+                             , int tile
+                             , int decode
+                             , int scale
+                             );
+
+/**
+ * \brief Returns the frame buffer to the API, or a kept stream frame's buffer
+ *        to its dispatcher pool, and frees the handle
+ **/
+void frameHandleRelease( FRAME_HANDLE * handle );
+
+/**
+ * \brief Sets the frame callback to pass every stream frame of the given
+ *        microcameras to callback on numWorkers threads
+ * \return the stream, or NULL if it could not be started
+ **/
+FRAME_HANDLE_STREAM * frameHandleStreamStart( const uint32_t * mcamIDs
+                                            , int numMCams
+                                            , FRAME_DISPATCH_POLICY policy
+                                            , int depth
+                                            , int numWorkers
+                                            , int decode
+                                            , int scale
+                                            , FRAME_HANDLE_CALLBACK callback
+                                            );
+
+/**
+ * \brief Returns the dispatch accounting of one microcamera of a stream
+ **/
+bool frameHandleStreamStats( FRAME_HANDLE_STREAM * stream
+                           , uint32_t mcamID
+                           , FRAME_DISPATCH_STATS * stats
+                           );
+
+/**
+ * \brief Keeps a stream frame and its pixels after the callback returns.
+ *        Call it at most once per frame, from the callback it was passed to
+ * \return a handle for frameHandleRelease, or NULL if the frame could not be
+ *         kept
+ **/
+FRAME_HANDLE * frameHandleKeep( const FRAME_HANDLE * handle );
+
+/**
+ * \brief Ignores further frames, waits for any frame a receiver is still
+ *        copying, delivers the queued ones and frees the stream once every
+ *        kept frame is released. The microcamera streams may still be
+ *        running
+ **/
+void frameHandleStreamStop( FRAME_HANDLE_STREAM * stream );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
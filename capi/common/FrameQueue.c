@@ -0,0 +1,152 @@
+/******************************************************************************
+ *
+ * FrameQueue.c
+ *
+ * Bounded, thread safe FIFO of FRAME structs. See FrameQueue.h
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+
+#include "FrameQueue.h"
+
+/**
+ * \brief Allocates a queue that holds up to capacity frames
+ **/
+bool frameQueueInit( FRAME_QUEUE * queue, int capacity )
+{
+   if( capacity < 1 ) {
+      return false;
+   }
+
+   queue->frames   = (FRAME *)malloc( capacity * sizeof(FRAME));
+   queue->received = (uint64_t *)malloc( capacity * sizeof(uint64_t));
+   if( queue->frames == NULL || queue->received == NULL ) {
+      free( queue->frames );
+      free( queue->received );
+      return false;
+   }
+
+   queue->capacity = capacity;
+   queue->head     = 0;
+   queue->count    = 0;
+   queue->closed   = false;
+   pthread_mutex_init( &queue->lock, NULL );
+   pthread_cond_init( &queue->notEmpty, NULL );
+   pthread_cond_init( &queue->notFull, NULL );
+
+   return true;
+}
+
+/**
+ * \brief Releases the queue storage
+ **/
+void frameQueueDestroy( FRAME_QUEUE * queue )
+{
+   pthread_cond_destroy( &queue->notFull );
+   pthread_cond_destroy( &queue->notEmpty );
+   pthread_mutex_destroy( &queue->lock );
+   free( queue->frames );
+   free( queue->received );
+   queue->frames   = NULL;
+   queue->received = NULL;
+}
+
+/**
+ * \brief Appends a frame, blocking while the queue is full
+ **/
+bool frameQueuePush( FRAME_QUEUE * queue, FRAME frame )
+{
+   return frameQueuePushReceived( queue, frame, 0 );
+}
+
+/**
+ * \brief Appends a frame with the time it was received
+ **/
+bool frameQueuePushReceived( FRAME_QUEUE * queue, FRAME frame, uint64_t received )
+{
+   pthread_mutex_lock( &queue->lock );
+   while( queue->count == queue->capacity && !queue->closed ) {
+      pthread_cond_wait( &queue->notFull, &queue->lock );
+   }
+
+   if( queue->closed ) {
+      pthread_mutex_unlock( &queue->lock );
+      return false;
+   }
+
+   int tail = (queue->head + queue->count) % queue->capacity;
+   queue->frames[tail]   = frame;
+   queue->received[tail] = received;
+   queue->count++;
+   pthread_cond_signal( &queue->notEmpty );
+   pthread_mutex_unlock( &queue->lock );
+
+   return true;
+}
+
+/**
+ * \brief Removes the oldest frame, blocking while the queue is empty
+ **/
+bool frameQueuePop( FRAME_QUEUE * queue, FRAME * frame )
+{
+   uint64_t received;
+   return frameQueuePopReceived( queue, frame, &received );
+}
+
+/**
+ * \brief Removes the oldest frame and the time it was pushed with
+ **/
+bool frameQueuePopReceived( FRAME_QUEUE * queue, FRAME * frame, uint64_t * received )
+{
+   pthread_mutex_lock( &queue->lock );
+   while( queue->count == 0 && !queue->closed ) {
+      pthread_cond_wait( &queue->notEmpty, &queue->lock );
+   }
+
+   if( queue->count == 0 ) {
+      pthread_mutex_unlock( &queue->lock );
+      return false;
+   }
+
+   *frame    = queue->frames[queue->head];
+   *received = queue->received[queue->head];
+   queue->head = (queue->head + 1) % queue->capacity;
+   queue->count--;
+   pthread_cond_signal( &queue->notFull );
+   pthread_mutex_unlock( &queue->lock );
+
+   return true;
+}
+
+/**
+ * \brief Finds the earliest timestamp among the queued frames of one
+ *        microcamera
+ **/
+bool frameQueueOldest( FRAME_QUEUE * queue, uint32_t camId, uint64_t * timestamp )
+{
+   bool found = false;
+
+   pthread_mutex_lock( &queue->lock );
+   for( int i = 0; i < queue->count; i++ ) {
+      const FRAME_METADATA * metadata = &queue->frames[(queue->head + i) % queue->capacity].m_metadata;
+      if( metadata->m_camId == camId && ( !found || metadata->m_timestamp < *timestamp )) {
+         *timestamp = metadata->m_timestamp;
+         found = true;
+      }
+   }
+   pthread_mutex_unlock( &queue->lock );
+
+   return found;
+}
+
+/**
+ * \brief Marks the queue closed and wakes all waiting threads
+ **/
+void frameQueueClose( FRAME_QUEUE * queue )
+{
+   pthread_mutex_lock( &queue->lock );
+   queue->closed = true;
+   pthread_cond_broadcast( &queue->notEmpty );
+   pthread_cond_broadcast( &queue->notFull );
+   pthread_mutex_unlock( &queue->lock );
+}
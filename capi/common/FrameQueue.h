@@ -0,0 +1,94 @@
+/******************************************************************************
+ *
+ * FrameQueue.h
+ *
+ * Bounded, thread safe FIFO of FRAME structs used to hand frames from the
+ * threads that request them to the threads that consume them. Producers
+ * block while the queue is full, which throttles requests to the rate the
+ * consumers can keep up with.
+ *
+ *****************************************************************************/
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Bounded queue of frames
+ **/
+typedef struct {
+   FRAME *         frames;     //!< Ring buffer of queued frames
+   uint64_t *      received;   //!< Caller supplied receive time of each slot
+   int             capacity;   //!< Number of slots in frames
+   int             head;       //!< Index of the oldest queued frame
+   int             count;      //!< Number of queued frames
+   bool            closed;     //!< Set once no more frames will be pushed
+   pthread_mutex_t lock;       //!< Guards all fields above
+   pthread_cond_t  notEmpty;   //!< Signaled when a frame is pushed or on close
+   pthread_cond_t  notFull;    //!< Signaled when a frame is popped or on close
+} FRAME_QUEUE;
+
+/**
+ * \brief Allocates a queue that holds up to capacity frames
+ * \return true on success, false if capacity is invalid or allocation failed
+ **/
+bool frameQueueInit( FRAME_QUEUE * queue, int capacity );
+
+/**
+ * \brief Releases the queue storage. Queued frames are not returned to the API
+ **/
+void frameQueueDestroy( FRAME_QUEUE * queue );
+
+/**
+ * \brief Appends a frame, blocking while the queue is full
+ * \return false if the queue was closed and the frame was not queued
+ **/
+bool frameQueuePush( FRAME_QUEUE * queue, FRAME frame );
+
+/**
+ * \brief Appends a frame with the time it was received, blocking while the
+ *        queue is full. The time is returned by frameQueuePopReceived so
+ *        consumers can measure how long the frame was held
+ * \return false if the queue was closed and the frame was not queued
+ **/
+bool frameQueuePushReceived( FRAME_QUEUE * queue, FRAME frame, uint64_t received );
+
+/**
+ * \brief Removes the oldest frame, blocking while the queue is empty
+ * \return false once the queue is closed and drained
+ **/
+bool frameQueuePop( FRAME_QUEUE * queue, FRAME * frame );
+
+/**
+ * \brief Removes the oldest frame and the time it was pushed with, blocking
+ *        while the queue is empty. Frames pushed with frameQueuePush have a
+ *        receive time of 0
+ * \return false once the queue is closed and drained
+ **/
+bool frameQueuePopReceived( FRAME_QUEUE * queue, FRAME * frame, uint64_t * received );
+
+/**
+ * \brief Finds the earliest timestamp among the queued frames of one
+ *        microcamera without removing them
+ * \param [out] timestamp earliest m_timestamp of frames with m_camId == camId
+ * \return false if no frame of the microcamera is queued
+ **/
+bool frameQueueOldest( FRAME_QUEUE * queue, uint32_t camId, uint64_t * timestamp );
+
+/**
+ * \brief Marks the queue closed and wakes all waiting threads. Frames already
+ *        queued can still be popped
+ **/
+void frameQueueClose( FRAME_QUEUE * queue );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
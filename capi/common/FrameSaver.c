@@ -0,0 +1,235 @@
+/******************************************************************************
+ *
+ * FrameSaver.c
+ *
+ * Pool of threads saving frames. See FrameSaver.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FrameSaver.h"
+#include "Metrics.h"
+
+/**
+ * \brief Save thread. Saves queued frames until the saver is finished and
+ *        its queue drained
+ **/
+static void * saveThread( void * data )
+{
+   FRAME_SAVER * saver = (FRAME_SAVER *)data;
+   int index = __atomic_fetch_add( &saver->nextWorker, 1, __ATOMIC_RELAXED );
+   FRAME_SAVE_JOB * job = &saver->saving[index];
+
+   pthread_mutex_lock( &saver->lock );
+   while( true ) {
+      while( saver->count == 0 && !saver->closed ) {
+         pthread_cond_wait( &saver->notEmpty, &saver->lock );
+      }
+      if( saver->count == 0 ) {
+         break;
+      }
+
+      //The frame moves from the queue to the worker under the lock, so
+      //frameSaverOldest always sees it in one of them
+      *job = saver->jobs[saver->head];
+      saver->head = ( saver->head + 1 ) % saver->capacity;
+      saver->count--;
+      saver->busy[index] = true;
+      pthread_cond_signal( &saver->notFull );
+      pthread_mutex_unlock( &saver->lock );
+
+      char fileName[FRAME_SAVER_NAME + 512];
+      snprintf( fileName, sizeof(fileName), "%s/%s",
+                frameSaverDir( saver, &job->frame.m_metadata ), job->name );
+      uint64_t saveStart = metricsNow();
+      bool saved = ( saver->writer.f != NULL ) ? saver->writer.f( job->frame, fileName, saver->writer.data )
+                                               : saveFrame( job->frame, fileName );
+      metricsRecord( METRIC_SAVE_FRAME, saveStart );
+
+      //Return the buffer before anything else so the API can reuse it
+      if( !returnPointer( job->frame.m_image )) {
+         printf("Failed to return the pointer for the frame buffer\n");
+      }
+      if( job->received != 0 ) {
+         metricsRecord( METRIC_FRAME_HOLD, job->received );
+      }
+      __atomic_add_fetch( saved ? &saver->saved : &saver->failed, 1, __ATOMIC_RELAXED );
+      if( saver->callback.f != NULL ) {
+         saver->callback.f( &job->frame.m_metadata, fileName, saved, saver->callback.data );
+      }
+
+      pthread_mutex_lock( &saver->lock );
+      saver->busy[index] = false;
+   }
+   pthread_mutex_unlock( &saver->lock );
+
+   return NULL;
+}
+
+/**
+ * \brief Allocates the queue and starts the save threads
+ **/
+bool frameSaverInit( FRAME_SAVER * saver
+                   , int numWorkers
+                   , int queueSize
+                   , const char * const * dirs
+                   , int numDirs
+                   , FRAME_SAVED_CALLBACK callback
+                   )
+{
+   memset( saver, 0, sizeof(FRAME_SAVER));
+   if( numWorkers < 1 || queueSize < 1 || numDirs < 1 || numDirs > FRAME_SAVER_MAX_DIRS ) {
+      return false;
+   }
+
+   saver->jobs    = (FRAME_SAVE_JOB *)malloc( queueSize * sizeof(FRAME_SAVE_JOB));
+   saver->saving  = (FRAME_SAVE_JOB *)malloc( numWorkers * sizeof(FRAME_SAVE_JOB));
+   saver->busy    = (bool *)calloc( numWorkers, sizeof(bool));
+   saver->workers = (pthread_t *)malloc( numWorkers * sizeof(pthread_t));
+   if( saver->jobs == NULL || saver->saving == NULL || saver->busy == NULL || saver->workers == NULL ) {
+      free( saver->jobs );
+      free( saver->saving );
+      free( saver->busy );
+      free( saver->workers );
+      memset( saver, 0, sizeof(FRAME_SAVER));
+      return false;
+   }
+
+   saver->capacity = queueSize;
+   saver->numDirs  = numDirs;
+   saver->callback = callback;
+   for( int i = 0; i < numDirs; i++ ) {
+      saver->dirs[i] = dirs[i];
+   }
+   pthread_mutex_init( &saver->lock, NULL );
+   pthread_cond_init( &saver->notEmpty, NULL );
+   pthread_cond_init( &saver->notFull, NULL );
+
+   for( int i = 0; i < numWorkers; i++ ) {
+      if( pthread_create( &saver->workers[i], NULL, saveThread, saver ) != 0 ) {
+         printf("Unable to start save thread %d\n", i);
+         return false;
+      }
+      saver->numWorkers++;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Writes frames with writer instead of saveFrame
+ **/
+void frameSaverSetWriter( FRAME_SAVER * saver, FRAME_WRITER writer )
+{
+   pthread_mutex_lock( &saver->lock );
+   saver->writer = writer;
+   pthread_mutex_unlock( &saver->lock );
+}
+
+/**
+ * \brief Queues a frame to be saved, blocking while the queue is full
+ **/
+bool frameSaverPush( FRAME_SAVER * saver, FRAME frame, const char * name, uint64_t received )
+{
+   pthread_mutex_lock( &saver->lock );
+   while( saver->count == saver->capacity && !saver->closed ) {
+      pthread_cond_wait( &saver->notFull, &saver->lock );
+   }
+
+   if( saver->closed || saver->numWorkers == 0 ) {
+      pthread_mutex_unlock( &saver->lock );
+      return false;
+   }
+
+   FRAME_SAVE_JOB * job = &saver->jobs[( saver->head + saver->count ) % saver->capacity];
+   job->frame    = frame;
+   job->received = received;
+   snprintf( job->name, sizeof(job->name), "%s", name );
+   saver->count++;
+   pthread_cond_signal( &saver->notEmpty );
+   pthread_mutex_unlock( &saver->lock );
+
+   return true;
+}
+
+/**
+ * \brief Returns the directory a frame is saved in
+ **/
+const char * frameSaverDir( const FRAME_SAVER * saver, const FRAME_METADATA * meta )
+{
+   uint64_t key = meta->m_id * 0x9E3779B97F4A7C15ull + meta->m_camId;
+
+   return saver->dirs[( key >> 32 ) % saver->numDirs];
+}
+
+/**
+ * \brief Finds the earliest queued or in progress frame of a microcamera
+ **/
+bool frameSaverOldest( FRAME_SAVER * saver, uint32_t mcamID, uint64_t * timestamp )
+{
+   bool found = false;
+   pthread_mutex_lock( &saver->lock );
+   for( int i = 0; i < saver->count; i++ ) {
+      const FRAME_METADATA * meta = &saver->jobs[( saver->head + i ) % saver->capacity].frame.m_metadata;
+      if( meta->m_camId == mcamID && ( !found || meta->m_timestamp < *timestamp )) {
+         *timestamp = meta->m_timestamp;
+         found = true;
+      }
+   }
+   for( int i = 0; i < saver->numWorkers; i++ ) {
+      const FRAME_METADATA * meta = &saver->saving[i].frame.m_metadata;
+      if( saver->busy[i] && meta->m_camId == mcamID && ( !found || meta->m_timestamp < *timestamp )) {
+         *timestamp = meta->m_timestamp;
+         found = true;
+      }
+   }
+   pthread_mutex_unlock( &saver->lock );
+
+   return found;
+}
+
+/**
+ * \brief Stops accepting frames, saves the queued ones and joins the threads
+ **/
+void frameSaverFinish( FRAME_SAVER * saver )
+{
+   if( saver->workers == NULL ) {
+      return;
+   }
+
+   pthread_mutex_lock( &saver->lock );
+   saver->closed = true;
+   pthread_cond_broadcast( &saver->notEmpty );
+   pthread_cond_broadcast( &saver->notFull );
+   pthread_mutex_unlock( &saver->lock );
+
+   for( int i = 0; i < saver->numWorkers; i++ ) {
+      pthread_join( saver->workers[i], NULL );
+   }
+   saver->numWorkers = 0;
+}
+
+/**
+ * \brief Finishes the saver if needed and frees it
+ **/
+void frameSaverDestroy( FRAME_SAVER * saver )
+{
+   if( saver->workers == NULL ) {
+      return;
+   }
+   frameSaverFinish( saver );
+
+   pthread_cond_destroy( &saver->notFull );
+   pthread_cond_destroy( &saver->notEmpty );
+   pthread_mutex_destroy( &saver->lock );
+   free( saver->jobs );
+   free( saver->saving );
+   free( saver->busy );
+   free( saver->workers );
+   saver->jobs    = NULL;
+   saver->saving  = NULL;
+   saver->busy    = NULL;
+   saver->workers = NULL;
+}
@@ -0,0 +1,142 @@
+/******************************************************************************
+ *
+ * FrameSaver.h
+ *
+ * Pool of threads that save frames with saveFrame, fed through a bounded
+ * queue so the threads requesting frames never wait on the disk unless
+ * every worker is behind. Each worker returns the API buffer with
+ * returnPointer as soon as its save finishes.
+ *
+ * Output can be sharded across several directories, for example one per
+ * disk. A frame always goes to the same directory, chosen from its
+ * microcamera and frame id, so a frame saved again overwrites its own file
+ * and consecutive frames of one microcamera are spread over every
+ * directory.
+ *
+ * frameSaverOldest reports the earliest frame of a microcamera that is
+ * queued or being saved, so checkpoints can tell which frames are already
+ * written.
+ *
+ *****************************************************************************/
+#ifndef FRAME_SAVER_H
+#define FRAME_SAVER_H
+
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_SAVER_WORKERS  4     //!< Default number of save threads
+#define FRAME_SAVER_MAX_DIRS 16    //!< Most output directories
+#define FRAME_SAVER_NAME     256   //!< Longest file name without directory
+
+/**
+ * \brief Called on a save thread after each frame was saved and its buffer
+ *        returned
+ **/
+typedef struct {
+   void (*f)( const FRAME_METADATA * meta, const char * fileName, bool saved, void * data );
+   void * data;
+} FRAME_SAVED_CALLBACK;
+
+/**
+ * \brief Writes a frame in place of saveFrame
+ * \return true if the frame was written
+ **/
+typedef struct {
+   bool (*f)( FRAME frame, const char * fileName, void * data );
+   void * data;
+} FRAME_WRITER;
+
+/**
+ * \brief A frame waiting to be saved or being saved
+ **/
+typedef struct {
+   FRAME    frame;
+   uint64_t received;                 //!< metricsNow() when the frame was received
+   char     name[FRAME_SAVER_NAME];   //!< File name passed to saveFrame, without directory
+} FRAME_SAVE_JOB;
+
+/**
+ * \brief Save threads and their queue
+ **/
+typedef struct {
+   FRAME_SAVE_JOB *     jobs;          //!< Ring buffer of queued frames
+   int                  capacity;      //!< Number of slots in jobs
+   int                  head;          //!< Index of the oldest queued frame
+   int                  count;         //!< Number of queued frames
+   FRAME_SAVE_JOB *     saving;        //!< Frame each worker is saving
+   bool *               busy;          //!< Set while the worker's entry of saving is valid
+   pthread_t *          workers;
+   int                  numWorkers;    //!< Workers started
+   int                  nextWorker;    //!< Index the next worker to run takes
+   const char *         dirs[FRAME_SAVER_MAX_DIRS];
+   int                  numDirs;
+   FRAME_SAVED_CALLBACK callback;
+   FRAME_WRITER         writer;        //!< Writer of each frame, saveFrame if f is NULL
+   uint64_t             saved;         //!< Frames saved
+   uint64_t             failed;        //!< Frames saveFrame failed on
+   bool                 closed;        //!< Set once no more frames will be pushed
+   pthread_mutex_t      lock;          //!< Guards all fields above except the counters
+   pthread_cond_t       notEmpty;
+   pthread_cond_t       notFull;
+} FRAME_SAVER;
+
+/**
+ * \brief Allocates the queue and starts the save threads
+ * \param [in] dirs     output directories, which must outlive the saver
+ * \param [in] callback called after every save, f may be NULL
+ * \return true if every thread was started
+ **/
+bool frameSaverInit( FRAME_SAVER * saver
+                   , int numWorkers
+                   , int queueSize
+                   , const char * const * dirs
+                   , int numDirs
+                   , FRAME_SAVED_CALLBACK callback
+                   );
+
+/**
+ * \brief Writes frames with writer instead of saveFrame. Call before the
+ *        first frame is pushed
+ **/
+void frameSaverSetWriter( FRAME_SAVER * saver, FRAME_WRITER writer );
+
+/**
+ * \brief Queues a frame to be saved as name in its directory, blocking
+ *        while the queue is full. The saver returns the buffer
+ * \param [in] received metricsNow() when the frame was received
+ * \return false if the saver was finished and the frame was not queued
+ **/
+bool frameSaverPush( FRAME_SAVER * saver, FRAME frame, const char * name, uint64_t received );
+
+/**
+ * \brief Returns the directory a frame is saved in
+ **/
+const char * frameSaverDir( const FRAME_SAVER * saver, const FRAME_METADATA * meta );
+
+/**
+ * \brief Finds the earliest timestamp among the frames of one microcamera
+ *        that are queued or being saved
+ * \return false if every frame of the microcamera pushed so far is saved
+ **/
+bool frameSaverOldest( FRAME_SAVER * saver, uint32_t mcamID, uint64_t * timestamp );
+
+/**
+ * \brief Stops accepting frames, saves the queued ones and joins the threads
+ **/
+void frameSaverFinish( FRAME_SAVER * saver );
+
+/**
+ * \brief Finishes the saver if needed and frees it
+ **/
+void frameSaverDestroy( FRAME_SAVER * saver );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,446 @@
+/******************************************************************************
+ *
+ * FramesetAssembler.c
+ *
+ * K-way merge of microcamera frame queues into framesets. See
+ * FramesetAssembler.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FramesetAssembler.h"
+
+/**
+ * \brief Returns the queued frame i of microcamera m
+ **/
+static FRAME * queued( FRAMESET_ASSEMBLER * a, int m, int i )
+{
+   return &a->queues[m * a->depth + ( a->head[m] + i ) % a->depth];
+}
+
+/**
+ * \brief Returns the timestamp of the oldest queued frame of microcamera m
+ **/
+static uint64_t headTime( FRAMESET_ASSEMBLER * a, int m )
+{
+   return queued( a, m, 0 )->m_metadata.m_timestamp;
+}
+
+/**
+ * \brief Swaps two heap entries and their positions
+ **/
+static void heapSwap( FRAMESET_ASSEMBLER * a, int i, int j )
+{
+   int t = a->heap[i];
+   a->heap[i] = a->heap[j];
+   a->heap[j] = t;
+   a->heapPos[a->heap[i]] = i;
+   a->heapPos[a->heap[j]] = j;
+}
+
+/**
+ * \brief Moves a heap entry towards the root while it is earlier than its parent
+ **/
+static void heapUp( FRAMESET_ASSEMBLER * a, int i )
+{
+   while( i > 0 ) {
+      int parent = ( i - 1 ) / 2;
+      if( headTime( a, a->heap[parent] ) <= headTime( a, a->heap[i] )) {
+         break;
+      }
+      heapSwap( a, i, parent );
+      i = parent;
+   }
+}
+
+/**
+ * \brief Moves a heap entry towards the leaves while a child is earlier
+ **/
+static void heapDown( FRAMESET_ASSEMBLER * a, int i )
+{
+   while( true ) {
+      int first = i;
+      int left  = 2 * i + 1;
+      int right = left + 1;
+      if( left < a->heapSize && headTime( a, a->heap[left] ) < headTime( a, a->heap[first] )) {
+         first = left;
+      }
+      if( right < a->heapSize && headTime( a, a->heap[right] ) < headTime( a, a->heap[first] )) {
+         first = right;
+      }
+      if( first == i ) {
+         return;
+      }
+      heapSwap( a, i, first );
+      i = first;
+   }
+}
+
+/**
+ * \brief Adds microcamera m, which just got its first queued frame
+ **/
+static void heapPush( FRAMESET_ASSEMBLER * a, int m )
+{
+   a->heap[a->heapSize] = m;
+   a->heapPos[m] = a->heapSize;
+   a->heapSize++;
+   heapUp( a, a->heapSize - 1 );
+}
+
+/**
+ * \brief Removes and returns the microcamera with the earliest head
+ **/
+static int heapPop( FRAMESET_ASSEMBLER * a )
+{
+   int m = a->heap[0];
+   a->heapSize--;
+   if( a->heapSize > 0 ) {
+      heapSwap( a, 0, a->heapSize );
+      heapDown( a, 0 );
+   }
+   a->heapPos[m] = -1;
+
+   return m;
+}
+
+/**
+ * \brief Returns the index of a microcamera, or -1 if it is not assembled
+ **/
+static int findMCam( FRAMESET_ASSEMBLER * a, uint32_t mcamID )
+{
+   int low = 0;
+   int high = a->numMCams - 1;
+   while( low <= high ) {
+      int mid = ( low + high ) / 2;
+      uint32_t id = a->mcamIDs[a->lookup[mid]];
+      if( id == mcamID ) {
+         return a->lookup[mid];
+      }
+      if( id < mcamID ) {
+         low = mid + 1;
+      }
+      else {
+         high = mid - 1;
+      }
+   }
+
+   return -1;
+}
+
+/**
+ * \brief Hands a frame back to its owner
+ **/
+static void releaseFrame( FRAMESET_ASSEMBLER * a, FRAME frame )
+{
+   if( a->release.f != NULL ) {
+      a->release.f( frame, a->release.data );
+   }
+}
+
+/**
+ * \brief Emits the frameset that starts at the earliest queued frame
+ **/
+static void emitNext( FRAMESET_ASSEMBLER * a, bool forced )
+{
+   uint64_t start = headTime( a, a->heap[0] );
+   uint64_t end   = start + a->tolerance;
+   uint64_t last  = start;
+   int numMembers = 0;
+
+   memset( a->setPresent, 0, a->numMCams * sizeof(bool));
+
+   /* Take the head of every microcamera inside the window. Members go back
+    * into the heap afterwards so a second frame of one microcamera inside
+    * the window starts the next set instead */
+   while( a->heapSize > 0 && headTime( a, a->heap[0] ) <= end ) {
+      int m = heapPop( a );
+      a->setFrames[m]  = *queued( a, m, 0 );
+      a->setPresent[m] = true;
+      a->head[m] = ( a->head[m] + 1 ) % a->depth;
+      a->count[m]--;
+      a->members[numMembers++] = m;
+
+      uint64_t timestamp = a->setFrames[m].m_metadata.m_timestamp;
+      if( timestamp > last ) {
+         last = timestamp;
+      }
+   }
+   for( int i = 0; i < numMembers; i++ ) {
+      int m = a->members[i];
+      if( a->count[m] > 0 ) {
+         heapPush( a, m );
+      }
+      else if( !a->finished[m] ) {
+         a->waiting++;
+      }
+   }
+   a->emitted = end;
+
+   FRAMESET frameset;
+   frameset.index      = a->stats.framesets;
+   frameset.timestamp  = start;
+   frameset.skew       = last - start;
+   frameset.numPresent = numMembers;
+   frameset.numMCams   = a->numMCams;
+   frameset.frames     = a->setFrames;
+   frameset.present    = a->setPresent;
+
+   a->stats.framesets++;
+   a->stats.frames += numMembers;
+   if( numMembers == a->numMCams ) {
+      a->stats.complete++;
+   }
+   if( forced ) {
+      a->stats.forced++;
+   }
+   intervalStatsAddInterval( &a->stats.skew, frameset.skew );
+
+   if( a->callback.f != NULL ) {
+      a->callback.f( &frameset, a->callback.data );
+   }
+   for( int i = 0; i < numMembers; i++ ) {
+      releaseFrame( a, a->setFrames[a->members[i]] );
+   }
+
+   pthread_cond_broadcast( &a->space );
+}
+
+/**
+ * \brief Emits framesets while the earliest one cannot gain more frames
+ **/
+static void emitReady( FRAMESET_ASSEMBLER * a )
+{
+   while( a->heapSize > 0 ) {
+      uint64_t end = headTime( a, a->heap[0] ) + a->tolerance;
+      bool timedOut = a->latency != UINT64_MAX && a->highWater > end && a->highWater - end > a->latency;
+      if( a->waiting > 0 && !timedOut ) {
+         return;
+      }
+      emitNext( a, false );
+   }
+}
+
+/**
+ * \brief Allocates an assembler
+ **/
+bool framesetAssemblerInit( FRAMESET_ASSEMBLER * assembler
+                          , const uint32_t * mcamIDs
+                          , int numMCams
+                          , int depth
+                          , uint64_t tolerance
+                          , uint64_t latency
+                          , bool block
+                          , FRAMESET_CALLBACK callback
+                          , FRAME_RELEASE_CALLBACK release
+                          )
+{
+   FRAMESET_ASSEMBLER * a = assembler;
+   memset( a, 0, sizeof(*a));
+   if( numMCams < 1 || depth < 1 ) {
+      return false;
+   }
+
+   a->numMCams   = numMCams;
+   a->depth      = depth;
+   a->mcamIDs    = (uint32_t *)malloc( numMCams * sizeof(uint32_t));
+   a->lookup     = (int *)malloc( numMCams * sizeof(int));
+   a->queues     = (FRAME *)malloc( (size_t)numMCams * depth * sizeof(FRAME));
+   a->head       = (int *)calloc( numMCams, sizeof(int));
+   a->count      = (int *)calloc( numMCams, sizeof(int));
+   a->finished   = (bool *)calloc( numMCams, sizeof(bool));
+   a->heap       = (int *)malloc( numMCams * sizeof(int));
+   a->heapPos    = (int *)malloc( numMCams * sizeof(int));
+   a->members    = (int *)malloc( numMCams * sizeof(int));
+   a->setFrames  = (FRAME *)calloc( numMCams, sizeof(FRAME));
+   a->setPresent = (bool *)calloc( numMCams, sizeof(bool));
+   if( a->mcamIDs == NULL || a->lookup == NULL || a->queues == NULL || a->head == NULL
+    || a->count == NULL || a->finished == NULL || a->heap == NULL || a->heapPos == NULL
+    || a->members == NULL || a->setFrames == NULL || a->setPresent == NULL ) {
+      framesetAssemblerDestroy( a );
+      return false;
+   }
+
+   //Sort indices by mcam ID for lookups. Lists are short and built once
+   for( int i = 0; i < numMCams; i++ ) {
+      a->mcamIDs[i] = mcamIDs[i];
+      a->heapPos[i] = -1;
+      int j = i;
+      while( j > 0 && mcamIDs[a->lookup[j - 1]] > mcamIDs[i] ) {
+         a->lookup[j] = a->lookup[j - 1];
+         j--;
+      }
+      a->lookup[j] = i;
+   }
+
+   a->waiting   = numMCams;
+   a->tolerance = tolerance;
+   a->latency   = latency;
+   a->block     = block;
+   a->callback  = callback;
+   a->release   = release;
+   intervalStatsInit( &a->stats.skew, 0 );
+   pthread_mutex_init( &a->lock, NULL );
+   pthread_cond_init( &a->space, NULL );
+
+   return true;
+}
+
+/**
+ * \brief Adds a frame and emits every frameset that became ready
+ **/
+bool framesetAssemblerAdd( FRAMESET_ASSEMBLER * assembler, FRAME frame )
+{
+   FRAMESET_ASSEMBLER * a = assembler;
+   uint64_t timestamp = frame.m_metadata.m_timestamp;
+
+   pthread_mutex_lock( &a->lock );
+   int m = findMCam( a, frame.m_metadata.m_camId );
+   if( m < 0 ) {
+      pthread_mutex_unlock( &a->lock );
+      releaseFrame( a, frame );
+      return false;
+   }
+
+   //Make room by waiting for the consumer or by emitting the oldest set
+   while( a->count[m] == a->depth && ( a->stats.framesets == 0 || timestamp > a->emitted )) {
+      if( a->block ) {
+         pthread_cond_wait( &a->space, &a->lock );
+      }
+      else {
+         emitNext( a, true );
+      }
+   }
+
+   //The instant of this frame was already emitted
+   if( a->stats.framesets > 0 && timestamp <= a->emitted ) {
+      a->stats.late++;
+      pthread_mutex_unlock( &a->lock );
+      releaseFrame( a, frame );
+      return false;
+   }
+
+   //Insert in timestamp order, usually at the tail
+   int i = a->count[m];
+   while( i > 0 && queued( a, m, i - 1 )->m_metadata.m_timestamp > timestamp ) {
+      *queued( a, m, i ) = *queued( a, m, i - 1 );
+      i--;
+   }
+   *queued( a, m, i ) = frame;
+   a->count[m]++;
+
+   if( a->count[m] == 1 ) {
+      heapPush( a, m );
+      if( !a->finished[m] ) {
+         a->waiting--;
+      }
+   }
+   else if( i == 0 ) {
+      heapUp( a, a->heapPos[m] );
+   }
+
+   if( timestamp > a->highWater ) {
+      a->highWater = timestamp;
+   }
+   emitReady( a );
+   pthread_mutex_unlock( &a->lock );
+
+   return true;
+}
+
+/**
+ * \brief Marks a microcamera as sending no more frames
+ **/
+void framesetAssemblerFinish( FRAMESET_ASSEMBLER * assembler, uint32_t mcamID )
+{
+   FRAMESET_ASSEMBLER * a = assembler;
+
+   pthread_mutex_lock( &a->lock );
+   int m = findMCam( a, mcamID );
+   if( m >= 0 && !a->finished[m] ) {
+      a->finished[m] = true;
+      if( a->count[m] == 0 ) {
+         a->waiting--;
+      }
+      emitReady( a );
+   }
+   pthread_mutex_unlock( &a->lock );
+}
+
+/**
+ * \brief Emits every queued frame in framesets
+ **/
+void framesetAssemblerFlush( FRAMESET_ASSEMBLER * assembler )
+{
+   pthread_mutex_lock( &assembler->lock );
+   while( assembler->heapSize > 0 ) {
+      emitNext( assembler, false );
+   }
+   pthread_mutex_unlock( &assembler->lock );
+}
+
+/**
+ * \brief Returns the accounting so far
+ **/
+FRAMESET_STATS framesetAssemblerGetStats( FRAMESET_ASSEMBLER * assembler )
+{
+   pthread_mutex_lock( &assembler->lock );
+   FRAMESET_STATS stats = assembler->stats;
+   pthread_mutex_unlock( &assembler->lock );
+
+   return stats;
+}
+
+/**
+ * \brief Prints a summary of stats
+ **/
+void framesetAssemblerPrintStats( const FRAMESET_STATS * stats, int numMCams )
+{
+   printf("Framesets: %lu (%lu complete, %lu forced out) with %.1f of %d mcams on average, %lu late frames dropped\n",
+          stats->framesets,
+          stats->complete,
+          stats->forced,
+          stats->framesets > 0 ? (double)stats->frames / stats->framesets : 0.0,
+          numMCams,
+          stats->late);
+   printf("Frameset skew (us): mean %.1f p50 %.0f p99 %.0f p99.9 %.0f max %lu\n",
+          stats->skew.mean,
+          intervalStatsQuantile( &stats->skew, 0.5 ),
+          intervalStatsQuantile( &stats->skew, 0.99 ),
+          intervalStatsQuantile( &stats->skew, 0.999 ),
+          stats->skew.max);
+}
+
+/**
+ * \brief Releases queued frames and frees the assembler
+ **/
+void framesetAssemblerDestroy( FRAMESET_ASSEMBLER * assembler )
+{
+   FRAMESET_ASSEMBLER * a = assembler;
+
+   if( a->queues != NULL && a->count != NULL && a->head != NULL ) {
+      for( int m = 0; m < a->numMCams; m++ ) {
+         for( int i = 0; i < a->count[m]; i++ ) {
+            releaseFrame( a, *queued( a, m, i ));
+         }
+      }
+   }
+   if( a->heap != NULL ) {
+      pthread_cond_destroy( &a->space );
+      pthread_mutex_destroy( &a->lock );
+   }
+
+   free( a->mcamIDs );
+   free( a->lookup );
+   free( a->queues );
+   free( a->head );
+   free( a->count );
+   free( a->finished );
+   free( a->heap );
+   free( a->heapPos );
+   free( a->members );
+   free( a->setFrames );
+   free( a->setPresent );
+   memset( a, 0, sizeof(*a));
+}
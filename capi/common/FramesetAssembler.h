@@ -0,0 +1,173 @@
+/******************************************************************************
+ *
+ * FramesetAssembler.h
+ *
+ * Groups frames of several microcameras into framesets of frames captured
+ * at the same instant. Each microcamera has a bounded queue of frames
+ * sorted by timestamp. A min-heap over the queue heads merges the queues
+ * by m_timestamp: the earliest head starts a frameset, and the head of
+ * every other microcamera within the tolerance of it joins the set.
+ *
+ * A frameset is emitted as soon as every microcamera that has not finished
+ * has a frame queued, so microcameras whose next frame is past the window
+ * are missing from it. While some microcamera has nothing queued the set
+ * waits until a frame more than the latency past the window arrives from
+ * another microcamera, or until a queue is full. Frames that arrive after
+ * their instant was emitted are dropped.
+ *
+ * When a queue is full, adding a frame either blocks until the set holding
+ * its oldest frame is emitted (for producers that can wait, such as clip
+ * retrieval) or emits that set partially (for stream callbacks). Memory is
+ * fixed when the assembler is created.
+ *
+ *****************************************************************************/
+#ifndef FRAMESET_ASSEMBLER_H
+#define FRAMESET_ASSEMBLER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+#include "IntervalStats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMESET_DEPTH 8   //!< Default frames queued per microcamera
+
+/**
+ * \brief Frames of all microcameras at one instant. frames and present are
+ *        indexed like the mcamIDs passed to framesetAssemblerInit
+ **/
+typedef struct {
+   uint64_t        index;       //!< Sequence number of the set
+   uint64_t        timestamp;   //!< Earliest timestamp in the set
+   uint64_t        skew;        //!< Latest minus earliest timestamp in microseconds
+   int             numPresent;  //!< Microcameras with a frame in the set
+   int             numMCams;    //!< Entries in frames and present
+   const FRAME *   frames;      //!< Frame of each microcamera
+   const bool *    present;     //!< Whether frames[i] is part of the set
+} FRAMESET;
+
+/**
+ * \brief Called for every emitted frameset with the assembler locked
+ **/
+typedef struct {
+   void (*f)( const FRAMESET * frameset, void * data );
+   void * data;
+} FRAMESET_CALLBACK;
+
+/**
+ * \brief Called for every frame once the assembler no longer needs it, such
+ *        as returnPointer for frames from getFrame. f may be NULL
+ **/
+typedef struct {
+   void (*f)( FRAME frame, void * data );
+   void * data;
+} FRAME_RELEASE_CALLBACK;
+
+/**
+ * \brief Assembly accounting
+ **/
+typedef struct {
+   uint64_t       framesets;  //!< Framesets emitted
+   uint64_t       complete;   //!< Framesets with every microcamera
+   uint64_t       frames;     //!< Frames emitted in framesets
+   uint64_t       late;       //!< Frames dropped because their set was emitted
+   uint64_t       forced;     //!< Framesets emitted early because a queue was full
+   INTERVAL_STATS skew;       //!< Skew of the framesets in microseconds
+} FRAMESET_STATS;
+
+/**
+ * \brief Frameset assembler for a fixed list of microcameras
+ **/
+typedef struct {
+   int              numMCams;    //!< Number of microcameras
+   int              depth;       //!< Frames queued per microcamera
+   uint32_t *       mcamIDs;     //!< Microcamera of each index
+   int *            lookup;      //!< Indices sorted by mcam ID
+   FRAME *          queues;      //!< depth frames per microcamera, sorted by time
+   int *            head;        //!< First queued slot of each microcamera
+   int *            count;       //!< Frames queued for each microcamera
+   bool *           finished;    //!< Set once a microcamera sends no more frames
+   int *            heap;        //!< Min-heap of microcameras by head timestamp
+   int *            heapPos;     //!< Position of each microcamera in heap, or -1
+   int              heapSize;    //!< Microcameras with queued frames
+   int              waiting;     //!< Unfinished microcameras with nothing queued
+   int *            members;     //!< Microcameras taken into the frameset being emitted
+   FRAME *          setFrames;   //!< Frameset being emitted
+   bool *           setPresent;  //!< Members of the frameset being emitted
+   uint64_t         tolerance;   //!< Widest spread of a frameset in microseconds
+   uint64_t         latency;     //!< How long past the window to wait for frames
+   bool             block;       //!< Block producers instead of forcing sets out
+   uint64_t         highWater;   //!< Latest timestamp added
+   uint64_t         emitted;     //!< End of the window of the last frameset
+   FRAMESET_CALLBACK      callback;
+   FRAME_RELEASE_CALLBACK release;
+   FRAMESET_STATS   stats;       //!< Accounting
+   pthread_mutex_t  lock;        //!< Guards all fields above
+   pthread_cond_t   space;       //!< Signaled when frames leave the queues
+} FRAMESET_ASSEMBLER;
+
+/**
+ * \brief Allocates an assembler
+ * \param [in] mcamIDs   microcameras to assemble, in frameset order
+ * \param [in] depth     frames queued per microcamera
+ * \param [in] tolerance widest spread of a frameset in microseconds
+ * \param [in] latency   how long past a window to wait for missing frames in
+ *                       microseconds, UINT64_MAX to wait for every
+ *                       microcamera to queue a frame or finish
+ * \param [in] block     block framesetAssemblerAdd while the queue of the
+ *                       microcamera is full instead of forcing a set out
+ * \return true on success
+ **/
+bool framesetAssemblerInit( FRAMESET_ASSEMBLER * assembler
+                          , const uint32_t * mcamIDs
+                          , int numMCams
+                          , int depth
+                          , uint64_t tolerance
+                          , uint64_t latency
+                          , bool block
+                          , FRAMESET_CALLBACK callback
+                          , FRAME_RELEASE_CALLBACK release
+                          );
+
+/**
+ * \brief Adds a frame and emits every frameset that became ready. Frames of
+ *        one microcamera should arrive roughly in timestamp order
+ * \return false if the frame was released without joining a set
+ **/
+bool framesetAssemblerAdd( FRAMESET_ASSEMBLER * assembler, FRAME frame );
+
+/**
+ * \brief Marks a microcamera as sending no more frames, so sets stop
+ *        waiting for it
+ **/
+void framesetAssemblerFinish( FRAMESET_ASSEMBLER * assembler, uint32_t mcamID );
+
+/**
+ * \brief Emits every queued frame in framesets
+ **/
+void framesetAssemblerFlush( FRAMESET_ASSEMBLER * assembler );
+
+/**
+ * \brief Returns the accounting so far
+ **/
+FRAMESET_STATS framesetAssemblerGetStats( FRAMESET_ASSEMBLER * assembler );
+
+/**
+ * \brief Prints a summary of stats
+ **/
+void framesetAssemblerPrintStats( const FRAMESET_STATS * stats, int numMCams );
+
+/**
+ * \brief Releases queued frames and frees the assembler
+ **/
+void framesetAssemblerDestroy( FRAMESET_ASSEMBLER * assembler );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
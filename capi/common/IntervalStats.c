@@ -0,0 +1,179 @@
+/******************************************************************************
+ *
+ * IntervalStats.c
+ *
+ * Streaming frame interval statistics. See IntervalStats.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "IntervalStats.h"
+
+#define SUB_BUCKETS (1 << INTERVAL_STATS_SUB_BITS)
+#define MAX_SHIFT   (INTERVAL_STATS_MAX_BITS - INTERVAL_STATS_SUB_BITS)
+#define CENTER      (INTERVAL_STATS_MAG_BUCKETS - 1)   //!< Bucket of a zero deviation
+
+/**
+ * \brief Maps a deviation magnitude to its bucket on one side of CENTER
+ **/
+static int magnitudeIndex( uint64_t value )
+{
+   if( value < SUB_BUCKETS ) {
+      return (int)value;
+   }
+
+   int shift = 63 - __builtin_clzll( value ) - INTERVAL_STATS_SUB_BITS;
+   if( shift > MAX_SHIFT ) {
+      return INTERVAL_STATS_MAG_BUCKETS - 1;
+   }
+
+   return shift * SUB_BUCKETS + (int)( value >> shift );
+}
+
+/**
+ * \brief Returns the midpoint of the magnitudes in a bucket
+ **/
+static double magnitudeValue( int index )
+{
+   if( index < 2 * SUB_BUCKETS ) {
+      return index;
+   }
+
+   int shift = index / SUB_BUCKETS - 1;
+   uint64_t sub = index - shift * SUB_BUCKETS;
+
+   return (double)( sub << shift ) + ((uint64_t)1 << shift ) / 2.0;
+}
+
+/**
+ * \brief Clears stats for a stream with the given frame period
+ **/
+void intervalStatsInit( INTERVAL_STATS * stats, double period )
+{
+   memset( stats, 0, sizeof(*stats));
+   stats->period = period;
+   stats->min    = UINT64_MAX;
+}
+
+/**
+ * \brief Adds the timestamp of the next frame
+ **/
+void intervalStatsAdd( INTERVAL_STATS * stats, uint64_t timestamp )
+{
+   if( stats->last == 0 ) {
+      stats->last = timestamp;
+      return;
+   }
+   if( timestamp <= stats->last ) {
+      stats->repeated++;
+      return;
+   }
+
+   uint64_t interval = timestamp - stats->last;
+   stats->last = timestamp;
+   intervalStatsAddInterval( stats, interval );
+}
+
+/**
+ * \brief Adds an interval measured elsewhere
+ **/
+void intervalStatsAddInterval( INTERVAL_STATS * stats, uint64_t interval )
+{
+   stats->count++;
+   double delta = interval - stats->mean;
+   stats->mean += delta / stats->count;
+   stats->m2   += delta * ( interval - stats->mean );
+   if( interval < stats->min ) {
+      stats->min = interval;
+   }
+   if( interval > stats->max ) {
+      stats->max = interval;
+   }
+
+   //A gap of n periods means n - 1 frames never arrived
+   if( stats->period > 0 ) {
+      uint64_t periods = (uint64_t)( interval / stats->period + 0.5 );
+      if( periods > 1 ) {
+         stats->missing += periods - 1;
+      }
+   }
+
+   int64_t deviation = (int64_t)interval - (int64_t)( stats->period + 0.5 );
+   int index = deviation < 0 ? CENTER - magnitudeIndex( (uint64_t)-deviation )
+                             : CENTER + magnitudeIndex( (uint64_t)deviation );
+   stats->counts[index]++;
+}
+
+/**
+ * \brief Returns the variance of the intervals
+ **/
+double intervalStatsVariance( const INTERVAL_STATS * stats )
+{
+   return stats->count > 1 ? stats->m2 / ( stats->count - 1 ) : 0.0;
+}
+
+/**
+ * \brief Returns an interval quantile in microseconds
+ **/
+double intervalStatsQuantile( const INTERVAL_STATS * stats, double q )
+{
+   if( stats->count == 0 ) {
+      return 0.0;
+   }
+
+   uint64_t rank = (uint64_t)( q * stats->count );
+   if( rank >= stats->count ) {
+      rank = stats->count - 1;
+   }
+
+   uint64_t seen = 0;
+   for( int b = 0; b < INTERVAL_STATS_BUCKETS; b++ ) {
+      seen += stats->counts[b];
+      if( seen > rank ) {
+         double deviation = b < CENTER ? -magnitudeValue( CENTER - b ) : magnitudeValue( b - CENTER );
+         double value = floor( stats->period + 0.5 ) + deviation;
+
+         //The bucket midpoint may lie outside the observed range
+         if( value < stats->min ) {
+            value = stats->min;
+         }
+         if( value > stats->max ) {
+            value = stats->max;
+         }
+         return value;
+      }
+   }
+
+   return stats->max;
+}
+
+/**
+ * \brief Prints the column names matching intervalStatsPrint
+ **/
+void intervalStatsPrintHeader( void )
+{
+   printf("%8s %9s %10s %9s %9s %9s %9s %9s %9s %9s %8s\n",
+          "mcam", "intervals", "mean(us)", "std(us)", "min(us)", "p50(us)",
+          "p99(us)", "p99.9(us)", "max(us)", "missing", "repeated");
+}
+
+/**
+ * \brief Prints a one line summary of the stats of a microcamera
+ **/
+void intervalStatsPrint( uint32_t mcamID, const INTERVAL_STATS * stats )
+{
+   printf("%8u %9lu %10.1f %9.1f %9lu %9.0f %9.0f %9.0f %9lu %9lu %8lu\n",
+          mcamID,
+          stats->count,
+          stats->mean,
+          sqrt( intervalStatsVariance( stats )),
+          stats->count > 0 ? stats->min : 0,
+          intervalStatsQuantile( stats, 0.5 ),
+          intervalStatsQuantile( stats, 0.99 ),
+          intervalStatsQuantile( stats, 0.999 ),
+          stats->max,
+          stats->missing,
+          stats->repeated);
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *
+ * IntervalStats.h
+ *
+ * Streaming statistics of the time between consecutive frames of one
+ * microcamera: mean and variance (Welford), min/max, percentiles and a
+ * count of frames missing from the expected period. Memory is constant
+ * per microcamera, so hundreds of sensors can be tracked live without
+ * keeping the timecodes.
+ *
+ * Percentiles come from a histogram of each interval's deviation from the
+ * expected period. Deviations are bucketed log-linearly with 16 sub-buckets
+ * per power of two in each direction, so jitter of a few microseconds is
+ * resolved exactly and larger deviations to within about 6%.
+ *
+ *****************************************************************************/
+#ifndef INTERVAL_STATS_H
+#define INTERVAL_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INTERVAL_STATS_SUB_BITS 4
+#define INTERVAL_STATS_MAX_BITS 26   //!< Deviations up to 2^26 us (about a minute)
+#define INTERVAL_STATS_MAG_BUCKETS ((INTERVAL_STATS_MAX_BITS - INTERVAL_STATS_SUB_BITS + 2) << INTERVAL_STATS_SUB_BITS)
+#define INTERVAL_STATS_BUCKETS (2 * INTERVAL_STATS_MAG_BUCKETS - 1)
+
+/**
+ * \brief Interval statistics of one microcamera
+ **/
+typedef struct {
+   double   period;      //!< Expected interval in microseconds
+   uint64_t last;        //!< Previous timestamp, 0 before the first frame
+   uint64_t count;       //!< Intervals measured
+   double   mean;        //!< Mean interval in microseconds
+   double   m2;          //!< Sum of squared differences from the mean
+   uint64_t min;         //!< Shortest interval in microseconds
+   uint64_t max;         //!< Longest interval in microseconds
+   uint64_t missing;     //!< Frames missing from gaps of several periods
+   uint64_t repeated;    //!< Timestamps not after the previous one, ignored
+   uint32_t counts[INTERVAL_STATS_BUCKETS]; //!< Deviation histogram
+} INTERVAL_STATS;
+
+/**
+ * \brief Clears stats for a stream with the given frame period
+ * \param [in] period expected interval in microseconds
+ **/
+void intervalStatsInit( INTERVAL_STATS * stats, double period );
+
+/**
+ * \brief Adds the timestamp of the next frame in microseconds
+ **/
+void intervalStatsAdd( INTERVAL_STATS * stats, uint64_t timestamp );
+
+/**
+ * \brief Adds an interval measured elsewhere, in microseconds. With a
+ *        period of 0 the stats describe any non-negative quantity, such as
+ *        the skew between microcameras
+ **/
+void intervalStatsAddInterval( INTERVAL_STATS * stats, uint64_t interval );
+
+/**
+ * \brief Returns the variance of the intervals in microseconds squared
+ **/
+double intervalStatsVariance( const INTERVAL_STATS * stats );
+
+/**
+ * \brief Returns an interval quantile in microseconds, 0 without intervals
+ * \param [in] q quantile between 0 and 1
+ **/
+double intervalStatsQuantile( const INTERVAL_STATS * stats, double q );
+
+/**
+ * \brief Prints the column names matching intervalStatsPrint
+ **/
+void intervalStatsPrintHeader( void );
+
+/**
+ * \brief Prints a one line summary of the stats of a microcamera
+ **/
+void intervalStatsPrint( uint32_t mcamID, const INTERVAL_STATS * stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
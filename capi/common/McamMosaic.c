@@ -0,0 +1,371 @@
+/******************************************************************************
+ *
+ * McamMosaic.c
+ *
+ * Thumbnail grid of many microcameras. See McamMosaic.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#include "McamMosaic.h"
+#include "FrameDispatcher.h"
+
+struct MCAM_MOSAIC {
+   int              numMCams;
+   uint32_t *       mcamIDs;      //!< Microcamera of each tile
+   int              columns;      //!< Tiles per row
+   int              tileWidth;
+   int              tileHeight;
+   int              width;        //!< Mosaic width in pixels
+   int              height;       //!< Mosaic height in pixels
+   uint8_t *        pixels;       //!< RGB mosaic
+   uint8_t *        tiles;        //!< Decoded thumbnail of each microcamera
+   uint64_t         generation;   //!< Incremented whenever a tile is drawn
+   uint64_t         decoded;
+   uint64_t         failed;
+   uint64_t         dropped;      //!< Dropped by dispatchers already stopped
+   pthread_rwlock_t lock;         //!< Shared while drawing a tile, exclusive while copying
+   FRAME_DISPATCHER dispatcher;
+   bool             started;
+};
+
+/**
+ * \brief libjpeg error handler that returns to the decoder instead of exiting
+ **/
+typedef struct {
+   struct jpeg_error_mgr pub;
+   jmp_buf               jump;
+} DECODE_ERROR;
+
+static void decodeErrorExit( j_common_ptr cinfo )
+{
+   longjmp( ((DECODE_ERROR *)cinfo->err)->jump, 1 );
+}
+
+static void decodeSilent( j_common_ptr cinfo )
+{
+}
+
+/**
+ * \brief Returns the tile of a microcamera, or -1 if it is not in the mosaic
+ **/
+static int findTile( const MCAM_MOSAIC * m, uint32_t mcamID )
+{
+   for( int i = 0; i < m->numMCams; i++ ) {
+      if( m->mcamIDs[i] == mcamID ) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+/**
+ * \brief Decodes a JPEG scaled down into a tileWidth x tileHeight RGB tile,
+ *        keeping its aspect ratio with black bars
+ * \return false if the image could not be decoded
+ **/
+static bool decodeTile( const MCAM_MOSAIC * m, const FRAME * frame, uint8_t * tile )
+{
+   struct jpeg_decompress_struct cinfo;
+   DECODE_ERROR error;
+   cinfo.err = jpeg_std_error( &error.pub );
+   error.pub.error_exit     = decodeErrorExit;
+   error.pub.output_message = decodeSilent;
+   if( setjmp( error.jump )) {
+      jpeg_destroy_decompress( &cinfo );
+      return false;
+   }
+
+   jpeg_create_decompress( &cinfo );
+   jpeg_mem_src( &cinfo, (unsigned char *)frame->m_image, frame->m_metadata.m_size );
+   jpeg_read_header( &cinfo, TRUE );
+
+   //Let the IDCT do the downscaling: the smallest scale that covers the tile
+   unsigned int denom = 8;
+   while( denom > 1 && ( ( cinfo.image_width + denom - 1 ) / denom < (unsigned int)m->tileWidth
+                      || ( cinfo.image_height + denom - 1 ) / denom < (unsigned int)m->tileHeight )) {
+      denom /= 2;
+   }
+   cinfo.scale_num           = 1;
+   cinfo.scale_denom         = denom;
+   cinfo.out_color_space     = JCS_RGB;
+   cinfo.dct_method          = JDCT_IFAST;
+   cinfo.do_fancy_upsampling = FALSE;
+   cinfo.do_block_smoothing  = FALSE;
+   jpeg_start_decompress( &cinfo );
+
+   int outWidth  = cinfo.output_width;
+   int outHeight = cinfo.output_height;
+   int rowBytes  = m->tileWidth * 3;
+   JSAMPARRAY row = (*cinfo.mem->alloc_sarray)( (j_common_ptr)&cinfo, JPOOL_IMAGE, outWidth * 3, 1 );
+
+   //Fit the image inside the tile
+   int fitWidth  = m->tileWidth;
+   int fitHeight = m->tileHeight;
+   if( (int64_t)outWidth * m->tileHeight > (int64_t)outHeight * m->tileWidth ) {
+      fitHeight = (int)((int64_t)outHeight * m->tileWidth / outWidth );
+   }
+   else {
+      fitWidth = (int)((int64_t)outWidth * m->tileHeight / outHeight );
+   }
+   if( fitWidth < m->tileWidth || fitHeight < m->tileHeight ) {
+      memset( tile, 0, (size_t)rowBytes * m->tileHeight );
+   }
+   uint8_t * origin = tile + ( m->tileHeight - fitHeight ) / 2 * rowBytes + ( m->tileWidth - fitWidth ) / 2 * 3;
+
+   //Nearest neighbour columns, unless the scaled image already fits exactly
+   int * columns = NULL;
+   if( outWidth != fitWidth ) {
+      columns = (int *)(*cinfo.mem->alloc_small)( (j_common_ptr)&cinfo, JPOOL_IMAGE, fitWidth * sizeof(int));
+      for( int x = 0; x < fitWidth; x++ ) {
+         columns[x] = (int)((int64_t)x * outWidth / fitWidth ) * 3;
+      }
+   }
+
+   int tileRow = 0;
+   while( cinfo.output_scanline < cinfo.output_height ) {
+      int y = cinfo.output_scanline;
+      jpeg_read_scanlines( &cinfo, row, 1 );
+      while( tileRow < fitHeight && (int64_t)tileRow * outHeight / fitHeight == y ) {
+         uint8_t * out = origin + tileRow * rowBytes;
+         if( columns == NULL ) {
+            memcpy( out, row[0], fitWidth * 3 );
+         }
+         else {
+            for( int x = 0; x < fitWidth; x++ ) {
+               const uint8_t * in = row[0] + columns[x];
+               out[3*x]     = in[0];
+               out[3*x + 1] = in[1];
+               out[3*x + 2] = in[2];
+            }
+         }
+         tileRow++;
+      }
+   }
+
+   jpeg_finish_decompress( &cinfo );
+   jpeg_destroy_decompress( &cinfo );
+
+   return true;
+}
+
+/**
+ * \brief Returns the frames the running dispatcher dropped
+ **/
+static uint64_t dispatcherDropped( MCAM_MOSAIC * m )
+{
+   uint64_t dropped = 0;
+   for( int i = 0; i < m->numMCams; i++ ) {
+      FRAME_DISPATCH_STATS stats;
+      if( frameDispatcherGetStats( &m->dispatcher, m->mcamIDs[i], &stats )) {
+         dropped += stats.dropped;
+      }
+   }
+
+   return dropped;
+}
+
+/**
+ * \brief Frame callback left behind by mcamMosaicStop
+ **/
+static void ignoreFrame( FRAME frame, void * data )
+{
+}
+
+/**
+ * \brief Dispatcher callback that draws a frame
+ **/
+static void mosaicFrame( FRAME frame, void * data )
+{
+   mcamMosaicAddFrame( (MCAM_MOSAIC *)data, &frame );
+}
+
+/**
+ * \brief Creates an all black mosaic
+ **/
+MCAM_MOSAIC * mcamMosaicCreate( const uint32_t * mcamIDs
+                              , int numMCams
+                              , int columns
+                              , int tileWidth
+                              , int tileHeight
+                              )
+{
+   if( numMCams < 1 || tileWidth < 1 || tileHeight < 1 ) {
+      return NULL;
+   }
+   if( columns <= 0 ) {
+      columns = (int)ceil( sqrt( numMCams ));
+   }
+   if( columns > numMCams ) {
+      columns = numMCams;
+   }
+
+   MCAM_MOSAIC * m = (MCAM_MOSAIC *)calloc( 1, sizeof(MCAM_MOSAIC));
+   if( m == NULL ) {
+      return NULL;
+   }
+   int rows = ( numMCams + columns - 1 ) / columns;
+   size_t tileBytes = (size_t)tileWidth * tileHeight * 3;
+
+   m->numMCams   = numMCams;
+   m->columns    = columns;
+   m->tileWidth  = tileWidth;
+   m->tileHeight = tileHeight;
+   m->width      = columns * tileWidth;
+   m->height     = rows * tileHeight;
+   m->mcamIDs    = (uint32_t *)malloc( numMCams * sizeof(uint32_t));
+   m->pixels     = (uint8_t *)calloc( (size_t)m->width * m->height, 3 );
+   m->tiles      = (uint8_t *)malloc( numMCams * tileBytes );
+   if( m->mcamIDs == NULL || m->pixels == NULL || m->tiles == NULL ) {
+      free( m->mcamIDs );
+      free( m->pixels );
+      free( m->tiles );
+      free( m );
+      return NULL;
+   }
+   memcpy( m->mcamIDs, mcamIDs, numMCams * sizeof(uint32_t));
+   pthread_rwlock_init( &m->lock, NULL );
+
+   return m;
+}
+
+/**
+ * \brief Returns the size of the mosaic in pixels
+ **/
+void mcamMosaicGetSize( const MCAM_MOSAIC * mosaic, int * width, int * height )
+{
+   *width  = mosaic->width;
+   *height = mosaic->height;
+}
+
+/**
+ * \brief Decodes a JPEG frame into the tile of its microcamera
+ **/
+bool mcamMosaicAddFrame( MCAM_MOSAIC * mosaic, const FRAME * frame )
+{
+   MCAM_MOSAIC * m = mosaic;
+   int i = findTile( m, frame->m_metadata.m_camId );
+   if( i < 0 ) {
+      return false;
+   }
+
+   //Decode outside the lock into the private tile of the microcamera
+   size_t rowBytes = (size_t)m->tileWidth * 3;
+   uint8_t * tile = m->tiles + i * rowBytes * m->tileHeight;
+   if( frame->m_image == NULL || frame->m_metadata.m_mode != ATL_MODE_JPEG || !decodeTile( m, frame, tile )) {
+      __atomic_add_fetch( &m->failed, 1, __ATOMIC_RELAXED );
+      return false;
+   }
+
+   //Tiles do not overlap, so drawing threads share the lock
+   size_t stride = (size_t)m->width * 3;
+   uint8_t * out = m->pixels + ( i / m->columns ) * m->tileHeight * stride + ( i % m->columns ) * rowBytes;
+   pthread_rwlock_rdlock( &m->lock );
+   for( int y = 0; y < m->tileHeight; y++ ) {
+      memcpy( out + y * stride, tile + y * rowBytes, rowBytes );
+   }
+   __atomic_add_fetch( &m->generation, 1, __ATOMIC_RELEASE );
+   pthread_rwlock_unlock( &m->lock );
+   __atomic_add_fetch( &m->decoded, 1, __ATOMIC_RELAXED );
+
+   return true;
+}
+
+/**
+ * \brief Copies the mosaic into rgb if it changed since generation
+ **/
+uint64_t mcamMosaicCopy( MCAM_MOSAIC * mosaic, uint8_t * rgb, uint64_t generation )
+{
+   if( __atomic_load_n( &mosaic->generation, __ATOMIC_ACQUIRE ) == generation ) {
+      return generation;
+   }
+
+   pthread_rwlock_wrlock( &mosaic->lock );
+   uint64_t current = __atomic_load_n( &mosaic->generation, __ATOMIC_ACQUIRE );
+   memcpy( rgb, mosaic->pixels, (size_t)mosaic->width * mosaic->height * 3 );
+   pthread_rwlock_unlock( &mosaic->lock );
+
+   return current;
+}
+
+/**
+ * \brief Sets the frame callback to add every received frame to the mosaic
+ **/
+bool mcamMosaicStart( MCAM_MOSAIC * mosaic, int numWorkers )
+{
+   if( mosaic->started ) {
+      return true;
+   }
+
+   MICRO_CAMERA_FRAME_CALLBACK decodeCB;
+   decodeCB.f    = mosaicFrame;
+   decodeCB.data = mosaic;
+   if( !frameDispatcherInit( &mosaic->dispatcher, mosaic->mcamIDs, mosaic->numMCams,
+                             FRAME_DISPATCH_LATEST, 1, numWorkers, decodeCB )) {
+      return false;
+   }
+   mosaic->started = true;
+   setMCamFrameCallback( frameDispatcherCallback( &mosaic->dispatcher ));
+
+   return true;
+}
+
+/**
+ * \brief Stops the decode threads
+ **/
+void mcamMosaicStop( MCAM_MOSAIC * mosaic )
+{
+   if( mosaic->started ) {
+      //Receivers that stay open must not call into the freed dispatcher.
+      //Stopping it waits for those already pushing a frame
+      MICRO_CAMERA_FRAME_CALLBACK ignoreCB;
+      ignoreCB.f    = ignoreFrame;
+      ignoreCB.data = NULL;
+      setMCamFrameCallback( ignoreCB );
+
+      frameDispatcherStop( &mosaic->dispatcher );
+      mosaic->dropped += dispatcherDropped( mosaic );
+      frameDispatcherDestroy( &mosaic->dispatcher );
+      mosaic->started = false;
+   }
+}
+
+/**
+ * \brief Returns the accounting so far
+ **/
+MCAM_MOSAIC_STATS mcamMosaicGetStats( MCAM_MOSAIC * mosaic )
+{
+   MCAM_MOSAIC_STATS stats;
+   stats.decoded = __atomic_load_n( &mosaic->decoded, __ATOMIC_RELAXED );
+   stats.failed  = __atomic_load_n( &mosaic->failed, __ATOMIC_RELAXED );
+   stats.dropped = mosaic->dropped;
+   if( mosaic->started ) {
+      stats.dropped += dispatcherDropped( mosaic );
+   }
+
+   return stats;
+}
+
+/**
+ * \brief Stops the decoders if needed and frees the mosaic
+ **/
+void mcamMosaicDestroy( MCAM_MOSAIC * mosaic )
+{
+   if( mosaic == NULL ) {
+      return;
+   }
+   mcamMosaicStop( mosaic );
+
+   pthread_rwlock_destroy( &mosaic->lock );
+   free( mosaic->mcamIDs );
+   free( mosaic->pixels );
+   free( mosaic->tiles );
+   free( mosaic );
+}
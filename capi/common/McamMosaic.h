@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * McamMosaic.h
+ *
+ * Live thumbnail grid of many microcameras in one RGB buffer, for viewers
+ * that cannot afford to decode and scale every stream themselves.
+ *
+ * Each JPEG frame is decoded with libjpeg DCT scaling to the smallest of
+ * 1/1, 1/2, 1/4 or 1/8 size that still covers a tile, so an HD frame is
+ * decoded straight to 240x135 without ever producing the full image. The
+ * thumbnail is resampled into a private tile, keeping its aspect ratio,
+ * and copied into the mosaic row by row. Frames of different microcameras
+ * are decoded in parallel.
+ *
+ * mcamMosaicStart sets a FrameDispatcher with the latest-only policy as the
+ * frame callback, so receiver threads only copy frames and a busy decoder
+ * skips to the newest frame of its microcamera. A viewer polls
+ * mcamMosaicCopy at its refresh rate and gets one buffer for the whole
+ * array. A mosaic of one microcamera with a tile the size of the window is
+ * a single stream view that repaints only the newest frame.
+ *
+ * Functions are exported without name mangling so the library can be
+ * loaded from Python with ctypes.
+ *
+ *****************************************************************************/
+#ifndef MCAM_MOSAIC_H
+#define MCAM_MOSAIC_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCAM_MOSAIC_TILE_WIDTH  240   //!< Default tile width, 1/8 of HD
+#define MCAM_MOSAIC_TILE_HEIGHT 135   //!< Default tile height, 1/8 of HD
+
+typedef struct MCAM_MOSAIC MCAM_MOSAIC;
+
+/**
+ * \brief Mosaic accounting
+ **/
+typedef struct {
+   uint64_t decoded;   //!< Frames drawn into the mosaic
+   uint64_t failed;    //!< Frames that were not JPEGs or failed to decode
+   uint64_t dropped;   //!< Frames replaced by a newer one before decoding
+} MCAM_MOSAIC_STATS;
+
+/**
+ * \brief Creates an all black mosaic
+ * \param [in] mcamIDs    microcameras in tile order, row by row
+ * \param [in] columns    tiles per row, 0 for a roughly square grid
+ * \param [in] tileWidth  tile width in pixels
+ * \param [in] tileHeight tile height in pixels
+ * \return the mosaic, or NULL if it could not be allocated
+ **/
+MCAM_MOSAIC * mcamMosaicCreate( const uint32_t * mcamIDs
+                              , int numMCams
+                              , int columns
+                              , int tileWidth
+                              , int tileHeight
+                              );
+
+/**
+ * \brief Returns the size of the mosaic in pixels. Rows are 3 * width bytes
+ **/
+void mcamMosaicGetSize( const MCAM_MOSAIC * mosaic, int * width, int * height );
+
+/**
+ * \brief Decodes a JPEG frame into the tile of its microcamera. Frames of
+ *        different microcameras may be added from different threads, frames
+ *        of one microcamera one at a time
+ * \return false if the frame is not in the mosaic or could not be decoded
+ **/
+bool mcamMosaicAddFrame( MCAM_MOSAIC * mosaic, const FRAME * frame );
+
+/**
+ * \brief Copies the mosaic into rgb if it changed since generation
+ * \param [out] rgb        width * height * 3 bytes
+ * \param [in]  generation value returned by the previous copy, 0 at first
+ * \return the generation of the mosaic. rgb is only written if it differs
+ *         from generation
+ **/
+uint64_t mcamMosaicCopy( MCAM_MOSAIC * mosaic, uint8_t * rgb, uint64_t generation );
+
+/**
+ * \brief Sets the frame callback to add every received frame to the mosaic
+ * \param [in] numWorkers decode threads
+ * \return true if the decoders were started
+ **/
+bool mcamMosaicStart( MCAM_MOSAIC * mosaic, int numWorkers );
+
+/**
+ * \brief Replaces the frame callback with one that ignores frames and stops
+ *        the decode threads, after any frame a receiver is still copying.
+ *        The streams may still be running. The mosaic can be started again
+ **/
+void mcamMosaicStop( MCAM_MOSAIC * mosaic );
+
+/**
+ * \brief Returns the accounting so far
+ **/
+MCAM_MOSAIC_STATS mcamMosaicGetStats( MCAM_MOSAIC * mosaic );
+
+/**
+ * \brief Stops the decoders if needed and frees the mosaic
+ **/
+void mcamMosaicDestroy( MCAM_MOSAIC * mosaic );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
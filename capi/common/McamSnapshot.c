@@ -0,0 +1,226 @@
+/******************************************************************************
+ *
+ * McamSnapshot.c
+ *
+ * Frames of every microcamera at a common time. See McamSnapshot.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "McamSnapshot.h"
+#include "Metrics.h"
+
+/**
+ * \brief Requests shared by the threads of one pass
+ **/
+typedef struct {
+   ACOS_CAMERA      cam;
+   int              tiling;
+   int              tile;
+   int              count;       //!< Requests in the pass
+   const uint32_t * mcamIDs;     //!< Microcamera of each request
+   const uint64_t * times;       //!< Time of each request
+   FRAME *          frames;      //!< Result of each request
+   int              next;        //!< Next request to take
+} SNAPSHOT_PASS;
+
+/**
+ * \brief Takes requests of a pass until none are left
+ **/
+static void * passThread( void * data )
+{
+   SNAPSHOT_PASS * pass = (SNAPSHOT_PASS *)data;
+   int i;
+   while(( i = __atomic_fetch_add( &pass->next, 1, __ATOMIC_RELAXED )) < pass->count ) {
+      uint64_t requested = metricsNow();
+      pass->frames[i] = getFrame( pass->cam, pass->mcamIDs[i], pass->times[i], pass->tiling, pass->tile );
+      metricsRecord( METRIC_GET_FRAME, requested );
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Runs the requests of a pass on up to numThreads threads, including
+ *        the caller's
+ **/
+static void runPass( SNAPSHOT_PASS * pass, int numThreads )
+{
+   pthread_t threads[MCAM_SNAPSHOT_MAX_THREADS];
+   int started = 0;
+   if( numThreads > pass->count ) {
+      numThreads = pass->count;
+   }
+   pass->next = 0;
+   while( started < numThreads - 1
+       && pthread_create( &threads[started], NULL, passThread, pass ) == 0 ) {
+      started++;
+   }
+   passThread( pass );
+   for( int i = 0; i < started; i++ ) {
+      pthread_join( threads[i], NULL );
+   }
+}
+
+/**
+ * \brief Requests a frame of every microcamera at a common time
+ **/
+bool mcamSnapshotGet( ACOS_CAMERA cam
+                    , const uint32_t * mcamIDs
+                    , int numMCams
+                    , uint64_t timestamp
+                    , int tiling
+                    , int tile
+                    , int numThreads
+                    , FRAME * frames
+                    , MCAM_SNAPSHOT_REPORT * report
+                    )
+{
+   uint64_t start = metricsNow();
+   MCAM_SNAPSHOT_REPORT r;
+   memset( &r, 0, sizeof(r));
+   memset( frames, 0, numMCams * sizeof(FRAME));
+   if( numThreads <= 0 || numThreads > MCAM_SNAPSHOT_MAX_THREADS ) {
+      numThreads = MCAM_SNAPSHOT_MAX_THREADS;
+   }
+
+   uint32_t * ids   = (uint32_t *)malloc( numMCams * sizeof(uint32_t));
+   uint64_t * times = (uint64_t *)malloc( numMCams * sizeof(uint64_t));
+   FRAME *    again = (FRAME *)malloc( numMCams * sizeof(FRAME));
+   int *      slot  = (int *)malloc( numMCams * sizeof(int));
+   if( ids == NULL || times == NULL || again == NULL || slot == NULL ) {
+      free( ids );
+      free( times );
+      free( again );
+      free( slot );
+      return false;
+   }
+
+   SNAPSHOT_PASS pass;
+   memset( &pass, 0, sizeof(pass));
+   pass.cam     = cam;
+   pass.tiling  = tiling;
+   pass.tile    = tile;
+   pass.count   = numMCams;
+   pass.mcamIDs = mcamIDs;
+   pass.times   = times;
+   pass.frames  = frames;
+   for( int i = 0; i < numMCams; i++ ) {
+      times[i] = timestamp;
+   }
+   runPass( &pass, numThreads );
+
+   if( timestamp == 0 ) {
+      //The oldest latest frame is the newest time every microcamera has
+      for( int i = 0; i < numMCams; i++ ) {
+         if( frames[i].m_image != NULL
+          && ( timestamp == 0 || frames[i].m_metadata.m_timestamp < timestamp )) {
+            timestamp = frames[i].m_metadata.m_timestamp;
+         }
+      }
+
+      //Request newer frames again at that time, unless they are closer to it
+      //than half a frame period
+      int count = 0;
+      for( int i = 0; timestamp != 0 && i < numMCams; i++ ) {
+         const FRAME_METADATA * meta = &frames[i].m_metadata;
+         uint64_t halfPeriod = meta->m_framerate > 0 ? (uint64_t)( 5e5 / meta->m_framerate ) : 0;
+         if( frames[i].m_image == NULL || meta->m_timestamp > timestamp + halfPeriod ) {
+            ids[count]   = mcamIDs[i];
+            times[count] = timestamp;
+            slot[count]  = i;
+            count++;
+         }
+      }
+      if( count > 0 ) {
+         pass.count   = count;
+         pass.mcamIDs = ids;
+         pass.frames  = again;
+         runPass( &pass, numThreads );
+
+         //A microcamera that has no frame at the common time keeps its latest
+         for( int j = 0; j < count; j++ ) {
+            FRAME * frame = &frames[slot[j]];
+            if( again[j].m_image == NULL ) {
+               continue;
+            }
+            if( frame->m_image != NULL && !returnPointer( frame->m_image )) {
+               printf("Failed to return the pointer for the frame buffer\n");
+            }
+            *frame = again[j];
+            r.refetched++;
+         }
+      }
+   }
+
+   r.timestamp = timestamp;
+   for( int i = 0; i < numMCams; i++ ) {
+      if( frames[i].m_image == NULL ) {
+         r.failures++;
+         continue;
+      }
+      uint64_t t = frames[i].m_metadata.m_timestamp;
+      if( r.frames == 0 || t < r.minTimestamp ) {
+         r.minTimestamp = t;
+      }
+      if( r.frames == 0 || t > r.maxTimestamp ) {
+         r.maxTimestamp = t;
+      }
+      r.frames++;
+   }
+   r.skew    = r.maxTimestamp - r.minTimestamp;
+   r.elapsed = ( metricsNow() - start ) / 1000;
+   if( report != NULL ) {
+      *report = r;
+   }
+
+   free( ids );
+   free( times );
+   free( again );
+   free( slot );
+
+   return r.failures == 0;
+}
+
+/**
+ * \brief Returns the buffers of a snapshot with returnPointer
+ **/
+void mcamSnapshotRelease( FRAME * frames, int numMCams )
+{
+   for( int i = 0; i < numMCams; i++ ) {
+      if( frames[i].m_image != NULL ) {
+         if( !returnPointer( frames[i].m_image )) {
+            printf("Failed to return the pointer for the frame buffer\n");
+         }
+         frames[i].m_image = NULL;
+      }
+   }
+}
+
+/**
+ * \brief Prints the report and the offset of every frame from the common time
+ **/
+void mcamSnapshotPrintReport( const MCAM_SNAPSHOT_REPORT * report
+                            , const FRAME * frames
+                            , int numMCams
+                            )
+{
+   printf("Snapshot at %lu: %d frames, %d failed, %d requested again, skew %lu us, took %lu us\n",
+          (unsigned long)report->timestamp,
+          report->frames,
+          report->failures,
+          report->refetched,
+          (unsigned long)report->skew,
+          (unsigned long)report->elapsed);
+   for( int i = 0; i < numMCams; i++ ) {
+      if( frames[i].m_image != NULL ) {
+         printf("\tmcam %u frame %lu offset %+ld us\n",
+                frames[i].m_metadata.m_camId,
+                (unsigned long)frames[i].m_metadata.m_id,
+                (long)( frames[i].m_metadata.m_timestamp - report->timestamp ));
+      }
+   }
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * McamSnapshot.h
+ *
+ * One frame of every microcamera of a camera, taken at a common time.
+ * Requesting the latest frame of each microcamera one after another mixes
+ * frames captured up to N request times apart and takes N request times.
+ *
+ * A snapshot requests the frames in parallel, so it takes about the time of
+ * one request. Without a given time it first requests the latest frame of
+ * every microcamera and picks the oldest of them as the common time, the
+ * newest time every microcamera has a frame for. Latest frames within half
+ * a frame period of it are kept. Frames of microcameras that have already
+ * captured a newer frame are requested again at the common time, also in
+ * parallel, so the worst case is two request times. With synchronized
+ * microcameras most latest frames are kept.
+ *
+ * The report gives the spread of the returned timestamps. Each frame's
+ * offset from the common time is m_timestamp - timestamp.
+ *
+ *****************************************************************************/
+#ifndef MCAM_SNAPSHOT_H
+#define MCAM_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCAM_SNAPSHOT_MAX_THREADS 64   //!< Most requests in flight at once
+
+/**
+ * \brief Timing of a snapshot
+ **/
+typedef struct {
+   uint64_t timestamp;      //!< Common time in microseconds
+   uint64_t minTimestamp;   //!< Oldest returned frame
+   uint64_t maxTimestamp;   //!< Newest returned frame
+   uint64_t skew;           //!< maxTimestamp - minTimestamp
+   int      frames;         //!< Microcameras with a frame
+   int      failures;       //!< Microcameras without a frame
+   int      refetched;      //!< Latest frames requested again at the common time
+   uint64_t elapsed;        //!< Microseconds the snapshot took
+} MCAM_SNAPSHOT_REPORT;
+
+/**
+ * \brief Requests a frame of every microcamera at a common time
+ * \param [in]  timestamp  common time, or 0 to use the newest time every
+ *                         microcamera has a frame for
+ * \param [in]  numThreads parallel requests, 0 for one per microcamera
+ * \param [out] frames     numMCams frames in the order of mcamIDs. m_image
+ *                         is NULL for microcameras without a frame
+ * \param [out] report     timing of the snapshot, may be NULL
+ * \return true if every microcamera returned a frame
+ **/
+bool mcamSnapshotGet( ACOS_CAMERA cam
+                    , const uint32_t * mcamIDs
+                    , int numMCams
+                    , uint64_t timestamp
+                    , int tiling
+                    , int tile
+                    , int numThreads
+                    , FRAME * frames
+                    , MCAM_SNAPSHOT_REPORT * report
+                    );
+
+/**
+ * \brief Returns the buffers of a snapshot with returnPointer
+ **/
+void mcamSnapshotRelease( FRAME * frames, int numMCams );
+
+/**
+ * \brief Prints the report and the offset of every frame from the common time
+ **/
+void mcamSnapshotPrintReport( const MCAM_SNAPSHOT_REPORT * report
+                            , const FRAME * frames
+                            , int numMCams
+                            );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
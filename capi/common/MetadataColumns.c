@@ -0,0 +1,901 @@
+/******************************************************************************
+ *
+ * MetadataColumns.c
+ *
+ * Columnar store of frame metadata. See MetadataColumns.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "MetadataColumns.h"
+
+//Furthest a timestamp may be from the first of its block, so that residuals
+//and block offsets fit in 32 bits
+#define MAX_BLOCK_SPAN ( INT32_MAX / 2 )
+
+/**
+ * \brief Header at the start of every store file
+ **/
+typedef struct {
+   uint32_t magic;       //!< METADATA_COLUMNS_MAGIC
+   uint16_t version;     //!< METADATA_COLUMNS_VERSION of the writer
+   uint16_t blockSize;   //!< Size of METADATA_COLUMNS_BLOCK in bytes
+   uint32_t numMCams;
+   uint32_t runSize;     //!< Size of METADATA_COLUMNS_RUN in bytes
+} METADATA_COLUMNS_HEADER;
+
+/**
+ * \brief Header of the columns of one microcamera. Followed by its blocks,
+ *        residuals, sizes and runs, each padded to 8 bytes
+ **/
+typedef struct {
+   uint32_t mcamID;
+   uint32_t reserved;
+   uint64_t numFrames;
+   uint64_t numBlocks;
+   uint64_t residualSize;
+   uint64_t runCount[METADATA_RUN_COLUMNS];
+} METADATA_COLUMNS_SECTION;
+
+static uint64_t padded( uint64_t size )
+{
+   return ( size + 7 ) & ~(uint64_t)7;
+}
+
+/**
+ * \brief Grows an array to hold at least needed elements
+ * \return the array, or NULL if out of memory and the array is unchanged
+ **/
+static void * grow( void * array, uint64_t * capacity, uint64_t needed, size_t elementSize )
+{
+   if( needed <= *capacity ) {
+      return array;
+   }
+   uint64_t newCapacity = ( *capacity > 0 ) ? *capacity : 64;
+   while( newCapacity < needed ) {
+      newCapacity *= 2;
+   }
+   void * grown = realloc( array, newCapacity * elementSize );
+   if( grown != NULL ) {
+      *capacity = newCapacity;
+   }
+
+   return grown;
+}
+
+static uint64_t doubleBits( double value )
+{
+   uint64_t bits;
+   memcpy( &bits, &value, sizeof(bits));
+   return bits;
+}
+
+static double bitsDouble( uint64_t bits )
+{
+   double value;
+   memcpy( &value, &bits, sizeof(value));
+   return value;
+}
+
+/**
+ * \brief Finds a microcamera, returning where it would be inserted if absent
+ **/
+static uint32_t findMcam( const METADATA_COLUMNS * store, uint32_t mcamID )
+{
+   uint32_t low  = 0;
+   uint32_t high = store->numMCams;
+   while( low < high ) {
+      uint32_t mid = low + ( high - low ) / 2;
+      if( store->mcams[mid]->mcamID < mcamID ) {
+         low = mid + 1;
+      }
+      else {
+         high = mid;
+      }
+   }
+
+   return low;
+}
+
+/**
+ * \brief Returns the columns of a microcamera, adding them if needed
+ **/
+static METADATA_COLUMNS_MCAM * getMcam( METADATA_COLUMNS * store, uint32_t mcamID )
+{
+   uint32_t i = findMcam( store, mcamID );
+   if( i < store->numMCams && store->mcams[i]->mcamID == mcamID ) {
+      return store->mcams[i];
+   }
+
+   if( store->numMCams == store->capacity ) {
+      uint32_t capacity = ( store->capacity > 0 ) ? 2 * store->capacity : 16;
+      METADATA_COLUMNS_MCAM ** mcams = (METADATA_COLUMNS_MCAM **)realloc( store->mcams, capacity * sizeof(*mcams));
+      if( mcams == NULL ) {
+         return NULL;
+      }
+      store->mcams    = mcams;
+      store->capacity = capacity;
+   }
+
+   METADATA_COLUMNS_MCAM * mcam = (METADATA_COLUMNS_MCAM *)calloc( 1, sizeof(METADATA_COLUMNS_MCAM));
+   if( mcam != NULL ) {
+      mcam->pending = (uint64_t *)malloc( METADATA_COLUMNS_BLOCK_FRAMES * sizeof(uint64_t));
+   }
+   if( mcam == NULL || mcam->pending == NULL ) {
+      free( mcam );
+      return NULL;
+   }
+   mcam->mcamID = mcamID;
+
+   memmove( &store->mcams[i + 1], &store->mcams[i], ( store->numMCams - i ) * sizeof(*store->mcams));
+   store->mcams[i] = mcam;
+   store->numMCams++;
+
+   return mcam;
+}
+
+/**
+ * \brief Appends a value to a column, extending its last run in the open
+ *        block if the value repeats
+ **/
+static bool appendRun( METADATA_COLUMNS_MCAM * mcam, METADATA_COLUMN column, uint64_t value )
+{
+   uint64_t count = mcam->runCount[column];
+   if( count > mcam->open.firstRun[column] && mcam->runs[column][count - 1].value == value ) {
+      mcam->runs[column][count - 1].count++;
+      return true;
+   }
+
+   METADATA_COLUMNS_RUN * runs = (METADATA_COLUMNS_RUN *)grow( mcam->runs[column], &mcam->runCapacity[column],
+                                                                count + 1, sizeof(METADATA_COLUMNS_RUN));
+   if( runs == NULL ) {
+      return false;
+   }
+   mcam->runs[column] = runs;
+   memset( &runs[count], 0, sizeof(METADATA_COLUMNS_RUN));
+   runs[count].value = value;
+   runs[count].count = 1;
+   mcam->runCount[column]++;
+
+   return true;
+}
+
+/**
+ * \brief Encodes the timestamps of the open block and adds it to the blocks
+ **/
+static bool sealBlock( METADATA_COLUMNS_MCAM * mcam )
+{
+   METADATA_COLUMNS_BLOCK * block = &mcam->open;
+   uint32_t count = block->count;
+   if( count == 0 ) {
+      return true;
+   }
+
+   //Residuals from the line through the first and last timestamps
+   const uint64_t * pending = mcam->pending;
+   int64_t period = ( count > 1 ) ? (int64_t)( pending[count - 1] - pending[0] ) / ( count - 1 ) : 0;
+   bool narrow = true;
+   block->minTimestamp = pending[0];
+   block->maxTimestamp = pending[0];
+   for( uint32_t i = 0; i < count; i++ ) {
+      int64_t residual = (int64_t)( pending[i] - pending[0] ) - i * period;
+      narrow = narrow && residual >= INT16_MIN && residual <= INT16_MAX;
+      block->minTimestamp = ( pending[i] < block->minTimestamp ) ? pending[i] : block->minTimestamp;
+      block->maxTimestamp = ( pending[i] > block->maxTimestamp ) ? pending[i] : block->maxTimestamp;
+   }
+   block->period        = (int32_t)period;
+   block->residualBytes = narrow ? 2 : 4;
+
+   //Residuals stay 4 byte aligned for the vector loads
+   uint64_t bytes = ( (uint64_t)count * block->residualBytes + 3 ) & ~(uint64_t)3;
+   uint8_t * residuals = (uint8_t *)grow( mcam->residuals, &mcam->residualCapacity,
+                                          mcam->residualSize + bytes, 1 );
+   METADATA_COLUMNS_BLOCK * blocks = (METADATA_COLUMNS_BLOCK *)grow( mcam->blocks, &mcam->blockCapacity,
+                                                                     mcam->numBlocks + 1, sizeof(METADATA_COLUMNS_BLOCK));
+   if( residuals != NULL ) {
+      mcam->residuals = residuals;
+   }
+   if( blocks != NULL ) {
+      mcam->blocks = blocks;
+   }
+   if( residuals == NULL || blocks == NULL ) {
+      return false;
+   }
+
+   block->residualOffset = mcam->residualSize;
+   for( uint32_t i = 0; i < count; i++ ) {
+      int64_t residual = (int64_t)( pending[i] - pending[0] ) - i * period;
+      if( narrow ) {
+         int16_t value = (int16_t)residual;
+         memcpy( residuals + block->residualOffset + 2 * i, &value, 2 );
+      }
+      else {
+         int32_t value = (int32_t)residual;
+         memcpy( residuals + block->residualOffset + 4 * i, &value, 4 );
+      }
+   }
+   memset( residuals + block->residualOffset + (uint64_t)count * block->residualBytes, 0,
+           bytes - (uint64_t)count * block->residualBytes );
+   mcam->residualSize += bytes;
+
+   for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+      block->numRuns[c] = (uint32_t)( mcam->runCount[c] - block->firstRun[c] );
+   }
+   mcam->blocks[mcam->numBlocks++] = *block;
+   mcam->numFrames += count;
+   memset( block, 0, sizeof(*block));
+
+   return true;
+}
+
+/**
+ * \brief Counts the frames from index from to index to of a block whose
+ *        timestamps are in [lo, hi], both relative to its first timestamp
+ **/
+static uint32_t countInBlock( const METADATA_COLUMNS_MCAM * mcam
+                            , const METADATA_COLUMNS_BLOCK * block
+                            , uint32_t from
+                            , uint32_t to
+                            , int64_t lo
+                            , int64_t hi
+                            )
+{
+   //Every offset of the block fits in 32 bits, so clamping keeps the result
+   int32_t low  = ( lo < INT32_MIN ) ? INT32_MIN : ( lo > INT32_MAX ) ? INT32_MAX : (int32_t)lo;
+   int32_t high = ( hi < INT32_MIN ) ? INT32_MIN : ( hi > INT32_MAX ) ? INT32_MAX : (int32_t)hi;
+   const uint8_t * residuals = mcam->residuals + block->residualOffset;
+   bool narrow = block->residualBytes == 2;
+   uint32_t count = 0;
+   uint32_t i = from;
+
+   //offset = i * period + residual, four frames at a time. The sums wrap
+   //the same way as the scalar ones
+#if defined(__SSE2__)
+   __m128i vlow  = _mm_set1_epi32( low );
+   __m128i vhigh = _mm_set1_epi32( high );
+   __m128i step  = _mm_set1_epi32( (int32_t)( 4u * (uint32_t)block->period ));
+   __m128i line  = _mm_setr_epi32( (int32_t)( i * (uint32_t)block->period ),
+                                   (int32_t)(( i + 1 ) * (uint32_t)block->period ),
+                                   (int32_t)(( i + 2 ) * (uint32_t)block->period ),
+                                   (int32_t)(( i + 3 ) * (uint32_t)block->period ));
+   for( ; i + 4 <= to; i += 4 ) {
+      __m128i residual;
+      if( narrow ) {
+         __m128i packed = _mm_loadl_epi64( (const __m128i *)( residuals + 2 * i ));
+         residual = _mm_srai_epi32( _mm_unpacklo_epi16( packed, packed ), 16 );
+      }
+      else {
+         residual = _mm_loadu_si128( (const __m128i *)( residuals + 4 * i ));
+      }
+      __m128i offset  = _mm_add_epi32( line, residual );
+      __m128i outside = _mm_or_si128( _mm_cmplt_epi32( offset, vlow ), _mm_cmpgt_epi32( offset, vhigh ));
+      count += 4 - __builtin_popcount( _mm_movemask_ps( _mm_castsi128_ps( outside )));
+      line = _mm_add_epi32( line, step );
+   }
+#elif defined(__ARM_NEON)
+   int32x4_t  vlow  = vdupq_n_s32( low );
+   int32x4_t  vhigh = vdupq_n_s32( high );
+   int32x4_t  step  = vdupq_n_s32( (int32_t)( 4u * (uint32_t)block->period ));
+   int32_t    start[4];
+   for( int k = 0; k < 4; k++ ) {
+      start[k] = (int32_t)(( i + k ) * (uint32_t)block->period );
+   }
+   int32x4_t  line   = vld1q_s32( start );
+   uint32x4_t inside = vdupq_n_u32( 0 );
+   for( ; i + 4 <= to; i += 4 ) {
+      int32x4_t residual = narrow ? vmovl_s16( vld1_s16( (const int16_t *)( residuals + 2 * i )))
+                                  : vld1q_s32( (const int32_t *)( residuals + 4 * i ));
+      int32x4_t offset = vaddq_s32( line, residual );
+      //A lane in range is all ones, so subtracting it adds one
+      inside = vsubq_u32( inside, vandq_u32( vcgeq_s32( offset, vlow ), vcleq_s32( offset, vhigh )));
+      line = vaddq_s32( line, step );
+   }
+   count += vgetq_lane_u32( inside, 0 ) + vgetq_lane_u32( inside, 1 )
+          + vgetq_lane_u32( inside, 2 ) + vgetq_lane_u32( inside, 3 );
+#endif
+   for( ; i < to; i++ ) {
+      int32_t residual;
+      if( narrow ) {
+         int16_t value;
+         memcpy( &value, residuals + 2 * i, 2 );
+         residual = value;
+      }
+      else {
+         memcpy( &residual, residuals + 4 * i, 4 );
+      }
+      int32_t offset = (int32_t)( i * (uint32_t)block->period + (uint32_t)residual );
+      count += ( offset >= low && offset <= high ) ? 1 : 0;
+   }
+
+   return count;
+}
+
+/**
+ * \brief Returns the timestamp of frame i of a block
+ **/
+static uint64_t blockTimestamp( const METADATA_COLUMNS_MCAM * mcam, const METADATA_COLUMNS_BLOCK * block, uint32_t i )
+{
+   const uint8_t * residuals = mcam->residuals + block->residualOffset;
+   int64_t residual;
+   if( block->residualBytes == 2 ) {
+      int16_t value;
+      memcpy( &value, residuals + 2 * i, 2 );
+      residual = value;
+   }
+   else {
+      int32_t value;
+      memcpy( &value, residuals + 4 * i, 4 );
+      residual = value;
+   }
+
+   return block->firstTimestamp + (uint64_t)( (int64_t)i * block->period + residual );
+}
+
+/**
+ * \brief Frees the columns of a microcamera. Mapped columns belong to the
+ *        mapping
+ **/
+static void freeMcam( METADATA_COLUMNS_MCAM * mcam, bool mapped )
+{
+   if( !mapped ) {
+      free( mcam->blocks );
+      free( mcam->residuals );
+      free( mcam->sizes );
+      for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+         free( mcam->runs[c] );
+      }
+   }
+   free( mcam->pending );
+   free( mcam );
+}
+
+/**
+ * \brief Initializes an empty store
+ **/
+void metadataColumnsInit( METADATA_COLUMNS * store )
+{
+   memset( store, 0, sizeof(*store));
+   pthread_mutex_init( &store->lock, NULL );
+}
+
+/**
+ * \brief Appends the metadata of a frame from microcamera mcamID
+ **/
+bool metadataColumnsAppend( METADATA_COLUMNS * store
+                          , const FRAME_METADATA * metadata
+                          , uint32_t mcamID
+                          )
+{
+   pthread_mutex_lock( &store->lock );
+   METADATA_COLUMNS_MCAM * mcam = ( store->data == NULL ) ? getMcam( store, mcamID ) : NULL;
+   if( mcam == NULL ) {
+      pthread_mutex_unlock( &store->lock );
+      return false;
+   }
+
+   //A block is also sealed early if a timestamp is too far from its first.
+   //A block left full by a failed seal takes no more frames
+   bool rc = true;
+   METADATA_COLUMNS_BLOCK * block = &mcam->open;
+   int64_t span = (int64_t)( metadata->m_timestamp - block->firstTimestamp );
+   if(( block->count == METADATA_COLUMNS_BLOCK_FRAMES
+     || ( block->count > 0 && ( span > MAX_BLOCK_SPAN || span < -MAX_BLOCK_SPAN )))
+    && !sealBlock( mcam )) {
+      pthread_mutex_unlock( &store->lock );
+      return false;
+   }
+   if( block->count == 0 ) {
+      block->firstTimestamp = metadata->m_timestamp;
+      block->firstId        = metadata->m_id;
+      block->firstFrame     = mcam->numFrames;
+      for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+         block->firstRun[c] = (uint32_t)mcam->runCount[c];
+      }
+   }
+
+   uint64_t frame = mcam->numFrames + block->count;
+   uint32_t * sizes = (uint32_t *)grow( mcam->sizes, &mcam->sizeCapacity, frame + 1, sizeof(uint32_t));
+   if( sizes == NULL ) {
+      pthread_mutex_unlock( &store->lock );
+      return false;
+   }
+   mcam->sizes = sizes;
+   sizes[frame] = (uint32_t)metadata->m_size;
+
+   //A block starts with a zero id delta so every column covers every frame
+   uint64_t idDelta = ( block->count > 0 ) ? metadata->m_id - mcam->lastId : 0;
+   rc = appendRun( mcam, METADATA_COLUMN_ID, idDelta ) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_WIDTH, metadata->m_width ) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_HEIGHT, metadata->m_height ) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_MODE, metadata->m_mode ) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_TILE, metadata->m_tile ) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_FRAMERATE, doubleBits( metadata->m_framerate )) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_GAIN, doubleBits( metadata->m_gain )) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_SHUTTER, doubleBits( metadata->m_shutter )) && rc;
+   rc = appendRun( mcam, METADATA_COLUMN_EXPOSURE, doubleBits( metadata->m_exposure )) && rc;
+   mcam->pending[block->count++] = metadata->m_timestamp;
+   mcam->lastId = metadata->m_id;
+
+   if( block->count == METADATA_COLUMNS_BLOCK_FRAMES ) {
+      rc = sealBlock( mcam ) && rc;
+   }
+   pthread_mutex_unlock( &store->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Seals the open blocks so their frames are visible to queries
+ **/
+void metadataColumnsFlush( METADATA_COLUMNS * store )
+{
+   pthread_mutex_lock( &store->lock );
+   for( uint32_t i = 0; store->data == NULL && i < store->numMCams; i++ ) {
+      if( !sealBlock( store->mcams[i] )) {
+         printf("Unable to seal the metadata of mcam %u\n", store->mcams[i]->mcamID );
+      }
+   }
+   pthread_mutex_unlock( &store->lock );
+}
+
+/**
+ * \brief Writes size bytes followed by zeros up to a multiple of 8
+ **/
+static bool writePadded( FILE * file, const void * data, uint64_t size )
+{
+   static const uint8_t zeros[8] = { 0 };
+   uint64_t padding = padded( size ) - size;
+
+   return ( size == 0 || fwrite( data, 1, size, file ) == size )
+       && ( padding == 0 || fwrite( zeros, 1, padding, file ) == padding );
+}
+
+/**
+ * \brief Flushes the store and writes it to a file
+ **/
+bool metadataColumnsSave( METADATA_COLUMNS * store, const char * fileName )
+{
+   metadataColumnsFlush( store );
+
+   //A reader never sees a partial store, even after a crash
+   char tempName[1024];
+   snprintf( tempName, sizeof(tempName), "%s.tmp", fileName );
+   FILE * file = fopen( tempName, "w" );
+   if( file == NULL ) {
+      return false;
+   }
+
+   pthread_mutex_lock( &store->lock );
+   METADATA_COLUMNS_HEADER header;
+   memset( &header, 0, sizeof(header));
+   header.magic     = METADATA_COLUMNS_MAGIC;
+   header.version   = METADATA_COLUMNS_VERSION;
+   header.blockSize = sizeof(METADATA_COLUMNS_BLOCK);
+   header.numMCams  = store->numMCams;
+   header.runSize   = sizeof(METADATA_COLUMNS_RUN);
+   bool rc = writePadded( file, &header, sizeof(header));
+   for( uint32_t i = 0; rc && i < store->numMCams; i++ ) {
+      const METADATA_COLUMNS_MCAM * mcam = store->mcams[i];
+      METADATA_COLUMNS_SECTION section;
+      memset( &section, 0, sizeof(section));
+      section.mcamID       = mcam->mcamID;
+      section.numFrames    = mcam->numFrames;
+      section.numBlocks    = mcam->numBlocks;
+      section.residualSize = mcam->residualSize;
+      for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+         section.runCount[c] = mcam->runCount[c];
+      }
+      rc = writePadded( file, &section, sizeof(section))
+        && writePadded( file, mcam->blocks, mcam->numBlocks * sizeof(METADATA_COLUMNS_BLOCK))
+        && writePadded( file, mcam->residuals, mcam->residualSize )
+        && writePadded( file, mcam->sizes, mcam->numFrames * sizeof(uint32_t));
+      for( int c = 0; rc && c < METADATA_RUN_COLUMNS; c++ ) {
+         rc = writePadded( file, mcam->runs[c], mcam->runCount[c] * sizeof(METADATA_COLUMNS_RUN));
+      }
+   }
+   pthread_mutex_unlock( &store->lock );
+
+   rc = ( fclose( file ) == 0 ) && rc;
+   if( !rc || rename( tempName, fileName ) != 0 ) {
+      unlink( tempName );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Points the columns of a microcamera at its section of a mapping
+ * \return the offset after the section, or 0 if it does not fit or its
+ *         blocks point outside its columns
+ **/
+static uint64_t mapMcam( METADATA_COLUMNS_MCAM * mcam, const uint8_t * data, uint64_t offset, uint64_t length )
+{
+   METADATA_COLUMNS_SECTION section;
+   if( offset + sizeof(section) > length ) {
+      return 0;
+   }
+   memcpy( &section, data + offset, sizeof(section));
+   offset += padded( sizeof(section));
+
+   //Every count is checked before it is multiplied so a corrupt file
+   //cannot wrap the offsets
+   uint64_t sizes[3 + METADATA_RUN_COLUMNS];
+   if( section.numBlocks > length / sizeof(METADATA_COLUMNS_BLOCK)
+    || section.residualSize > length
+    || section.numFrames > length / sizeof(uint32_t)) {
+      return 0;
+   }
+   sizes[0] = section.numBlocks * sizeof(METADATA_COLUMNS_BLOCK);
+   sizes[1] = section.residualSize;
+   sizes[2] = section.numFrames * sizeof(uint32_t);
+   for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+      if( section.runCount[c] > length / sizeof(METADATA_COLUMNS_RUN)) {
+         return 0;
+      }
+      sizes[3 + c] = section.runCount[c] * sizeof(METADATA_COLUMNS_RUN);
+   }
+
+   const uint8_t * columns[3 + METADATA_RUN_COLUMNS];
+   for( int k = 0; k < 3 + METADATA_RUN_COLUMNS; k++ ) {
+      if( offset > length || padded( sizes[k] ) > length - offset ) {
+         return 0;
+      }
+      columns[k] = data + offset;
+      offset += padded( sizes[k] );
+   }
+
+   mcam->mcamID       = section.mcamID;
+   mcam->numFrames    = section.numFrames;
+   mcam->blocks       = (METADATA_COLUMNS_BLOCK *)columns[0];
+   mcam->numBlocks    = section.numBlocks;
+   mcam->residuals    = (uint8_t *)columns[1];
+   mcam->residualSize = section.residualSize;
+   mcam->sizes        = (uint32_t *)columns[2];
+   for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+      mcam->runs[c]     = (METADATA_COLUMNS_RUN *)columns[3 + c];
+      mcam->runCount[c] = section.runCount[c];
+   }
+
+   for( uint64_t b = 0; b < mcam->numBlocks; b++ ) {
+      const METADATA_COLUMNS_BLOCK * block = &mcam->blocks[b];
+      bool valid = ( block->residualBytes == 2 || block->residualBytes == 4 )
+                && block->count <= METADATA_COLUMNS_BLOCK_FRAMES
+                && block->residualOffset <= mcam->residualSize
+                && (uint64_t)block->count * block->residualBytes <= mcam->residualSize - block->residualOffset
+                && block->firstFrame <= mcam->numFrames
+                && block->count <= mcam->numFrames - block->firstFrame;
+      for( int c = 0; valid && c < METADATA_RUN_COLUMNS; c++ ) {
+         valid = (uint64_t)block->firstRun[c] + block->numRuns[c] <= mcam->runCount[c];
+      }
+      if( !valid ) {
+         return 0;
+      }
+   }
+
+   return offset;
+}
+
+/**
+ * \brief Maps a saved store for reading
+ **/
+bool metadataColumnsMap( METADATA_COLUMNS * store, const char * fileName )
+{
+   metadataColumnsInit( store );
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(METADATA_COLUMNS_HEADER)) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+   store->data   = (const uint8_t *)data;
+   store->length = st.st_size;
+
+   //The columns are used in place, so their layout must match exactly
+   const METADATA_COLUMNS_HEADER * header = (const METADATA_COLUMNS_HEADER *)data;
+   bool rc = header->magic == METADATA_COLUMNS_MAGIC
+          && header->blockSize == sizeof(METADATA_COLUMNS_BLOCK)
+          && header->runSize == sizeof(METADATA_COLUMNS_RUN)
+          && header->numMCams <= st.st_size / sizeof(METADATA_COLUMNS_SECTION);
+   if( rc ) {
+      store->mcams    = (METADATA_COLUMNS_MCAM **)calloc( header->numMCams + 1, sizeof(*store->mcams));
+      store->capacity = header->numMCams;
+      rc = store->mcams != NULL;
+   }
+
+   uint64_t offset = padded( sizeof(METADATA_COLUMNS_HEADER));
+   for( uint32_t i = 0; rc && i < header->numMCams; i++ ) {
+      METADATA_COLUMNS_MCAM * mcam = (METADATA_COLUMNS_MCAM *)calloc( 1, sizeof(METADATA_COLUMNS_MCAM));
+      if( mcam == NULL ) {
+         rc = false;
+         break;
+      }
+      store->mcams[store->numMCams++] = mcam;
+      offset = mapMcam( mcam, store->data, offset, store->length );
+      rc = offset != 0 && ( i == 0 || store->mcams[i - 1]->mcamID < mcam->mcamID );
+   }
+
+   if( !rc ) {
+      metadataColumnsDestroy( store );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Frees or unmaps a store
+ **/
+void metadataColumnsDestroy( METADATA_COLUMNS * store )
+{
+   for( uint32_t i = 0; i < store->numMCams; i++ ) {
+      freeMcam( store->mcams[i], store->data != NULL );
+   }
+   free( store->mcams );
+   if( store->data != NULL ) {
+      munmap( (void *)store->data, store->length );
+   }
+   pthread_mutex_destroy( &store->lock );
+   memset( store, 0, sizeof(*store));
+}
+
+/**
+ * \brief Returns the bytes taken by the columns of a store
+ **/
+uint64_t metadataColumnsMemory( const METADATA_COLUMNS * store )
+{
+   uint64_t bytes = 0;
+   for( uint32_t i = 0; i < store->numMCams; i++ ) {
+      const METADATA_COLUMNS_MCAM * mcam = store->mcams[i];
+      bytes += mcam->numBlocks * sizeof(METADATA_COLUMNS_BLOCK)
+             + mcam->residualSize
+             + mcam->numFrames * sizeof(uint32_t);
+      for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+         bytes += mcam->runCount[c] * sizeof(METADATA_COLUMNS_RUN);
+      }
+   }
+
+   return bytes;
+}
+
+/**
+ * \brief Returns the microcameras a query covers as [first, last)
+ **/
+static void mcamRange( const METADATA_COLUMNS * store, uint32_t mcamID, uint32_t * first, uint32_t * last )
+{
+   if( mcamID == 0 ) {
+      *first = 0;
+      *last  = store->numMCams;
+      return;
+   }
+   *first = findMcam( store, mcamID );
+   *last  = ( *first < store->numMCams && store->mcams[*first]->mcamID == mcamID ) ? *first + 1 : *first;
+}
+
+/**
+ * \brief Returns [start, end] as offsets from the first timestamp of a block
+ *        it overlaps. Clamping to the block first keeps the offsets within
+ *        its span, where an open end such as UINT64_MAX would overflow
+ **/
+static void blockOffsets( const METADATA_COLUMNS_BLOCK * block
+                        , uint64_t start
+                        , uint64_t end
+                        , int64_t * lo
+                        , int64_t * hi
+                        )
+{
+   uint64_t from = ( start > block->minTimestamp ) ? start : block->minTimestamp;
+   uint64_t to   = ( end < block->maxTimestamp ) ? end : block->maxTimestamp;
+   *lo = (int64_t)( from - block->firstTimestamp );
+   *hi = (int64_t)( to - block->firstTimestamp );
+}
+
+/**
+ * \brief Counts the frames with timestamps in [start, end]
+ **/
+uint64_t metadataColumnsCount( const METADATA_COLUMNS * store
+                             , uint32_t mcamID
+                             , uint64_t start
+                             , uint64_t end
+                             )
+{
+   uint32_t first;
+   uint32_t last;
+   mcamRange( store, mcamID, &first, &last );
+
+   uint64_t frames = 0;
+   for( uint32_t i = first; i < last; i++ ) {
+      const METADATA_COLUMNS_MCAM * mcam = store->mcams[i];
+      for( uint64_t b = 0; b < mcam->numBlocks; b++ ) {
+         const METADATA_COLUMNS_BLOCK * block = &mcam->blocks[b];
+         if( block->maxTimestamp < start || block->minTimestamp > end ) {
+            continue;
+         }
+         if( block->minTimestamp >= start && block->maxTimestamp <= end ) {
+            frames += block->count;
+            continue;
+         }
+         int64_t lo;
+         int64_t hi;
+         blockOffsets( block, start, end, &lo, &hi );
+         frames += countInBlock( mcam, block, 0, block->count, lo, hi );
+      }
+   }
+
+   return frames;
+}
+
+/**
+ * \brief Adds the runs of a column in a block to a sum, minimum and maximum,
+ *        weighting each run by its frames in [lo, hi]
+ * \return the number of frames added
+ **/
+static uint64_t aggregateRuns( const METADATA_COLUMNS_MCAM * mcam
+                             , const METADATA_COLUMNS_BLOCK * block
+                             , METADATA_COLUMN column
+                             , bool whole
+                             , int64_t lo
+                             , int64_t hi
+                             , double * sum
+                             , double * min
+                             , double * max
+                             )
+{
+   const METADATA_COLUMNS_RUN * runs = mcam->runs[column] + block->firstRun[column];
+   uint64_t frames = 0;
+   uint32_t from = 0;
+   for( uint32_t r = 0; r < block->numRuns[column]; r++ ) {
+      uint32_t to = from + runs[r].count;
+      uint32_t weight = whole ? runs[r].count : countInBlock( mcam, block, from, to, lo, hi );
+      if( weight > 0 ) {
+         double value = bitsDouble( runs[r].value );
+         *sum += value * weight;
+         *min  = ( value < *min ) ? value : *min;
+         *max  = ( value > *max ) ? value : *max;
+         frames += weight;
+      }
+      from = to;
+   }
+
+   return frames;
+}
+
+/**
+ * \brief Aggregates gain and exposure of each microcamera
+ **/
+uint32_t metadataColumnsAggregate( const METADATA_COLUMNS * store
+                                 , uint64_t start
+                                 , uint64_t end
+                                 , METADATA_COLUMNS_STATS * stats
+                                 , uint32_t maxStats
+                                 )
+{
+   uint32_t numStats = 0;
+   for( uint32_t i = 0; i < store->numMCams && numStats < maxStats; i++ ) {
+      const METADATA_COLUMNS_MCAM * mcam = store->mcams[i];
+      double gainSum     = 0.0;
+      double exposureSum = 0.0;
+      double range[4]    = { HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL };
+      uint64_t frames    = 0;
+      for( uint64_t b = 0; b < mcam->numBlocks; b++ ) {
+         const METADATA_COLUMNS_BLOCK * block = &mcam->blocks[b];
+         if( block->maxTimestamp < start || block->minTimestamp > end ) {
+            continue;
+         }
+         bool whole = block->minTimestamp >= start && block->maxTimestamp <= end;
+         int64_t lo;
+         int64_t hi;
+         blockOffsets( block, start, end, &lo, &hi );
+         frames += aggregateRuns( mcam, block, METADATA_COLUMN_GAIN, whole, lo, hi,
+                                  &gainSum, &range[0], &range[1] );
+         aggregateRuns( mcam, block, METADATA_COLUMN_EXPOSURE, whole, lo, hi,
+                        &exposureSum, &range[2], &range[3] );
+      }
+
+      METADATA_COLUMNS_STATS * s = &stats[numStats++];
+      memset( s, 0, sizeof(*s));
+      s->mcamID = mcam->mcamID;
+      s->frames = frames;
+      if( frames > 0 ) {
+         s->minGain      = range[0];
+         s->maxGain      = range[1];
+         s->meanGain     = gainSum / frames;
+         s->minExposure  = range[2];
+         s->maxExposure  = range[3];
+         s->meanExposure = exposureSum / frames;
+      }
+   }
+
+   return numStats;
+}
+
+/**
+ * \brief Decodes the frames with timestamps in [start, end]
+ **/
+uint64_t metadataColumnsScan( const METADATA_COLUMNS * store
+                            , uint32_t mcamID
+                            , uint64_t start
+                            , uint64_t end
+                            , METADATA_COLUMNS_CALLBACK callback
+                            )
+{
+   uint32_t first;
+   uint32_t last;
+   mcamRange( store, mcamID, &first, &last );
+
+   uint64_t frames = 0;
+   for( uint32_t m = first; m < last; m++ ) {
+      const METADATA_COLUMNS_MCAM * mcam = store->mcams[m];
+      for( uint64_t b = 0; b < mcam->numBlocks; b++ ) {
+         const METADATA_COLUMNS_BLOCK * block = &mcam->blocks[b];
+         if( block->maxTimestamp < start || block->minTimestamp > end ) {
+            continue;
+         }
+
+         //One cursor per column, moved to the next run as each one ends
+         const METADATA_COLUMNS_RUN * run[METADATA_RUN_COLUMNS];
+         uint32_t left[METADATA_RUN_COLUMNS];
+         for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+            run[c]  = mcam->runs[c] + block->firstRun[c];
+            left[c] = ( block->numRuns[c] > 0 ) ? run[c]->count : 0;
+         }
+
+         FRAME_METADATA metadata;
+         memset( &metadata, 0, sizeof(metadata));
+         metadata.m_id    = block->firstId;
+         metadata.m_camId = mcam->mcamID;
+         for( uint32_t i = 0; i < block->count; i++ ) {
+            for( int c = 0; c < METADATA_RUN_COLUMNS; c++ ) {
+               if( left[c] == 0 ) {
+                  run[c]++;
+                  left[c] = run[c]->count;
+               }
+               left[c]--;
+            }
+            metadata.m_id        += run[METADATA_COLUMN_ID]->value;
+            metadata.m_timestamp  = blockTimestamp( mcam, block, i );
+            if( metadata.m_timestamp < start || metadata.m_timestamp > end ) {
+               continue;
+            }
+            metadata.m_width      = (uint32_t)run[METADATA_COLUMN_WIDTH]->value;
+            metadata.m_height     = (uint32_t)run[METADATA_COLUMN_HEIGHT]->value;
+            metadata.m_mode       = (uint32_t)run[METADATA_COLUMN_MODE]->value;
+            metadata.m_tile       = (uint32_t)run[METADATA_COLUMN_TILE]->value;
+            metadata.m_framerate  = bitsDouble( run[METADATA_COLUMN_FRAMERATE]->value );
+            metadata.m_gain       = bitsDouble( run[METADATA_COLUMN_GAIN]->value );
+            metadata.m_shutter    = bitsDouble( run[METADATA_COLUMN_SHUTTER]->value );
+            metadata.m_exposure   = bitsDouble( run[METADATA_COLUMN_EXPOSURE]->value );
+            metadata.m_size       = mcam->sizes[block->firstFrame + i];
+            frames++;
+            if( callback.f != NULL ) {
+               callback.f( &metadata, callback.data );
+            }
+         }
+      }
+   }
+
+   return frames;
+}
@@ -0,0 +1,234 @@
+/******************************************************************************
+ *
+ * MetadataColumns.h
+ *
+ * Columnar store of frame metadata for long recordings. A FRAME_METADATA
+ * repeats the same width, height, gain, shutter and exposure for every
+ * frame, so instead of raw structs the store keeps each field of each
+ * microcamera in its own array, cut into blocks of up to
+ * METADATA_COLUMNS_BLOCK_FRAMES frames:
+ *
+ *   - timestamps are stored as their deviation from the block's average
+ *     frame period, in 16 bits when the jitter allows and 32 bits
+ *     otherwise. This is delta-of-delta encoding against a fixed
+ *     reference, so a timestamp decodes without a running sum and scans
+ *     compare four of them per SIMD instruction
+ *   - frame ids are run-length encoded as the delta from the previous frame
+ *   - width, height, mode, tile, framerate, gain, shutter and exposure are
+ *     run-length encoded
+ *   - sizes are kept as plain 32-bit values
+ *
+ * A day of 30 fps metadata from 100 microcameras takes about 2 GB instead
+ * of about 20 GB of structs. Each block keeps its first, lowest and highest
+ * timestamp, so a time range query skips blocks outside the range, takes
+ * blocks inside it as a whole and only compares the timestamps of the
+ * blocks on its edges. Gain and exposure are aggregated over whole runs.
+ *
+ * Appends are serialized so one store can be shared by several export
+ * threads. Frames appended since the last metadataColumnsFlush are not
+ * visible to queries. A saved store is mapped back read-only without
+ * copying its columns.
+ *
+ *****************************************************************************/
+#ifndef METADATA_COLUMNS_H
+#define METADATA_COLUMNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METADATA_COLUMNS_MAGIC        0x4C4F4341 //!< "ACOL" in a little endian file
+#define METADATA_COLUMNS_VERSION      1
+#define METADATA_COLUMNS_EXTENSION    "cols"
+#define METADATA_COLUMNS_BLOCK_FRAMES 4096       //!< Most frames in a block
+
+/**
+ * \brief Run-length encoded columns
+ **/
+typedef enum {
+   METADATA_COLUMN_ID = 0,   //!< Delta of m_id from the previous frame
+   METADATA_COLUMN_WIDTH,
+   METADATA_COLUMN_HEIGHT,
+   METADATA_COLUMN_MODE,
+   METADATA_COLUMN_TILE,
+   METADATA_COLUMN_FRAMERATE,
+   METADATA_COLUMN_GAIN,
+   METADATA_COLUMN_SHUTTER,
+   METADATA_COLUMN_EXPOSURE,
+   METADATA_RUN_COLUMNS
+} METADATA_COLUMN;
+
+/**
+ * \brief A value repeated for count consecutive frames. Floating point
+ *        values are stored by their bits
+ **/
+typedef struct {
+   uint64_t value;
+   uint32_t count;
+   uint32_t reserved;
+} METADATA_COLUMNS_RUN;
+
+/**
+ * \brief Up to METADATA_COLUMNS_BLOCK_FRAMES consecutive frames of a microcamera
+ **/
+typedef struct {
+   uint64_t firstTimestamp;                 //!< Timestamp of the first frame
+   uint64_t minTimestamp;                   //!< Lowest timestamp in the block
+   uint64_t maxTimestamp;                   //!< Highest timestamp in the block
+   uint64_t firstId;                        //!< m_id of the first frame
+   uint64_t firstFrame;                     //!< Index of the first frame in the size column
+   uint64_t residualOffset;                 //!< Byte offset of the timestamp residuals
+   int32_t  period;                         //!< Average microseconds between frames
+   uint16_t count;                          //!< Frames in the block
+   uint16_t residualBytes;                  //!< 2 or 4 bytes per residual
+   uint32_t firstRun[METADATA_RUN_COLUMNS]; //!< First run of each column
+   uint32_t numRuns[METADATA_RUN_COLUMNS];  //!< Runs of each column
+} METADATA_COLUMNS_BLOCK;
+
+/**
+ * \brief Columns of one microcamera
+ **/
+typedef struct {
+   uint32_t                 mcamID;
+   uint64_t                 numFrames;       //!< Frames in sealed blocks
+   METADATA_COLUMNS_BLOCK * blocks;
+   uint64_t                 numBlocks;
+   uint64_t                 blockCapacity;
+   uint8_t *                residuals;       //!< Timestamp residuals of all blocks
+   uint64_t                 residualSize;
+   uint64_t                 residualCapacity;
+   uint32_t *               sizes;           //!< m_size of every frame
+   uint64_t                 sizeCapacity;
+   METADATA_COLUMNS_RUN *   runs[METADATA_RUN_COLUMNS];
+   uint64_t                 runCount[METADATA_RUN_COLUMNS];
+   uint64_t                 runCapacity[METADATA_RUN_COLUMNS];
+   METADATA_COLUMNS_BLOCK   open;            //!< Block being appended to
+   uint64_t *               pending;         //!< Timestamps of the open block
+   uint64_t                 lastId;          //!< m_id of the last appended frame
+} METADATA_COLUMNS_MCAM;
+
+/**
+ * \brief A columnar metadata store, either built in memory or mapped from
+ *        a file
+ **/
+typedef struct {
+   METADATA_COLUMNS_MCAM ** mcams;     //!< Microcameras sorted by id
+   uint32_t                 numMCams;
+   uint32_t                 capacity;
+   pthread_mutex_t          lock;      //!< Serializes appends
+   const uint8_t *          data;      //!< File mapping, NULL if built in memory
+   size_t                   length;    //!< Length of the mapping in bytes
+} METADATA_COLUMNS;
+
+/**
+ * \brief Gain and exposure of a microcamera over a time range
+ **/
+typedef struct {
+   uint32_t mcamID;
+   uint64_t frames;        //!< Frames in the range
+   double   minGain;
+   double   maxGain;
+   double   meanGain;
+   double   minExposure;
+   double   maxExposure;
+   double   meanExposure;
+} METADATA_COLUMNS_STATS;
+
+/**
+ * \brief Callback for each frame found by metadataColumnsScan
+ **/
+typedef struct {
+   void (*f)( const FRAME_METADATA * metadata, void * data );
+   void * data;
+} METADATA_COLUMNS_CALLBACK;
+
+/**
+ * \brief Initializes an empty store
+ **/
+void metadataColumnsInit( METADATA_COLUMNS * store );
+
+/**
+ * \brief Appends the metadata of a frame from microcamera mcamID
+ * \return false if out of memory or the store is mapped from a file
+ **/
+bool metadataColumnsAppend( METADATA_COLUMNS * store
+                          , const FRAME_METADATA * metadata
+                          , uint32_t mcamID
+                          );
+
+/**
+ * \brief Seals the open blocks so their frames are visible to queries
+ **/
+void metadataColumnsFlush( METADATA_COLUMNS * store );
+
+/**
+ * \brief Flushes the store and writes it to a file, replacing any file of
+ *        the same name once complete
+ * \return true on success
+ **/
+bool metadataColumnsSave( METADATA_COLUMNS * store, const char * fileName );
+
+/**
+ * \brief Maps a saved store for reading
+ * \return true if the file exists and is valid
+ **/
+bool metadataColumnsMap( METADATA_COLUMNS * store, const char * fileName );
+
+/**
+ * \brief Frees or unmaps a store
+ **/
+void metadataColumnsDestroy( METADATA_COLUMNS * store );
+
+/**
+ * \brief Returns the bytes taken by the columns of a store
+ **/
+uint64_t metadataColumnsMemory( const METADATA_COLUMNS * store );
+
+/**
+ * \brief Counts the frames with timestamps in [start, end]
+ * \param [in] mcamID microcamera to count, 0 for all of them
+ **/
+uint64_t metadataColumnsCount( const METADATA_COLUMNS * store
+                             , uint32_t mcamID
+                             , uint64_t start
+                             , uint64_t end
+                             );
+
+/**
+ * \brief Aggregates gain and exposure of each microcamera over the frames
+ *        with timestamps in [start, end]
+ * \param [out] stats    one entry per microcamera, in order of mcamID
+ * \param [in]  maxStats entries available in stats
+ * \return the number of entries written
+ **/
+uint32_t metadataColumnsAggregate( const METADATA_COLUMNS * store
+                                 , uint64_t start
+                                 , uint64_t end
+                                 , METADATA_COLUMNS_STATS * stats
+                                 , uint32_t maxStats
+                                 );
+
+/**
+ * \brief Decodes the frames with timestamps in [start, end] and passes
+ *        each one to callback, in order of mcamID then frame
+ * \param [in] mcamID microcamera to scan, 0 for all of them
+ * \return the number of frames found
+ **/
+uint64_t metadataColumnsScan( const METADATA_COLUMNS * store
+                            , uint32_t mcamID
+                            , uint64_t start
+                            , uint64_t end
+                            , METADATA_COLUMNS_CALLBACK callback
+                            );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/******************************************************************************
+ *
+ * MetadataIndex.c
+ *
+ * Append-only binary frame index. See MetadataIndex.h
+ *
+ *****************************************************************************/
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MetadataIndex.h"
+
+/**
+ * \brief Creates or truncates an index file and writes its header
+ **/
+bool metadataIndexOpen( METADATA_INDEX * index, const char * fileName )
+{
+   index->file = fopen( fileName, "w" );
+   if( index->file == NULL ) {
+      return false;
+   }
+
+   METADATA_INDEX_HEADER header;
+   memset( &header, 0, sizeof(header));
+   header.magic      = METADATA_INDEX_MAGIC;
+   header.version    = METADATA_INDEX_VERSION;
+   header.recordSize = sizeof(METADATA_INDEX_RECORD);
+   if( fwrite( &header, sizeof(header), 1, index->file ) != 1 ) {
+      fclose( index->file );
+      index->file = NULL;
+      return false;
+   }
+
+   pthread_mutex_init( &index->lock, NULL );
+   return true;
+}
+
+/**
+ * \brief Reopens an existing index file keeping its first numRecords records
+ **/
+bool metadataIndexResume( METADATA_INDEX * index, const char * fileName, uint64_t numRecords )
+{
+   METADATA_INDEX_HEADER header;
+   index->file = fopen( fileName, "r+" );
+   if( index->file == NULL ) {
+      return false;
+   }
+
+   /* Only continue files written with the current record layout */
+   off_t length = sizeof(header) + numRecords * sizeof(METADATA_INDEX_RECORD);
+   if( fread( &header, sizeof(header), 1, index->file ) != 1
+    || header.magic != METADATA_INDEX_MAGIC
+    || header.recordSize != sizeof(METADATA_INDEX_RECORD)
+    || ftruncate( fileno( index->file ), length ) != 0
+    || fseeko( index->file, length, SEEK_SET ) != 0 ) {
+      fclose( index->file );
+      index->file = NULL;
+      return false;
+   }
+
+   pthread_mutex_init( &index->lock, NULL );
+   return true;
+}
+
+/**
+ * \brief Appends the record for a frame written at offset in its stream file
+ **/
+bool metadataIndexAppend( METADATA_INDEX * index
+                        , const FRAME_METADATA * metadata
+                        , uint32_t mcamID
+                        , uint64_t offset
+                        )
+{
+   METADATA_INDEX_RECORD record;
+   memset( &record, 0, sizeof(record));
+   record.mcamID    = mcamID;
+   record.mode      = metadata->m_mode;
+   record.timestamp = metadata->m_timestamp;
+   record.frameId   = metadata->m_id;
+   record.offset    = offset;
+   record.size      = metadata->m_size;
+
+   pthread_mutex_lock( &index->lock );
+   bool rc = fwrite( &record, sizeof(record), 1, index->file ) == 1;
+   pthread_mutex_unlock( &index->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Flushes appended records and waits until they are on disk
+ **/
+bool metadataIndexSync( METADATA_INDEX * index )
+{
+   pthread_mutex_lock( &index->lock );
+   bool rc = fflush( index->file ) == 0 && fdatasync( fileno( index->file )) == 0;
+   pthread_mutex_unlock( &index->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Flushes and closes an index file
+ **/
+void metadataIndexClose( METADATA_INDEX * index )
+{
+   if( index->file == NULL ) {
+      return;
+   }
+
+   fclose( index->file );
+   index->file = NULL;
+   pthread_mutex_destroy( &index->lock );
+}
+
+/**
+ * \brief Maps an index file for reading
+ **/
+bool metadataIndexMap( METADATA_INDEX_READER * reader, const char * fileName )
+{
+   memset( reader, 0, sizeof(*reader));
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(METADATA_INDEX_HEADER)) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+
+   const METADATA_INDEX_HEADER * header = (const METADATA_INDEX_HEADER *)data;
+   if( header->magic != METADATA_INDEX_MAGIC
+    || header->recordSize < sizeof(METADATA_INDEX_RECORD)) {
+      munmap( data, st.st_size );
+      return false;
+   }
+
+   reader->data       = (const uint8_t *)data;
+   reader->length     = st.st_size;
+   reader->recordSize = header->recordSize;
+   reader->numRecords = (st.st_size - sizeof(METADATA_INDEX_HEADER)) / header->recordSize;
+
+   return true;
+}
+
+/**
+ * \brief Returns record i of a mapped index
+ **/
+const METADATA_INDEX_RECORD * metadataIndexRecord( const METADATA_INDEX_READER * reader
+                                                 , size_t i
+                                                 )
+{
+   return (const METADATA_INDEX_RECORD *)( reader->data
+                                         + sizeof(METADATA_INDEX_HEADER)
+                                         + i * reader->recordSize );
+}
+
+/**
+ * \brief Unmaps an index file
+ **/
+void metadataIndexUnmap( METADATA_INDEX_READER * reader )
+{
+   if( reader->data != NULL ) {
+      munmap( (void *)reader->data, reader->length );
+   }
+   memset( reader, 0, sizeof(*reader));
+}
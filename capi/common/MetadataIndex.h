@@ -0,0 +1,127 @@
+/******************************************************************************
+ *
+ * MetadataIndex.h
+ *
+ * Append-only binary index of exported frames. The file starts with a
+ * METADATA_INDEX_HEADER followed by fixed-size METADATA_INDEX_RECORDs, one
+ * per frame written to a stream file, in native byte order. The header
+ * stores the record size so readers can step over fields appended by newer
+ * versions. A record cut short by a crash is ignored by the reader.
+ *
+ *****************************************************************************/
+#ifndef METADATA_INDEX_H
+#define METADATA_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METADATA_INDEX_MAGIC   0x58444D41 //!< "AMDX" in a little endian file
+#define METADATA_INDEX_VERSION 1
+
+/**
+ * \brief Header at the start of every index file
+ **/
+typedef struct {
+   uint32_t magic;        //!< METADATA_INDEX_MAGIC
+   uint16_t version;      //!< METADATA_INDEX_VERSION of the writer
+   uint16_t recordSize;   //!< Size of each record in bytes
+   uint64_t reserved;     //!< Zero
+} METADATA_INDEX_HEADER;
+
+/**
+ * \brief Index entry for one frame
+ **/
+typedef struct {
+   uint32_t mcamID;       //!< Microcamera the frame came from
+   uint32_t mode;         //!< Frame mode, e.g. ATL_MODE_H264_I_FRAME
+   uint64_t timestamp;    //!< Frame timestamp in microseconds
+   uint64_t frameId;      //!< Frame id (m_id)
+   uint64_t offset;       //!< Byte offset of the frame in its stream file
+   uint64_t size;         //!< Size of the frame in bytes
+} METADATA_INDEX_RECORD;
+
+/**
+ * \brief Index file being written. Appends are serialized so one index can
+ *        be shared by several export threads
+ **/
+typedef struct {
+   FILE *          file;  //!< Open index file
+   pthread_mutex_t lock;  //!< Serializes appends
+} METADATA_INDEX;
+
+/**
+ * \brief Read-only view of an index file mapped into memory
+ **/
+typedef struct {
+   const uint8_t * data;        //!< Start of the mapping
+   size_t          length;      //!< Length of the mapping in bytes
+   size_t          recordSize;  //!< Stride between records
+   size_t          numRecords;  //!< Number of complete records
+} METADATA_INDEX_READER;
+
+/**
+ * \brief Creates or truncates an index file and writes its header
+ * \return true on success
+ **/
+bool metadataIndexOpen( METADATA_INDEX * index, const char * fileName );
+
+/**
+ * \brief Reopens an existing index file keeping its first numRecords
+ *        records. Later records, written after the last checkpoint of an
+ *        interrupted export, are discarded
+ * \return true on success
+ **/
+bool metadataIndexResume( METADATA_INDEX * index, const char * fileName, uint64_t numRecords );
+
+/**
+ * \brief Appends the record for a frame written at offset in its stream file
+ * \return true on success
+ **/
+bool metadataIndexAppend( METADATA_INDEX * index
+                        , const FRAME_METADATA * metadata
+                        , uint32_t mcamID
+                        , uint64_t offset
+                        );
+
+/**
+ * \brief Flushes appended records and waits until they are on disk
+ * \return true on success
+ **/
+bool metadataIndexSync( METADATA_INDEX * index );
+
+/**
+ * \brief Flushes and closes an index file
+ **/
+void metadataIndexClose( METADATA_INDEX * index );
+
+/**
+ * \brief Maps an index file for reading
+ * \return true if the file exists and has a valid header
+ **/
+bool metadataIndexMap( METADATA_INDEX_READER * reader, const char * fileName );
+
+/**
+ * \brief Returns record i of a mapped index. i must be below numRecords
+ **/
+const METADATA_INDEX_RECORD * metadataIndexRecord( const METADATA_INDEX_READER * reader
+                                                 , size_t i
+                                                 );
+
+/**
+ * \brief Unmaps an index file
+ **/
+void metadataIndexUnmap( METADATA_INDEX_READER * reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
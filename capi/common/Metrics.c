@@ -0,0 +1,418 @@
+/******************************************************************************
+ *
+ * Metrics.c
+ *
+ * Per-thread latency histograms and periodic metrics dumps. See Metrics.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "Metrics.h"
+
+#define SUB_BITS     5                                  //!< log2 of sub-buckets per power of two
+#define SUB_BUCKETS  (1 << SUB_BITS)
+#define MAX_SHIFT    (40 - SUB_BITS)                    //!< Values up to 2^40 ns (about 18 minutes)
+#define NUM_BUCKETS  ((MAX_SHIFT + 2) * SUB_BUCKETS)
+#define NAME_SIZE    1024
+
+static const char * g_stageNames[METRIC_NUM_STAGES] = {
+   "get_frame",
+   "save_frame",
+   "frame_hold",
+   "frame_callback",
+   "dispatch_queue"
+};
+
+static const double g_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+#define NUM_QUANTILES (int)(sizeof(g_quantiles)/sizeof(g_quantiles[0]))
+
+/**
+ * \brief Histograms written by one thread
+ **/
+typedef struct METRICS_RECORDER {
+   uint64_t counts[METRIC_NUM_STAGES][NUM_BUCKETS];  //!< Values per bucket
+   uint64_t sum[METRIC_NUM_STAGES];                  //!< Sum of values in ns
+   uint64_t max[METRIC_NUM_STAGES];                  //!< Largest value in ns
+   struct METRICS_RECORDER * next;                   //!< Next registered recorder
+} METRICS_RECORDER;
+
+/**
+ * \brief Merged view of all recorders
+ **/
+typedef struct {
+   uint64_t counts[METRIC_NUM_STAGES][NUM_BUCKETS];
+   uint64_t total[METRIC_NUM_STAGES];
+   uint64_t sum[METRIC_NUM_STAGES];
+   uint64_t max[METRIC_NUM_STAGES];
+} METRICS_SNAPSHOT;
+
+static volatile bool g_enabled = false;
+static __thread METRICS_RECORDER * t_recorder = NULL;
+static METRICS_RECORDER * g_recorders = NULL;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static bool g_stop = false;
+static pthread_t g_reporter;
+static char g_prefix[NAME_SIZE - 16];                 //!< Leaves room for the extensions
+static char g_tool[128];
+static double g_interval = METRICS_INTERVAL;
+static uint64_t g_startTime = 0;
+static uint64_t g_lastTotal[METRIC_NUM_STAGES];
+static uint64_t g_lastTime = 0;
+
+/**
+ * \brief Returns a monotonic timestamp in nanoseconds
+ **/
+uint64_t metricsNow( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * \brief Maps a value to its bucket
+ **/
+static int bucketIndex( uint64_t value )
+{
+   if( value < SUB_BUCKETS ) {
+      return (int)value;
+   }
+
+   int shift = 63 - __builtin_clzll( value ) - SUB_BITS;
+   if( shift > MAX_SHIFT ) {
+      return NUM_BUCKETS - 1;
+   }
+
+   return shift * SUB_BUCKETS + (int)( value >> shift );
+}
+
+/**
+ * \brief Returns the midpoint of the values in a bucket
+ **/
+static uint64_t bucketValue( int index )
+{
+   if( index < 2 * SUB_BUCKETS ) {
+      return index;
+   }
+
+   int shift = index / SUB_BUCKETS - 1;
+   uint64_t sub = index - shift * SUB_BUCKETS;
+
+   return ( sub << shift ) + ((uint64_t)1 << shift ) / 2;
+}
+
+/**
+ * \brief Returns the recorder of the calling thread, registering it on
+ *        first use. Recorders live until the process exits so counts from
+ *        finished threads are kept
+ **/
+static METRICS_RECORDER * threadRecorder( void )
+{
+   if( t_recorder == NULL ) {
+      METRICS_RECORDER * recorder = (METRICS_RECORDER *)calloc( 1, sizeof(METRICS_RECORDER));
+      if( recorder == NULL ) {
+         return NULL;
+      }
+      pthread_mutex_lock( &g_lock );
+      recorder->next = g_recorders;
+      g_recorders = recorder;
+      pthread_mutex_unlock( &g_lock );
+      t_recorder = recorder;
+   }
+
+   return t_recorder;
+}
+
+/**
+ * \brief Records a duration in nanoseconds for a stage
+ **/
+void metricsRecordValue( METRIC_STAGE stage, uint64_t nanoseconds )
+{
+   if( !g_enabled ) {
+      return;
+   }
+   METRICS_RECORDER * recorder = threadRecorder();
+   if( recorder == NULL ) {
+      return;
+   }
+
+   /* Only this thread writes its recorder, so plain increments published
+    * with relaxed stores are enough for the reporter to read */
+   uint64_t * count = &recorder->counts[stage][bucketIndex( nanoseconds )];
+   __atomic_store_n( count, *count + 1, __ATOMIC_RELAXED );
+   __atomic_store_n( &recorder->sum[stage], recorder->sum[stage] + nanoseconds, __ATOMIC_RELAXED );
+   if( nanoseconds > recorder->max[stage] ) {
+      __atomic_store_n( &recorder->max[stage], nanoseconds, __ATOMIC_RELAXED );
+   }
+}
+
+/**
+ * \brief Records the time from start until now for a stage
+ **/
+uint64_t metricsRecord( METRIC_STAGE stage, uint64_t start )
+{
+   uint64_t now = metricsNow();
+   metricsRecordValue( stage, now - start );
+
+   return now;
+}
+
+/**
+ * \brief Sums the histograms of all recorders
+ **/
+static void takeSnapshot( METRICS_SNAPSHOT * snapshot )
+{
+   memset( snapshot, 0, sizeof(*snapshot));
+
+   pthread_mutex_lock( &g_lock );
+   METRICS_RECORDER * recorder = g_recorders;
+   pthread_mutex_unlock( &g_lock );
+
+   //Recorders are only ever prepended, so the list from here on is stable
+   for( ; recorder != NULL; recorder = recorder->next ) {
+      for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+         for( int b = 0; b < NUM_BUCKETS; b++ ) {
+            uint64_t count = __atomic_load_n( &recorder->counts[s][b], __ATOMIC_RELAXED );
+            snapshot->counts[s][b] += count;
+            snapshot->total[s] += count;
+         }
+         snapshot->sum[s] += __atomic_load_n( &recorder->sum[s], __ATOMIC_RELAXED );
+         uint64_t max = __atomic_load_n( &recorder->max[s], __ATOMIC_RELAXED );
+         if( max > snapshot->max[s] ) {
+            snapshot->max[s] = max;
+         }
+      }
+   }
+}
+
+/**
+ * \brief Returns a quantile of a stage in seconds
+ **/
+static double quantile( const METRICS_SNAPSHOT * snapshot, int stage, double q )
+{
+   uint64_t total = snapshot->total[stage];
+   if( total == 0 ) {
+      return 0.0;
+   }
+
+   uint64_t rank = (uint64_t)( q * total );
+   if( rank >= total ) {
+      rank = total - 1;
+   }
+   uint64_t seen = 0;
+   for( int b = 0; b < NUM_BUCKETS; b++ ) {
+      seen += snapshot->counts[stage][b];
+      if( seen > rank ) {
+         uint64_t value = bucketValue( b );
+         return ( value < snapshot->max[stage] ? value : snapshot->max[stage] ) / 1e9;
+      }
+   }
+
+   return snapshot->max[stage] / 1e9;
+}
+
+/**
+ * \brief Writes a file through a temporary name so readers never see a
+ *        partial dump
+ **/
+static FILE * openDump( const char * extension, char * tmpName, char * name )
+{
+   snprintf( name, NAME_SIZE, "%s.%s", g_prefix, extension );
+   snprintf( tmpName, NAME_SIZE, "%s.%s.tmp", g_prefix, extension );
+
+   return fopen( tmpName, "w" );
+}
+
+/**
+ * \brief Renames a finished dump into place
+ **/
+static void closeDump( FILE * file, const char * tmpName, const char * name )
+{
+   if( fclose( file ) != 0 || rename( tmpName, name ) != 0 ) {
+      printf("Unable to write metrics to %s: %s\n", name, strerror(errno));
+   }
+}
+
+/**
+ * \brief Writes the JSON and Prometheus files for a snapshot
+ * \param [in] final rates cover the whole run instead of the last interval,
+ *                   which is usually cut short by metricsStop
+ **/
+static void writeDump( const METRICS_SNAPSHOT * snapshot, uint64_t now, bool final )
+{
+   double uptime  = ( now - g_startTime ) / 1e9;
+   double elapsed = final ? uptime : ( now - g_lastTime ) / 1e9;
+   double rate[METRIC_NUM_STAGES];
+   for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+      uint64_t count = final ? snapshot->total[s] : snapshot->total[s] - g_lastTotal[s];
+      rate[s] = elapsed > 0 ? count / elapsed : 0.0;
+   }
+
+   char name[NAME_SIZE];
+   char tmpName[NAME_SIZE];
+   FILE * file = openDump( "json", tmpName, name );
+   if( file != NULL ) {
+      fprintf( file, "{\"tool\":\"%s\",\"uptime\":%.3f,\"stages\":{", g_tool, uptime );
+      for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+         fprintf( file, "%s\"%s\":{\"count\":%lu,\"rate\":%.3f,\"mean\":%.9f,\"max\":%.9f",
+                  s > 0 ? "," : "",
+                  g_stageNames[s],
+                  snapshot->total[s],
+                  rate[s],
+                  snapshot->total[s] > 0 ? snapshot->sum[s] / 1e9 / snapshot->total[s] : 0.0,
+                  snapshot->max[s] / 1e9 );
+         for( int q = 0; q < NUM_QUANTILES; q++ ) {
+            fprintf( file, ",\"p%g\":%.9f", g_quantiles[q] * 100, quantile( snapshot, s, g_quantiles[q] ));
+         }
+         fprintf( file, "}" );
+      }
+      fprintf( file, "}}\n" );
+      closeDump( file, tmpName, name );
+   }
+
+   file = openDump( "prom", tmpName, name );
+   if( file != NULL ) {
+      fprintf( file, "# HELP mantis_stage_latency_seconds Latency of a frame capture stage\n" );
+      fprintf( file, "# TYPE mantis_stage_latency_seconds summary\n" );
+      for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+         for( int q = 0; q < NUM_QUANTILES; q++ ) {
+            fprintf( file, "mantis_stage_latency_seconds{tool=\"%s\",stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     g_tool, g_stageNames[s], g_quantiles[q], quantile( snapshot, s, g_quantiles[q] ));
+         }
+         fprintf( file, "mantis_stage_latency_seconds_sum{tool=\"%s\",stage=\"%s\"} %.9f\n",
+                  g_tool, g_stageNames[s], snapshot->sum[s] / 1e9 );
+         fprintf( file, "mantis_stage_latency_seconds_count{tool=\"%s\",stage=\"%s\"} %lu\n",
+                  g_tool, g_stageNames[s], snapshot->total[s] );
+      }
+      fprintf( file, "# HELP mantis_stage_rate Operations per second over the last interval, or the whole run in the final dump\n" );
+      fprintf( file, "# TYPE mantis_stage_rate gauge\n" );
+      for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+         fprintf( file, "mantis_stage_rate{tool=\"%s\",stage=\"%s\"} %.3f\n", g_tool, g_stageNames[s], rate[s] );
+      }
+      closeDump( file, tmpName, name );
+   }
+
+   for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+      g_lastTotal[s] = snapshot->total[s];
+   }
+   g_lastTime = now;
+}
+
+/**
+ * \brief Reporter thread. Dumps the merged histograms every interval
+ **/
+static void * reporterThread( void * data )
+{
+   METRICS_SNAPSHOT * snapshot = (METRICS_SNAPSHOT *)data;
+
+   pthread_mutex_lock( &g_lock );
+   while( !g_stop ) {
+      struct timespec deadline;
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      deadline.tv_sec  += (time_t)g_interval;
+      deadline.tv_nsec += (long)(( g_interval - (time_t)g_interval ) * 1e9 );
+      if( deadline.tv_nsec >= 1000000000L ) {
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait( &g_wake, &g_lock, &deadline );
+      if( g_stop ) {
+         break;
+      }
+      pthread_mutex_unlock( &g_lock );
+
+      takeSnapshot( snapshot );
+      writeDump( snapshot, metricsNow(), false );
+
+      pthread_mutex_lock( &g_lock );
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   //Final dump with everything recorded before metricsStop
+   takeSnapshot( snapshot );
+   writeDump( snapshot, metricsNow(), true );
+   free( snapshot );
+
+   return NULL;
+}
+
+/**
+ * \brief Starts recording and the reporter thread
+ **/
+bool metricsStart( const char * prefix, const char * tool, double interval )
+{
+   if( g_enabled || prefix == NULL ) {
+      return false;
+   }
+
+   snprintf( g_prefix, sizeof(g_prefix), "%s", prefix );
+   snprintf( g_tool, sizeof(g_tool), "%s", tool );
+   g_interval  = interval > 0 ? interval : METRICS_INTERVAL;
+   g_startTime = metricsNow();
+   g_lastTime  = g_startTime;
+   g_stop      = false;
+   memset( g_lastTotal, 0, sizeof(g_lastTotal));
+
+   //The snapshot is too large for a thread stack
+   METRICS_SNAPSHOT * snapshot = (METRICS_SNAPSHOT *)malloc( sizeof(METRICS_SNAPSHOT));
+   if( snapshot == NULL ) {
+      return false;
+   }
+
+   g_enabled = true;
+   if( pthread_create( &g_reporter, NULL, reporterThread, snapshot ) != 0 ) {
+      g_enabled = false;
+      free( snapshot );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Stops the reporter after a final dump and prints a summary
+ **/
+void metricsStop( void )
+{
+   if( !g_enabled ) {
+      return;
+   }
+
+   pthread_mutex_lock( &g_lock );
+   g_stop = true;
+   pthread_cond_signal( &g_wake );
+   pthread_mutex_unlock( &g_lock );
+
+   pthread_join( g_reporter, NULL );
+   g_enabled = false;
+
+   //The reporter wrote its last dump on the way out; print the totals too
+   void * snapshot = malloc( sizeof(METRICS_SNAPSHOT));
+   if( snapshot == NULL ) {
+      return;
+   }
+   takeSnapshot( (METRICS_SNAPSHOT *)snapshot );
+   const METRICS_SNAPSHOT * merged = (const METRICS_SNAPSHOT *)snapshot;
+   double uptime = ( metricsNow() - g_startTime ) / 1e9;
+   for( int s = 0; s < METRIC_NUM_STAGES; s++ ) {
+      if( merged->total[s] == 0 ) {
+         continue;
+      }
+      printf("%-14s %8lu ops %9.1f/s  p50 %8.3f ms  p99 %8.3f ms  p99.9 %8.3f ms  max %8.3f ms\n",
+             g_stageNames[s],
+             merged->total[s],
+             uptime > 0 ? merged->total[s] / uptime : 0.0,
+             quantile( merged, s, 0.5 ) * 1e3,
+             quantile( merged, s, 0.99 ) * 1e3,
+             quantile( merged, s, 0.999 ) * 1e3,
+             merged->max[s] / 1e6 );
+   }
+   free( snapshot );
+}
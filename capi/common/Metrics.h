@@ -0,0 +1,75 @@
+/******************************************************************************
+ *
+ * Metrics.h
+ *
+ * Latency histograms for the stages of frame capture. Each thread records
+ * into its own log-linear histograms (32 sub-buckets per power of two, so
+ * values are kept to within about 3%) without locks or atomic
+ * read-modify-write operations. A reporter thread merges the per-thread
+ * histograms every interval and rewrites <prefix>.json and <prefix>.prom
+ * (Prometheus text format) with counts, throughput and percentiles.
+ *
+ * Recording is a no-op until metricsStart is called, so tools can record
+ * unconditionally.
+ *
+ *****************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_INTERVAL 10.0  //!< Default seconds between dumps
+
+/**
+ * \brief Stages with a latency histogram
+ **/
+typedef enum {
+   METRIC_GET_FRAME,        //!< getFrame call
+   METRIC_SAVE_FRAME,       //!< saveFrame or writing a frame to a file
+   METRIC_FRAME_HOLD,       //!< From receiving a frame until returnPointer
+   METRIC_FRAME_CALLBACK,   //!< Execution of a frame callback
+   METRIC_DISPATCH_QUEUE,   //!< From a dispatched frame being queued until its callback
+   METRIC_NUM_STAGES
+} METRIC_STAGE;
+
+/**
+ * \brief Starts recording and the reporter thread
+ * \param [in] prefix   path of the output files without extension
+ * \param [in] tool     tool name added to every metric
+ * \param [in] interval seconds between dumps
+ * \return true if the reporter was started
+ **/
+bool metricsStart( const char * prefix, const char * tool, double interval );
+
+/**
+ * \brief Stops the reporter after a final dump and prints a summary
+ **/
+void metricsStop( void );
+
+/**
+ * \brief Returns a monotonic timestamp in nanoseconds
+ **/
+uint64_t metricsNow( void );
+
+/**
+ * \brief Records the time from start until now for a stage
+ * \param [in] start value from metricsNow
+ * \return the current time, to use as the start of the next stage
+ **/
+uint64_t metricsRecord( METRIC_STAGE stage, uint64_t start );
+
+/**
+ * \brief Records a duration in nanoseconds for a stage
+ **/
+void metricsRecordValue( METRIC_STAGE stage, uint64_t nanoseconds );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
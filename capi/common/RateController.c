@@ -0,0 +1,258 @@
+/******************************************************************************
+ *
+ * RateController.c
+ *
+ * AIMD request rate and concurrency controller. See RateController.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "RateController.h"
+
+#define WINDOW_MIN_REQUESTS 8       //!< Completions needed to judge a window
+#define WINDOW_MIN_TIME     0.25    //!< Shortest window in seconds
+#define TIMEOUT_THRESHOLD   0.02    //!< Fraction of slow failures treated as overload
+#define TIMEOUT_FACTOR      4.0     //!< Latency/minimum ratio that makes a failure a timeout
+#define ERROR_THRESHOLD     0.5     //!< Failure fraction treated as server errors
+#define LATENCY_FACTOR      2.0     //!< Mean/minimum latency ratio treated as overload
+#define LATENCY_SLACK       0.002   //!< Latency in seconds always tolerated above the minimum
+#define LATENCY_SMOOTHING   0.125   //!< Weight of a new sample in the smoothed latency
+#define MIN_LATENCY_DRIFT   1.05    //!< Per window growth of the minimum, so it tracks a slower server
+#define DECREASE_FACTOR     0.7     //!< Multiplicative decrease
+#define INCREASE_FRACTION   0.1     //!< Additive increase as a fraction of the rate at the last decrease
+#define RATE_USED_FRACTION  0.9     //!< Window throughput that counts as limited by the rate
+
+/**
+ * \brief Returns the current monotonic time in seconds
+ **/
+static double getTime()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**
+ * \brief Adds the tokens earned since the last refill. Called with the lock held
+ **/
+static void refill( RATE_CONTROLLER * rc, double now )
+{
+   rc->tokens += ( now - rc->lastRefill ) * rc->rate;
+   rc->lastRefill = now;
+
+   //Allow a burst of one request per slot
+   double burst = rc->limit > 1 ? rc->limit : 1;
+   if( rc->tokens > burst ) {
+      rc->tokens = burst;
+   }
+}
+
+/**
+ * \brief Evaluates a finished window and moves the setpoint. Called with
+ *        the lock held
+ **/
+static void adjust( RATE_CONTROLLER * rc, double now )
+{
+   double elapsed = now - rc->windowStart;
+   double meanLatency = rc->windowLatency / rc->windowRequests;
+
+   if( rc->minLatency == 0 || rc->windowMin < rc->minLatency ) {
+      rc->minLatency = rc->windowMin;
+   }
+   rc->failureRate = (double)rc->windowFailures / rc->windowRequests;
+
+   /* A request for a frame the camera never captured fails as quickly as
+    * any other, so fast failures alone are not a congestion signal. Only
+    * failures that took as long as a timeout, or a window in which most
+    * requests fail, mean the server is in trouble */
+   double timeoutRate = (double)rc->windowTimeouts / rc->windowRequests;
+   bool congested = timeoutRate > TIMEOUT_THRESHOLD
+                 || rc->failureRate > ERROR_THRESHOLD
+                 || meanLatency > LATENCY_FACTOR * rc->minLatency + LATENCY_SLACK;
+
+   if( congested ) {
+      rc->slowStart = false;
+      rc->rate *= DECREASE_FACTOR;
+      if( rc->rate < rc->minRate ) {
+         rc->rate = rc->minRate;
+      }
+      rc->step = rc->rate * INCREASE_FRACTION;
+      rc->limit = (int)( rc->limit * DECREASE_FACTOR );
+      if( rc->limit < 1 ) {
+         rc->limit = 1;
+      }
+      rc->decreases++;
+   }
+   else {
+      //Only raise a setpoint that actually held requests back
+      if( rc->windowRequests / elapsed >= RATE_USED_FRACTION * rc->rate ) {
+         rc->rate = rc->slowStart ? rc->rate * 2 : rc->rate + rc->step;
+         if( rc->rate > rc->maxRate ) {
+            rc->rate = rc->maxRate;
+         }
+      }
+      if( rc->windowLimited && rc->limit < rc->maxLimit ) {
+         rc->limit = rc->slowStart ? rc->limit * 2 : rc->limit + 1;
+         if( rc->limit > rc->maxLimit ) {
+            rc->limit = rc->maxLimit;
+         }
+      }
+   }
+
+   rc->minLatency *= MIN_LATENCY_DRIFT;
+   rc->windowStart    = now;
+   rc->windowRequests = 0;
+   rc->windowFailures = 0;
+   rc->windowTimeouts = 0;
+   rc->windowLatency  = 0;
+   rc->windowMin      = 0;
+   rc->windowLimited  = false;
+
+   pthread_cond_broadcast( &rc->slotFree );
+}
+
+/**
+ * \brief Initializes a controller
+ **/
+void rateControllerInit( RATE_CONTROLLER * rc, double initialRate, double minRate, double maxRate, int maxLimit )
+{
+   memset( rc, 0, sizeof(*rc));
+
+   rc->maxRate    = maxRate > 0 ? maxRate : RATE_CONTROLLER_MAX_RATE;
+   rc->rate       = initialRate < rc->maxRate ? initialRate : rc->maxRate;
+   rc->minRate    = minRate > 0 ? minRate : 1.0;
+   rc->minRate    = rc->rate < rc->minRate ? rc->rate : rc->minRate;
+   rc->step       = rc->rate * INCREASE_FRACTION;
+   rc->maxLimit   = maxLimit > 1 ? maxLimit : 1;
+   rc->limit      = 1;
+   rc->slowStart  = true;
+   rc->tokens     = 1;
+   rc->lastRefill = getTime();
+   rc->windowStart = rc->lastRefill;
+
+   pthread_mutex_init( &rc->lock, NULL );
+   pthread_cond_init( &rc->slotFree, NULL );
+}
+
+/**
+ * \brief Releases the controller resources
+ **/
+void rateControllerDestroy( RATE_CONTROLLER * rc )
+{
+   pthread_mutex_destroy( &rc->lock );
+   pthread_cond_destroy( &rc->slotFree );
+}
+
+/**
+ * \brief Waits until a request may be sent
+ **/
+double rateControllerAcquire( RATE_CONTROLLER * rc )
+{
+   pthread_mutex_lock( &rc->lock );
+   while( true ) {
+      if( rc->outstanding >= rc->limit ) {
+         rc->windowLimited = true;
+         pthread_cond_wait( &rc->slotFree, &rc->lock );
+         continue;
+      }
+
+      double now = getTime();
+      refill( rc, now );
+      if( rc->tokens >= 1.0 ) {
+         rc->tokens -= 1.0;
+         rc->outstanding++;
+         pthread_mutex_unlock( &rc->lock );
+         return now;
+      }
+
+      //Sleep until the next token is due
+      double wait = ( 1.0 - rc->tokens ) / rc->rate;
+      pthread_mutex_unlock( &rc->lock );
+
+      struct timespec ts;
+      ts.tv_sec  = (time_t)wait;
+      ts.tv_nsec = (long)(( wait - ts.tv_sec ) * 1e9 );
+      nanosleep( &ts, NULL );
+
+      pthread_mutex_lock( &rc->lock );
+   }
+}
+
+/**
+ * \brief Reports the outcome of a request and adjusts the setpoint
+ **/
+void rateControllerRelease( RATE_CONTROLLER * rc, double start, bool success )
+{
+   double now = getTime();
+   double latency = now - start;
+
+   pthread_mutex_lock( &rc->lock );
+   rc->outstanding--;
+   rc->requests++;
+   rc->windowRequests++;
+   rc->windowLatency += latency;
+   if( rc->windowMin == 0 || latency < rc->windowMin ) {
+      rc->windowMin = latency;
+   }
+   if( !success ) {
+      rc->failures++;
+      rc->windowFailures++;
+      if( rc->minLatency > 0 && latency > TIMEOUT_FACTOR * rc->minLatency + LATENCY_SLACK ) {
+         rc->timeouts++;
+         rc->windowTimeouts++;
+      }
+   }
+   rc->latency = ( rc->latency == 0 ) ? latency
+               : rc->latency + LATENCY_SMOOTHING * ( latency - rc->latency );
+
+   if( rc->windowRequests >= WINDOW_MIN_REQUESTS && now - rc->windowStart >= WINDOW_MIN_TIME ) {
+      adjust( rc, now );
+   }
+   else {
+      pthread_cond_signal( &rc->slotFree );
+   }
+   pthread_mutex_unlock( &rc->lock );
+}
+
+/**
+ * \brief Returns the current setpoint and totals
+ **/
+RATE_SETPOINT rateControllerSetpoint( RATE_CONTROLLER * rc )
+{
+   RATE_SETPOINT setpoint;
+
+   pthread_mutex_lock( &rc->lock );
+   setpoint.rate        = rc->rate;
+   setpoint.limit       = rc->limit;
+   setpoint.latency     = rc->latency;
+   setpoint.minLatency  = rc->minLatency;
+   setpoint.failureRate = rc->failureRate;
+   setpoint.requests    = rc->requests;
+   setpoint.failures    = rc->failures;
+   setpoint.timeouts    = rc->timeouts;
+   setpoint.decreases   = rc->decreases;
+   pthread_mutex_unlock( &rc->lock );
+
+   return setpoint;
+}
+
+/**
+ * \brief Prints a setpoint
+ **/
+void rateControllerPrintSetpoint( RATE_SETPOINT setpoint )
+{
+   printf("Rate controller: %.1f requests/s, %d outstanding, latency %.2f ms (min %.2f ms), "
+          "%.1f%% failed in the last window, %lu of %lu requests failed (%lu timed out), %lu back-offs\n",
+          setpoint.rate,
+          setpoint.limit,
+          setpoint.latency * 1e3,
+          setpoint.minLatency * 1e3,
+          setpoint.failureRate * 100.0,
+          setpoint.failures,
+          setpoint.requests,
+          setpoint.timeouts,
+          setpoint.decreases);
+}
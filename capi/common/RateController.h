@@ -0,0 +1,120 @@
+/******************************************************************************
+ *
+ * RateController.h
+ *
+ * Adaptive flow control for frame requests. Requests are admitted by a
+ * token bucket that sets the request rate and by a limit on the number of
+ * requests outstanding at once. Both setpoints follow AIMD: they start with
+ * a doubling phase and grow additively while the server keeps up, and are
+ * cut multiplicatively when a window of requests shows a mean latency well
+ * above the lowest latency seen, failures slow enough to be timeouts, or
+ * mostly failures. A request that fails quickly, such as one for a frame
+ * the camera never captured, does not slow the requests down.
+ *
+ * A controller is thread safe and is normally shared by every thread that
+ * requests frames from the same server.
+ *
+ *****************************************************************************/
+#ifndef RATE_CONTROLLER_H
+#define RATE_CONTROLLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RATE_CONTROLLER_MAX_RATE 100000.0 //!< Request rate cap when none is given
+
+/**
+ * \brief Current operating point of a controller
+ **/
+typedef struct {
+   double   rate;         //!< Admitted requests per second
+   int      limit;        //!< Requests allowed outstanding at once
+   double   latency;      //!< Smoothed request latency in seconds
+   double   minLatency;   //!< Lowest recent request latency in seconds
+   double   failureRate;  //!< Fraction of failed requests in the last window
+   uint64_t requests;     //!< Requests completed
+   uint64_t failures;     //!< Requests that failed
+   uint64_t timeouts;     //!< Failed requests slow enough to be timeouts
+   uint64_t decreases;    //!< Times the setpoint was cut
+} RATE_SETPOINT;
+
+/**
+ * \brief Request rate and concurrency controller
+ **/
+typedef struct {
+   double          rate;           //!< Token refill rate in requests per second
+   double          minRate;        //!< Lower bound of rate
+   double          maxRate;        //!< Upper bound of rate
+   double          step;           //!< Additive rate increase per window
+   int             limit;          //!< Requests allowed outstanding
+   int             maxLimit;       //!< Upper bound of limit
+   int             outstanding;    //!< Requests admitted and not yet released
+   bool            slowStart;      //!< Doubling until the first congestion signal
+   double          tokens;         //!< Tokens available in the bucket
+   double          lastRefill;     //!< Time tokens were last added
+   double          latency;        //!< Smoothed latency in seconds
+   double          minLatency;     //!< Lowest recent latency, 0 until measured
+   double          windowStart;    //!< Start time of the current window
+   uint64_t        windowRequests; //!< Requests completed in the window
+   uint64_t        windowFailures; //!< Failures in the window
+   uint64_t        windowTimeouts; //!< Failures in the window slow enough to be timeouts
+   double          windowLatency;  //!< Sum of latencies in the window
+   double          windowMin;      //!< Lowest latency in the window
+   bool            windowLimited;  //!< Set if a request waited for a free slot
+   double          failureRate;    //!< Failure fraction of the last window
+   uint64_t        requests;       //!< Requests completed
+   uint64_t        failures;       //!< Requests that failed
+   uint64_t        timeouts;       //!< Failed requests slow enough to be timeouts
+   uint64_t        decreases;      //!< Multiplicative decreases applied
+   pthread_mutex_t lock;           //!< Guards all fields above
+   pthread_cond_t  slotFree;       //!< Signaled when a request is released
+} RATE_CONTROLLER;
+
+/**
+ * \brief Initializes a controller
+ * \param [in] initialRate first request rate in requests per second
+ * \param [in] minRate     lowest rate a back-off may reach, normally the
+ *                         framerate of one stream. 0 selects 1 request/s
+ * \param [in] maxRate     highest rate to allow. 0 selects RATE_CONTROLLER_MAX_RATE
+ * \param [in] maxLimit    most requests to allow outstanding at once
+ **/
+void rateControllerInit( RATE_CONTROLLER * rc, double initialRate, double minRate, double maxRate, int maxLimit );
+
+/**
+ * \brief Releases the controller resources
+ **/
+void rateControllerDestroy( RATE_CONTROLLER * rc );
+
+/**
+ * \brief Waits until a request may be sent
+ * \return time the request was admitted, to pass to rateControllerRelease
+ **/
+double rateControllerAcquire( RATE_CONTROLLER * rc );
+
+/**
+ * \brief Reports the outcome of a request admitted at start and adjusts the
+ *        setpoint at the end of each window
+ * \param [in] success false if the request returned no frame
+ **/
+void rateControllerRelease( RATE_CONTROLLER * rc, double start, bool success );
+
+/**
+ * \brief Returns the current setpoint and totals
+ **/
+RATE_SETPOINT rateControllerSetpoint( RATE_CONTROLLER * rc );
+
+/**
+ * \brief Prints a setpoint
+ **/
+void rateControllerPrintSetpoint( RATE_SETPOINT setpoint );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+/******************************************************************************
+ *
+ * StreamContainer.c
+ *
+ * Single file multi microcamera H.264 container. See StreamContainer.h
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "StreamContainer.h"
+
+/**
+ * \brief Orders entries by microcamera and then timestamp
+ **/
+static int compareEntries( const void * a, const void * b )
+{
+   const STREAM_CONTAINER_ENTRY * ea = (const STREAM_CONTAINER_ENTRY *)a;
+   const STREAM_CONTAINER_ENTRY * eb = (const STREAM_CONTAINER_ENTRY *)b;
+
+   if( ea->mcamID != eb->mcamID ) {
+      return ea->mcamID < eb->mcamID ? -1 : 1;
+   }
+   if( ea->timestamp != eb->timestamp ) {
+      return ea->timestamp < eb->timestamp ? -1 : 1;
+   }
+   return 0;
+}
+
+/**
+ * \brief Creates or truncates a container file and writes its header
+ **/
+bool streamContainerOpen( STREAM_CONTAINER * container, const char * fileName )
+{
+   memset( container, 0, sizeof(*container));
+
+   container->file = fopen( fileName, "w" );
+   if( container->file == NULL ) {
+      return false;
+   }
+
+   STREAM_CONTAINER_HEADER header;
+   memset( &header, 0, sizeof(header));
+   header.magic   = STREAM_CONTAINER_MAGIC;
+   header.version = STREAM_CONTAINER_VERSION;
+   if( fwrite( &header, sizeof(header), 1, container->file ) != 1 ) {
+      fclose( container->file );
+      container->file = NULL;
+      return false;
+   }
+
+   container->offset = sizeof(header);
+   pthread_mutex_init( &container->lock, NULL );
+   return true;
+}
+
+/**
+ * \brief Appends a frame from mcamID to the container
+ **/
+bool streamContainerAppend( STREAM_CONTAINER * container
+                          , uint32_t mcamID
+                          , const FRAME * frame
+                          , uint64_t * offset
+                          )
+{
+   pthread_mutex_lock( &container->lock );
+
+   if( container->numEntries == container->maxEntries ) {
+      size_t maxEntries = container->maxEntries ? 2 * container->maxEntries : 4096;
+      STREAM_CONTAINER_ENTRY * entries = (STREAM_CONTAINER_ENTRY *)
+         realloc( container->entries, maxEntries * sizeof(STREAM_CONTAINER_ENTRY));
+      if( entries == NULL ) {
+         pthread_mutex_unlock( &container->lock );
+         return false;
+      }
+      container->entries    = entries;
+      container->maxEntries = maxEntries;
+   }
+
+   uint64_t size = frame->m_metadata.m_size;
+   if( fwrite( frame->m_image, 1, size, container->file ) != size ) {
+      pthread_mutex_unlock( &container->lock );
+      return false;
+   }
+
+   STREAM_CONTAINER_ENTRY * entry = &container->entries[container->numEntries++];
+   memset( entry, 0, sizeof(*entry));
+   entry->mcamID    = mcamID;
+   entry->flags     = frame->m_metadata.m_mode == ATL_MODE_H264_I_FRAME ? STREAM_CONTAINER_I_FRAME : 0;
+   entry->timestamp = frame->m_metadata.m_timestamp;
+   entry->offset    = container->offset;
+   entry->size      = size;
+   if( offset != NULL ) {
+      *offset = container->offset;
+   }
+   container->offset += size;
+
+   pthread_mutex_unlock( &container->lock );
+   return true;
+}
+
+/**
+ * \brief Writes the sorted entry table and trailer and closes the file
+ **/
+bool streamContainerClose( STREAM_CONTAINER * container )
+{
+   if( container->file == NULL ) {
+      return false;
+   }
+
+   qsort( container->entries, container->numEntries, sizeof(STREAM_CONTAINER_ENTRY), compareEntries );
+
+   /* A GOP runs from an I-frame to the frame before the next I-frame or the
+    * next microcamera. Frames before the first I-frame form their own GOP */
+   size_t gopStart = 0;
+   for( size_t i = 0; i <= container->numEntries; i++ ) {
+      bool endOfGop = i == container->numEntries
+                   || ( i > gopStart
+                     && ( container->entries[i].mcamID != container->entries[gopStart].mcamID
+                       || container->entries[i].flags & STREAM_CONTAINER_I_FRAME ));
+      if( !endOfGop ) {
+         continue;
+      }
+      for( size_t j = gopStart; j < i; j++ ) {
+         container->entries[j].gopFirst  = (uint32_t)(j - gopStart);
+         container->entries[j].gopLength = (uint32_t)(i - gopStart);
+      }
+      gopStart = i;
+   }
+
+   /* Align the entry table so the mapped entries can be read in place */
+   static const uint8_t padding[sizeof(uint64_t)] = {0};
+   size_t padSize = (sizeof(uint64_t) - container->offset % sizeof(uint64_t)) % sizeof(uint64_t);
+   bool rc = fwrite( padding, 1, padSize, container->file ) == padSize;
+   container->offset += padSize;
+
+   STREAM_CONTAINER_TRAILER trailer;
+   memset( &trailer, 0, sizeof(trailer));
+   trailer.indexOffset = container->offset;
+   trailer.numEntries  = container->numEntries;
+   trailer.entrySize   = sizeof(STREAM_CONTAINER_ENTRY);
+   trailer.magic       = STREAM_CONTAINER_MAGIC;
+
+   rc = rc && fwrite( container->entries, sizeof(STREAM_CONTAINER_ENTRY), container->numEntries, container->file ) == container->numEntries
+          && fwrite( &trailer, sizeof(trailer), 1, container->file ) == 1;
+   rc = fclose( container->file ) == 0 && rc;
+
+   container->file = NULL;
+   free( container->entries );
+   container->entries = NULL;
+   pthread_mutex_destroy( &container->lock );
+
+   return rc;
+}
+
+/**
+ * \brief Maps a closed container for reading
+ **/
+bool streamContainerMap( STREAM_CONTAINER_READER * reader, const char * fileName )
+{
+   memset( reader, 0, sizeof(*reader));
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   size_t minSize = sizeof(STREAM_CONTAINER_HEADER) + sizeof(STREAM_CONTAINER_TRAILER);
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < minSize ) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+
+   const uint8_t * bytes = (const uint8_t *)data;
+   const STREAM_CONTAINER_HEADER * header = (const STREAM_CONTAINER_HEADER *)bytes;
+   const STREAM_CONTAINER_TRAILER * trailer = (const STREAM_CONTAINER_TRAILER *)
+      ( bytes + st.st_size - sizeof(STREAM_CONTAINER_TRAILER));
+
+   uint64_t tableEnd = trailer->indexOffset + trailer->numEntries * sizeof(STREAM_CONTAINER_ENTRY);
+   if( header->magic != STREAM_CONTAINER_MAGIC
+    || trailer->magic != STREAM_CONTAINER_MAGIC
+    || trailer->entrySize != sizeof(STREAM_CONTAINER_ENTRY)
+    || tableEnd != st.st_size - sizeof(STREAM_CONTAINER_TRAILER)) {
+      munmap( data, st.st_size );
+      return false;
+   }
+
+   reader->data       = bytes;
+   reader->length     = st.st_size;
+   reader->entries    = (const STREAM_CONTAINER_ENTRY *)( bytes + trailer->indexOffset );
+   reader->numEntries = trailer->numEntries;
+
+   return true;
+}
+
+/**
+ * \brief Finds the GOP of mcamID covering time
+ **/
+bool streamContainerFindGop( const STREAM_CONTAINER_READER * reader
+                           , uint32_t mcamID
+                           , uint64_t time
+                           , STREAM_CONTAINER_GOP * gop
+                           )
+{
+   /* Find the first entry ordered after (mcamID, time) */
+   size_t low = 0;
+   size_t high = reader->numEntries;
+   while( low < high ) {
+      size_t mid = low + (high - low)/2;
+      const STREAM_CONTAINER_ENTRY * entry = &reader->entries[mid];
+      if( entry->mcamID < mcamID || ( entry->mcamID == mcamID && entry->timestamp <= time )) {
+         low = mid + 1;
+      } else {
+         high = mid;
+      }
+   }
+
+   /* Step back to the last frame at or before time, or use the first frame
+    * of the microcamera if time is before all of them */
+   size_t i;
+   if( low > 0 && reader->entries[low - 1].mcamID == mcamID ) {
+      i = low - 1;
+   } else if( low < reader->numEntries && reader->entries[low].mcamID == mcamID ) {
+      i = low;
+   } else {
+      return false;
+   }
+
+   size_t first = i - reader->entries[i].gopFirst;
+   gop->entries    = &reader->entries[first];
+   gop->numEntries = reader->entries[first].gopLength;
+   gop->data       = reader->data;
+
+   return true;
+}
+
+/**
+ * \brief Unmaps a container
+ **/
+void streamContainerUnmap( STREAM_CONTAINER_READER * reader )
+{
+   if( reader->data != NULL ) {
+      munmap( (void *)reader->data, reader->length );
+   }
+   memset( reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,150 @@
+/******************************************************************************
+ *
+ * StreamContainer.h
+ *
+ * Single file container for the H.264 streams of many microcameras.
+ *
+ * Layout, all integers in native byte order:
+ *   STREAM_CONTAINER_HEADER
+ *   frame data, in the order frames were appended
+ *   zero padding to a multiple of 8 bytes
+ *   STREAM_CONTAINER_ENTRY[numEntries], sorted by (mcamID, timestamp)
+ *   STREAM_CONTAINER_TRAILER
+ *
+ * The entry table is written when the container is closed. Every entry
+ * records where its GOP starts and how long it is, so a reader can find
+ * the GOP covering any (mcam, time) with one binary search.
+ *
+ *****************************************************************************/
+#ifndef STREAM_CONTAINER_H
+#define STREAM_CONTAINER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STREAM_CONTAINER_MAGIC   0x434D4D41 //!< "AMMC" in a little endian file
+#define STREAM_CONTAINER_VERSION 1
+#define STREAM_CONTAINER_I_FRAME 0x1        //!< Entry flag for I-frames
+
+/**
+ * \brief Header at the start of a container
+ **/
+typedef struct {
+   uint32_t magic;        //!< STREAM_CONTAINER_MAGIC
+   uint32_t version;      //!< STREAM_CONTAINER_VERSION
+   uint64_t reserved;     //!< Zero
+} STREAM_CONTAINER_HEADER;
+
+/**
+ * \brief Index entry for one frame
+ **/
+typedef struct {
+   uint32_t mcamID;       //!< Microcamera the frame came from
+   uint32_t flags;        //!< STREAM_CONTAINER_I_FRAME for I-frames
+   uint64_t timestamp;    //!< Frame timestamp in microseconds
+   uint64_t offset;       //!< Byte offset of the frame in the container
+   uint64_t size;         //!< Size of the frame in bytes
+   uint32_t gopFirst;     //!< Number of entries back to the first frame of the GOP
+   uint32_t gopLength;    //!< Number of entries in the GOP
+} STREAM_CONTAINER_ENTRY;
+
+/**
+ * \brief Trailer at the end of a closed container
+ **/
+typedef struct {
+   uint64_t indexOffset;  //!< Byte offset of the entry table
+   uint64_t numEntries;   //!< Number of entries in the table
+   uint32_t entrySize;    //!< Size of each entry in bytes
+   uint32_t magic;        //!< STREAM_CONTAINER_MAGIC
+} STREAM_CONTAINER_TRAILER;
+
+/**
+ * \brief Container being written. Appends are serialized so one container
+ *        can be shared by several export threads
+ **/
+typedef struct {
+   FILE *                   file;         //!< Open container file
+   uint64_t                 offset;       //!< Offset of the next frame
+   STREAM_CONTAINER_ENTRY * entries;      //!< Entries of the frames written so far
+   size_t                   numEntries;   //!< Number of used entries
+   size_t                   maxEntries;   //!< Allocated entries
+   pthread_mutex_t          lock;         //!< Serializes appends
+} STREAM_CONTAINER;
+
+/**
+ * \brief Read-only view of a container mapped into memory
+ **/
+typedef struct {
+   const uint8_t *                data;         //!< Start of the mapping
+   size_t                         length;       //!< Length of the mapping
+   const STREAM_CONTAINER_ENTRY * entries;      //!< Sorted entry table
+   size_t                         numEntries;   //!< Number of entries
+} STREAM_CONTAINER_READER;
+
+/**
+ * \brief Frames of one GOP. Points into the reader's mapping
+ **/
+typedef struct {
+   const STREAM_CONTAINER_ENTRY * entries;      //!< First entry of the GOP
+   size_t                         numEntries;   //!< Number of frames in the GOP
+   const uint8_t *                data;         //!< Base of the container, add entry offsets
+} STREAM_CONTAINER_GOP;
+
+/**
+ * \brief Creates or truncates a container file and writes its header
+ * \return true on success
+ **/
+bool streamContainerOpen( STREAM_CONTAINER * container, const char * fileName );
+
+/**
+ * \brief Appends a frame from mcamID to the container
+ * \param [out] offset optional, receives the offset the frame was written at
+ * \return true on success
+ **/
+bool streamContainerAppend( STREAM_CONTAINER * container
+                          , uint32_t mcamID
+                          , const FRAME * frame
+                          , uint64_t * offset
+                          );
+
+/**
+ * \brief Writes the sorted entry table and trailer and closes the file
+ * \return true on success
+ **/
+bool streamContainerClose( STREAM_CONTAINER * container );
+
+/**
+ * \brief Maps a closed container for reading
+ * \return true if the file is a valid container
+ **/
+bool streamContainerMap( STREAM_CONTAINER_READER * reader, const char * fileName );
+
+/**
+ * \brief Finds the GOP of mcamID covering time, which is the GOP of the last
+ *        frame at or before time, or the first GOP if time is earlier
+ * \return true if the container has frames for mcamID
+ **/
+bool streamContainerFindGop( const STREAM_CONTAINER_READER * reader
+                           , uint32_t mcamID
+                           , uint64_t time
+                           , STREAM_CONTAINER_GOP * gop
+                           );
+
+/**
+ * \brief Unmaps a container
+ **/
+void streamContainerUnmap( STREAM_CONTAINER_READER * reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
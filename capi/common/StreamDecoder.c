@@ -0,0 +1,443 @@
+/******************************************************************************
+ *
+ * StreamDecoder.c
+ *
+ * In-process H.264 to JPEG conversion. See StreamDecoder.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <jpeglib.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+
+#include "StreamDecoder.h"
+#include "FrameQueue.h"
+
+#define DECODER_QUEUE_SIZE 64
+#define DECODER_FNAME_SIZE 1024
+
+/**
+ * \brief Decode state for one microcamera
+ **/
+typedef struct {
+   uint32_t         mcamID;      //!< Microcamera decoded by this stream
+   AVCodecContext * codec;       //!< Software H.264 decoder
+   uint64_t         jpegCount;   //!< JPEGs written so far
+} DECODER_STREAM;
+
+/**
+ * \brief One decode thread and the frames queued for it
+ **/
+typedef struct {
+   STREAM_DECODER * decoder;     //!< Owning decoder
+   int              id;          //!< Streams with index % numWorkers == id belong here
+   FRAME_QUEUE      queue;       //!< Copied frames waiting to be decoded
+   AVPacket *       packet;      //!< Reused input packet
+   AVFrame *        picture;     //!< Reused decoded picture
+   pthread_t        thread;      //!< Decode thread
+   bool             started;     //!< Set if thread is running
+} DECODER_WORKER;
+
+struct STREAM_DECODER {
+   char             path[DECODER_FNAME_SIZE];  //!< Output directory
+   int              quality;     //!< JPEG quality
+   DECODER_STREAM * streams;     //!< One entry per microcamera
+   int              numStreams;  //!< Number of streams
+   DECODER_WORKER * workers;     //!< Decode threads
+   int              numWorkers;  //!< Number of decode threads
+};
+
+/**
+ * \brief Rounds and clamps a sample to 0-255
+ **/
+static uint8_t clampSample( double value )
+{
+   if( value <= 0 ) {
+      return 0;
+   }
+   if( value >= 255 ) {
+      return 255;
+   }
+   return (uint8_t)(value + 0.5);
+}
+
+/**
+ * \brief Builds the tables that expand limited range samples (16-235 luma,
+ *        16-240 chroma) to the full range JPEG expects
+ **/
+static void fullRangeTables( uint8_t luma[256], uint8_t chroma[256] )
+{
+   for( int i = 0; i < 256; i++ ) {
+      luma[i]   = clampSample(( i - 16 ) * 255.0 / 219.0 );
+      chroma[i] = clampSample(( i - 128 ) * 255.0 / 224.0 + 128 );
+   }
+}
+
+/**
+ * \brief Returns a row of a plane that libjpeg can read paddedWidth samples
+ *        from. The row is used in place if it needs no range expansion and
+ *        its line is long enough; otherwise it is copied to scratch,
+ *        expanded to full range if table is not NULL, and its last sample
+ *        repeated up to paddedWidth
+ **/
+static JSAMPROW planeRow( const AVFrame * picture
+                        , int plane
+                        , int row
+                        , int width
+                        , int paddedWidth
+                        , const uint8_t * table
+                        , uint8_t * scratch
+                        )
+{
+   uint8_t * src = picture->data[plane] + row * picture->linesize[plane];
+   if( table == NULL && picture->linesize[plane] >= paddedWidth ) {
+      return src;
+   }
+
+   if( table != NULL ) {
+      for( int i = 0; i < width; i++ ) {
+         scratch[i] = table[src[i]];
+      }
+   }
+   else {
+      memcpy( scratch, src, width );
+   }
+   memset( scratch + width, scratch[width - 1], paddedWidth - width );
+   return scratch;
+}
+
+/**
+ * \brief Encodes a decoded 4:2:0 picture to a JPEG file. The planes are
+ *        handed to libjpeg as raw YCbCr data so no resampling is done.
+ *        JPEG uses full range YCbCr, so limited range (MPEG) pictures are
+ *        expanded row by row first; full range pictures are passed as is
+ **/
+static bool writeJpeg( const AVFrame * picture, const char * fileName, int quality )
+{
+   if( picture->format != AV_PIX_FMT_YUV420P && picture->format != AV_PIX_FMT_YUVJ420P ) {
+      printf("Unsupported pixel format %d for %s\n", picture->format, fileName );
+      return false;
+   }
+
+   /* YUVJ420P is always full range. H.264 streams are normally limited
+    * range unless they signal otherwise */
+   bool limited = picture->format == AV_PIX_FMT_YUV420P
+               && picture->color_range != AVCOL_RANGE_JPEG;
+   int chromaWidth  = (picture->width + 1)/2;
+   int chromaHeight = (picture->height + 1)/2;
+   uint8_t lumaTable[256];
+   uint8_t chromaTable[256];
+   if( limited ) {
+      fullRangeTables( lumaTable, chromaTable );
+   }
+   const uint8_t * yTable = limited ? lumaTable : NULL;
+   const uint8_t * cTable = limited ? chromaTable : NULL;
+
+   /* libjpeg reads whole MCUs of 16x16 luma and 8x8 chroma samples, so rows
+    * are read past the picture width up to the next MCU. Rows that are
+    * expanded or too short go through scratch rows padded to that width */
+   int mcusPerRow    = (picture->width + 2*DCTSIZE - 1)/(2*DCTSIZE);
+   int lumaPadded    = mcusPerRow * 2*DCTSIZE;
+   int chromaPadded  = mcusPerRow * DCTSIZE;
+   uint8_t * scratch = (uint8_t *)malloc( 2*DCTSIZE * lumaPadded + 2*DCTSIZE * chromaPadded );
+   if( scratch == NULL ) {
+      printf("Unable to allocate JPEG rows for %s\n", fileName );
+      return false;
+   }
+
+   FILE * file = fopen( fileName, "wb" );
+   if( file == NULL ) {
+      printf("Unable to open %s\n", fileName );
+      free( scratch );
+      return false;
+   }
+
+   struct jpeg_compress_struct cinfo;
+   struct jpeg_error_mgr jerr;
+   cinfo.err = jpeg_std_error( &jerr );
+   jpeg_create_compress( &cinfo );
+   jpeg_stdio_dest( &cinfo, file );
+
+   cinfo.image_width      = picture->width;
+   cinfo.image_height     = picture->height;
+   cinfo.input_components = 3;
+   cinfo.in_color_space   = JCS_YCbCr;
+   jpeg_set_defaults( &cinfo );
+   jpeg_set_colorspace( &cinfo, JCS_YCbCr );
+   jpeg_set_quality( &cinfo, quality, TRUE );
+   cinfo.raw_data_in = TRUE;
+   cinfo.comp_info[0].h_samp_factor = 2;
+   cinfo.comp_info[0].v_samp_factor = 2;
+   cinfo.comp_info[1].h_samp_factor = 1;
+   cinfo.comp_info[1].v_samp_factor = 1;
+   cinfo.comp_info[2].h_samp_factor = 1;
+   cinfo.comp_info[2].v_samp_factor = 1;
+   jpeg_start_compress( &cinfo, TRUE );
+
+   /* libjpeg consumes one MCU row (16 luma rows) at a time. Rows past the
+    * bottom of the picture repeat the last row */
+   JSAMPROW yRows[2*DCTSIZE];
+   JSAMPROW cbRows[DCTSIZE];
+   JSAMPROW crRows[DCTSIZE];
+   JSAMPARRAY planes[3] = { yRows, cbRows, crRows };
+   uint8_t * yScratch  = scratch;
+   uint8_t * cbScratch = yScratch + 2*DCTSIZE * lumaPadded;
+   uint8_t * crScratch = cbScratch + DCTSIZE * chromaPadded;
+
+   while( cinfo.next_scanline < cinfo.image_height ) {
+      for( int i = 0; i < 2*DCTSIZE; i++ ) {
+         int row = cinfo.next_scanline + i;
+         if( row >= picture->height ) {
+            row = picture->height - 1;
+         }
+         yRows[i] = planeRow( picture, 0, row, picture->width, lumaPadded, yTable
+                            , yScratch + i * lumaPadded );
+      }
+      for( int i = 0; i < DCTSIZE; i++ ) {
+         int row = cinfo.next_scanline/2 + i;
+         if( row >= chromaHeight ) {
+            row = chromaHeight - 1;
+         }
+         cbRows[i] = planeRow( picture, 1, row, chromaWidth, chromaPadded, cTable
+                             , cbScratch + i * chromaPadded );
+         crRows[i] = planeRow( picture, 2, row, chromaWidth, chromaPadded, cTable
+                             , crScratch + i * chromaPadded );
+      }
+      jpeg_write_raw_data( &cinfo, planes, 2*DCTSIZE );
+   }
+
+   jpeg_finish_compress( &cinfo );
+   jpeg_destroy_compress( &cinfo );
+   fclose( file );
+   free( scratch );
+
+   return true;
+}
+
+/**
+ * \brief Sends one packet (or NULL to flush) to a stream and writes every
+ *        picture the decoder returns
+ **/
+static void decodePacket( DECODER_WORKER * worker, DECODER_STREAM * stream, AVPacket * packet )
+{
+   if( avcodec_send_packet( stream->codec, packet ) < 0 ) {
+      printf("Decoder for %u rejected a packet\n", stream->mcamID );
+      return;
+   }
+
+   while( avcodec_receive_frame( stream->codec, worker->picture ) == 0 ) {
+      char fileName[DECODER_FNAME_SIZE];
+      snprintf( fileName
+              , DECODER_FNAME_SIZE
+              , "%s/stream%u_%05lu.jpg"
+              , worker->decoder->path
+              , stream->mcamID
+              , stream->jpegCount + 1
+              );
+      if( writeJpeg( worker->picture, fileName, worker->decoder->quality )) {
+         stream->jpegCount++;
+      }
+      av_frame_unref( worker->picture );
+   }
+}
+
+/**
+ * \brief Returns the stream owned by worker for a microcamera
+ **/
+static DECODER_STREAM * findStream( DECODER_WORKER * worker, uint32_t mcamID )
+{
+   STREAM_DECODER * decoder = worker->decoder;
+   for( int i = worker->id; i < decoder->numStreams; i += decoder->numWorkers ) {
+      if( decoder->streams[i].mcamID == mcamID ) {
+         return &decoder->streams[i];
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Decode thread. Decodes queued frames until the queue is closed,
+ *        then flushes the streams it owns
+ **/
+static void * decodeThread( void * data )
+{
+   DECODER_WORKER * worker = (DECODER_WORKER *)data;
+   STREAM_DECODER * decoder = worker->decoder;
+   FRAME frame;
+
+   while( frameQueuePop( &worker->queue, &frame )) {
+      DECODER_STREAM * stream = findStream( worker, frame.m_metadata.m_camId );
+      if( stream != NULL ) {
+         worker->packet->data = (uint8_t *)frame.m_image;
+         worker->packet->size = (int)frame.m_metadata.m_size;
+         decodePacket( worker, stream, worker->packet );
+      }
+      free( frame.m_image );
+   }
+
+   for( int i = worker->id; i < decoder->numStreams; i += decoder->numWorkers ) {
+      decodePacket( worker, &decoder->streams[i], NULL );
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Frees everything owned by a decoder. Threads must be stopped
+ **/
+static void destroyDecoder( STREAM_DECODER * decoder )
+{
+   for( int i = 0; i < decoder->numWorkers; i++ ) {
+      DECODER_WORKER * worker = &decoder->workers[i];
+      if( worker->queue.frames != NULL ) {
+         frameQueueDestroy( &worker->queue );
+      }
+      av_packet_free( &worker->packet );
+      av_frame_free( &worker->picture );
+   }
+   for( int i = 0; i < decoder->numStreams; i++ ) {
+      avcodec_free_context( &decoder->streams[i].codec );
+   }
+
+   free( decoder->workers );
+   free( decoder->streams );
+   free( decoder );
+}
+
+/**
+ * \brief Creates a decoder for the given microcameras and starts its threads
+ **/
+STREAM_DECODER * streamDecoderCreate( const char * path
+                                    , const uint32_t * mcamIDs
+                                    , int numMCams
+                                    , int numThreads
+                                    , int quality
+                                    )
+{
+   const AVCodec * h264 = avcodec_find_decoder( AV_CODEC_ID_H264 );
+   if( h264 == NULL || numMCams < 1 || numThreads < 1 ) {
+      return NULL;
+   }
+   if( numThreads > numMCams ) {
+      numThreads = numMCams;
+   }
+
+   STREAM_DECODER * decoder = (STREAM_DECODER *)calloc( 1, sizeof(STREAM_DECODER));
+   if( decoder == NULL ) {
+      return NULL;
+   }
+   snprintf( decoder->path, DECODER_FNAME_SIZE, "%s", path );
+   decoder->quality    = quality;
+   decoder->numStreams = numMCams;
+   decoder->numWorkers = numThreads;
+   decoder->streams    = (DECODER_STREAM *)calloc( numMCams, sizeof(DECODER_STREAM));
+   decoder->workers    = (DECODER_WORKER *)calloc( numThreads, sizeof(DECODER_WORKER));
+   if( decoder->streams == NULL || decoder->workers == NULL ) {
+      destroyDecoder( decoder );
+      return NULL;
+   }
+
+   /* Parallelism comes from decoding many streams at once, so each decoder
+    * context runs single threaded */
+   for( int i = 0; i < numMCams; i++ ) {
+      DECODER_STREAM * stream = &decoder->streams[i];
+      stream->mcamID = mcamIDs[i];
+      stream->codec  = avcodec_alloc_context3( h264 );
+      if( stream->codec == NULL ) {
+         destroyDecoder( decoder );
+         return NULL;
+      }
+      stream->codec->thread_count = 1;
+      if( avcodec_open2( stream->codec, h264, NULL ) < 0 ) {
+         destroyDecoder( decoder );
+         return NULL;
+      }
+   }
+
+   for( int i = 0; i < numThreads; i++ ) {
+      DECODER_WORKER * worker = &decoder->workers[i];
+      worker->decoder = decoder;
+      worker->id      = i;
+      worker->packet  = av_packet_alloc();
+      worker->picture = av_frame_alloc();
+      if( worker->packet == NULL
+       || worker->picture == NULL
+       || !frameQueueInit( &worker->queue, DECODER_QUEUE_SIZE )) {
+         streamDecoderFinish( decoder );
+         return NULL;
+      }
+   }
+
+   for( int i = 0; i < numThreads; i++ ) {
+      DECODER_WORKER * worker = &decoder->workers[i];
+      worker->started = pthread_create( &worker->thread, NULL, decodeThread, worker ) == 0;
+      if( !worker->started ) {
+         streamDecoderFinish( decoder );
+         return NULL;
+      }
+   }
+
+   return decoder;
+}
+
+/**
+ * \brief Queues a copy of an H.264 frame for the microcamera at index
+ **/
+bool streamDecoderSubmit( STREAM_DECODER * decoder, int index, const FRAME * frame )
+{
+   if( index < 0 || index >= decoder->numStreams ) {
+      return false;
+   }
+
+   /* libavcodec requires zeroed padding after the packet data */
+   size_t size = frame->m_metadata.m_size;
+   void * copy = malloc( size + AV_INPUT_BUFFER_PADDING_SIZE );
+   if( copy == NULL ) {
+      return false;
+   }
+   memcpy( copy, frame->m_image, size );
+   memset( (uint8_t *)copy + size, 0, AV_INPUT_BUFFER_PADDING_SIZE );
+
+   FRAME queued = *frame;
+   queued.m_image = copy;
+   queued.m_metadata.m_camId = decoder->streams[index].mcamID;
+
+   /* blocks while the decode thread is behind */
+   if( !frameQueuePush( &decoder->workers[index % decoder->numWorkers].queue, queued )) {
+      free( copy );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Decodes everything still queued, flushes the decoders, stops the
+ *        threads and frees the decoder
+ **/
+uint64_t streamDecoderFinish( STREAM_DECODER * decoder )
+{
+   for( int i = 0; i < decoder->numWorkers; i++ ) {
+      if( decoder->workers[i].queue.frames != NULL ) {
+         frameQueueClose( &decoder->workers[i].queue );
+      }
+   }
+   for( int i = 0; i < decoder->numWorkers; i++ ) {
+      if( decoder->workers[i].started ) {
+         pthread_join( decoder->workers[i].thread, NULL );
+      }
+   }
+
+   uint64_t jpegCount = 0;
+   for( int i = 0; i < decoder->numStreams; i++ ) {
+      jpegCount += decoder->streams[i].jpegCount;
+   }
+
+   destroyDecoder( decoder );
+   return jpegCount;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+ *
+ * StreamDecoder.h
+ *
+ * In-process H.264 to JPEG conversion for exported microcamera streams.
+ * Frames are submitted while they are fetched. A pool of decode threads
+ * decodes them with the libavcodec software decoder and encodes every
+ * picture with libjpeg-turbo, writing <path>/stream<mcamID>_<nnnnn>.jpg
+ * with the same numbering avconv uses (starting at 1).
+ *
+ * Each microcamera is always handled by the same decode thread so its
+ * frames are decoded in the order they were submitted. Frames for one
+ * microcamera must be submitted from one thread at a time.
+ *
+ *****************************************************************************/
+#ifndef STREAM_DECODER_H
+#define STREAM_DECODER_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct STREAM_DECODER STREAM_DECODER;
+
+/**
+ * \brief Creates a decoder for the given microcameras and starts its threads
+ * \param [in] path       directory the JPEGs are written to
+ * \param [in] mcamIDs    microcameras that frames will be submitted for
+ * \param [in] numMCams   number of entries in mcamIDs
+ * \param [in] numThreads number of decode threads
+ * \param [in] quality    JPEG quality, 1 to 100
+ * \return the decoder, or NULL if it could not be created
+ **/
+STREAM_DECODER * streamDecoderCreate( const char * path
+                                    , const uint32_t * mcamIDs
+                                    , int numMCams
+                                    , int numThreads
+                                    , int quality
+                                    );
+
+/**
+ * \brief Queues a copy of an H.264 frame for the microcamera at index in the
+ *        list given to streamDecoderCreate. The caller keeps ownership of
+ *        the frame and may return it to the API immediately
+ * \return true if the frame was queued
+ **/
+bool streamDecoderSubmit( STREAM_DECODER * decoder, int index, const FRAME * frame );
+
+/**
+ * \brief Decodes everything still queued, flushes the decoders, stops the
+ *        threads and frees the decoder
+ * \return the number of JPEGs written
+ **/
+uint64_t streamDecoderFinish( STREAM_DECODER * decoder );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+/******************************************************************************
+ *
+ * StreamWriter.c
+ *
+ * Coalescing, preallocating stream file writer. See StreamWriter.h
+ *
+ *****************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "StreamWriter.h"
+
+#define MB_SCALE (1024.0*1024.0)
+
+/**
+ * \brief Returns the current monotonic time in seconds
+ **/
+static double getTime()
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**
+ * \brief Writes size bytes of the block at the current file offset
+ **/
+static bool writeBlock( STREAM_WRITER * writer, size_t size )
+{
+   double start = getTime();
+   size_t done = 0;
+   while( done < size ) {
+      ssize_t rc = pwrite( writer->fd, writer->block + done, size - done, writer->flushed + done );
+      if( rc < 0 ) {
+         if( errno == EINTR ) {
+            continue;
+         }
+         printf("Stream write failed: %s\n", strerror(errno));
+         return false;
+      }
+      done += rc;
+   }
+   writer->writeTime += getTime() - start;
+
+   return true;
+}
+
+/**
+ * \brief Opens a stream file and allocates the block. With truncate unset
+ *        the file is cut back to offset and writing continues there
+ **/
+static bool openWriter( STREAM_WRITER * writer
+                      , const char * fileName
+                      , size_t blockSize
+                      , bool direct
+                      , bool truncate
+                      , uint64_t offset
+                      )
+{
+   memset( writer, 0, sizeof(*writer));
+   writer->fd = -1;
+
+   if( blockSize == 0 ) {
+      blockSize = STREAM_WRITER_BLOCK_SIZE;
+   }
+   blockSize = (blockSize + STREAM_WRITER_ALIGNMENT - 1) / STREAM_WRITER_ALIGNMENT * STREAM_WRITER_ALIGNMENT;
+
+   /* Resuming reads back the partial block at the end of the file */
+   int flags = O_CREAT | (truncate ? O_WRONLY | O_TRUNC : O_RDWR);
+   if( direct ) {
+      writer->fd = open( fileName, flags | O_DIRECT, 0666 );
+      if( writer->fd < 0 ) {
+         printf("O_DIRECT is not supported for %s, using buffered writes\n", fileName );
+      }
+   }
+   if( writer->fd < 0 ) {
+      writer->fd = open( fileName, flags, 0666 );
+      if( writer->fd < 0 ) {
+         return false;
+      }
+   } else {
+      writer->direct = true;
+   }
+
+   void * block = NULL;
+   if( posix_memalign( &block, STREAM_WRITER_ALIGNMENT, blockSize ) != 0 ) {
+      close( writer->fd );
+      writer->fd = -1;
+      return false;
+   }
+
+   writer->block     = (uint8_t *)block;
+   writer->blockSize = blockSize;
+
+   if( !truncate ) {
+      /* Keep block writes aligned by restarting at the aligned offset below
+       * the checkpoint with the bytes in between loaded into the block */
+      writer->flushed = offset / STREAM_WRITER_ALIGNMENT * STREAM_WRITER_ALIGNMENT;
+      writer->used    = offset - writer->flushed;
+      writer->base    = offset;
+
+      bool rc = ftruncate( writer->fd, offset ) == 0;
+      if( rc && writer->used > 0 ) {
+         rc = pread( writer->fd, writer->block, STREAM_WRITER_ALIGNMENT, writer->flushed ) == (ssize_t)writer->used;
+      }
+      if( !rc ) {
+         printf("Unable to resume %s at offset %lu\n", fileName, offset );
+         close( writer->fd );
+         free( writer->block );
+         memset( writer, 0, sizeof(*writer));
+         writer->fd = -1;
+         return false;
+      }
+   }
+
+   writer->openTime = getTime();
+
+   return true;
+}
+
+/**
+ * \brief Creates or truncates a stream file
+ **/
+bool streamWriterOpen( STREAM_WRITER * writer
+                     , const char * fileName
+                     , size_t blockSize
+                     , bool direct
+                     )
+{
+   return openWriter( writer, fileName, blockSize, direct, true, 0 );
+}
+
+/**
+ * \brief Reopens an existing stream file to continue writing at offset
+ **/
+bool streamWriterResume( STREAM_WRITER * writer
+                       , const char * fileName
+                       , uint64_t offset
+                       , size_t blockSize
+                       , bool direct
+                       )
+{
+   return openWriter( writer, fileName, blockSize, direct, false, offset );
+}
+
+/**
+ * \brief Preallocates the file up to size bytes
+ **/
+bool streamWriterReserve( STREAM_WRITER * writer, uint64_t size )
+{
+   if( size <= writer->reserved ) {
+      return true;
+   }
+
+   /* KEEP_SIZE leaves the file length at the data written so far, so a
+    * crash does not leave a tail of zeros behind the stream */
+   if( fallocate( writer->fd, FALLOC_FL_KEEP_SIZE, writer->reserved, size - writer->reserved ) != 0 ) {
+      return false;
+   }
+   writer->reserved = size;
+
+   return true;
+}
+
+/**
+ * \brief Appends size bytes to the stream
+ **/
+bool streamWriterWrite( STREAM_WRITER * writer, const void * data, size_t size )
+{
+   const uint8_t * bytes = (const uint8_t *)data;
+
+   while( size > 0 ) {
+      size_t count = writer->blockSize - writer->used;
+      if( count > size ) {
+         count = size;
+      }
+      memcpy( writer->block + writer->used, bytes, count );
+      writer->used += count;
+      bytes += count;
+      size -= count;
+
+      if( writer->used == writer->blockSize ) {
+         if( !writeBlock( writer, writer->blockSize )) {
+            return false;
+         }
+         writer->flushed += writer->blockSize;
+         writer->used = 0;
+      }
+   }
+
+   return true;
+}
+
+/**
+ * \brief Returns the number of bytes appended so far
+ **/
+uint64_t streamWriterTell( const STREAM_WRITER * writer )
+{
+   return writer->flushed + writer->used;
+}
+
+/**
+ * \brief Writes the partial block at the current file offset without
+ *        consuming it. O_DIRECT writes must be whole aligned blocks, so the
+ *        tail is padded; later writes overwrite the padding
+ **/
+static bool writeTail( STREAM_WRITER * writer )
+{
+   if( writer->used == 0 ) {
+      return true;
+   }
+
+   size_t size = writer->used;
+   if( writer->direct ) {
+      size = (size + STREAM_WRITER_ALIGNMENT - 1) / STREAM_WRITER_ALIGNMENT * STREAM_WRITER_ALIGNMENT;
+      memset( writer->block + writer->used, 0, size - writer->used );
+   }
+
+   return writeBlock( writer, size );
+}
+
+/**
+ * \brief Writes out everything appended so far and waits until it is on disk
+ **/
+bool streamWriterSync( STREAM_WRITER * writer )
+{
+   if( !writeTail( writer )) {
+      return false;
+   }
+
+   return fdatasync( writer->fd ) == 0;
+}
+
+/**
+ * \brief Writes the last partial block, trims the file and closes it
+ **/
+bool streamWriterClose( STREAM_WRITER * writer )
+{
+   if( writer->fd < 0 ) {
+      return false;
+   }
+
+   /* The padding of an O_DIRECT tail is cut off with ftruncate */
+   uint64_t length = streamWriterTell( writer );
+   bool rc = writeTail( writer );
+   writer->flushed = length;
+   writer->used = 0;
+
+   /* Truncating also releases preallocated space past the data */
+   if( ftruncate( writer->fd, length ) != 0 ) {
+      rc = false;
+   }
+   if( close( writer->fd ) != 0 ) {
+      rc = false;
+   }
+
+   writer->fd = -1;
+   writer->closeTime = getTime();
+   free( writer->block );
+   writer->block = NULL;
+
+   return rc;
+}
+
+/**
+ * \brief Returns the sustained rate in MB/s from open to close (or now)
+ **/
+double streamWriterRate( const STREAM_WRITER * writer )
+{
+   double end = writer->closeTime > 0 ? writer->closeTime : getTime();
+   double elapsed = end - writer->openTime;
+
+   return elapsed > 0 ? (streamWriterTell( writer ) - writer->base) / MB_SCALE / elapsed : 0.0;
+}
+
+/**
+ * \brief Returns the rate in MB/s while inside write calls
+ **/
+double streamWriterDeviceRate( const STREAM_WRITER * writer )
+{
+   uint64_t written = writer->flushed > writer->base ? writer->flushed - writer->base : 0;
+
+   return writer->writeTime > 0 ? written / MB_SCALE / writer->writeTime : 0.0;
+}
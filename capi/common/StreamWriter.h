@@ -0,0 +1,123 @@
+/******************************************************************************
+ *
+ * StreamWriter.h
+ *
+ * Sequential file writer for exported streams. Frames are copied into a
+ * large aligned block that is written with one pwrite when it fills, so
+ * many concurrent streams issue few large writes instead of one small
+ * write per frame. The file can be preallocated with fallocate to limit
+ * fragmentation and can optionally bypass the page cache with O_DIRECT.
+ *
+ * An interrupted export can be continued with streamWriterResume, which
+ * cuts the file back to the last checkpoint taken with streamWriterSync.
+ *
+ * A writer is not thread safe.
+ *
+ *****************************************************************************/
+#ifndef STREAM_WRITER_H
+#define STREAM_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STREAM_WRITER_ALIGNMENT  4096              //!< Block and offset alignment for O_DIRECT
+#define STREAM_WRITER_BLOCK_SIZE (4*1024*1024)     //!< Default block size
+
+/**
+ * \brief Open stream file
+ **/
+typedef struct {
+   int       fd;            //!< File descriptor
+   bool      direct;        //!< Set if the file was opened with O_DIRECT
+   uint8_t * block;         //!< Aligned block being filled
+   size_t    blockSize;     //!< Size of block in bytes
+   size_t    used;          //!< Bytes of block filled
+   uint64_t  flushed;       //!< Bytes of the file already written
+   uint64_t  reserved;      //!< Bytes preallocated with fallocate
+   uint64_t  base;          //!< File length kept when the writer was resumed
+   double    openTime;      //!< Time the writer was opened, in seconds
+   double    closeTime;     //!< Time the writer was closed, in seconds
+   double    writeTime;     //!< Seconds spent in write calls
+} STREAM_WRITER;
+
+/**
+ * \brief Creates or truncates a stream file
+ * \param [in] blockSize bytes coalesced per write, rounded up to the
+ *                       alignment. 0 selects STREAM_WRITER_BLOCK_SIZE
+ * \param [in] direct    open with O_DIRECT. Falls back to buffered I/O if
+ *                       the filesystem does not support it
+ * \return true on success
+ **/
+bool streamWriterOpen( STREAM_WRITER * writer
+                     , const char * fileName
+                     , size_t blockSize
+                     , bool direct
+                     );
+
+/**
+ * \brief Reopens an existing stream file to continue writing at offset.
+ *        Anything past offset, such as a partial frame written before a
+ *        crash, is discarded
+ * \param [in] offset length of the file to keep, usually from a checkpoint
+ * \return true on success
+ **/
+bool streamWriterResume( STREAM_WRITER * writer
+                       , const char * fileName
+                       , uint64_t offset
+                       , size_t blockSize
+                       , bool direct
+                       );
+
+/**
+ * \brief Preallocates the file up to size bytes. Space beyond the data
+ *        written is released when the writer is closed
+ * \return true if the space was reserved
+ **/
+bool streamWriterReserve( STREAM_WRITER * writer, uint64_t size );
+
+/**
+ * \brief Appends size bytes to the stream
+ * \return true on success
+ **/
+bool streamWriterWrite( STREAM_WRITER * writer, const void * data, size_t size );
+
+/**
+ * \brief Returns the number of bytes appended so far, which is the offset
+ *        the next write will start at
+ **/
+uint64_t streamWriterTell( const STREAM_WRITER * writer );
+
+/**
+ * \brief Writes out everything appended so far and waits until it is on
+ *        disk. Afterwards streamWriterTell bytes are durable
+ * \return true on success
+ **/
+bool streamWriterSync( STREAM_WRITER * writer );
+
+/**
+ * \brief Writes the last partial block, trims the file to its data and
+ *        closes it
+ * \return true on success
+ **/
+bool streamWriterClose( STREAM_WRITER * writer );
+
+/**
+ * \brief Returns the sustained rate in MB/s from open to close (or now)
+ **/
+double streamWriterRate( const STREAM_WRITER * writer );
+
+/**
+ * \brief Returns the rate in MB/s while inside write calls
+ **/
+double streamWriterDeviceRate( const STREAM_WRITER * writer );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+/******************************************************************************
+ *
+ * TileArchive.c
+ *
+ * Indexed tile pyramid files. See TileArchive.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TileArchive.h"
+
+/**
+ * \brief Orders tiles by level, row and column
+ **/
+static uint64_t tileKey( int level, int row, int column )
+{
+   return ( (uint64_t)level << 32 ) | ( (uint64_t)row << 16 ) | (uint64_t)column;
+}
+
+/**
+ * \brief Writes an archive, replacing any file of the same name once complete
+ **/
+bool tileArchiveWrite( const char * fileName
+                     , const TILE_ARCHIVE_HEADER * header
+                     , TILE_ARCHIVE_ENTRY * entries
+                     , const uint8_t * const * tiles
+                     )
+{
+   TILE_ARCHIVE_HEADER h = *header;
+   h.magic     = TILE_ARCHIVE_MAGIC;
+   h.version   = TILE_ARCHIVE_VERSION;
+   h.entrySize = sizeof(TILE_ARCHIVE_ENTRY);
+
+   uint64_t offset = sizeof(h) + (uint64_t)h.numTiles * sizeof(TILE_ARCHIVE_ENTRY);
+   for( uint32_t i = 0; i < h.numTiles; i++ ) {
+      entries[i].offset = offset;
+      offset += entries[i].size;
+   }
+
+   //A reader never sees a partial archive, even after a crash
+   char tempName[1024];
+   snprintf( tempName, sizeof(tempName), "%s.tmp", fileName );
+   FILE * file = fopen( tempName, "w" );
+   if( file == NULL ) {
+      return false;
+   }
+   bool rc = fwrite( &h, sizeof(h), 1, file ) == 1
+          && fwrite( entries, sizeof(TILE_ARCHIVE_ENTRY), h.numTiles, file ) == h.numTiles;
+   for( uint32_t i = 0; rc && i < h.numTiles; i++ ) {
+      rc = fwrite( tiles[i], 1, entries[i].size, file ) == entries[i].size;
+   }
+   rc = ( fclose( file ) == 0 ) && rc;
+   if( !rc || rename( tempName, fileName ) != 0 ) {
+      unlink( tempName );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Maps an archive for reading
+ **/
+bool tileArchiveMap( TILE_ARCHIVE_READER * reader, const char * fileName )
+{
+   memset( reader, 0, sizeof(*reader));
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(TILE_ARCHIVE_HEADER)) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+
+   const TILE_ARCHIVE_HEADER * header = (const TILE_ARCHIVE_HEADER *)data;
+   if( header->magic != TILE_ARCHIVE_MAGIC
+    || header->entrySize < sizeof(TILE_ARCHIVE_ENTRY)
+    || sizeof(TILE_ARCHIVE_HEADER) + (uint64_t)header->numTiles * header->entrySize > (uint64_t)st.st_size ) {
+      munmap( data, st.st_size );
+      return false;
+   }
+
+   reader->data      = (const uint8_t *)data;
+   reader->length    = st.st_size;
+   reader->header    = header;
+   reader->entrySize = header->entrySize;
+
+   return true;
+}
+
+/**
+ * \brief Returns entry i of a mapped archive
+ **/
+const TILE_ARCHIVE_ENTRY * tileArchiveEntry( const TILE_ARCHIVE_READER * reader, size_t i )
+{
+   return (const TILE_ARCHIVE_ENTRY *)( reader->data
+                                      + sizeof(TILE_ARCHIVE_HEADER)
+                                      + i * reader->entrySize );
+}
+
+/**
+ * \brief Finds a tile of a mapped archive
+ **/
+const uint8_t * tileArchiveFind( const TILE_ARCHIVE_READER * reader
+                               , int level
+                               , int column
+                               , int row
+                               , uint64_t * size
+                               )
+{
+   uint64_t key = tileKey( level, row, column );
+   size_t low   = 0;
+   size_t high  = reader->header->numTiles;
+   while( low < high ) {
+      size_t mid = low + ( high - low ) / 2;
+      const TILE_ARCHIVE_ENTRY * entry = tileArchiveEntry( reader, mid );
+      uint64_t midKey = tileKey( entry->level, entry->row, entry->column );
+      if( midKey < key ) {
+         low = mid + 1;
+      }
+      else if( midKey > key ) {
+         high = mid;
+      }
+      else if( entry->offset > reader->length || entry->size > reader->length - entry->offset ) {
+         return NULL;
+      }
+      else {
+         *size = entry->size;
+         return reader->data + entry->offset;
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Unmaps an archive
+ **/
+void tileArchiveUnmap( TILE_ARCHIVE_READER * reader )
+{
+   if( reader->data != NULL ) {
+      munmap( (void *)reader->data, reader->length );
+   }
+   memset( reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,118 @@
+/******************************************************************************
+ *
+ * TileArchive.h
+ *
+ * Single file holding the tile pyramid of one frame. The file starts with a
+ * TILE_ARCHIVE_HEADER, followed by one TILE_ARCHIVE_ENTRY per tile sorted
+ * by level, row and column, followed by the encoded tiles, in native byte
+ * order. Level 0 is the full resolution image and each level above it is
+ * half the width and height of the one below. A viewer maps the file, finds
+ * the visible tiles of the level matching its zoom with a binary search of
+ * the entries and reads only those.
+ *
+ * The header stores the entry size so readers can step over fields
+ * appended by newer versions.
+ *
+ *****************************************************************************/
+#ifndef TILE_ARCHIVE_H
+#define TILE_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TILE_ARCHIVE_MAGIC     0x52495054 //!< "TPIR" in a little endian file
+#define TILE_ARCHIVE_VERSION   1
+#define TILE_ARCHIVE_EXTENSION "tiles"    //!< Extension added to archive file names
+
+/**
+ * \brief Header at the start of every archive
+ **/
+typedef struct {
+   uint32_t magic;       //!< TILE_ARCHIVE_MAGIC
+   uint16_t version;     //!< TILE_ARCHIVE_VERSION of the writer
+   uint16_t entrySize;   //!< Size of each entry in bytes
+   uint32_t mcamID;      //!< Microcamera the frame came from
+   uint32_t tileSize;    //!< Width and height of full tiles in pixels
+   uint64_t frameId;     //!< Frame id (m_id)
+   uint64_t timestamp;   //!< Frame timestamp in microseconds
+   uint32_t width;       //!< Width of level 0 in pixels
+   uint32_t height;      //!< Height of level 0 in pixels
+   uint32_t numLevels;   //!< Number of levels
+   uint32_t numTiles;    //!< Number of entries
+} TILE_ARCHIVE_HEADER;
+
+/**
+ * \brief Index entry for one tile
+ **/
+typedef struct {
+   uint16_t level;       //!< Pyramid level, 0 for full resolution
+   uint16_t row;         //!< Tile row within the level
+   uint16_t column;      //!< Tile column within the level
+   uint16_t reserved;    //!< Zero
+   uint32_t width;       //!< Tile width, below tileSize in the last column
+   uint32_t height;      //!< Tile height, below tileSize in the last row
+   uint64_t offset;      //!< Byte offset of the tile in the file
+   uint64_t size;        //!< Size of the encoded tile in bytes
+} TILE_ARCHIVE_ENTRY;
+
+/**
+ * \brief Read-only view of an archive mapped into memory
+ **/
+typedef struct {
+   const uint8_t *             data;        //!< Start of the mapping
+   size_t                      length;      //!< Length of the mapping in bytes
+   const TILE_ARCHIVE_HEADER * header;      //!< Header of the archive
+   size_t                      entrySize;   //!< Stride between entries
+} TILE_ARCHIVE_READER;
+
+/**
+ * \brief Writes an archive, replacing any file of the same name only once
+ *        it is complete. Entry offsets are filled in
+ * \param [in] entries header->numTiles entries sorted by level, row, column
+ * \param [in] tiles   encoded tile of each entry, entries[i].size bytes
+ * \return true on success
+ **/
+bool tileArchiveWrite( const char * fileName
+                     , const TILE_ARCHIVE_HEADER * header
+                     , TILE_ARCHIVE_ENTRY * entries
+                     , const uint8_t * const * tiles
+                     );
+
+/**
+ * \brief Maps an archive for reading
+ * \return true if the file exists and its header and entries are valid
+ **/
+bool tileArchiveMap( TILE_ARCHIVE_READER * reader, const char * fileName );
+
+/**
+ * \brief Returns entry i of a mapped archive. i must be below numTiles
+ **/
+const TILE_ARCHIVE_ENTRY * tileArchiveEntry( const TILE_ARCHIVE_READER * reader, size_t i );
+
+/**
+ * \brief Finds a tile of a mapped archive
+ * \param [out] size size of the encoded tile
+ * \return the encoded tile, or NULL if the archive has no such tile
+ **/
+const uint8_t * tileArchiveFind( const TILE_ARCHIVE_READER * reader
+                               , int level
+                               , int column
+                               , int row
+                               , uint64_t * size
+                               );
+
+/**
+ * \brief Unmaps an archive
+ **/
+void tileArchiveUnmap( TILE_ARCHIVE_READER * reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+/******************************************************************************
+ *
+ * TilePyramid.c
+ *
+ * Multi-resolution tile pyramids of JPEG frames. See TilePyramid.h
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "TilePyramid.h"
+
+/**
+ * \brief Everything a pyramid allocates, so an error can free it all
+ **/
+typedef struct {
+   struct jpeg_decompress_struct dinfo;
+   struct jpeg_compress_struct   cinfo;
+   struct jpeg_error_mgr         pub;
+   jmp_buf                       jump;
+   bool                          haveDecompress;
+   bool                          haveCompress;
+   uint8_t *                     levels[2];   //!< Alternate RGBX levels
+   uint8_t *                     row;         //!< RGB row for libjpeg without RGBX support
+   TILE_ARCHIVE_ENTRY *          entries;
+   uint8_t **                    tiles;       //!< Encoded tiles, allocated by jpeg_mem_dest
+   uint32_t                      numTiles;    //!< Tiles encoded so far
+} PYRAMID_BUILD;
+
+static void pyramidErrorExit( j_common_ptr cinfo )
+{
+   longjmp( *(jmp_buf *)cinfo->client_data, 1 );
+}
+
+static void pyramidSilent( j_common_ptr cinfo )
+{
+}
+
+/**
+ * \brief Frees everything a pyramid allocated
+ **/
+static void freeBuild( PYRAMID_BUILD * b )
+{
+   if( b->haveDecompress ) {
+      jpeg_destroy_decompress( &b->dinfo );
+   }
+   if( b->haveCompress ) {
+      jpeg_destroy_compress( &b->cinfo );
+   }
+   for( uint32_t i = 0; b->tiles != NULL && i < b->numTiles; i++ ) {
+      free( b->tiles[i] );
+   }
+   free( b->tiles );
+   free( b->entries );
+   free( b->levels[0] );
+   free( b->levels[1] );
+   free( b->row );
+   free( b );
+}
+
+/**
+ * \brief Decodes the frame into levels[0] as RGBX
+ **/
+static void decodeLevel0( PYRAMID_BUILD * b, const FRAME * frame, int * width, int * height )
+{
+   jpeg_create_decompress( &b->dinfo );
+   b->haveDecompress = true;
+   jpeg_mem_src( &b->dinfo, (unsigned char *)frame->m_image, frame->m_metadata.m_size );
+   jpeg_read_header( &b->dinfo, TRUE );
+#ifdef JCS_EXTENSIONS
+   b->dinfo.out_color_space = JCS_EXT_RGBX;
+#else
+   b->dinfo.out_color_space = JCS_RGB;
+#endif
+   jpeg_start_decompress( &b->dinfo );
+
+   *width  = b->dinfo.output_width;
+   *height = b->dinfo.output_height;
+   size_t stride = (size_t)*width * 4;
+   b->levels[0] = (uint8_t *)malloc( stride * *height );
+   b->row       = (uint8_t *)malloc( stride );
+   if( b->levels[0] == NULL || b->row == NULL ) {
+      longjmp( b->jump, 1 );
+   }
+
+   while( b->dinfo.output_scanline < b->dinfo.output_height ) {
+      uint8_t * out = b->levels[0] + b->dinfo.output_scanline * stride;
+#ifdef JCS_EXTENSIONS
+      jpeg_read_scanlines( &b->dinfo, &out, 1 );
+#else
+      jpeg_read_scanlines( &b->dinfo, &b->row, 1 );
+      for( int x = 0; x < *width; x++ ) {
+         out[4*x]     = b->row[3*x];
+         out[4*x + 1] = b->row[3*x + 1];
+         out[4*x + 2] = b->row[3*x + 2];
+         out[4*x + 3] = 0xFF;
+      }
+#endif
+   }
+   jpeg_finish_decompress( &b->dinfo );
+}
+
+/**
+ * \brief Encodes one tile of an RGBX level as the next tile of the archive
+ **/
+static void encodeTile( PYRAMID_BUILD * b, const uint8_t * origin, size_t stride, int width, int height, int quality )
+{
+   unsigned long size = 0;
+   b->tiles[b->numTiles] = NULL;
+   jpeg_mem_dest( &b->cinfo, &b->tiles[b->numTiles], &size );
+   b->numTiles++;
+
+   b->cinfo.image_width  = width;
+   b->cinfo.image_height = height;
+#ifdef JCS_EXTENSIONS
+   b->cinfo.input_components = 4;
+   b->cinfo.in_color_space   = JCS_EXT_RGBX;
+#else
+   b->cinfo.input_components = 3;
+   b->cinfo.in_color_space   = JCS_RGB;
+#endif
+   jpeg_set_defaults( &b->cinfo );
+   jpeg_set_quality( &b->cinfo, quality, TRUE );
+   jpeg_start_compress( &b->cinfo, TRUE );
+   while( b->cinfo.next_scanline < b->cinfo.image_height ) {
+      const uint8_t * in = origin + b->cinfo.next_scanline * stride;
+#ifdef JCS_EXTENSIONS
+      JSAMPROW row = (JSAMPROW)in;
+#else
+      JSAMPROW row = b->row;
+      for( int x = 0; x < width; x++ ) {
+         row[3*x]     = in[4*x];
+         row[3*x + 1] = in[4*x + 1];
+         row[3*x + 2] = in[4*x + 2];
+      }
+#endif
+      jpeg_write_scanlines( &b->cinfo, &row, 1 );
+   }
+   jpeg_finish_compress( &b->cinfo );
+
+   b->entries[b->numTiles - 1].size = size;
+}
+
+/**
+ * \brief Halves an RGBX image, averaging each 2x2 block of pixels
+ **/
+void tilePyramidDownsample( const uint8_t * src
+                          , int width
+                          , int height
+                          , size_t srcStride
+                          , uint8_t * dst
+                          , size_t dstStride
+                          )
+{
+   int outWidth  = width / 2;
+   int outHeight = height / 2;
+   for( int y = 0; y < outHeight; y++ ) {
+      const uint8_t * a = src + 2 * y * srcStride;
+      const uint8_t * b = a + srcStride;
+      uint8_t * out = dst + y * dstStride;
+      int x = 0;
+
+      //Average the two rows, then the even and odd pixels of the result.
+      //Pixels are 32 bits, so the even and odd ones split as float lanes
+#if defined(__SSE2__)
+      for( ; x + 4 <= outWidth; x += 4 ) {
+         __m128i v0 = _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)( a + 8*x )),
+                                    _mm_loadu_si128( (const __m128i *)( b + 8*x )));
+         __m128i v1 = _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)( a + 8*x + 16 )),
+                                    _mm_loadu_si128( (const __m128i *)( b + 8*x + 16 )));
+         __m128 p0 = _mm_castsi128_ps( v0 );
+         __m128 p1 = _mm_castsi128_ps( v1 );
+         __m128i even = _mm_castps_si128( _mm_shuffle_ps( p0, p1, _MM_SHUFFLE( 2, 0, 2, 0 )));
+         __m128i odd  = _mm_castps_si128( _mm_shuffle_ps( p0, p1, _MM_SHUFFLE( 3, 1, 3, 1 )));
+         _mm_storeu_si128( (__m128i *)( out + 4*x ), _mm_avg_epu8( even, odd ));
+      }
+#elif defined(__ARM_NEON)
+      for( ; x + 4 <= outWidth; x += 4 ) {
+         uint8x16_t v0 = vrhaddq_u8( vld1q_u8( a + 8*x ), vld1q_u8( b + 8*x ));
+         uint8x16_t v1 = vrhaddq_u8( vld1q_u8( a + 8*x + 16 ), vld1q_u8( b + 8*x + 16 ));
+         uint32x4x2_t pixels = vuzpq_u32( vreinterpretq_u32_u8( v0 ), vreinterpretq_u32_u8( v1 ));
+         vst1q_u8( out + 4*x, vrhaddq_u8( vreinterpretq_u8_u32( pixels.val[0] ),
+                                          vreinterpretq_u8_u32( pixels.val[1] )));
+      }
+#endif
+      //Same rounding as the vector averages
+      for( ; x < outWidth; x++ ) {
+         for( int c = 0; c < 4; c++ ) {
+            int left  = ( a[8*x + c] + b[8*x + c] + 1 ) >> 1;
+            int right = ( a[8*x + 4 + c] + b[8*x + 4 + c] + 1 ) >> 1;
+            out[4*x + c] = (uint8_t)(( left + right + 1 ) >> 1 );
+         }
+      }
+   }
+}
+
+/**
+ * \brief Decodes a JPEG frame and writes its pyramid
+ **/
+bool tilePyramidSave( FRAME frame, const char * fileName, int tileSize, int quality )
+{
+   if( frame.m_image == NULL || frame.m_metadata.m_mode != ATL_MODE_JPEG || tileSize < 16 ) {
+      return false;
+   }
+   PYRAMID_BUILD * b = (PYRAMID_BUILD *)calloc( 1, sizeof(PYRAMID_BUILD));
+   if( b == NULL ) {
+      return false;
+   }
+
+   b->dinfo.err         = jpeg_std_error( &b->pub );
+   b->cinfo.err         = &b->pub;
+   b->pub.error_exit     = pyramidErrorExit;
+   b->pub.output_message = pyramidSilent;
+   b->dinfo.client_data = &b->jump;
+   b->cinfo.client_data = &b->jump;
+   if( setjmp( b->jump )) {
+      freeBuild( b );
+      return false;
+   }
+
+   int width;
+   int height;
+   decodeLevel0( b, &frame, &width, &height );
+
+   //Levels until one tile covers the image, and the tiles of all of them
+   TILE_ARCHIVE_HEADER header;
+   memset( &header, 0, sizeof(header));
+   header.mcamID    = frame.m_metadata.m_camId;
+   header.tileSize  = tileSize;
+   header.frameId   = frame.m_metadata.m_id;
+   header.timestamp = frame.m_metadata.m_timestamp;
+   header.width     = width;
+   header.height    = height;
+   for( int w = width, h = height; ; w /= 2, h /= 2 ) {
+      header.numLevels++;
+      header.numTiles += (uint32_t)((( w + tileSize - 1 ) / tileSize ) * (( h + tileSize - 1 ) / tileSize ));
+      if(( w <= tileSize && h <= tileSize ) || w < 2 || h < 2 ) {
+         break;
+      }
+   }
+
+   b->entries = (TILE_ARCHIVE_ENTRY *)calloc( header.numTiles, sizeof(TILE_ARCHIVE_ENTRY));
+   b->tiles   = (uint8_t **)calloc( header.numTiles, sizeof(uint8_t *));
+   if( header.numLevels > 1 ) {
+      b->levels[1] = (uint8_t *)malloc( (size_t)( width / 2 ) * ( height / 2 ) * 4 );
+   }
+   if( b->entries == NULL || b->tiles == NULL || ( header.numLevels > 1 && b->levels[1] == NULL )) {
+      freeBuild( b );
+      return false;
+   }
+   jpeg_create_compress( &b->cinfo );
+   b->haveCompress = true;
+
+   //Each level overwrites the one two below it, which is already encoded
+   int w = width;
+   int h = height;
+   for( uint32_t level = 0; level < header.numLevels; level++ ) {
+      const uint8_t * pixels = b->levels[level % 2];
+      size_t stride = (size_t)w * 4;
+      for( int row = 0; row * tileSize < h; row++ ) {
+         for( int column = 0; column * tileSize < w; column++ ) {
+            TILE_ARCHIVE_ENTRY * entry = &b->entries[b->numTiles];
+            entry->level  = level;
+            entry->row    = row;
+            entry->column = column;
+            entry->width  = ( w - column * tileSize < tileSize ) ? w - column * tileSize : tileSize;
+            entry->height = ( h - row * tileSize < tileSize ) ? h - row * tileSize : tileSize;
+            encodeTile( b, pixels + row * tileSize * stride + column * tileSize * 4, stride,
+                        entry->width, entry->height, quality );
+         }
+      }
+      if( level + 1 < header.numLevels ) {
+         tilePyramidDownsample( pixels, w, h, stride, b->levels[( level + 1 ) % 2], (size_t)( w / 2 ) * 4 );
+         w /= 2;
+         h /= 2;
+      }
+   }
+
+   char archiveName[1024];
+   snprintf( archiveName, sizeof(archiveName), "%s.%s", fileName, TILE_ARCHIVE_EXTENSION );
+   bool rc = tileArchiveWrite( archiveName, &header, b->entries, (const uint8_t * const *)b->tiles );
+   freeBuild( b );
+
+   return rc;
+}
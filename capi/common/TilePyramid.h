@@ -0,0 +1,59 @@
+/******************************************************************************
+ *
+ * TilePyramid.h
+ *
+ * Multi-resolution tile pyramids of JPEG frames, so a viewer that zooms out
+ * reads a few small tiles of a lower level instead of downscaling the full
+ * 4K image every time. A frame is decoded once to RGBX, each level is made
+ * from the one below with a 2x2 box filter and every level is cut into
+ * tileSize x tileSize JPEG tiles, stored together in a TileArchive. Levels
+ * are added until one tile covers the whole image. An odd last row or
+ * column of a level is dropped by the level above it.
+ *
+ * The box filter averages with SSE2 or NEON when the compiler targets them,
+ * four output pixels per instruction, and falls back to plain C otherwise.
+ * A pyramid is built on the calling thread, so tools build several at once
+ * on the threads of a FrameSaver.
+ *
+ *****************************************************************************/
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include <stdint.h>
+
+#include "mantis/MantisAPI.h"
+#include "TileArchive.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TILE_PYRAMID_TILE_SIZE 256   //!< Default tile width and height
+#define TILE_PYRAMID_QUALITY   85    //!< JPEG quality of the tiles
+
+/**
+ * \brief Halves an RGBX image, averaging each 2x2 block of pixels
+ * \param [in]  width  width of src, dst is width / 2 wide
+ * \param [in]  height height of src, dst is height / 2 high
+ **/
+void tilePyramidDownsample( const uint8_t * src
+                          , int width
+                          , int height
+                          , size_t srcStride
+                          , uint8_t * dst
+                          , size_t dstStride
+                          );
+
+/**
+ * \brief Decodes a JPEG frame and writes its pyramid to
+ *        fileName.TILE_ARCHIVE_EXTENSION
+ * \return false if the frame is not a JPEG, could not be decoded or the
+ *         archive could not be written
+ **/
+bool tilePyramidSave( FRAME frame, const char * fileName, int tileSize, int quality );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
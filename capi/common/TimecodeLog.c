@@ -0,0 +1,371 @@
+/******************************************************************************
+ *
+ * TimecodeLog.c
+ *
+ * Lock-free per receiver timecode rings and their writer. See TimecodeLog.h
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TimecodeLog.h"
+
+#define DRAIN_BATCH    1024        //!< Records copied out of a ring at a time
+#define DRAIN_INTERVAL 5000000L    //!< ns the writer sleeps when the rings are empty
+
+/**
+ * \brief Returns the first slot to look for mcamID in
+ **/
+static uint32_t slotHash( uint32_t mcamID, uint32_t mask )
+{
+   return ( mcamID * 2654435761u ) & mask;
+}
+
+/**
+ * \brief Returns the ring of a microcamera, or NULL if it has none. The
+ *        table is never full, so a probe ends at an empty slot
+ **/
+static TIMECODE_RING * findRing( TIMECODE_LOG * log, uint32_t mcamID )
+{
+   for( uint32_t i = slotHash( mcamID, log->slotMask ); log->slots[i] >= 0; i = ( i + 1 ) & log->slotMask ) {
+      TIMECODE_RING * ring = &log->rings[log->slots[i]];
+      if( ring->mcamID == mcamID ) {
+         return ring;
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Moves up to max records from a ring into batch
+ * \return the number of records moved
+ **/
+static uint32_t drainRing( TIMECODE_RING * ring, TIMECODE_RECORD * batch, uint32_t max )
+{
+   uint64_t tail = ring->tail;
+   uint64_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+   uint32_t count = 0;
+
+   while( tail != head && count < max ) {
+      batch[count++] = ring->records[tail & ring->mask];
+      tail++;
+   }
+
+   //Hand the slots back to the receiver only after they were copied
+   __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+   return count;
+}
+
+/**
+ * \brief Drains every ring once
+ * \return the number of records written
+ **/
+static uint64_t drainAll( TIMECODE_LOG * log, TIMECODE_RECORD * batch )
+{
+   uint64_t total = 0;
+
+   for( int i = 0; i < log->numRings; i++ ) {
+      uint32_t count;
+      while(( count = drainRing( &log->rings[i], batch, DRAIN_BATCH )) > 0 ) {
+         if( fwrite( batch, sizeof(TIMECODE_RECORD), count, log->file ) != count ) {
+            printf("Unable to write %u timecodes\n", count);
+         }
+         if( log->callback.f != NULL ) {
+            for( uint32_t j = 0; j < count; j++ ) {
+               log->callback.f( &batch[j], log->callback.data );
+            }
+         }
+         total += count;
+      }
+   }
+   log->written += total;
+
+   return total;
+}
+
+/**
+ * \brief Writer thread. Polls the rings so receivers never have to signal it
+ **/
+static void * writerThread( void * data )
+{
+   TIMECODE_LOG * log = (TIMECODE_LOG *)data;
+   TIMECODE_RECORD * batch = (TIMECODE_RECORD *)malloc( DRAIN_BATCH * sizeof(TIMECODE_RECORD));
+   if( batch == NULL ) {
+      printf("Unable to allocate the timecode writer batch\n");
+      return NULL;
+   }
+
+   struct timespec idle = { 0, DRAIN_INTERVAL };
+   while( !log->stop ) {
+      if( drainAll( log, batch ) == 0 ) {
+         nanosleep( &idle, NULL );
+      }
+   }
+
+   //Records pushed before stop was set are still in the rings
+   drainAll( log, batch );
+   free( batch );
+
+   return NULL;
+}
+
+/**
+ * \brief Opens the file for appending, writing the header of a new log
+ **/
+static FILE * openLogFile( const char * fileName )
+{
+   FILE * file = fopen( fileName, "a+" );
+   if( file == NULL ) {
+      return NULL;
+   }
+
+   TIMECODE_LOG_HEADER header;
+   if( fread( &header, sizeof(header), 1, file ) == 1 ) {
+      //Only extend logs written with the current record layout
+      if( header.magic != TIMECODE_LOG_MAGIC || header.recordSize != sizeof(TIMECODE_RECORD)) {
+         printf("%s is not a timecode log with the current record layout\n", fileName);
+         fclose( file );
+         return NULL;
+      }
+
+      //Cut off a record left partial by an interrupted run
+      struct stat st;
+      if( fstat( fileno( file ), &st ) == 0 ) {
+         off_t records = ( st.st_size - sizeof(header)) / sizeof(TIMECODE_RECORD);
+         if( ftruncate( fileno( file ), sizeof(header) + records * sizeof(TIMECODE_RECORD)) != 0 ) {
+            fclose( file );
+            return NULL;
+         }
+      }
+
+      //A stream must seek between reading and writing
+      fseeko( file, 0, SEEK_END );
+      return file;
+   }
+
+   memset( &header, 0, sizeof(header));
+   header.magic      = TIMECODE_LOG_MAGIC;
+   header.version    = TIMECODE_LOG_VERSION;
+   header.recordSize = sizeof(TIMECODE_RECORD);
+   if( ftruncate( fileno( file ), 0 ) != 0
+    || fwrite( &header, sizeof(header), 1, file ) != 1 ) {
+      fclose( file );
+      return NULL;
+   }
+
+   return file;
+}
+
+/**
+ * \brief Opens a log file and starts its writer thread
+ **/
+bool timecodeLogOpen( TIMECODE_LOG * log
+                    , const char * fileName
+                    , const uint32_t * mcamIDs
+                    , int numMCams
+                    , uint32_t capacity
+                    , TIMECODE_RECORD_CALLBACK callback
+                    )
+{
+   memset( log, 0, sizeof(*log));
+   if( numMCams < 1 || capacity < 1 ) {
+      return false;
+   }
+
+   uint32_t size = 1;
+   while( size < capacity ) {
+      size <<= 1;
+   }
+
+   //Keep head and tail on their own cache lines
+   void * rings = NULL;
+   if( posix_memalign( &rings, 64, numMCams * sizeof(TIMECODE_RING)) != 0 ) {
+      return false;
+   }
+   memset( rings, 0, numMCams * sizeof(TIMECODE_RING));
+   log->rings = (TIMECODE_RING *)rings;
+   log->numRings = numMCams;
+   for( int i = 0; i < numMCams; i++ ) {
+      log->rings[i].records = (TIMECODE_RECORD *)malloc( size * sizeof(TIMECODE_RECORD));
+      log->rings[i].mask    = size - 1;
+      log->rings[i].mcamID  = mcamIDs[i];
+      if( log->rings[i].records == NULL ) {
+         timecodeLogClose( log );
+         return false;
+      }
+   }
+
+   /* Receivers look up their ring for every frame, so map mcamIDs to rings
+    * through a hash table at most half full instead of searching them */
+   uint32_t numSlots = 2;
+   while( numSlots < 2 * (uint32_t)numMCams ) {
+      numSlots <<= 1;
+   }
+   log->slots = (int32_t *)malloc( numSlots * sizeof(int32_t));
+   if( log->slots == NULL ) {
+      timecodeLogClose( log );
+      return false;
+   }
+   memset( log->slots, 0xFF, numSlots * sizeof(int32_t));
+   log->slotMask = numSlots - 1;
+   for( int i = 0; i < numMCams; i++ ) {
+      uint32_t slot = slotHash( mcamIDs[i], log->slotMask );
+      while( log->slots[slot] >= 0 ) {
+         slot = ( slot + 1 ) & log->slotMask;
+      }
+      log->slots[slot] = i;
+   }
+
+   log->callback = callback;
+   log->file = openLogFile( fileName );
+   if( log->file == NULL ) {
+      timecodeLogClose( log );
+      return false;
+   }
+
+   if( pthread_create( &log->writer, NULL, writerThread, log ) != 0 ) {
+      fclose( log->file );
+      log->file = NULL;
+      timecodeLogClose( log );
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * \brief Records the timecode of a received frame
+ **/
+bool timecodeLogRecord( TIMECODE_LOG * log, const FRAME_METADATA * metadata )
+{
+   struct timespec now;
+   clock_gettime( CLOCK_REALTIME, &now );
+
+   TIMECODE_RING * ring = findRing( log, metadata->m_camId );
+   if( ring == NULL ) {
+      return false;
+   }
+
+   uint64_t head = ring->head;
+   if( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) > ring->mask ) {
+      __atomic_store_n( &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED );
+      return false;
+   }
+
+   TIMECODE_RECORD * record = &ring->records[head & ring->mask];
+   record->mcamID    = metadata->m_camId;
+   record->tile      = metadata->m_tile;
+   record->frameId   = metadata->m_id;
+   record->timestamp = metadata->m_timestamp;
+   record->received  = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+   //Publish the record to the writer
+   __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+
+   return true;
+}
+
+/**
+ * \brief Returns the number of records dropped because a ring was full
+ **/
+uint64_t timecodeLogDropped( const TIMECODE_LOG * log )
+{
+   uint64_t dropped = 0;
+   for( int i = 0; i < log->numRings; i++ ) {
+      dropped += __atomic_load_n( &log->rings[i].dropped, __ATOMIC_RELAXED );
+   }
+
+   return dropped;
+}
+
+/**
+ * \brief Stops the writer after draining every ring and closes the file
+ **/
+void timecodeLogClose( TIMECODE_LOG * log )
+{
+   if( log->file != NULL ) {
+      log->stop = true;
+      pthread_join( log->writer, NULL );
+      if( fclose( log->file ) != 0 ) {
+         printf("Unable to close the timecode log\n");
+      }
+      log->file = NULL;
+   }
+
+   if( log->rings != NULL ) {
+      for( int i = 0; i < log->numRings; i++ ) {
+         free( log->rings[i].records );
+      }
+      free( log->rings );
+      log->rings = NULL;
+   }
+   free( log->slots );
+   log->slots = NULL;
+}
+
+/**
+ * \brief Maps a timecode log for reading
+ **/
+bool timecodeLogMap( TIMECODE_LOG_READER * reader, const char * fileName )
+{
+   memset( reader, 0, sizeof(*reader));
+
+   int fd = open( fileName, O_RDONLY );
+   if( fd < 0 ) {
+      return false;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(TIMECODE_LOG_HEADER)) {
+      close( fd );
+      return false;
+   }
+
+   void * data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( data == MAP_FAILED ) {
+      return false;
+   }
+
+   const TIMECODE_LOG_HEADER * header = (const TIMECODE_LOG_HEADER *)data;
+   if( header->magic != TIMECODE_LOG_MAGIC
+    || header->recordSize < sizeof(TIMECODE_RECORD)) {
+      munmap( data, st.st_size );
+      return false;
+   }
+
+   reader->data       = (const uint8_t *)data;
+   reader->length     = st.st_size;
+   reader->recordSize = header->recordSize;
+   reader->numRecords = (st.st_size - sizeof(TIMECODE_LOG_HEADER)) / header->recordSize;
+
+   return true;
+}
+
+/**
+ * \brief Returns record i of a mapped log
+ **/
+const TIMECODE_RECORD * timecodeLogRecordAt( const TIMECODE_LOG_READER * reader, size_t i )
+{
+   return (const TIMECODE_RECORD *)( reader->data
+                                   + sizeof(TIMECODE_LOG_HEADER)
+                                   + i * reader->recordSize );
+}
+
+/**
+ * \brief Unmaps a timecode log
+ **/
+void timecodeLogUnmap( TIMECODE_LOG_READER * reader )
+{
+   if( reader->data != NULL ) {
+      munmap( (void *)reader->data, reader->length );
+   }
+   memset( reader, 0, sizeof(*reader));
+}
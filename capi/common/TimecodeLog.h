@@ -0,0 +1,160 @@
+/******************************************************************************
+ *
+ * TimecodeLog.h
+ *
+ * Binary log of frame timecodes received from microcamera streams. Each
+ * receiver thread appends fixed-size TIMECODE_RECORDs to its own single
+ * producer, single consumer ring buffer, which takes a clock read and a few
+ * stores and never blocks or allocates. One writer thread drains the rings
+ * into the log file. If a ring fills up because the writer falls behind,
+ * records are dropped and counted instead of stalling the receiver.
+ *
+ * The file starts with a TIMECODE_LOG_HEADER followed by TIMECODE_RECORDs
+ * in native byte order. Records of one microcamera are in the order they
+ * were received; records of different microcameras are interleaved in the
+ * order the writer drained them. The header stores the record size so
+ * readers can step over fields appended by newer versions.
+ *
+ *****************************************************************************/
+#ifndef TIMECODE_LOG_H
+#define TIMECODE_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMECODE_LOG_MAGIC    0x4C435441 //!< "ATCL" in a little endian file
+#define TIMECODE_LOG_VERSION  1
+#define TIMECODE_LOG_CAPACITY 4096       //!< Default records per ring
+
+/**
+ * \brief Header at the start of every timecode log
+ **/
+typedef struct {
+   uint32_t magic;        //!< TIMECODE_LOG_MAGIC
+   uint16_t version;      //!< TIMECODE_LOG_VERSION of the writer
+   uint16_t recordSize;   //!< Size of each record in bytes
+   uint64_t reserved;     //!< Zero
+} TIMECODE_LOG_HEADER;
+
+/**
+ * \brief Timecode of one received frame
+ **/
+typedef struct {
+   uint32_t mcamID;       //!< Microcamera the frame came from
+   uint32_t tile;         //!< Tile of the frame, e.g. ATL_TILE_4K
+   uint64_t frameId;      //!< Frame id (m_id)
+   uint64_t timestamp;    //!< Frame timestamp in microseconds
+   uint64_t received;     //!< Host time the frame arrived, in ns since the epoch
+} TIMECODE_RECORD;
+
+/**
+ * \brief Called by the writer thread for each record it drains, in the
+ *        order records are written
+ **/
+typedef struct {
+   void (*f)( const TIMECODE_RECORD * record, void * data );
+   void * data;
+} TIMECODE_RECORD_CALLBACK;
+
+/**
+ * \brief Ring buffer of one receiver. head is only written by the receiver
+ *        and tail only by the writer; they sit on separate cache lines so
+ *        the two threads do not contend
+ **/
+typedef struct {
+   TIMECODE_RECORD * records;                     //!< Storage, capacity records
+   uint32_t          mask;                        //!< capacity - 1, capacity is a power of two
+   uint32_t          mcamID;                      //!< Microcamera this ring belongs to
+   uint64_t          head __attribute__((aligned(64))); //!< Records pushed
+   uint64_t          dropped;                     //!< Records lost to a full ring
+   uint64_t          tail __attribute__((aligned(64))); //!< Records drained
+} TIMECODE_RING;
+
+/**
+ * \brief Timecode log being written
+ **/
+typedef struct {
+   FILE *          file;      //!< Open log file
+   TIMECODE_RING * rings;     //!< One ring per microcamera
+   int             numRings;  //!< Number of entries in rings
+   int32_t *       slots;     //!< Hash table of ring indices by mcamID, -1 if empty
+   uint32_t        slotMask;  //!< Entries in slots - 1, a power of two above numRings
+   TIMECODE_RECORD_CALLBACK callback; //!< Optional per record callback
+   uint64_t        written;   //!< Records written to the file
+   volatile bool   stop;      //!< Set to stop the writer thread
+   pthread_t       writer;    //!< Thread draining the rings
+} TIMECODE_LOG;
+
+/**
+ * \brief Read-only view of a timecode log mapped into memory
+ **/
+typedef struct {
+   const uint8_t * data;        //!< Start of the mapping
+   size_t          length;      //!< Length of the mapping in bytes
+   size_t          recordSize;  //!< Stride between records
+   size_t          numRecords;  //!< Number of complete records
+} TIMECODE_LOG_READER;
+
+/**
+ * \brief Opens a log file and starts its writer thread. Records are
+ *        appended to an existing log written with the same record layout
+ * \param [in] mcamIDs  microcameras that will record, one ring each
+ * \param [in] capacity records per ring, rounded up to a power of two
+ * \param [in] callback called for every drained record, f may be NULL
+ * \return true on success
+ **/
+bool timecodeLogOpen( TIMECODE_LOG * log
+                    , const char * fileName
+                    , const uint32_t * mcamIDs
+                    , int numMCams
+                    , uint32_t capacity
+                    , TIMECODE_RECORD_CALLBACK callback
+                    );
+
+/**
+ * \brief Records the timecode of a received frame. Must only be called
+ *        from one thread per microcamera, such as its stream receiver
+ * \return false if the microcamera has no ring or its ring was full
+ **/
+bool timecodeLogRecord( TIMECODE_LOG * log, const FRAME_METADATA * metadata );
+
+/**
+ * \brief Returns the number of records dropped because a ring was full
+ **/
+uint64_t timecodeLogDropped( const TIMECODE_LOG * log );
+
+/**
+ * \brief Stops the writer after draining every ring and closes the file.
+ *        No more records may be recorded
+ **/
+void timecodeLogClose( TIMECODE_LOG * log );
+
+/**
+ * \brief Maps a timecode log for reading
+ * \return true if the file exists and has a valid header
+ **/
+bool timecodeLogMap( TIMECODE_LOG_READER * reader, const char * fileName );
+
+/**
+ * \brief Returns record i of a mapped log. i must be below numRecords
+ **/
+const TIMECODE_RECORD * timecodeLogRecordAt( const TIMECODE_LOG_READER * reader, size_t i );
+
+/**
+ * \brief Unmaps a timecode log
+ **/
+void timecodeLogUnmap( TIMECODE_LOG_READER * reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
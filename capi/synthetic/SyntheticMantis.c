@@ -0,0 +1,908 @@
+/******************************************************************************
+ *
+ * SyntheticMantis.c
+ *
+ * Synthetic implementation of the MantisAPI subset declared in
+ * synthetic/mantis/MantisAPI.h, used to build and measure the examples
+ * without a Mantis system. It serves one camera whose microcameras capture
+ * at a fixed framerate, each with its own phase, from the wall clock.
+ * Frames exist for every frame period of the last MANTIS_SYNTH_HISTORY
+ * seconds. Their ids, modes, sizes, contents and drops are derived from a
+ * hash of the seed, microcamera id and frame number, so every run and every
+ * request for the same frame sees the same data.
+ *
+ * Behavior is configured through environment variables read on first use:
+ *
+ *   MANTIS_SYNTH_MCAMS        microcameras in the camera (default 4)
+ *   MANTIS_SYNTH_FRAMERATE    frames per second (default 30)
+ *   MANTIS_SYNTH_GOP          frames per H.264 GOP (default 30)
+ *   MANTIS_SYNTH_LATENCY_US   mean getFrame latency in microseconds (default 2000)
+ *   MANTIS_SYNTH_JITTER_US    uniform latency jitter, +/- microseconds (default 500)
+ *   MANTIS_SYNTH_DROP         fraction of frames that were never captured (default 0)
+ *   MANTIS_SYNTH_SEED         seed of all generated data (default 1)
+ *   MANTIS_SYNTH_MODE         h264 or jpeg frames (default h264)
+ *   MANTIS_SYNTH_IFRAME_KB    mean I-frame size (default 256)
+ *   MANTIS_SYNTH_PFRAME_KB    mean P-frame size (default 32)
+ *   MANTIS_SYNTH_JPEG_KB      mean JPEG size (default 1024)
+ *   MANTIS_SYNTH_HISTORY      seconds of frames kept by the server (default 3600)
+ *   MANTIS_SYNTH_CLIPS        recorded clips reported to clip callbacks (default 3)
+ *
+ * HD tiles are a quarter of the size of 4K tiles. Streams started with
+ * startMCamStream deliver each frame as it is captured to the frame
+ * callback, which does not own the buffer.
+ *
+ *****************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mantis/MantisAPI.h"
+
+#define SYNTH_CAMERA_ID   1
+#define SYNTH_MAX_MCAMS   1024
+#define SYNTH_MAX_STREAMS 256
+#define SYNTH_CLIP_LENGTH 10     //!< Seconds in each synthetic clip
+#define SYNTH_CLIP_SPACING 60    //!< Seconds between synthetic clips
+#define SYNTH_MCAMS_PER_TEGRA 2
+
+#define SALT_PHASE  1
+#define SALT_SIZE   2
+#define SALT_DROP   3
+#define SALT_DATA   4
+#define SALT_JITTER 5
+#define SALT_SENSOR 6
+
+/**
+ * \brief Settings read from the environment
+ **/
+typedef struct {
+   int      numMCams;     //!< Microcameras in the camera
+   double   framerate;    //!< Frames per second
+   double   period;       //!< Frame period in microseconds
+   int      gopLength;    //!< Frames per GOP
+   double   latency;      //!< Mean getFrame latency in microseconds
+   double   jitter;       //!< Latency jitter in microseconds
+   double   dropRate;     //!< Fraction of frames dropped
+   uint64_t seed;         //!< Seed of generated data
+   bool     jpeg;         //!< Generate JPEG instead of H.264 frames
+   uint64_t iFrameSize;   //!< Mean I-frame size in bytes
+   uint64_t pFrameSize;   //!< Mean P-frame size in bytes
+   uint64_t jpegSize;     //!< Mean JPEG size in bytes
+   uint64_t history;      //!< Microseconds of frames kept
+   int      numClips;     //!< Clips reported to clip callbacks
+} SYNTH_CONFIG;
+
+/**
+ * \brief A running microcamera stream
+ **/
+typedef struct {
+   MICRO_CAMERA    mcam;      //!< Streaming microcamera
+   int             port;      //!< Receiver port
+   int             filter;    //!< ATL_SCALE_MODE_* of delivered tiles
+   volatile bool   running;   //!< Cleared to stop the thread
+   bool            active;    //!< Set while the slot is in use
+   pthread_t       thread;    //!< Delivery thread
+} SYNTH_STREAM;
+
+/**
+ * \brief White balance state of a microcamera
+ **/
+typedef struct {
+   int             mode;      //!< 0 manual, otherwise automatic
+   AtlWhiteBalance manual;    //!< Gains set in manual mode
+} SYNTH_WHITE_BALANCE;
+
+static SYNTH_CONFIG g_config;
+static pthread_once_t g_configOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool g_serverConnected = false;
+static bool g_cameraConnected = false;
+static bool g_cameraReceiving = true;
+static uint64_t g_recordStart = 0;
+static uint64_t g_requestCounter = 0;
+static int g_clipCounter = 0;
+static ACOS_CLIP_CALLBACK g_clipCallback = { NULL, NULL };
+
+static bool g_mcamConnected[SYNTH_MAX_MCAMS];
+static NEW_MICRO_CAMERA_CALLBACK g_mcamCallback = { NULL, NULL };
+static MICRO_CAMERA_FRAME_CALLBACK g_frameCallback = { NULL, NULL };
+static SYNTH_STREAM g_streams[SYNTH_MAX_STREAMS];
+static SYNTH_WHITE_BALANCE g_whiteBalance[SYNTH_MAX_MCAMS];
+
+/**
+ * \brief Reads a numeric environment variable
+ **/
+static double envNumber( const char * name, double fallback )
+{
+   const char * value = getenv( name );
+   return ( value != NULL && *value != 0 ) ? atof( value ) : fallback;
+}
+
+/**
+ * \brief Loads the configuration from the environment
+ **/
+static void loadConfig( void )
+{
+   g_config.numMCams   = (int)envNumber( "MANTIS_SYNTH_MCAMS", 4 );
+   g_config.framerate  = envNumber( "MANTIS_SYNTH_FRAMERATE", 30 );
+   g_config.gopLength  = (int)envNumber( "MANTIS_SYNTH_GOP", 30 );
+   g_config.latency    = envNumber( "MANTIS_SYNTH_LATENCY_US", 2000 );
+   g_config.jitter     = envNumber( "MANTIS_SYNTH_JITTER_US", 500 );
+   g_config.dropRate   = envNumber( "MANTIS_SYNTH_DROP", 0 );
+   g_config.seed       = (uint64_t)envNumber( "MANTIS_SYNTH_SEED", 1 );
+   g_config.iFrameSize = (uint64_t)( envNumber( "MANTIS_SYNTH_IFRAME_KB", 256 ) * 1024 );
+   g_config.pFrameSize = (uint64_t)( envNumber( "MANTIS_SYNTH_PFRAME_KB", 32 ) * 1024 );
+   g_config.jpegSize   = (uint64_t)( envNumber( "MANTIS_SYNTH_JPEG_KB", 1024 ) * 1024 );
+   g_config.history    = (uint64_t)( envNumber( "MANTIS_SYNTH_HISTORY", 3600 ) * 1e6 );
+   g_config.numClips   = (int)envNumber( "MANTIS_SYNTH_CLIPS", 3 );
+
+   const char * mode = getenv( "MANTIS_SYNTH_MODE" );
+   g_config.jpeg = ( mode != NULL && !strcmp( mode, "jpeg" ));
+
+   if( g_config.numMCams < 1 ) {
+      g_config.numMCams = 1;
+   }
+   if( g_config.numMCams > SYNTH_MAX_MCAMS ) {
+      g_config.numMCams = SYNTH_MAX_MCAMS;
+   }
+   if( g_config.framerate <= 0 ) {
+      g_config.framerate = 30;
+   }
+   if( g_config.gopLength < 1 ) {
+      g_config.gopLength = 1;
+   }
+   if( g_config.pFrameSize < 16 ) {
+      g_config.pFrameSize = 16;
+   }
+   g_config.period = 1e6 / g_config.framerate;
+}
+
+/**
+ * \brief Returns the configuration, loading it on first use
+ **/
+static const SYNTH_CONFIG * config( void )
+{
+   pthread_once( &g_configOnce, loadConfig );
+   return &g_config;
+}
+
+/**
+ * \brief splitmix64 finalizer
+ **/
+static uint64_t mix( uint64_t x )
+{
+   x += 0x9E3779B97F4A7C15ULL;
+   x = ( x ^ ( x >> 30 )) * 0xBF58476D1CE4E5B9ULL;
+   x = ( x ^ ( x >> 27 )) * 0x94D049BB133111EBULL;
+   return x ^ ( x >> 31 );
+}
+
+/**
+ * \brief Hash of a frame property
+ **/
+static uint64_t frameHash( uint32_t mcamID, uint64_t n, uint64_t salt )
+{
+   return mix( config()->seed ^ mix( ((uint64_t)mcamID << 40) ^ n ^ mix( salt )));
+}
+
+/**
+ * \brief Maps a hash to [0,1)
+ **/
+static double unitHash( uint64_t hash )
+{
+   return ( hash >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/**
+ * \brief Returns the wall clock time in microseconds
+ **/
+static uint64_t nowMicroseconds( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_REALTIME, &ts );
+
+   return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * \brief Sleeps for a number of microseconds
+ **/
+static void sleepMicroseconds( double usec )
+{
+   if( usec <= 0 ) {
+      return;
+   }
+   struct timespec ts;
+   ts.tv_sec  = (time_t)( usec / 1e6 );
+   ts.tv_nsec = (long)(( usec - ts.tv_sec * 1e6 ) * 1e3 );
+   nanosleep( &ts, NULL );
+}
+
+/**
+ * \brief Returns true if mcamID belongs to the synthetic camera
+ **/
+static bool validMCam( uint32_t mcamID )
+{
+   return mcamID >= 1 && mcamID <= (uint32_t)config()->numMCams;
+}
+
+/**
+ * \brief Fills in the MICRO_CAMERA for an id. Two microcameras share a Tegra
+ **/
+static MICRO_CAMERA describeMCam( uint32_t mcamID )
+{
+   MICRO_CAMERA mcam;
+   memset( &mcam, 0, sizeof(mcam));
+   mcam.mcamID = mcamID;
+   snprintf( mcam.tegraip, sizeof(mcam.tegraip), "10.0.1.%u", ( mcamID - 1 ) / SYNTH_MCAMS_PER_TEGRA + 1 );
+   mcam.tegraport = 9999;
+
+   return mcam;
+}
+
+/**
+ * \brief Returns the ACOS_CAMERA of the synthetic camera
+ **/
+static ACOS_CAMERA describeCamera( void )
+{
+   ACOS_CAMERA cam;
+   memset( &cam, 0, sizeof(cam));
+   cam.camID = SYNTH_CAMERA_ID;
+   cam.mcamList.numMCams = config()->numMCams;
+
+   return cam;
+}
+
+/**
+ * \brief Capture offset of a microcamera within the frame period
+ **/
+static uint64_t mcamPhase( uint32_t mcamID )
+{
+   return (uint64_t)( unitHash( frameHash( mcamID, 0, SALT_PHASE )) * config()->period * 0.5 );
+}
+
+/**
+ * \brief Capture time of frame n of a microcamera
+ **/
+static uint64_t frameTimestamp( uint32_t mcamID, uint64_t n )
+{
+   return mcamPhase( mcamID ) + (uint64_t)( n * config()->period + 0.5 );
+}
+
+/**
+ * \brief Finds the last frame captured at or before timestamp
+ * \return false if no frame was captured by then
+ **/
+static bool frameAt( uint32_t mcamID, uint64_t timestamp, uint64_t * n )
+{
+   uint64_t phase = mcamPhase( mcamID );
+   if( timestamp < phase ) {
+      return false;
+   }
+
+   uint64_t index = (uint64_t)(( timestamp - phase ) / config()->period );
+   while( index > 0 && frameTimestamp( mcamID, index ) > timestamp ) {
+      index--;
+   }
+   while( frameTimestamp( mcamID, index + 1 ) <= timestamp ) {
+      index++;
+   }
+
+   *n = index;
+   return true;
+}
+
+/**
+ * \brief Returns true if frame n of a microcamera was dropped
+ **/
+static bool frameDropped( uint32_t mcamID, uint64_t n )
+{
+   return unitHash( frameHash( mcamID, n, SALT_DROP )) < config()->dropRate;
+}
+
+/**
+ * \brief Generates frame n of a microcamera. The caller owns m_image
+ **/
+static FRAME makeFrame( uint32_t mcamID, uint64_t n, int tile )
+{
+   const SYNTH_CONFIG * cfg = config();
+   FRAME frame;
+   memset( &frame, 0, sizeof(frame));
+
+   FRAME_METADATA * meta = &frame.m_metadata;
+   meta->m_id        = n;
+   meta->m_timestamp = frameTimestamp( mcamID, n );
+   meta->m_camId     = mcamID;
+   meta->m_tile      = tile;
+   meta->m_width     = ( tile == ATL_TILE_HD ) ? 1920 : 3840;
+   meta->m_height    = ( tile == ATL_TILE_HD ) ? 1080 : 2160;
+   meta->m_framerate = cfg->framerate;
+
+   double sensor = unitHash( frameHash( mcamID, n / cfg->gopLength, SALT_SENSOR ));
+   meta->m_gain     = 1.0 + 3.0 * sensor;
+   meta->m_shutter  = 1.0 / cfg->framerate * ( 0.25 + 0.75 * sensor );
+   meta->m_exposure = meta->m_gain * meta->m_shutter;
+
+   uint64_t size;
+   if( cfg->jpeg ) {
+      meta->m_mode = ATL_MODE_JPEG;
+      size = cfg->jpegSize;
+   }
+   else if( n % cfg->gopLength == 0 ) {
+      meta->m_mode = ATL_MODE_H264_I_FRAME;
+      size = cfg->iFrameSize;
+   }
+   else {
+      meta->m_mode = ATL_MODE_H264_P_FRAME;
+      size = cfg->pFrameSize;
+   }
+   if( tile == ATL_TILE_HD ) {
+      size /= 4;
+   }
+   size = (uint64_t)( size * ( 0.9 + 0.2 * unitHash( frameHash( mcamID, n, SALT_SIZE + tile ))));
+   if( size < 16 ) {
+      size = 16;
+   }
+
+   uint8_t * data = (uint8_t *)malloc( size );
+   if( data == NULL ) {
+      return frame;
+   }
+
+   //Pseudo-random payload behind a plausible start marker
+   uint64_t state = frameHash( mcamID, n, SALT_DATA + tile ) | 1;
+   for( uint64_t i = 0; i < size; i += sizeof(state)) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      memcpy( data + i, &state, ( size - i < sizeof(state)) ? size - i : sizeof(state));
+   }
+   if( cfg->jpeg ) {
+      data[0] = 0xFF; data[1] = 0xD8; data[2] = 0xFF; data[3] = 0xE0;
+      data[size-2] = 0xFF; data[size-1] = 0xD9;
+   }
+   else {
+      data[0] = 0; data[1] = 0; data[2] = 0; data[3] = 1;
+      data[4] = ( meta->m_mode == ATL_MODE_H264_I_FRAME ) ? 0x65 : 0x41;
+   }
+
+   frame.m_image = data;
+   meta->m_size  = size;
+
+   return frame;
+}
+
+/**
+ * \brief Builds the synthetic clip with the given index, counted back from now
+ **/
+static ACOS_CLIP makeClip( int index, uint64_t now )
+{
+   ACOS_CLIP clip;
+   memset( &clip, 0, sizeof(clip));
+   snprintf( clip.name, sizeof(clip.name), "synthetic_clip_%d", index );
+   clip.cam       = describeCamera();
+   clip.endTime   = now - (uint64_t)index * SYNTH_CLIP_SPACING * 1000000ULL;
+   clip.startTime = clip.endTime - SYNTH_CLIP_LENGTH * 1000000ULL;
+   clip.framerate = config()->framerate;
+
+   return clip;
+}
+
+/*****************************************************************************
+ * Camera server
+ *****************************************************************************/
+void connectToCameraServer( const char * ip, int port )
+{
+   config();
+   pthread_mutex_lock( &g_lock );
+   g_serverConnected = true;
+   pthread_mutex_unlock( &g_lock );
+}
+
+void disconnectFromCameraServer( void )
+{
+   pthread_mutex_lock( &g_lock );
+   g_serverConnected = false;
+   g_cameraConnected = false;
+   pthread_mutex_unlock( &g_lock );
+}
+
+int getNumberOfCameras( void )
+{
+   pthread_mutex_lock( &g_lock );
+   int count = g_serverConnected ? 1 : 0;
+   pthread_mutex_unlock( &g_lock );
+
+   return count;
+}
+
+void setNewCameraCallback( NEW_CAMERA_CALLBACK cb )
+{
+   if( cb.f != NULL && getNumberOfCameras() > 0 ) {
+      cb.f( describeCamera(), cb.data );
+   }
+}
+
+void setNewClipCallback( ACOS_CLIP_CALLBACK cb )
+{
+   pthread_mutex_lock( &g_lock );
+   g_clipCallback = cb;
+   pthread_mutex_unlock( &g_lock );
+
+   //Existing clips are reported when the callback is set
+   uint64_t now = nowMicroseconds();
+   for( int i = config()->numClips; i > 0 && cb.f != NULL; i-- ) {
+      cb.f( makeClip( i, now ), cb.data );
+   }
+}
+
+/*****************************************************************************
+ * Cameras
+ *****************************************************************************/
+AQ_SYSTEM_STATE isCameraConnected( ACOS_CAMERA cam )
+{
+   pthread_mutex_lock( &g_lock );
+   bool connected = g_cameraConnected;
+   pthread_mutex_unlock( &g_lock );
+
+   return connected ? AQ_CAMERA_CONNECTED : AQ_CAMERA_DISCONNECTED;
+}
+
+AQ_SYSTEM_STATE setCameraConnection( ACOS_CAMERA cam, bool connect, int timeout )
+{
+   if( cam.camID != SYNTH_CAMERA_ID ) {
+      return AQ_FAILURE;
+   }
+   pthread_mutex_lock( &g_lock );
+   g_cameraConnected = connect && g_serverConnected;
+   bool ok = g_cameraConnected == connect;
+   pthread_mutex_unlock( &g_lock );
+
+   return ok ? AQ_SUCCESS : AQ_FAILURE;
+}
+
+AQ_SYSTEM_STATE isCameraReceivingData( ACOS_CAMERA cam )
+{
+   pthread_mutex_lock( &g_lock );
+   bool receiving = g_cameraReceiving;
+   pthread_mutex_unlock( &g_lock );
+
+   return receiving ? AQ_CAMERA_RECEIVING_DATA : AQ_CAMERA_NOT_RECEIVING_DATA;
+}
+
+AQ_SYSTEM_STATE setCameraReceivingData( ACOS_CAMERA cam, bool receive, int timeout )
+{
+   pthread_mutex_lock( &g_lock );
+   g_cameraReceiving = receive;
+   pthread_mutex_unlock( &g_lock );
+
+   return AQ_SUCCESS;
+}
+
+AQ_SYSTEM_STATE setCameraRecording( ACOS_CAMERA cam, bool record, int timeout )
+{
+   uint64_t now = nowMicroseconds();
+
+   pthread_mutex_lock( &g_lock );
+   if( record ) {
+      g_recordStart = now;
+      pthread_mutex_unlock( &g_lock );
+      return AQ_SUCCESS;
+   }
+
+   //Stopping a recording creates a clip and reports it
+   if( g_recordStart == 0 ) {
+      pthread_mutex_unlock( &g_lock );
+      return AQ_FAILURE;
+   }
+   ACOS_CLIP clip;
+   memset( &clip, 0, sizeof(clip));
+   snprintf( clip.name, sizeof(clip.name), "synthetic_recording_%d", ++g_clipCounter );
+   clip.cam       = describeCamera();
+   clip.startTime = g_recordStart;
+   clip.endTime   = now;
+   clip.framerate = config()->framerate;
+   g_recordStart = 0;
+   ACOS_CLIP_CALLBACK cb = g_clipCallback;
+   pthread_mutex_unlock( &g_lock );
+
+   if( cb.f != NULL ) {
+      cb.f( clip, cb.data );
+   }
+
+   return AQ_SUCCESS;
+}
+
+void disconnectCamera( ACOS_CAMERA cam )
+{
+   setCameraConnection( cam, false, 0 );
+}
+
+uint32_t getCameraNumberOfMCams( ACOS_CAMERA cam )
+{
+   return ( cam.camID == SYNTH_CAMERA_ID ) ? config()->numMCams : 0;
+}
+
+int getCameraMCamList( ACOS_CAMERA cam, MICRO_CAMERA * list, int size )
+{
+   int count = (int)getCameraNumberOfMCams( cam );
+   if( count > size ) {
+      count = size;
+   }
+   for( int i = 0; i < count; i++ ) {
+      list[i] = describeMCam( i + 1 );
+   }
+
+   return count;
+}
+
+/*****************************************************************************
+ * Frames
+ *****************************************************************************/
+FRAME getFrame( ACOS_CAMERA cam, uint32_t mcamID, uint64_t timestamp, int tiling, int tile )
+{
+   const SYNTH_CONFIG * cfg = config();
+   FRAME frame;
+   memset( &frame, 0, sizeof(frame));
+
+   pthread_mutex_lock( &g_lock );
+   bool connected = g_serverConnected;
+   uint64_t request = g_requestCounter++;
+   pthread_mutex_unlock( &g_lock );
+
+   //Each request waits the configured latency plus its own jitter
+   double jitter = ( 2.0 * unitHash( mix( cfg->seed ^ mix( request ^ mix( SALT_JITTER )))) - 1.0 ) * cfg->jitter;
+   sleepMicroseconds( cfg->latency + jitter );
+
+   if( !connected || cam.camID != SYNTH_CAMERA_ID || !validMCam( mcamID )) {
+      return frame;
+   }
+
+   //Time 0 asks for the latest frame. Later times have not been captured
+   uint64_t now = nowMicroseconds();
+   if( timestamp == 0 ) {
+      timestamp = now;
+   }
+   uint64_t n;
+   if( timestamp > now
+    || timestamp + cfg->history < now
+    || !frameAt( mcamID, timestamp, &n )
+    || frameDropped( mcamID, n )) {
+      return frame;
+   }
+
+   return makeFrame( mcamID, n, tile );
+}
+
+bool returnPointer( void * image )
+{
+   if( image == NULL ) {
+      return false;
+   }
+   free( image );
+
+   return true;
+}
+
+bool saveFrame( FRAME frame, const char * fileName )
+{
+   if( frame.m_image == NULL ) {
+      return false;
+   }
+
+   char name[1024];
+   snprintf( name, sizeof(name), "%s.%s", fileName,
+             frame.m_metadata.m_mode == ATL_MODE_JPEG ? "jpeg" : "h264" );
+   FILE * file = fopen( name, "w" );
+   if( file == NULL ) {
+      return false;
+   }
+   bool rc = fwrite( frame.m_image, 1, frame.m_metadata.m_size, file ) == frame.m_metadata.m_size;
+   rc = ( fclose( file ) == 0 ) && rc;
+
+   //Metadata goes next to the image as JSON
+   snprintf( name, sizeof(name), "%s.json", fileName );
+   file = fopen( name, "w" );
+   if( file == NULL ) {
+      return false;
+   }
+   const FRAME_METADATA * meta = &frame.m_metadata;
+   fprintf( file,
+            "{\"id\":%lu,\"timestamp\":%lu,\"camId\":%u,\"width\":%u,\"height\":%u,"
+            "\"size\":%lu,\"mode\":%u,\"tile\":%u,\"framerate\":%f,\"gain\":%f,"
+            "\"shutter\":%f,\"exposure\":%f}\n",
+            meta->m_id, meta->m_timestamp, meta->m_camId, meta->m_width, meta->m_height,
+            meta->m_size, meta->m_mode, meta->m_tile, meta->m_framerate, meta->m_gain,
+            meta->m_shutter, meta->m_exposure );
+
+   return ( fclose( file ) == 0 ) && rc;
+}
+
+/*****************************************************************************
+ * Direct microcamera connections and streams
+ *****************************************************************************/
+void mCamConnect( const char * ip, int port )
+{
+   const SYNTH_CONFIG * cfg = config();
+
+   /* Connect the microcameras hosted at ip. An address that hosts none is
+    * treated as a single host for the whole camera */
+   bool found = false;
+   for( int i = 1; i <= cfg->numMCams; i++ ) {
+      found = found || !strcmp( describeMCam( i ).tegraip, ip );
+   }
+
+   for( int i = 1; i <= cfg->numMCams; i++ ) {
+      MICRO_CAMERA mcam = describeMCam( i );
+      if( found && strcmp( mcam.tegraip, ip )) {
+         continue;
+      }
+
+      pthread_mutex_lock( &g_lock );
+      bool added = !g_mcamConnected[i-1];
+      g_mcamConnected[i-1] = true;
+      NEW_MICRO_CAMERA_CALLBACK cb = g_mcamCallback;
+      pthread_mutex_unlock( &g_lock );
+
+      if( added && cb.f != NULL ) {
+         cb.f( mcam, cb.data );
+      }
+   }
+}
+
+void mCamDisconnect( const char * ip, int port )
+{
+   for( int i = 1; i <= config()->numMCams; i++ ) {
+      MICRO_CAMERA mcam = describeMCam( i );
+      if( !strcmp( mcam.tegraip, ip )) {
+         stopMCamStream( mcam, port );
+         pthread_mutex_lock( &g_lock );
+         g_mcamConnected[i-1] = false;
+         pthread_mutex_unlock( &g_lock );
+      }
+   }
+}
+
+int getNumberOfMCams( void )
+{
+   int count = 0;
+   pthread_mutex_lock( &g_lock );
+   for( int i = 0; i < config()->numMCams; i++ ) {
+      count += g_mcamConnected[i] ? 1 : 0;
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   return count;
+}
+
+void setNewMCamCallback( NEW_MICRO_CAMERA_CALLBACK cb )
+{
+   bool connected[SYNTH_MAX_MCAMS];
+
+   pthread_mutex_lock( &g_lock );
+   g_mcamCallback = cb;
+   memcpy( connected, g_mcamConnected, sizeof(connected));
+   pthread_mutex_unlock( &g_lock );
+
+   //Microcameras already discovered are reported when the callback is set
+   for( int i = 0; i < config()->numMCams && cb.f != NULL; i++ ) {
+      if( connected[i] ) {
+         cb.f( describeMCam( i + 1 ), cb.data );
+      }
+   }
+}
+
+void setMCamFrameCallback( MICRO_CAMERA_FRAME_CALLBACK cb )
+{
+   pthread_mutex_lock( &g_lock );
+   g_frameCallback = cb;
+   pthread_mutex_unlock( &g_lock );
+}
+
+bool initMCamFrameReceiver( int port, int numBuffers )
+{
+   return port > 0;
+}
+
+bool closeMCamFrameReceiver( int port )
+{
+   return port > 0;
+}
+
+/**
+ * \brief Delivers each frame of a microcamera to the frame callback as it
+ *        is captured
+ **/
+static void * streamThread( void * data )
+{
+   SYNTH_STREAM * stream = (SYNTH_STREAM *)data;
+   uint32_t mcamID = stream->mcam.mcamID;
+
+   uint64_t n;
+   if( !frameAt( mcamID, nowMicroseconds(), &n )) {
+      n = 0;
+   }
+
+   while( stream->running ) {
+      n++;
+      uint64_t due = frameTimestamp( mcamID, n );
+      uint64_t now = nowMicroseconds();
+      if( due > now ) {
+         sleepMicroseconds( (double)( due - now ));
+      }
+      if( !stream->running || frameDropped( mcamID, n )) {
+         continue;
+      }
+
+      pthread_mutex_lock( &g_lock );
+      MICRO_CAMERA_FRAME_CALLBACK cb = g_frameCallback;
+      int filter = stream->filter;
+      pthread_mutex_unlock( &g_lock );
+      if( cb.f == NULL ) {
+         continue;
+      }
+
+      //The buffer belongs to the stream and is released after the callback
+      for( int tile = ATL_TILE_4K; tile <= ATL_TILE_HD; tile++ ) {
+         if(( tile == ATL_TILE_4K && filter == ATL_SCALE_MODE_HD )
+         || ( tile == ATL_TILE_HD && filter == ATL_SCALE_MODE_4K )) {
+            continue;
+         }
+         FRAME frame = makeFrame( mcamID, n, tile );
+         if( frame.m_image != NULL ) {
+            cb.f( frame, cb.data );
+            free( frame.m_image );
+         }
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * \brief Finds the active stream of a microcamera on a port. Called with
+ *        g_lock held
+ **/
+static SYNTH_STREAM * findStream( uint32_t mcamID, int port )
+{
+   for( int i = 0; i < SYNTH_MAX_STREAMS; i++ ) {
+      if( g_streams[i].active && g_streams[i].mcam.mcamID == mcamID && g_streams[i].port == port ) {
+         return &g_streams[i];
+      }
+   }
+
+   return NULL;
+}
+
+bool startMCamStream( MICRO_CAMERA mcam, int port )
+{
+   if( !validMCam( mcam.mcamID )) {
+      return false;
+   }
+
+   pthread_mutex_lock( &g_lock );
+   if( !g_mcamConnected[mcam.mcamID-1] || findStream( mcam.mcamID, port ) != NULL ) {
+      pthread_mutex_unlock( &g_lock );
+      return false;
+   }
+
+   SYNTH_STREAM * stream = NULL;
+   for( int i = 0; i < SYNTH_MAX_STREAMS && stream == NULL; i++ ) {
+      if( !g_streams[i].active ) {
+         stream = &g_streams[i];
+      }
+   }
+   if( stream == NULL ) {
+      pthread_mutex_unlock( &g_lock );
+      return false;
+   }
+
+   stream->mcam    = mcam;
+   stream->port    = port;
+   stream->filter  = ATL_SCALE_MODE_ALL;
+   stream->running = true;
+   stream->active  = pthread_create( &stream->thread, NULL, streamThread, stream ) == 0;
+   bool ok = stream->active;
+   pthread_mutex_unlock( &g_lock );
+
+   return ok;
+}
+
+bool stopMCamStream( MICRO_CAMERA mcam, int port )
+{
+   pthread_mutex_lock( &g_lock );
+   SYNTH_STREAM * stream = findStream( mcam.mcamID, port );
+   if( stream != NULL ) {
+      stream->running = false;
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   if( stream == NULL ) {
+      return false;
+   }
+   pthread_join( stream->thread, NULL );
+
+   pthread_mutex_lock( &g_lock );
+   stream->active = false;
+   pthread_mutex_unlock( &g_lock );
+
+   return true;
+}
+
+bool setMCamStreamFilter( MICRO_CAMERA mcam, int port, int scaleMode )
+{
+   pthread_mutex_lock( &g_lock );
+   SYNTH_STREAM * stream = findStream( mcam.mcamID, port );
+   if( stream != NULL ) {
+      stream->filter = scaleMode;
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   return stream != NULL;
+}
+
+/*****************************************************************************
+ * White balance
+ *****************************************************************************/
+bool setMCamWhiteBalanceMode( MICRO_CAMERA mcam, int mode )
+{
+   if( !validMCam( mcam.mcamID )) {
+      return false;
+   }
+
+   //Switching to manual keeps the gains the automatic mode had chosen
+   AtlWhiteBalance current = getMCamWhiteBalance( mcam );
+   pthread_mutex_lock( &g_lock );
+   g_whiteBalance[mcam.mcamID-1].mode = mode;
+   if( mode == 0 ) {
+      g_whiteBalance[mcam.mcamID-1].manual = current;
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   return true;
+}
+
+AtlWhiteBalance getMCamWhiteBalance( MICRO_CAMERA mcam )
+{
+   AtlWhiteBalance wb = { 0, 0, 0 };
+   if( !validMCam( mcam.mcamID )) {
+      return wb;
+   }
+
+   pthread_mutex_lock( &g_lock );
+   SYNTH_WHITE_BALANCE state = g_whiteBalance[mcam.mcamID-1];
+   pthread_mutex_unlock( &g_lock );
+
+   if( state.mode == 0 && state.manual.green > 0 ) {
+      return state.manual;
+   }
+
+   //Automatic gains differ slightly between microcameras
+   wb.red   = 1.6 + 0.3 * unitHash( frameHash( mcam.mcamID, 0, SALT_SENSOR ));
+   wb.green = 1.0;
+   wb.blue  = 1.9 + 0.3 * unitHash( frameHash( mcam.mcamID, 1, SALT_SENSOR ));
+
+   return wb;
+}
+
+bool setMCamWhiteBalance( MICRO_CAMERA mcam, AtlWhiteBalance whiteBalance )
+{
+   if( !validMCam( mcam.mcamID )) {
+      return false;
+   }
+
+   pthread_mutex_lock( &g_lock );
+   bool manual = g_whiteBalance[mcam.mcamID-1].mode == 0;
+   if( manual ) {
+      g_whiteBalance[mcam.mcamID-1].manual = whiteBalance;
+   }
+   pthread_mutex_unlock( &g_lock );
+
+   return manual;
+}
@@ -0,0 +1,160 @@
+/******************************************************************************
+ *
+ * MantisAPI.h
+ *
+ * Stand-in for the MantisAPI header used when the examples are built with
+ * MANTIS_BACKEND=Synthetic. It declares the subset of the API the examples
+ * use, with the same names and signatures, and is implemented by
+ * SyntheticMantis.c. Enum values and struct layouts are not guaranteed to
+ * match the real library, so binaries built against one backend must not be
+ * run against the other.
+ *
+ *****************************************************************************/
+#ifndef MANTIS_API_H
+#define MANTIS_API_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Status codes returned by camera control functions
+ **/
+typedef enum {
+   AQ_SUCCESS = 0,
+   AQ_FAILURE,
+   AQ_CAMERA_CONNECTED,
+   AQ_CAMERA_DISCONNECTED,
+   AQ_CAMERA_RECEIVING_DATA,
+   AQ_CAMERA_NOT_RECEIVING_DATA
+} AQ_SYSTEM_STATE;
+
+enum { ATL_TILING_1_1_2 = 0 };                                        //!< Tiling of requested frames
+enum { ATL_TILE_4K = 0, ATL_TILE_HD = 1 };                            //!< Tile within a tiling
+enum { ATL_SCALE_MODE_ALL = 0, ATL_SCALE_MODE_4K, ATL_SCALE_MODE_HD }; //!< Stream filters
+enum { ATL_MODE_JPEG = 0, ATL_MODE_H264_I_FRAME, ATL_MODE_H264_P_FRAME }; //!< FRAME_METADATA::m_mode
+enum { ATL_OUTPUT_MODE_H264 = 0, ATL_OUTPUT_MODE_JPEG };              //!< Export output modes
+
+/**
+ * \brief A microcamera and the Tegra that hosts it
+ **/
+typedef struct {
+   uint32_t mcamID;        //!< Microcamera id, never 0
+   char     tegraip[24];   //!< Address of the hosting Tegra
+   uint32_t tegraport;     //!< Port of the hosting Tegra
+} MICRO_CAMERA;
+
+/**
+ * \brief Microcameras of a camera
+ **/
+typedef struct {
+   uint32_t numMCams;      //!< Number of microcameras, 0 until connected
+} MICRO_CAMERA_LIST;
+
+/**
+ * \brief A Mantis camera system
+ **/
+typedef struct {
+   uint32_t          camID;    //!< Camera id
+   MICRO_CAMERA_LIST mcamList; //!< Microcameras of the camera
+} ACOS_CAMERA;
+
+/**
+ * \brief A recorded clip
+ **/
+typedef struct {
+   char        name[256];  //!< Clip name
+   ACOS_CAMERA cam;        //!< Camera the clip was recorded on
+   uint64_t    startTime;  //!< First timestamp in microseconds
+   uint64_t    endTime;    //!< Last timestamp in microseconds
+   double      framerate;  //!< Capture framerate
+} ACOS_CLIP;
+
+/**
+ * \brief Metadata delivered with every frame
+ **/
+typedef struct {
+   uint64_t m_id;          //!< Frame number of the microcamera
+   uint64_t m_timestamp;   //!< Capture time in microseconds since the epoch
+   uint32_t m_camId;       //!< Microcamera id
+   uint32_t m_width;       //!< Width in pixels
+   uint32_t m_height;      //!< Height in pixels
+   uint64_t m_size;        //!< Bytes in m_image
+   uint32_t m_mode;        //!< ATL_MODE_* of the frame
+   uint32_t m_tile;        //!< ATL_TILE_* of the frame
+   double   m_framerate;   //!< Capture framerate
+   double   m_gain;        //!< Sensor gain
+   double   m_shutter;     //!< Shutter time
+   double   m_exposure;    //!< Exposure value
+} FRAME_METADATA;
+
+/**
+ * \brief A frame. m_image is NULL if the request failed
+ **/
+typedef struct {
+   void *         m_image;     //!< Encoded image data
+   FRAME_METADATA m_metadata;  //!< Frame metadata
+} FRAME;
+
+/**
+ * \brief White balance gains
+ **/
+typedef struct {
+   double red;
+   double green;
+   double blue;
+} AtlWhiteBalance;
+
+typedef struct { void (*f)(ACOS_CAMERA, void*); void* data; } NEW_CAMERA_CALLBACK;
+typedef struct { void (*f)(ACOS_CLIP, void*); void* data; } ACOS_CLIP_CALLBACK;
+typedef struct { void (*f)(MICRO_CAMERA, void*); void* data; } NEW_MICRO_CAMERA_CALLBACK;
+typedef struct { void (*f)(FRAME, void*); void* data; } MICRO_CAMERA_FRAME_CALLBACK;
+
+/* Camera server */
+void connectToCameraServer( const char * ip, int port );
+void disconnectFromCameraServer( void );
+int  getNumberOfCameras( void );
+void setNewCameraCallback( NEW_CAMERA_CALLBACK cb );
+void setNewClipCallback( ACOS_CLIP_CALLBACK cb );
+
+/* Cameras */
+AQ_SYSTEM_STATE isCameraConnected( ACOS_CAMERA cam );
+AQ_SYSTEM_STATE setCameraConnection( ACOS_CAMERA cam, bool connect, int timeout );
+AQ_SYSTEM_STATE isCameraReceivingData( ACOS_CAMERA cam );
+AQ_SYSTEM_STATE setCameraReceivingData( ACOS_CAMERA cam, bool receive, int timeout );
+AQ_SYSTEM_STATE setCameraRecording( ACOS_CAMERA cam, bool record, int timeout );
+void     disconnectCamera( ACOS_CAMERA cam );
+uint32_t getCameraNumberOfMCams( ACOS_CAMERA cam );
+int      getCameraMCamList( ACOS_CAMERA cam, MICRO_CAMERA * list, int size );
+
+/* Frames. Buffers returned by getFrame must be released with returnPointer */
+FRAME getFrame( ACOS_CAMERA cam, uint32_t mcamID, uint64_t timestamp, int tiling, int tile );
+bool  returnPointer( void * image );
+bool  saveFrame( FRAME frame, const char * fileName );
+
+/* Direct microcamera connections and streams */
+void mCamConnect( const char * ip, int port );
+void mCamDisconnect( const char * ip, int port );
+int  getNumberOfMCams( void );
+void setNewMCamCallback( NEW_MICRO_CAMERA_CALLBACK cb );
+void setMCamFrameCallback( MICRO_CAMERA_FRAME_CALLBACK cb );
+bool initMCamFrameReceiver( int port, int numBuffers );
+bool closeMCamFrameReceiver( int port );
+bool startMCamStream( MICRO_CAMERA mcam, int port );
+bool stopMCamStream( MICRO_CAMERA mcam, int port );
+bool setMCamStreamFilter( MICRO_CAMERA mcam, int port, int scaleMode );
+
+/* White balance */
+bool            setMCamWhiteBalanceMode( MICRO_CAMERA mcam, int mode );
+AtlWhiteBalance getMCamWhiteBalance( MICRO_CAMERA mcam );
+bool            setMCamWhiteBalance( MICRO_CAMERA mcam, AtlWhiteBalance whiteBalance );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
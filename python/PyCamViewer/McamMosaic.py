@@ -0,0 +1,85 @@
+# -*- coding: utf-8 -*-
+""" ctypes wrapper of libMantisMosaic, the native thumbnail grid decoder
+    built from capi/common/McamMosaic.c. Frames never reach Python: the
+    library decodes every microcamera's JPEGs to thumbnail size on its own
+    threads and the viewer copies the whole grid once per refresh. With one
+    microcamera and a tile the size of the window it is a single stream view
+    that only ever holds the newest frame.
+
+    The library is found through MANTIS_MOSAIC_LIB or the usual library
+    search path. It must link the same MantisAPI library as MantisPyAPI so
+    that it receives the frames of the streams started from Python. """
+
+import ctypes, ctypes.util, os
+
+TILE_WIDTH = 240
+TILE_HEIGHT = 135
+
+class MOSAIC_STATS(ctypes.Structure):
+    _fields_ = [("decoded", ctypes.c_uint64),
+                ("failed", ctypes.c_uint64),
+                ("dropped", ctypes.c_uint64)]
+
+def loadLibrary():
+    path = os.environ.get("MANTIS_MOSAIC_LIB") or ctypes.util.find_library("MantisMosaic") \
+        or "libMantisMosaic.so"
+    lib = ctypes.CDLL(path)
+    lib.mcamMosaicCreate.restype = ctypes.c_void_p
+    lib.mcamMosaicCreate.argtypes = [ctypes.POINTER(ctypes.c_uint32), ctypes.c_int,
+                                     ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.mcamMosaicGetSize.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int),
+                                      ctypes.POINTER(ctypes.c_int)]
+    lib.mcamMosaicCopy.restype = ctypes.c_uint64
+    lib.mcamMosaicCopy.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint64]
+    lib.mcamMosaicStart.restype = ctypes.c_bool
+    lib.mcamMosaicStart.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.mcamMosaicStop.argtypes = [ctypes.c_void_p]
+    lib.mcamMosaicGetStats.restype = MOSAIC_STATS
+    lib.mcamMosaicGetStats.argtypes = [ctypes.c_void_p]
+    lib.mcamMosaicDestroy.argtypes = [ctypes.c_void_p]
+    return lib
+
+class McamMosaic(object):
+    """ Grid of the latest frame of each microcamera in one RGB888 buffer """
+    lib = None
+
+    def __init__(self, mcamIDs, columns=0, tileWidth=TILE_WIDTH, tileHeight=TILE_HEIGHT):
+        if not McamMosaic.lib:
+            McamMosaic.lib = loadLibrary()
+        ids = (ctypes.c_uint32 * len(mcamIDs))(*mcamIDs)
+        self.handle = self.lib.mcamMosaicCreate(ids, len(mcamIDs), columns, tileWidth, tileHeight)
+        if not self.handle:
+            raise MemoryError("Unable to create a mosaic of %d microcameras" % len(mcamIDs))
+        width = ctypes.c_int()
+        height = ctypes.c_int()
+        self.lib.mcamMosaicGetSize(self.handle, ctypes.byref(width), ctypes.byref(height))
+        self.width = width.value
+        self.height = height.value
+        self.bytesPerLine = 3 * self.width
+        self.buffer = bytearray(self.bytesPerLine * self.height)
+        self.pointer = (ctypes.c_uint8 * len(self.buffer)).from_buffer(self.buffer)
+        self.generation = 0
+
+    def start(self, workers=os.cpu_count() or 1):
+        """ Replaces the frame callback with the mosaic decoders """
+        return self.lib.mcamMosaicStart(self.handle, workers)
+
+    def stop(self):
+        """ Stops the decoders and ignores further frames, waiting for any
+            frame still being received """
+        self.lib.mcamMosaicStop(self.handle)
+
+    def update(self):
+        """ Copies the grid into buffer, returns False if nothing changed """
+        generation = self.lib.mcamMosaicCopy(self.handle, self.pointer, self.generation)
+        changed = generation != self.generation
+        self.generation = generation
+        return changed
+
+    def stats(self):
+        return self.lib.mcamMosaicGetStats(self.handle)
+
+    def close(self):
+        if self.handle:
+            self.lib.mcamMosaicDestroy(self.handle)
+            self.handle = None
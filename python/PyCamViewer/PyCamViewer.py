@@ -6,6 +6,10 @@ from pcvform import Ui_PyCamViewer as UI
 from PIL import Image
 from PIL.ImageQt import ImageQt
 import MantisPyAPI as api
+try:
+    from McamMosaic import McamMosaic, TILE_WIDTH, TILE_HEIGHT
+except ImportError:
+    McamMosaic = None
 
 try:
     from PySide import QtCore, QtWidgets
@@ -13,15 +17,24 @@ except:
     from PyQt5.QtCore import pyqtSlot as Slot
     from PyQt5 import QtCore, QtWidgets, QtGui
 
+GRID_PORT = 9100   # first receiver port of the grid, one port per mcam
+GRID_FPS = 15      # grid refreshes per second
+DISPLAY_FPS = 30   # single stream refreshes per second
+
 class PyCamViewer(QtWidgets.QMainWindow):
     newImage = QtCore.pyqtSignal(api.FRAME_METADATA, 'QImage')
     mcamhandle = None
     ipAddress = None
+    mosaic = None
+    gridMcams = None
 
     def __init__(self, app):
         QtWidgets.QMainWindow.__init__(self)
         self.newImage.connect(self.receiveImage)
         app.aboutToQuit.connect(self.exiting)
+        self.mcams = []
+        self.displayTimer = QtCore.QTimer(self)
+        self.displayTimer.timeout.connect(self.refreshDisplay)
         # --- Initialize the frame receiver ---
         api.initMCamFrameReceiver(9002, 1)
         # ---- Set the frame callback -----
@@ -33,8 +46,10 @@ class PyCamViewer(QtWidgets.QMainWindow):
     def setup(self, ui):
         self.ui = ui
         ui.port.setValidator(QtGui.QIntValidator(1, 65535, self))
+        ui.gridCheckBox.setEnabled(McamMosaic is not None)
 
     def newMcam(self, mcamhandle):
+        self.mcams.append(mcamhandle)
         if not self.mcamhandle:
             self.mcamhandle = mcamhandle
 
@@ -44,7 +59,14 @@ class PyCamViewer(QtWidgets.QMainWindow):
         self.newImage.emit(meta, image)
 
     def startStreaming(self, start):
-        if start and self.mcamhandle:
+        self.ui.gridCheckBox.setEnabled(not start and McamMosaic is not None)
+        if self.gridMcams or (start and self.ui.gridCheckBox.isChecked()):
+            self.startGrid(start)
+        elif start and self.mcamhandle:
+            # Decode natively at the label size when the library is available
+            if McamMosaic:
+                lbl = self.ui.imageLabel
+                self.startSink([self.mcamhandle], max(lbl.width(), 1), max(lbl.height(), 1), DISPLAY_FPS)
             # --- Start streaming ---
             api.startMCamStream(self.mcamhandle, 9002)
             # --- Only receive HD ---
@@ -55,6 +77,51 @@ class PyCamViewer(QtWidgets.QMainWindow):
             # --- Start streaming ---
             api.stopMCamStream(self.mcamhandle, 9002)
             # -----------------------
+            self.stopSink()
+
+    def startSink(self, mcams, tileWidth, tileHeight, fps, columns=1):
+        """ Replaces self.call with native decoding of the newest frame of
+            each mcam, repainted at most fps times per second """
+        self.mosaic = McamMosaic([mcam.mcamID for mcam in mcams], columns,
+                                 tileWidth, tileHeight)
+        self.mosaic.start()
+        self.displayTimer.start(1000 // fps)
+
+    def stopSink(self):
+        if self.mosaic:
+            self.displayTimer.stop()
+            self.mosaic.stop()
+            self.mosaic.close()
+            self.mosaic = None
+            api.setMCamFrameCallback(self.call)
+
+    def startGrid(self, start):
+        if start and self.mcams:
+            self.gridMcams = list(self.mcams)
+            self.startSink(self.gridMcams, TILE_WIDTH, TILE_HEIGHT, GRID_FPS, 0)
+            # --- Stream every mcam to its own receiver ---
+            for i, mcam in enumerate(self.gridMcams):
+                api.initMCamFrameReceiver(GRID_PORT + i, 1)
+                api.startMCamStream(mcam, GRID_PORT + i)
+                api.setMCamStreamFilter(mcam, GRID_PORT + i, api.ATL_SCALE_MODE_HD)
+            # ---------------------------------------------
+
+        elif self.gridMcams:
+            for i, mcam in enumerate(self.gridMcams):
+                api.stopMCamStream(mcam, GRID_PORT + i)
+            time.sleep(0.2) # Give it time to disconnect.  This is a known bug
+            for i in range(len(self.gridMcams)):
+                api.closeMCamFrameReceiver(GRID_PORT + i)
+            self.stopSink()
+            self.gridMcams = None
+
+    def refreshDisplay(self):
+        # --- One QImage per refresh and only if a frame arrived ---
+        m = self.mosaic
+        if m and m.update():
+            image = QtGui.QImage(m.buffer, m.width, m.height, m.bytesPerLine,
+                                 QtGui.QImage.Format_RGB888)
+            self.showImage(image)
 
     def setShutter(self, val):
         # --- Set the Shutter value ---
@@ -62,6 +129,9 @@ class PyCamViewer(QtWidgets.QMainWindow):
         # -----------------------------
 
     def receiveImage(self, meta, image):
+        self.showImage(image)
+
+    def showImage(self, image):
         lbl = self.ui.imageLabel
         qimage = image.scaled(lbl.size(), QtCore.Qt.KeepAspectRatio);
         lbl.setPixmap(QtGui.QPixmap.fromImage(qimage))
@@ -62,6 +62,9 @@ class Ui_PyCamViewer(object):
         self.horizontalLayout_2.setObjectName("horizontalLayout_2")
         spacerItem1 = QtWidgets.QSpacerItem(40, 20, QtWidgets.QSizePolicy.Expanding, QtWidgets.QSizePolicy.Minimum)
         self.horizontalLayout_2.addItem(spacerItem1)
+        self.gridCheckBox = QtWidgets.QCheckBox(self.groupBox_2)
+        self.gridCheckBox.setObjectName("gridCheckBox")
+        self.horizontalLayout_2.addWidget(self.gridCheckBox)
         self.streamingButton = QtWidgets.QPushButton(self.groupBox_2)
         self.streamingButton.setCheckable(True)
         self.streamingButton.setObjectName("streamingButton")
@@ -123,6 +126,8 @@ class Ui_PyCamViewer(object):
         self.port.setPlaceholderText(_translate("PyCamViewer", "Port"))
         self.startServerButton.setText(_translate("PyCamViewer", "Connect"))
         self.groupBox_2.setTitle(_translate("PyCamViewer", "Streaming"))
+        self.gridCheckBox.setToolTip(_translate("PyCamViewer", "Stream every microcamera as a thumbnail grid"))
+        self.gridCheckBox.setText(_translate("PyCamViewer", "All Microcameras"))
         self.streamingButton.setText(_translate("PyCamViewer", "Start Streaming"))
         self.groupBox_3.setTitle(_translate("PyCamViewer", "Sensor Values"))
         self.label_2.setText(_translate("PyCamViewer", "Shutter:"))
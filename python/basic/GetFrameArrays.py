@@ -0,0 +1,52 @@
+import MantisFrames as frames
+
+import time, sys
+
+"""Cameras are tracked by ID inside the frames library"""
+frames.connect("localhost", 9999)
+time.sleep(1)
+
+cameraList = frames.cameras()
+if not cameraList:
+    print("No camera found")
+    sys.exit(0)
+
+"""The rest of this example will use the first camera in the list"""
+myMantis = cameraList[0]
+mcamList = frames.mcams(myMantis)
+
+if not frames.setReceiving(myMantis, True):
+    print("Virtual camera " + str(myMantis) + " failed to start receiving data!")
+    sys.exit(0)
+
+"""short sleep to give the camera time to start receiving before requesting an image"""
+time.sleep(1)
+
+"""Encoded frames are written straight from the API buffer, which is
+    returned to the API when the with block ends"""
+for mcamID in mcamList:
+    filename = "mcam_" + str(mcamID) + ".jpg"
+    frame = frames.getFrame(myMantis, mcamID)
+    if frame is None:
+        print("Could not save frame " + filename)
+        continue
+    with frame, open(filename, "wb") as f:
+        f.write(frame.data)
+    print("Saved frame " + filename + " to disk")
+
+"""Decoded frames are NumPy arrays over native memory when NumPy is
+    installed. Decoding at 1/4 size is much cheaper than at full size"""
+for mcamID in mcamList:
+    frame = frames.getFrame(myMantis, mcamID, decode=frames.DECODE_LUMA, scale=4)
+    if frame is None:
+        print("Could not decode a frame of microcamera " + str(mcamID))
+        continue
+    luma = frame.array()
+    print("Microcamera " + str(mcamID) + " frame " + str(frame.frameId)
+          + " decoded to " + str(frame.shape) + ", first row starts with "
+          + str(list(luma[0][:4]) if frames.numpy else list(luma[:4])))
+    frame.release()
+
+"""Disconnect from every camera"""
+frames.setReceiving(myMantis, False)
+frames.disconnect()
@@ -0,0 +1,268 @@
+# -*- coding: utf-8 -*-
+""" ctypes wrapper of libMantisFrames, built from capi/common/FrameHandle.c,
+    for reading frames without copying them into Python objects.
+
+    getFrame returns a Frame that holds the buffer returned by the API until
+    it is released. Frame.data is a memoryview of the encoded JPEG or H.264
+    bytes and Frame.pixels one of the decoded image when decoding was asked
+    for; both support the buffer protocol, so numpy.frombuffer, bytes() or
+    file.write() read them in place. Frame.array() returns the pixels as a
+    height x width x channels NumPy array when NumPy is installed. Decoding
+    is optional and only applies to JPEG frames, and scale decodes at 1/2,
+    1/4 or 1/8 of the size for a fraction of the work.
+
+    Each view counts as an export of its Frame. release(), or leaving a with
+    block, stops the Frame from handing out more views, and the buffer is
+    returned with returnPointer once the last export is gone, so views and
+    arrays taken before the release stay valid for as long as they are used.
+
+    Stream frames are passed to a callback on native worker threads through
+    a FrameDispatcher, which copies each one into a pooled buffer. The first
+    view of a stream frame keeps that buffer with frameHandleKeep, so its
+    data, pixels and array() read the pooled copy in place and stay valid
+    like those of getFrame. A kept buffer returns to the pool once the last
+    export is gone; while many are kept, the dispatcher drops frames.
+
+    connect replaces the new camera callback, so use the functions here
+    rather than MantisPyAPI to discover cameras. The library is found through
+    MANTIS_FRAMES_LIB or the usual library search path and must link the same
+    MantisAPI library as MantisPyAPI. """
+
+import ctypes, ctypes.util, os
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+DECODE_NONE = 0
+DECODE_RGB = 1
+DECODE_LUMA = 2
+
+POLICY_LATEST = 0
+POLICY_DROP_OLDEST = 1
+POLICY_BLOCK = 2
+
+MAX_CAMERAS = 64
+MAX_MCAMS = 1024
+
+class FRAME_HANDLE(ctypes.Structure):
+    """ Fixed layout prefix of FRAME_HANDLE """
+    _fields_ = [("frameId", ctypes.c_uint64),
+                ("timestamp", ctypes.c_uint64),
+                ("mcamID", ctypes.c_uint32),
+                ("mode", ctypes.c_uint32),
+                ("tile", ctypes.c_uint32),
+                ("width", ctypes.c_uint32),
+                ("height", ctypes.c_uint32),
+                ("channels", ctypes.c_uint32),
+                ("pixelWidth", ctypes.c_uint32),
+                ("pixelHeight", ctypes.c_uint32),
+                ("size", ctypes.c_uint64),
+                ("pixelSize", ctypes.c_uint64),
+                ("data", ctypes.c_void_p),
+                ("pixels", ctypes.c_void_p)]
+
+class DISPATCH_STATS(ctypes.Structure):
+    _fields_ = [("received", ctypes.c_uint64),
+                ("delivered", ctypes.c_uint64),
+                ("dropped", ctypes.c_uint64),
+                ("blocked", ctypes.c_uint64)]
+
+FRAME_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.POINTER(FRAME_HANDLE), ctypes.c_void_p)
+
+class FRAME_HANDLE_CALLBACK(ctypes.Structure):
+    _fields_ = [("f", FRAME_CALLBACK),
+                ("data", ctypes.c_void_p)]
+
+def loadLibrary():
+    path = os.environ.get("MANTIS_FRAMES_LIB") or ctypes.util.find_library("MantisFrames") \
+        or "libMantisFrames.so"
+    lib = ctypes.CDLL(path)
+    lib.frameHandleConnect.argtypes = [ctypes.c_char_p, ctypes.c_int]
+    lib.frameHandleCameras.argtypes = [ctypes.POINTER(ctypes.c_uint32), ctypes.c_int]
+    lib.frameHandleMCams.argtypes = [ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32), ctypes.c_int]
+    lib.frameHandleSetReceiving.restype = ctypes.c_bool
+    lib.frameHandleSetReceiving.argtypes = [ctypes.c_uint32, ctypes.c_bool]
+    lib.frameHandleGet.restype = ctypes.POINTER(FRAME_HANDLE)
+    lib.frameHandleGet.argtypes = [ctypes.c_uint32, ctypes.c_uint32, ctypes.c_uint64,
+                                   ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    lib.frameHandleRelease.argtypes = [ctypes.POINTER(FRAME_HANDLE)]
+    lib.frameHandleKeep.restype = ctypes.POINTER(FRAME_HANDLE)
+    lib.frameHandleKeep.argtypes = [ctypes.POINTER(FRAME_HANDLE)]
+    lib.frameHandleStreamStart.restype = ctypes.c_void_p
+    lib.frameHandleStreamStart.argtypes = [ctypes.POINTER(ctypes.c_uint32), ctypes.c_int,
+                                           ctypes.c_int, ctypes.c_int, ctypes.c_int,
+                                           ctypes.c_int, ctypes.c_int, FRAME_HANDLE_CALLBACK]
+    lib.frameHandleStreamStats.restype = ctypes.c_bool
+    lib.frameHandleStreamStats.argtypes = [ctypes.c_void_p, ctypes.c_uint32,
+                                           ctypes.POINTER(DISPATCH_STATS)]
+    lib.frameHandleStreamStop.argtypes = [ctypes.c_void_p]
+    return lib
+
+lib = None
+
+def library():
+    global lib
+    if not lib:
+        lib = loadLibrary()
+    return lib
+
+def connect(ip="localhost", port=9999):
+    """ Connects to the camera server and tracks its cameras by ID """
+    library().frameHandleConnect(ip.encode(), port)
+
+def cameras():
+    """ Returns the IDs of the cameras reported so far """
+    ids = (ctypes.c_uint32 * MAX_CAMERAS)()
+    n = library().frameHandleCameras(ids, len(ids))
+    return list(ids[:min(n, len(ids))])
+
+def mcams(camID):
+    """ Returns the microcamera IDs of a camera, connecting it if needed """
+    ids = (ctypes.c_uint32 * MAX_MCAMS)()
+    n = library().frameHandleMCams(camID, ids, len(ids))
+    if n < 0:
+        raise RuntimeError("Unable to list the microcameras of camera %d" % camID)
+    return list(ids[:min(n, len(ids))])
+
+def setReceiving(camID, receive):
+    return library().frameHandleSetReceiving(camID, receive)
+
+def disconnect():
+    library().frameHandleDisconnect()
+
+class Export(object):
+    """ Counts a view of the native memory of a Frame for as long as the
+        view, or anything made from it, is alive """
+
+    def __init__(self, frame):
+        self.frame = frame
+        frame.exports += 1
+
+    def __del__(self):
+        self.frame.exports -= 1
+        self.frame.free()
+
+def view(address, size, frame):
+    """ Returns a memoryview of native memory that holds an export of frame """
+    array = (ctypes.c_uint8 * size).from_address(address)
+    array.owner = Export(frame)
+    return memoryview(array).cast("B")
+
+class Frame(object):
+    """ A frame whose buffers stay in native memory """
+
+    def __init__(self, handle, owned=True):
+        self.handle = handle
+        self.owned = owned
+        self.exports = 0
+        self.released = False
+        h = handle.contents
+        self.mcamID = h.mcamID
+        self.frameId = h.frameId
+        self.timestamp = h.timestamp
+        self.mode = h.mode
+        self.tile = h.tile
+        self.width = h.width
+        self.height = h.height
+        self.shape = None
+        if h.pixels:
+            self.shape = (h.pixelHeight, h.pixelWidth) if h.channels == 1 \
+                else (h.pixelHeight, h.pixelWidth, h.channels)
+
+    def contents(self):
+        if self.released or not self.handle:
+            raise ValueError("Frame of microcamera %d was released" % self.mcamID)
+        if not self.owned:
+            # The handle of a stream frame dies with its callback
+            kept = library().frameHandleKeep(self.handle)
+            if not kept:
+                raise RuntimeError("Unable to keep frame of microcamera %d" % self.mcamID)
+            self.handle = kept
+            self.owned = True
+        return self.handle.contents
+
+    @property
+    def data(self):
+        """ Encoded JPEG or H.264 bytes """
+        h = self.contents()
+        return view(h.data, h.size, self)
+
+    @property
+    def pixels(self):
+        """ Decoded image, rows of width * channels bytes, or None """
+        h = self.contents()
+        return view(h.pixels, h.pixelSize, self) if h.pixels else None
+
+    def array(self):
+        """ Decoded image as a NumPy array, or a memoryview without NumPy """
+        pixels = self.pixels
+        if pixels is None or numpy is None:
+            return pixels
+        return numpy.frombuffer(pixels, dtype=numpy.uint8).reshape(self.shape)
+
+    def release(self):
+        """ Stops handing out views and returns the buffer to the API once
+            no view of it is left """
+        self.released = True
+        self.free()
+
+    def free(self):
+        if self.handle and self.released and self.exports == 0:
+            if self.owned:
+                library().frameHandleRelease(self.handle)
+            self.handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.release()
+
+    def __del__(self):
+        self.release()
+
+def getFrame(camID, mcamID, timestamp=0, tiling=0, tile=0, decode=DECODE_NONE, scale=1):
+    """ Requests a frame like MantisPyAPI.getFrame. timestamp 0 is the newest
+        frame, and tiling and tile take the ATL_TILING and ATL_TILE values
+        of MantisPyAPI. Returns None if the request or the decode failed """
+    handle = library().frameHandleGet(camID, mcamID, timestamp, tiling, tile, decode, scale)
+    if not handle:
+        return None
+    return Frame(handle)
+
+class Stream(object):
+    """ Passes the frames of the given microcameras to callback(frame) on
+        native worker threads. Start the microcamera streams with
+        MantisPyAPI and stop them before stopping this """
+
+    def __init__(self, mcamIDs, callback, policy=POLICY_LATEST, depth=1, workers=1,
+                 decode=DECODE_NONE, scale=1):
+        self.callback = callback
+        self.frameCallback = FRAME_CALLBACK(self.onFrame)
+        ids = (ctypes.c_uint32 * len(mcamIDs))(*mcamIDs)
+        self.stream = library().frameHandleStreamStart(ids, len(mcamIDs), policy, depth, workers,
+                                                       decode, scale,
+                                                       FRAME_HANDLE_CALLBACK(self.frameCallback, None))
+        if not self.stream:
+            raise RuntimeError("Unable to dispatch frames of %d microcameras" % len(mcamIDs))
+
+    def onFrame(self, handle, data):
+        frame = Frame(handle, owned=False)
+        try:
+            self.callback(frame)
+        finally:
+            frame.release()
+
+    def stats(self, mcamID):
+        stats = DISPATCH_STATS()
+        if self.stream:
+            library().frameHandleStreamStats(self.stream, mcamID, ctypes.byref(stats))
+        return stats
+
+    def stop(self):
+        """ Delivers the queued frames and ignores further ones """
+        if self.stream:
+            library().frameHandleStreamStop(self.stream)
+            self.stream = None